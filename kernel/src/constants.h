@@ -4,5 +4,7 @@
 #define KERNEL_STACK_SIZE 0x8000
 #define PAGE_SIZE 0x1000
 #define PAGE_BITSIZE 12
+#define KERNEL_MAX_CPUS 16
+#define CACHE_LINE_SIZE 64
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "bootprof.h"
+
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "debugging/kprint.h"
+#include "debugging/serialout.h"
+#include "debugging/trace.h"
+#include "drivers/qemu.h"
+
+static struct bootprof_stage _bootprof_stages[BOOTPROF_MAX_STAGES];
+static int _bootprof_nstages = 0;
+static bool _bootprof_open = false;
+
+
+void bootprof_end(){
+    if(_bootprof_open){
+        _bootprof_stages[_bootprof_nstages-1].end_tsc = cpu_rdtsc();
+        _bootprof_open = false;
+    }
+}
+
+
+void bootprof_begin(const char* name){
+    uint64_t now = cpu_rdtsc();
+    if(_bootprof_open){
+        _bootprof_stages[_bootprof_nstages-1].end_tsc = now;
+        _bootprof_open = false;
+    }
+    if(_bootprof_nstages >= BOOTPROF_MAX_STAGES){
+        return;
+    }
+    TRACE(TRACE_BOOT_STAGE, _bootprof_nstages);
+    _bootprof_stages[_bootprof_nstages].name = name;
+    _bootprof_stages[_bootprof_nstages].start_tsc = now;
+    _bootprof_nstages++;
+    _bootprof_open = true;
+}
+
+
+static uint64_t _bootprof_stage_ns(const struct bootprof_stage* stage){
+    return tsc_cycles_to_ns(stage->end_tsc - stage->start_tsc);
+}
+
+
+void bootprof_report(){
+    bootprof_end();
+
+    /*
+        Sort a copy by duration, longest first (insertion sort, there are only a handful of stages)
+    */
+    struct bootprof_stage sorted[BOOTPROF_MAX_STAGES];
+    uint64_t total_ns = 0;
+    for(int i=0; i<_bootprof_nstages; i++){
+        struct bootprof_stage stage = _bootprof_stages[i];
+        uint64_t ns = _bootprof_stage_ns(&stage);
+        total_ns += ns;
+        int j = i;
+        while(j > 0 && _bootprof_stage_ns(&sorted[j-1]) < ns){
+            sorted[j] = sorted[j-1];
+            j--;
+        }
+        sorted[j] = stage;
+    }
+    uint64_t total_us = total_ns / NS_PER_US;
+
+    kprintf("Boot profile (%d stages, %lu us total):\n", _bootprof_nstages, total_us);
+    kprintf("  %-24s %10s %6s\n", "stage", "us", "%");
+    for(int i=0; i<_bootprof_nstages; i++){
+        uint64_t us = _bootprof_stage_ns(&sorted[i]) / NS_PER_US;
+        uint64_t permille = (total_us > 0)? us * 1000 / total_us : 0;
+        kprintf("  %-24s %10lu %4lu.%lu\n", sorted[i].name, us, permille / 10, permille % 10);
+    }
+
+    for(int i=0; i<_bootprof_nstages; i++){
+        debug_serial_printf("BOOTPROF stage=%s us=%lu\n", _bootprof_stages[i].name, _bootprof_stage_ns(&_bootprof_stages[i]) / NS_PER_US);
+    }
+    debug_serial_printf("BOOTPROF total_us=%lu\n", total_us);
+}
+
+
+bool bootprof_exit_requested(){
+    uint16_t select;
+    uint32_t size;
+    return qemu_fwcfg_find_file(BOOTPROF_EXIT_FWCFG, &select, &size);
+}
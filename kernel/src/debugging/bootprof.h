@@ -0,0 +1,35 @@
+#ifndef BOOTPROF_H
+#define BOOTPROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Boot stage profiler.
+    kmain marks the start of each stage with bootprof_begin(), which also closes the previous one.
+    Stages store raw TSC stamps, so they can be recorded before the clock is calibrated.
+
+    bootprof_report() prints a table sorted by duration, and one machine readable line per stage
+    directly to serial for tools/bootprof_check.py:
+        BOOTPROF stage=<name> us=<duration>
+        BOOTPROF total_us=<sum>
+*/
+#define BOOTPROF_MAX_STAGES     32
+
+/*
+    fw_cfg file that asks the kernel to exit QEMU after reporting (make bootprof)
+*/
+#define BOOTPROF_EXIT_FWCFG     "opt/mechtayu/bootprof-exit"
+
+struct bootprof_stage{
+    const char* name;
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+};
+
+void bootprof_begin(const char* name);
+void bootprof_end();
+void bootprof_report();
+bool bootprof_exit_requested();
+
+#endif
@@ -0,0 +1,394 @@
+#include "dmesg.h"
+
+#include "util/cpu.h"
+#include "util/kformat.h"
+#include "time/tsc.h"
+#include "time/timerwheel.h"
+
+_Static_assert(sizeof(struct dmesg_slot) == DMESG_SLOT_SIZE, "dmesg slot size mismatch");
+
+#define DMESG_SLOT_NOT_READY    0
+#define DMESG_SLOT_READY        1
+#define DMESG_SLOT_OVERWRITTEN  2
+
+static struct dmesg_ring _dmesg_rings[KERNEL_MAX_CPUS];
+static volatile uint64_t _dmesg_seq = 0;
+
+static struct dmesg_consumer _dmesg_consumers[DMESG_MAX_CONSUMERS];
+static int _dmesg_n_consumers = 0; // Protected by _dmesg_draining
+static volatile bool _dmesg_draining = false;
+static volatile bool _dmesg_deferred = false;
+
+/*
+    Deferred mode: a CPU that logs something arms a one-shot drain on its own timer wheel, unless one
+    is already pending. All fields are only touched by their own CPU with interrupts off.
+*/
+#define DMESG_DRAIN_DELAY_NS    (2 * NS_PER_MS)
+
+struct dmesg_drain_cpu{
+    struct ktimer timer;
+    bool armed;
+    uint64_t armed_head;    // Ring head when the timer was armed
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct dmesg_drain_cpu _dmesg_drain_cpus[KERNEL_MAX_CPUS];
+
+typedef void (*dmesg_emit_fn)(const struct dmesg_slot* slot, void* ctx);
+
+
+/*
+    Append a message to the executing CPU's ring.
+    Lock-free and never waits, safe from interrupt context.
+*/
+void dmesg_write(const char* buf, size_t len){
+    if(len == 0){
+        return;
+    }
+    struct dmesg_ring* ring = &_dmesg_rings[cpu_current_id()];
+
+    size_t nparts = (len + DMESG_SLOT_TEXT - 1) / DMESG_SLOT_TEXT;
+    if(nparts > DMESG_SLOTS_PER_CPU / 4){
+        nparts = DMESG_SLOTS_PER_CPU / 4; // Don't let one message wipe out the whole ring
+        len = nparts * DMESG_SLOT_TEXT;
+    }
+
+    uint64_t first = __atomic_fetch_add(&ring->head, nparts, __ATOMIC_RELAXED);
+    uint64_t seq = __atomic_fetch_add(&_dmesg_seq, 1, __ATOMIC_RELAXED);
+    uint64_t tsc = cpu_rdtsc();
+
+    for(size_t part=0; part<nparts; part++){
+        uint64_t idx = first + part;
+        struct dmesg_slot* slot = &ring->slots[idx & (DMESG_SLOTS_PER_CPU-1)];
+
+        // Invalidate before touching the contents so a concurrent reader can't see a torn slot
+        __atomic_store_n(&slot->commit, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        size_t n = len - part*DMESG_SLOT_TEXT;
+        if(n > DMESG_SLOT_TEXT){
+            n = DMESG_SLOT_TEXT;
+        }
+        slot->seq = seq;
+        slot->tsc = tsc;
+        slot->cpu = cpu_current_id();
+        slot->part = part;
+        slot->nparts = nparts;
+        slot->len = n;
+        for(size_t i=0; i<n; i++){
+            slot->text[i] = buf[part*DMESG_SLOT_TEXT + i];
+        }
+
+        __atomic_store_n(&slot->commit, idx + 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*
+    Check the state of absolute slot idx in a ring, copying it out if it is readable.
+*/
+static int _dmesg_slot_peek(struct dmesg_ring* ring, uint64_t idx, struct dmesg_slot* copy){
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(head - idx > DMESG_SLOTS_PER_CPU){
+        return DMESG_SLOT_OVERWRITTEN;
+    }
+    struct dmesg_slot* slot = &ring->slots[idx & (DMESG_SLOTS_PER_CPU-1)];
+    uint64_t commit = __atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE);
+    if(commit != idx + 1){
+        return (commit > idx + 1)? DMESG_SLOT_OVERWRITTEN : DMESG_SLOT_NOT_READY;
+    }
+    if(copy != NULL){
+        *copy = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->commit, __ATOMIC_RELAXED) != commit){
+            return DMESG_SLOT_OVERWRITTEN; // Producer lapped us mid-copy
+        }
+    }
+    return DMESG_SLOT_READY;
+}
+
+
+/*
+    Merge every CPU's ring from the given read positions in sequence order,
+    handing each slot of each complete message to emit().
+*/
+static void _dmesg_merge(uint64_t* tails, uint64_t* lost, dmesg_emit_fn emit, void* ctx){
+    struct dmesg_slot slot;
+    for(;;){
+        int best_cpu = -1;
+        uint64_t best_seq = UINT64_MAX;
+
+        for(int cpu=0; cpu<KERNEL_MAX_CPUS; cpu++){
+            struct dmesg_ring* ring = &_dmesg_rings[cpu];
+            for(;;){
+                uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+                if(tails[cpu] >= head){
+                    break;
+                }
+                int state = _dmesg_slot_peek(ring, tails[cpu], &slot);
+                if(state == DMESG_SLOT_OVERWRITTEN || (state == DMESG_SLOT_READY && slot.part != 0)){
+                    // Fell behind the producer, resync to the oldest slot that still exists
+                    uint64_t oldest = (head > DMESG_SLOTS_PER_CPU)? head - DMESG_SLOTS_PER_CPU : 0;
+                    uint64_t next = (tails[cpu] + 1 > oldest)? tails[cpu] + 1 : oldest;
+                    *lost += next - tails[cpu];
+                    tails[cpu] = next;
+                    continue;
+                }
+                if(state == DMESG_SLOT_READY){
+                    // Only eligible once every part of the message has been published
+                    bool complete = true;
+                    for(int part=1; part<slot.nparts; part++){
+                        if(_dmesg_slot_peek(ring, tails[cpu] + part, NULL) != DMESG_SLOT_READY){
+                            complete = false;
+                            break;
+                        }
+                    }
+                    if(complete && slot.seq < best_seq){
+                        best_seq = slot.seq;
+                        best_cpu = cpu;
+                    }
+                }
+                break;
+            }
+        }
+
+        if(best_cpu < 0){
+            return;
+        }
+
+        struct dmesg_ring* ring = &_dmesg_rings[best_cpu];
+        _dmesg_slot_peek(ring, tails[best_cpu], &slot);
+        int nparts = slot.nparts;
+        for(int part=0; part<nparts; part++){
+            if(_dmesg_slot_peek(ring, tails[best_cpu], &slot) != DMESG_SLOT_READY){
+                break; // Overwritten while we were emitting, the resync above will count it
+            }
+            emit(&slot, ctx);
+            tails[best_cpu]++;
+        }
+    }
+}
+
+
+static void _dmesg_emit_to_sink(const struct dmesg_slot* slot, void* ctx){
+    const struct kprint_sink* sink = ctx;
+    sink->write(slot->text, slot->len);
+}
+
+
+static void _dmesg_oldest_tails(uint64_t* tails);
+
+/*
+    Start feeding a sink. With replay it first gets everything still retained in the log,
+    otherwise only messages written from now on.
+*/
+bool dmesg_add_consumer(const struct kprint_sink* sink, bool replay){
+    while(__atomic_exchange_n(&_dmesg_draining, true, __ATOMIC_ACQUIRE)){
+        cpu_pause();
+    }
+    bool ok = false;
+    if(_dmesg_n_consumers < DMESG_MAX_CONSUMERS){
+        struct dmesg_consumer* consumer = &_dmesg_consumers[_dmesg_n_consumers];
+        consumer->sink = sink;
+        consumer->lost_slots = 0;
+        if(replay){
+            _dmesg_oldest_tails(consumer->tail);
+        }else{
+            for(int cpu=0; cpu<KERNEL_MAX_CPUS; cpu++){
+                consumer->tail[cpu] = __atomic_load_n(&_dmesg_rings[cpu].head, __ATOMIC_ACQUIRE);
+            }
+        }
+        _dmesg_n_consumers++;
+        ok = true;
+    }
+    __atomic_store_n(&_dmesg_draining, false, __ATOMIC_RELEASE);
+    return ok;
+}
+
+
+void dmesg_remove_consumer(const struct kprint_sink* sink){
+    while(__atomic_exchange_n(&_dmesg_draining, true, __ATOMIC_ACQUIRE)){
+        cpu_pause();
+    }
+    for(int i=0; i<_dmesg_n_consumers; i++){
+        if(_dmesg_consumers[i].sink == sink){
+            _dmesg_consumers[i] = _dmesg_consumers[_dmesg_n_consumers-1];
+            _dmesg_n_consumers--;
+            break;
+        }
+    }
+    __atomic_store_n(&_dmesg_draining, false, __ATOMIC_RELEASE);
+}
+
+
+/*
+    Push everything new in the log out to every consumer.
+    Only one CPU drains at a time; returns false without waiting if another one already is.
+*/
+static void _dmesg_drain_locked(){
+    for(int i=0; i<_dmesg_n_consumers; i++){
+        struct dmesg_consumer* consumer = &_dmesg_consumers[i];
+        _dmesg_merge(consumer->tail, &consumer->lost_slots, _dmesg_emit_to_sink, (void*)consumer->sink);
+        if(consumer->sink->flush != NULL){
+            consumer->sink->flush();
+        }
+    }
+}
+
+
+bool dmesg_drain(){
+    if(__atomic_exchange_n(&_dmesg_draining, true, __ATOMIC_ACQUIRE)){
+        return false;
+    }
+    _dmesg_drain_locked();
+    __atomic_store_n(&_dmesg_draining, false, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/*
+    Keep the sinks quiet while something writes to the UART directly (the binary dumps), so no drain
+    lands in the middle of it. Everything logged so far goes out first, anything logged meanwhile
+    waits for dmesg_resume(). Not for the panic path, it waits for a drain in progress to finish.
+*/
+void dmesg_pause(){
+    while(__atomic_exchange_n(&_dmesg_draining, true, __ATOMIC_ACQUIRE)){
+        cpu_pause();
+    }
+    _dmesg_drain_locked();
+}
+
+
+void dmesg_resume(){
+    __atomic_store_n(&_dmesg_draining, false, __ATOMIC_RELEASE);
+    dmesg_drain();
+}
+
+
+static void _dmesg_drain_timer(struct ktimer* timer, void* arg){
+    struct dmesg_drain_cpu* drain = arg;
+    if(dmesg_drain()){
+        drain->armed = false;
+    }else{
+        // Another CPU is draining and may already be past this CPU's ring, try again shortly
+        ktimer_arm_after(timer, DMESG_DRAIN_DELAY_NS);
+    }
+}
+
+
+/*
+    Called by producers after writing.
+    Drains inline until deferred mode is switched on, then leaves it to the executing CPU's drain
+    timer. A CPU that writes half a ring before its timer gets to run (interrupts off for a long
+    stretch) still drains inline, rather than overwrite its own messages.
+*/
+void dmesg_kick(){
+    if(!_dmesg_deferred){
+        dmesg_drain();
+        return;
+    }
+    uint64_t rflags = cpu_irq_save();
+    uint32_t cpu = cpu_current_id();
+    struct dmesg_drain_cpu* drain = &_dmesg_drain_cpus[cpu];
+    uint64_t head = __atomic_load_n(&_dmesg_rings[cpu].head, __ATOMIC_RELAXED);
+    bool drain_now = false;
+    if(!drain->armed){
+        drain->armed = true;
+        drain->armed_head = head;
+        ktimer_arm_after(&drain->timer, DMESG_DRAIN_DELAY_NS);
+    }else if(head - drain->armed_head >= DMESG_SLOTS_PER_CPU/2){
+        drain->armed_head = head;
+        drain_now = true;
+    }
+    cpu_irq_restore(rflags);
+    if(drain_now){
+        dmesg_drain();
+    }
+}
+
+
+/*
+    Switch between draining inline on every write and draining from timers.
+    Deferred mode needs the timer wheel (timer_wheel_init()) to be running. Switching back drains
+    whatever is still queued.
+*/
+void dmesg_set_deferred(bool deferred){
+    if(deferred){
+        for(int i=0; i<KERNEL_MAX_CPUS; i++){
+            if(!_dmesg_drain_cpus[i].armed){
+                ktimer_init(&_dmesg_drain_cpus[i].timer, _dmesg_drain_timer, &_dmesg_drain_cpus[i]);
+            }
+        }
+        _dmesg_deferred = true;
+    }else{
+        _dmesg_deferred = false;
+        dmesg_drain();
+    }
+}
+
+
+uint64_t dmesg_sequence(){
+    return __atomic_load_n(&_dmesg_seq, __ATOMIC_RELAXED);
+}
+
+
+static void _dmesg_oldest_tails(uint64_t* tails){
+    for(int cpu=0; cpu<KERNEL_MAX_CPUS; cpu++){
+        uint64_t head = __atomic_load_n(&_dmesg_rings[cpu].head, __ATOMIC_ACQUIRE);
+        tails[cpu] = (head > DMESG_SLOTS_PER_CPU)? head - DMESG_SLOTS_PER_CPU : 0;
+    }
+}
+
+
+/*
+    Write out the whole retained log, each message prefixed with its sequence number,
+    CPU and timestamp.
+*/
+static void _dmesg_emit_prefixed(const struct dmesg_slot* slot, void* ctx){
+    const struct kprint_sink* sink = ctx;
+    if(slot->part == 0){
+        char prefix[64];
+        int len;
+        if(g_tsc_clock.calibrated){
+            uint64_t us = ktime_from_tsc(slot->tsc) / NS_PER_US;
+            len = ksnprintf(prefix, sizeof(prefix), "[%6lu cpu%u %5lu.%06lu] ", slot->seq, slot->cpu, us / 1000000, us % 1000000);
+        }else{
+            len = ksnprintf(prefix, sizeof(prefix), "[%6lu cpu%u tsc=%lu] ", slot->seq, slot->cpu, slot->tsc);
+        }
+        sink->write(prefix, len);
+    }
+    sink->write(slot->text, slot->len);
+}
+
+void dmesg_dump(const struct kprint_sink* sink){
+    uint64_t tails[KERNEL_MAX_CPUS];
+    uint64_t lost = 0;
+    _dmesg_oldest_tails(tails);
+    _dmesg_merge(tails, &lost, _dmesg_emit_prefixed, (void*)sink);
+}
+
+
+struct dmesg_read_ctx{
+    char* out;
+    size_t size;
+    size_t pos;
+};
+
+static void _dmesg_emit_to_buffer(const struct dmesg_slot* slot, void* ctx){
+    struct dmesg_read_ctx* read = ctx;
+    for(int i=0; i<slot->len && read->pos < read->size; i++){
+        read->out[read->pos++] = slot->text[i];
+    }
+}
+
+/*
+    Copy the raw text of the whole retained log (oldest first) into out.
+    Returns the number of bytes copied.
+*/
+size_t dmesg_read(char* out, size_t out_size){
+    uint64_t tails[KERNEL_MAX_CPUS];
+    uint64_t lost = 0;
+    struct dmesg_read_ctx ctx = {out, out_size, 0};
+    _dmesg_oldest_tails(tails);
+    _dmesg_merge(tails, &lost, _dmesg_emit_to_buffer, &ctx);
+    return ctx.pos;
+}
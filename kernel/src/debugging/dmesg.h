@@ -0,0 +1,66 @@
+#ifndef DMESG_H
+#define DMESG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "debugging/kprint.h"
+
+/*
+    Kernel log ring (dmesg).
+
+    Every CPU owns a ring of fixed size slots. Producers reserve slots with a single atomic add on
+    their own CPU's ring and publish them with a release store, so they never take a lock and never
+    touch device I/O. A message longer than one slot takes several consecutive slots.
+
+    Messages carry a global sequence number and a TSC timestamp. Consumers (the kprint sinks) keep
+    their own read position in every ring and merge the rings back into sequence order when they
+    drain. Slow consumers simply lose the oldest records, which are counted.
+
+    Early in boot every write drains inline. Once timers run, dmesg_set_deferred() hands draining to a
+    short one-shot timer on the writing CPU, so printing no longer waits on the sinks.
+*/
+#define DMESG_SLOTS_PER_CPU     512 // Must be a power of 2
+#define DMESG_SLOT_SIZE         128
+#define DMESG_SLOT_HEADER_SIZE  32
+#define DMESG_SLOT_TEXT         (DMESG_SLOT_SIZE - DMESG_SLOT_HEADER_SIZE)
+#define DMESG_MAX_CONSUMERS     KPRINT_MAX_SINKS
+
+struct dmesg_slot{
+    volatile uint64_t commit;   // Absolute slot index + 1 once the contents are valid
+    uint64_t seq;
+    uint64_t tsc;
+    uint16_t cpu;
+    uint8_t part;               // Index of this slot within its message
+    uint8_t nparts;
+    uint16_t len;
+    uint16_t reserved;
+    char text[DMESG_SLOT_TEXT];
+};
+
+struct dmesg_ring{
+    volatile uint64_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct dmesg_slot slots[DMESG_SLOTS_PER_CPU] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct dmesg_consumer{
+    const struct kprint_sink* sink;
+    uint64_t tail[KERNEL_MAX_CPUS];
+    uint64_t lost_slots;
+};
+
+void dmesg_write(const char* buf, size_t len);
+bool dmesg_add_consumer(const struct kprint_sink* sink, bool replay);
+void dmesg_remove_consumer(const struct kprint_sink* sink);
+bool dmesg_drain();
+void dmesg_pause();
+void dmesg_resume();
+void dmesg_kick();
+void dmesg_set_deferred(bool deferred);
+void dmesg_dump(const struct kprint_sink* sink);
+size_t dmesg_read(char* out, size_t out_size);
+uint64_t dmesg_sequence();
+
+#endif
@@ -0,0 +1,145 @@
+#include "kbench.h"
+
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "drivers/qemu.h"
+#include "debugging/kprint.h"
+#include "debugging/serialout.h"
+
+// Collected by linker.ld
+extern const struct kbench __kbench_start[];
+extern const struct kbench __kbench_end[];
+
+static uint64_t _kbench_samples[KBENCH_MAX_SAMPLES];
+static uint64_t _kbench_overhead = 0;
+
+void* memcpy(void* dest, const void* src, size_t n);
+void* memset(void* s, int c, size_t n);
+
+
+static void _kbench_sort(uint64_t* values, uint32_t n){
+    // Shell sort, the sample counts are small
+    for(uint32_t gap=n/2; gap>0; gap/=2){
+        for(uint32_t i=gap; i<n; i++){
+            uint64_t value = values[i];
+            uint32_t j = i;
+            while(j >= gap && values[j-gap] > value){
+                values[j] = values[j-gap];
+                j -= gap;
+            }
+            values[j] = value;
+        }
+    }
+}
+
+
+/*
+    Cost of the timing itself: the smallest back-to-back pair of ordered TSC reads
+*/
+static uint64_t _kbench_measure_overhead(){
+    uint64_t best = UINT64_MAX;
+    for(int i=0; i<64; i++){
+        uint64_t start = cpu_rdtsc_ordered();
+        uint64_t end = cpu_rdtsc_ordered();
+        if(end - start < best){
+            best = end - start;
+        }
+    }
+    return best;
+}
+
+
+/*
+    memcpy/memset at a few sizes. They come from third-party/gcc-clang-required.c.
+*/
+#define KBENCH_MEM_MAX  0x10000
+
+static uint8_t _kbench_mem_src[KBENCH_MEM_MAX];
+static uint8_t _kbench_mem_dst[KBENCH_MEM_MAX];
+
+static void _kbench_memcpy(void* arg){
+    memcpy(_kbench_mem_dst, _kbench_mem_src, (size_t)arg);
+}
+
+static void _kbench_memset(void* arg){
+    memset(_kbench_mem_dst, 0x5A, (size_t)arg);
+}
+
+KBENCH(memcpy_64, .fn = _kbench_memcpy, .arg = (void*)64, .batch = 16);
+KBENCH(memcpy_4k, .fn = _kbench_memcpy, .arg = (void*)0x1000);
+KBENCH(memcpy_64k, .fn = _kbench_memcpy, .arg = (void*)0x10000, .samples = 64);
+KBENCH(memset_64, .fn = _kbench_memset, .arg = (void*)64, .batch = 16);
+KBENCH(memset_4k, .fn = _kbench_memset, .arg = (void*)0x1000);
+KBENCH(memset_64k, .fn = _kbench_memset, .arg = (void*)0x10000, .samples = 64);
+
+
+bool kbench_requested(){
+#ifdef KCONFIG_BENCH
+    return true;
+#else
+    uint16_t select;
+    uint32_t size;
+    return qemu_fwcfg_find_file(KBENCH_RUN_FWCFG, &select, &size);
+#endif
+}
+
+
+/*
+    Run one benchmark. Results are cycles per operation, with the timing overhead taken out.
+*/
+void kbench_run(const struct kbench* bench, struct kbench_result* result){
+    uint32_t samples = bench->samples? bench->samples : KBENCH_DEFAULT_SAMPLES;
+    if(samples > KBENCH_MAX_SAMPLES){
+        samples = KBENCH_MAX_SAMPLES;
+    }
+    uint32_t batch = bench->batch? bench->batch : 1;
+    if(_kbench_overhead == 0){
+        _kbench_overhead = _kbench_measure_overhead();
+    }
+
+    if(bench->setup != NULL){
+        bench->setup(bench->arg);
+    }
+    for(uint32_t i=0; i<samples; i++){
+        if(bench->before != NULL){
+            bench->before(bench->arg);
+        }
+        uint64_t rflags = cpu_irq_save();
+        uint64_t start = cpu_rdtsc_ordered();
+        for(uint32_t j=0; j<batch; j++){
+            bench->fn(bench->arg);
+        }
+        uint64_t end = cpu_rdtsc_ordered();
+        cpu_irq_restore(rflags);
+
+        uint64_t cycles = end - start;
+        cycles = (cycles > _kbench_overhead)? cycles - _kbench_overhead : 0;
+        _kbench_samples[i] = cycles / batch;
+    }
+    if(bench->teardown != NULL){
+        bench->teardown(bench->arg);
+    }
+
+    _kbench_sort(_kbench_samples, samples);
+    result->samples = samples;
+    result->batch = batch;
+    result->min = _kbench_samples[0];
+    result->median = _kbench_samples[samples / 2];
+    result->p99 = _kbench_samples[(samples * 99) / 100];
+}
+
+
+void kbench_run_all(){
+    uint32_t count = __kbench_end - __kbench_start;
+    kprintf("kbench: %u benchmarks, timing overhead %lu cycles\n", count, _kbench_measure_overhead());
+    kprintf("  %-24s %10s %10s %10s %10s\n", "name", "min", "median", "p99", "median ns");
+    for(const struct kbench* bench=__kbench_start; bench<__kbench_end; bench++){
+        struct kbench_result result;
+        kbench_run(bench, &result);
+        uint64_t median_ns = tsc_cycles_to_ns(result.median);
+        kprintf("  %-24s %10lu %10lu %10lu %10lu\n", bench->name, result.min, result.median, result.p99, median_ns);
+        debug_serial_printf("KBENCH name=%s samples=%u batch=%u min_cyc=%lu median_cyc=%lu p99_cyc=%lu median_ns=%lu\n",
+                            bench->name, result.samples, result.batch, result.min, result.median, result.p99, median_ns);
+    }
+    debug_serial_printf("KBENCH done count=%u\n", count);
+}
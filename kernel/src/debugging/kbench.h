@@ -0,0 +1,57 @@
+#ifndef KBENCH_H
+#define KBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Microbenchmark harness.
+
+    Benchmarks are registered where the code they measure lives, with KBENCH(), which places a
+    struct kbench in the .kbench section (collected by linker.ld). kbench_run_all() runs each one
+    for its number of samples, timing every sample with serialised TSC reads and interrupts off,
+    and reports min/median/p99 per operation. One machine readable line per benchmark goes
+    directly to serial for tools/kbench_parse.py:
+        KBENCH name=<name> samples=<n> batch=<ops per sample> min_cyc=<c> median_cyc=<c> p99_cyc=<c> median_ns=<ns>
+
+    fn runs batch times per sample, so operations much shorter than the TSC read overhead can
+    still be measured. before (optional, untimed) runs ahead of every sample, setup/teardown
+    (optional) once around the whole benchmark.
+*/
+#define KBENCH_MAX_SAMPLES      1024
+#define KBENCH_DEFAULT_SAMPLES  256
+
+/*
+    fw_cfg file that asks the kernel to run the suite (make kbench)
+*/
+#define KBENCH_RUN_FWCFG        "opt/mechtayu/kbench"
+
+struct kbench{
+    const char* name;
+    void (*fn)(void* arg);
+    void* arg;
+    void (*before)(void* arg);
+    void (*setup)(void* arg);
+    void (*teardown)(void* arg);
+    uint32_t samples;           // 0 = KBENCH_DEFAULT_SAMPLES
+    uint32_t batch;             // 0 = 1
+};
+
+struct kbench_result{
+    uint32_t samples;
+    uint32_t batch;
+    uint64_t min;
+    uint64_t median;
+    uint64_t p99;
+};
+
+#define KBENCH(id, ...) \
+    __attribute__((used, section(".kbench"), aligned(8))) \
+    static const struct kbench _kbench_##id = { .name = #id, __VA_ARGS__ }
+
+bool kbench_requested();
+void kbench_run(const struct kbench* bench, struct kbench_result* result);
+void kbench_run_all();
+
+#endif
@@ -0,0 +1,43 @@
+#include "kprint.h"
+
+#include "debugging/dmesg.h"
+
+/*
+    Sinks are consumers of the dmesg ring: every message is logged there first
+    and the sinks are fed from it.
+*/
+void kprint_register_sink(const struct kprint_sink* sink){
+    dmesg_add_consumer(sink, false);
+}
+
+/*
+    Register a sink that starts with everything still retained in the log
+*/
+void kprint_register_sink_replay(const struct kprint_sink* sink){
+    dmesg_add_consumer(sink, true);
+}
+
+void kprint_unregister_sink(const struct kprint_sink* sink){
+    dmesg_remove_consumer(sink);
+}
+
+void kprint_write(const char* buf, size_t len){
+    dmesg_write(buf, len);
+    dmesg_kick();
+}
+
+void kvprintf(const char* fmt, va_list args){
+    char buf[KPRINT_BUF_SIZE];
+    int len = kvsnprintf(buf, sizeof(buf), fmt, args);
+    if(len > (int)sizeof(buf)-1){
+        len = sizeof(buf)-1; // Truncated
+    }
+    kprint_write(buf, len);
+}
+
+void kprintf(const char* fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    kvprintf(fmt, args);
+    va_end(args);
+}
@@ -0,0 +1,31 @@
+#ifndef KPRINT_H
+#define KPRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#include "util/kformat.h"
+
+#define KPRINT_MAX_SINKS    4
+#define KPRINT_BUF_SIZE     512
+
+/*
+    An output device for kernel messages.
+    Messages are formatted once, appended to the dmesg ring, and each registered sink is
+    then handed whole buffers from it, so sinks are free to do bulk writes.
+*/
+struct kprint_sink{
+    const char* name;
+    void (*write)(const char* buf, size_t len);
+    void (*flush)(void); // Optional, called once after each batch of writes
+};
+
+void kprint_register_sink(const struct kprint_sink* sink);
+void kprint_register_sink_replay(const struct kprint_sink* sink);
+void kprint_unregister_sink(const struct kprint_sink* sink);
+void kprint_write(const char* buf, size_t len);
+void kvprintf(const char* fmt, va_list args);
+void kprintf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
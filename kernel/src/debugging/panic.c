@@ -0,0 +1,43 @@
+#include "panic.h"
+
+#include "util/cpu.h"
+#include "debugging/trace.h"
+#include "debugging/dmesg.h"
+
+/*
+    Report a fatal error and stop.
+    Interrupts are disabled first, then the message is logged and pushed out through every sink. The serial
+    TX ring is flushed synchronously so nothing queued before the panic is lost.
+    Any trace records are dumped after the message.
+*/
+void kpanic(const char* fmt, ...){
+    cpu_irq_save();
+
+    char buf[KPRINT_BUF_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if(len > (int)sizeof(buf)-1){
+        len = sizeof(buf)-1;
+    }
+
+    dmesg_write("PANIC: ", 7);
+    dmesg_write(buf, len);
+    dmesg_write("\n", 1);
+    if(!dmesg_drain()){
+        // The log is mid-drain (possibly on this CPU), go straight to the UART instead
+        serial_tx_write_sync("PANIC: ", 7);
+        serial_tx_write_sync(buf, len);
+        serial_tx_write_sync("\n", 1);
+    }
+    serial_tx_flush();
+
+    if(trace_count() > 0){
+        trace_dump();
+    }
+
+    for(;;){
+        asm volatile("cli; hlt");
+    }
+}
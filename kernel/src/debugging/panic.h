@@ -0,0 +1,12 @@
+#ifndef PANIC_H
+#define PANIC_H
+
+#include <stdarg.h>
+
+#include "util/utility.h"
+#include "debugging/kprint.h"
+#include "debugging/serialout.h"
+
+void kpanic(const char* fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,222 @@
+#include "profile.h"
+
+#include "constants.h"
+#include "util/cpu.h"
+#include "time/pit.h"
+#include "smp/smp.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+#include "interrupts/pic.h"
+#include "interrupts/lapic.h"
+#include "sched/sched.h"
+#include "debugging/kprint.h"
+#include "debugging/serialout.h"
+#include "debugging/dmesg.h"
+
+#define PROFILE_KERNEL_TEXT_BASE    0xffffffff80000000UL
+#define PROFILE_KERNEL_HALF         0xffff800000000000UL
+#define PROFILE_RING_PAGES          ((PROFILE_RING_ENTRIES * sizeof(struct profile_sample) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+struct profile_ring{
+    struct profile_sample* samples;
+    uint32_t count;
+    uint32_t lost;
+    bool busy;          // In _profile_sample(), a nested sample (NMI during the PIT tick) is lost
+};
+
+static struct profile_ring _profile_rings[KERNEL_MAX_CPUS];
+static volatile bool _profile_active = false;
+static uint32_t _profile_hz = 0;
+
+
+/*
+    Follow the saved rbp chain of the interrupted code. Frames must move strictly up the stack and
+    stay on it: inside the current thread's stack when rsp is there, else within KERNEL_STACK_SIZE
+    of rsp (boot and AP stacks). Threads and APs start with rbp = 0, which ends the walk.
+    Only upper half stacks are walked, a sample can land in the kernel still on the user's rsp
+    (syscall_entry), and a fault here would be fatal in NMI context.
+*/
+static uint16_t _profile_backtrace(const struct interrupt_frame* frame, uint64_t* pcs){
+    pcs[0] = frame->rip;
+    uint16_t depth = 1;
+    if((frame->cs & 3) || frame->rsp < PROFILE_KERNEL_HALF){
+        return depth;   // Only kernel stacks are walked
+    }
+
+    uint64_t stack_lo = frame->rsp;
+    uint64_t stack_hi = frame->rsp + KERNEL_STACK_SIZE;
+    struct thread* thread = sched_current();
+    if(thread != NULL && thread->stack_base != 0){
+        uint64_t top = thread->stack_base + SCHED_STACK_PAGES*PAGE_SIZE;
+        if(frame->rsp < thread->stack_base || frame->rsp >= top){
+            return depth;   // Not on its stack (IST or switch in progress), nothing safe to walk
+        }
+        stack_hi = top;
+    }
+    uint64_t fp = frame->rbp;
+    while(depth < PROFILE_MAX_FRAMES && fp >= stack_lo && fp + 16 <= stack_hi && (fp & 7) == 0){
+        const uint64_t* saved = (const uint64_t*)fp;
+        if(saved[1] < PROFILE_KERNEL_TEXT_BASE){
+            break;
+        }
+        pcs[depth++] = saved[1];
+        stack_lo = fp + 16;
+        fp = saved[0];
+    }
+    return depth;
+}
+
+
+/*
+    busy is raised before _profile_active is checked (again), so once profile_dump() has cleared
+    _profile_active and seen every busy flag down, no sample can still be writing to a ring.
+*/
+static void _profile_sample(const struct interrupt_frame* frame){
+    struct profile_ring* ring = &_profile_rings[cpu_current_id()];
+    if(ring->samples == NULL){
+        return;
+    }
+    if(ring->busy){
+        ring->lost++;
+        return;
+    }
+    __atomic_store_n(&ring->busy, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(!_profile_active){
+        __atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+        return;
+    }
+    if(ring->count >= PROFILE_RING_ENTRIES){
+        ring->lost++;
+    }else{
+        struct profile_sample* sample = &ring->samples[ring->count];
+        sample->cpu = cpu_current_id();
+        sample->reserved = 0;
+        sample->tsc = cpu_rdtsc();
+        sample->depth = _profile_backtrace(frame, sample->pcs);
+        ring->count++;
+    }
+    __atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+}
+
+
+// PIT tick, BSP only: sample here and have every other online CPU sample itself
+static void _profile_tick_handler(struct interrupt_frame* frame){
+    if(!_profile_active){
+        return;
+    }
+    _profile_sample(frame);
+    if(g_lapic.regs == NULL){
+        return;
+    }
+    for(uint32_t id=1; id<KERNEL_MAX_CPUS; id++){
+        if(g_percpu[id].online){
+            lapic_send_nmi(g_percpu[id].lapic_id);
+        }
+    }
+}
+
+// NMI, on the IST stack through interrupt_dispatch_paranoid(): no locks, no EOI
+static void _profile_nmi_handler(struct interrupt_frame* frame){
+    if(_profile_active){
+        _profile_sample(frame);
+    }
+}
+
+
+static void _profile_start_default(){
+    profile_start(PROFILE_DEFAULT_HZ);
+}
+
+
+/*
+    Install the handlers. Requires the IDT; sampling only starts with profile_start().
+*/
+void profile_init(){
+    interrupt_register_handler(PIC_VECTOR_BASE + PIT_IRQ, _profile_tick_handler);
+    interrupt_register_handler(INTERRUPT_VECTOR_NMI, _profile_nmi_handler);
+    serial_command_register(PROFILE_CMD_START, _profile_start_default);
+    serial_command_register(PROFILE_CMD_DUMP, profile_dump);
+}
+
+
+/*
+    Allocate the rings (once, for every CPU Limine reported) and start the PIT.
+*/
+void profile_start(uint32_t hz){
+    if(_profile_active){
+        return;
+    }
+    for(uint32_t id=0; id<g_smp_cpu_count; id++){
+        if(_profile_rings[id].samples == NULL){
+            uint64_t phys = (uint64_t)pmm_alloc_pages(PROFILE_RING_PAGES);
+            _profile_rings[id].samples = (struct profile_sample*)vmm_identity_map_n_pages(phys, PROFILE_RING_PAGES, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+        }
+    }
+    _profile_hz = hz;
+    _profile_active = true;
+    pit_ch0_periodic(hz);
+    pic_unmask(PIT_IRQ);
+}
+
+
+void profile_stop(){
+    pic_mask(PIT_IRQ);
+    pit_ch0_stop();
+    _profile_active = false;
+}
+
+
+bool profile_running(){
+    return _profile_active;
+}
+
+
+/*
+    Send every recorded sample over serial and empty the rings.
+    Sampling is paused meanwhile and resumes afterwards if it was running.
+*/
+void profile_dump(){
+    bool was_active = _profile_active;
+    _profile_active = false;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    // A CPU may still be inside _profile_sample() from an NMI, wait for it to leave
+    uint32_t counts[KERNEL_MAX_CPUS];
+    uint32_t lost[KERNEL_MAX_CPUS];
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        while(__atomic_load_n(&_profile_rings[id].busy, __ATOMIC_ACQUIRE)){
+            cpu_pause();
+        }
+        counts[id] = _profile_rings[id].count;
+        lost[id] = _profile_rings[id].lost;
+    }
+
+    struct profile_dump_header header = {
+        .magic = PROFILE_DUMP_MAGIC,
+        .version = PROFILE_DUMP_VERSION,
+        .sample_size = sizeof(struct profile_sample),
+        .hz = _profile_hz,
+        .max_frames = PROFILE_MAX_FRAMES
+    };
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        header.sample_count += counts[id];
+        header.lost_samples += lost[id];
+    }
+    kprintf("Profile: %u samples, %u lost\n", header.sample_count, header.lost_samples);
+    kprintf("Profile: CPU 0 is sampled from the PIT IRQ, its interrupts-off sections are not seen\n");
+
+    dmesg_pause();
+    serial_tx_write_sync((const char*)&header, sizeof(header));
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        struct profile_ring* ring = &_profile_rings[id];
+        serial_tx_write_sync((const char*)ring->samples, counts[id] * sizeof(struct profile_sample));
+        ring->count = 0;
+        ring->lost = 0;
+    }
+    serial_tx_write_sync(PROFILE_DUMP_END_MAGIC, 4);
+    dmesg_resume();
+
+    _profile_active = was_active;
+}
+
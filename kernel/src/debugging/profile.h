@@ -0,0 +1,68 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Sampling profiler.
+
+    PIT channel 0 interrupts the BSP PROFILE_DEFAULT_HZ times a second, and the BSP forwards each
+    tick to the other online CPUs as an NMI, so they are sampled inside interrupts-off sections too.
+    The BSP itself samples from the PIT IRQ: a tick that arrives while it has interrupts off waits
+    for the sti, so its interrupts-off sections never show up and their time is charged to the code
+    right after them. profile_dump() and tools/profile_symbolize.py say so next to the totals.
+    Every CPU records the interrupted RIP plus a short frame pointer backtrace into its own ring,
+    so sampling takes no locks. The NMI runs on its own IST stack (memory/gdt.h) and the backtrace
+    only reads the interrupted thread's stack, so it is safe wherever it lands. A ring that fills
+    up keeps its oldest samples (the interesting part of a boot profile) and counts the rest as lost.
+
+    Nothing is symbolized in the kernel: profile_dump() sends the raw samples over serial and
+    tools/profile_symbolize.py resolves them against kernel/bin/kernel.
+    Sending PROFILE_CMD_DUMP over COM1 requests a dump from the idle loop, PROFILE_CMD_START
+    starts sampling if it isn't running yet (see serial_command_register()).
+*/
+#define PROFILE_DEFAULT_HZ      1000
+#define PROFILE_RING_ENTRIES    4096    // Per CPU
+#define PROFILE_MAX_FRAMES      8       // Interrupted RIP + up to 7 return addresses
+
+#define PROFILE_CMD_DUMP        'P'
+#define PROFILE_CMD_START       'S'
+
+struct profile_sample{
+    uint16_t cpu;
+    uint16_t depth;         // Valid entries in pcs, pcs[0] is the interrupted RIP
+    uint32_t reserved;
+    uint64_t tsc;
+    uint64_t pcs[PROFILE_MAX_FRAMES];
+};
+
+/*
+    Dump framing, all little endian:
+        struct profile_dump_header
+        sample_count * struct profile_sample (per CPU, oldest first)
+        PROFILE_DUMP_END_MAGIC (4 bytes)
+*/
+#define PROFILE_DUMP_MAGIC      "MPRF"
+#define PROFILE_DUMP_END_MAGIC  "FRPM"
+#define PROFILE_DUMP_VERSION    1
+
+struct profile_dump_header{
+    char magic[4];
+    uint16_t version;
+    uint16_t sample_size;
+    uint32_t sample_count;
+    uint32_t lost_samples;
+    uint32_t hz;
+    uint16_t max_frames;
+    uint16_t reserved;
+};
+
+void profile_init();
+void profile_start(uint32_t hz);
+void profile_stop();
+bool profile_running();
+void profile_dump();
+
+#endif
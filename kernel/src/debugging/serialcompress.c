@@ -0,0 +1,72 @@
+#include "serialcompress.h"
+
+#include "util/lz4.h"
+#include "util/checksum.h"
+
+struct serial_lz_stats g_serial_lz_stats = {0};
+
+static uint8_t _serial_lz_stage[SERIAL_LZ_BLOCK_SIZE];
+static size_t _serial_lz_stage_len = 0;
+static uint8_t _serial_lz_frame[sizeof(struct serial_lz_frame_header) + LZ4_BOUND(SERIAL_LZ_BLOCK_SIZE)];
+
+/*
+    Compress whatever is staged into one frame and hand it to emit.
+    Callers serialise access (the serial driver's compression lock, across all CPUs).
+*/
+void serial_lz_flush(void (*emit)(const char* buf, size_t len)){
+    if(_serial_lz_stage_len == 0){
+        return;
+    }
+    struct serial_lz_frame_header* header = (struct serial_lz_frame_header*)_serial_lz_frame;
+    uint8_t* payload = _serial_lz_frame + sizeof(struct serial_lz_frame_header);
+
+    size_t payload_len = lz4_compress_block(_serial_lz_stage, _serial_lz_stage_len, payload, LZ4_BOUND(SERIAL_LZ_BLOCK_SIZE));
+    uint8_t flags = 0;
+    if(payload_len == 0 || payload_len >= _serial_lz_stage_len){
+        // Incompressible, store it instead
+        for(size_t i=0; i<_serial_lz_stage_len; i++){
+            payload[i] = _serial_lz_stage[i];
+        }
+        payload_len = _serial_lz_stage_len;
+        flags |= SERIAL_LZ_FLAG_STORED;
+    }
+
+    header->magic[0] = SERIAL_LZ_MAGIC[0];
+    header->magic[1] = SERIAL_LZ_MAGIC[1];
+    header->magic[2] = SERIAL_LZ_MAGIC[2];
+    header->magic[3] = SERIAL_LZ_MAGIC[3];
+    header->flags = flags;
+    header->reserved0 = 0;
+    header->raw_len = _serial_lz_stage_len;
+    header->payload_len = payload_len;
+    header->reserved1 = 0;
+    header->checksum = adler32(_serial_lz_stage, _serial_lz_stage_len);
+
+    size_t frame_len = sizeof(struct serial_lz_frame_header) + payload_len;
+    g_serial_lz_stats.raw_bytes += _serial_lz_stage_len;
+    g_serial_lz_stats.sent_bytes += frame_len;
+    g_serial_lz_stats.frames++;
+    _serial_lz_stage_len = 0;
+
+    emit((const char*)_serial_lz_frame, frame_len);
+}
+
+void serial_lz_write(const char* buf, size_t len, void (*emit)(const char* buf, size_t len)){
+    while(len > 0){
+        size_t space = SERIAL_LZ_BLOCK_SIZE - _serial_lz_stage_len;
+        size_t n = (len < space)? len : space;
+        for(size_t i=0; i<n; i++){
+            _serial_lz_stage[_serial_lz_stage_len + i] = buf[i];
+        }
+        _serial_lz_stage_len += n;
+        buf += n;
+        len -= n;
+        if(_serial_lz_stage_len == SERIAL_LZ_BLOCK_SIZE){
+            serial_lz_flush(emit);
+        }
+    }
+}
+
+bool serial_lz_pending(){
+    return _serial_lz_stage_len > 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SERIALCOMPRESS_H
+#define SERIALCOMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Optional LZ4 compressed mode for the debug serial channel.
+
+    Output is collected in a staging block and sent as self-describing frames when the block fills
+    up or is flushed explicitly. tools/serial_decompress.py turns a capture back into plain text.
+    Bytes outside of frames (e.g. output from before compression was enabled) pass through as-is.
+
+    Frame layout (little endian):
+        char     magic[4]       SERIAL_LZ_MAGIC
+        uint8_t  flags          SERIAL_LZ_FLAG_*
+        uint8_t  reserved
+        uint16_t raw_len        Uncompressed length
+        uint16_t payload_len    Bytes of payload following the header
+        uint16_t reserved
+        uint32_t checksum       Adler-32 of the uncompressed data
+        payload
+*/
+#define SERIAL_LZ_MAGIC         "MLZ4"
+#define SERIAL_LZ_FLAG_STORED   0x01    // Payload is uncompressed (compression didn't help)
+#define SERIAL_LZ_BLOCK_SIZE    0x1000
+
+struct serial_lz_frame_header{
+    char magic[4];
+    uint8_t flags;
+    uint8_t reserved0;
+    uint16_t raw_len;
+    uint16_t payload_len;
+    uint16_t reserved1;
+    uint32_t checksum;
+}__attribute__((packed));
+
+struct serial_lz_stats{
+    uint64_t raw_bytes;
+    uint64_t sent_bytes;    // Including frame headers
+    uint64_t frames;
+};
+
+extern struct serial_lz_stats g_serial_lz_stats;
+
+void serial_lz_write(const char* buf, size_t len, void (*emit)(const char* buf, size_t len));
+void serial_lz_flush(void (*emit)(const char* buf, size_t len));
+bool serial_lz_pending();
+
+#endif
@@ -1,5 +1,11 @@
 #include "serialout.h"
 
+#include "util/cpu.h"
+#include "sync/spinlock.h"
+#include "debugging/serialcompress.h"
+#include "debugging/kbench.h"
+#include "debugging/trace.h"
+
 
 uint8_t asm_inline_inb(uint16_t port) {
     uint8_t data;
@@ -19,15 +25,85 @@ void asm_inline_outb(uint16_t port, uint8_t data) {
 }
 
 
+const struct kprint_sink g_serial_sink = {
+    .name = "serial",
+    .write = writebuf_debug_serial,
+    .flush = serial_flush_staged
+};
+
+struct serial_tx_stats g_serial_tx_stats = {0};
+
+/*
+    TX ring. Producers advance the head, the drain (THRE interrupt or a synchronous flush)
+    advances the tail. Both are free running counters, masked on access.
+    The ring, the FIFO refill and the stats are under _serial_tx_lock, from every CPU and the IRQ.
+*/
+#define SERIAL_LOCK_NO_OWNER    UINT32_MAX
+
+struct serial_lock{
+    struct spinlock lock;
+    volatile uint32_t owner;
+};
+
+static char _serial_tx_ring[SERIAL_TX_RING_SIZE];
+static volatile uint64_t _serial_tx_head = 0;
+static volatile uint64_t _serial_tx_tail = 0;
+__attribute__((unused)) static struct lock_class _serial_tx_lock_class = LOCK_CLASS_INIT("serial tx");
+static struct serial_lock _serial_tx_lock = {SPINLOCK_INIT(&_serial_tx_lock_class), SERIAL_LOCK_NO_OWNER};
+
+/*
+    The compression stage (serialcompress.c) is shared by every CPU too. Taken before the TX lock,
+    so a frame is staged, compressed and queued without another CPU's text landing in it.
+*/
+__attribute__((unused)) static struct lock_class _serial_lz_lock_class = LOCK_CLASS_INIT("serial lz");
+static struct serial_lock _serial_lz_lock = {SPINLOCK_INIT(&_serial_lz_lock_class), SERIAL_LOCK_NO_OWNER};
+static bool _serial_tx_irq_mode = false;
+static int _serial_fifo_depth = 1;
+static uint8_t _serial_ier = 0;
+static serial_rx_handler_t _serial_rx_handler = NULL;
+
+struct serial_command{
+    char c;
+    serial_command_fn_t fn;
+    volatile bool requested;
+};
+
+static struct serial_command _serial_commands[SERIAL_MAX_COMMANDS];
+static volatile uint32_t _serial_command_count = 0;
+static volatile bool _serial_command_pending = false;
+
+#ifdef KCONFIG_SERIAL_COMPRESS
+static bool _serial_compress = true;
+#else
+static bool _serial_compress = false;
+#endif
+
+static void _serial_write_raw_sync(const char* buf, size_t len);
+
+
 int init_debug_serial() {
+    return init_debug_serial_divisor(SERIAL_DEBUG_BAUD_DIVISOR);
+}
+
+
+int init_debug_serial_divisor(uint16_t divisor) {
+    if(divisor == 0){
+        divisor = 1;
+    }
     asm_inline_outb(SERIAL_DEBUG_COM_PORT + 1, 0x00);    // Disable all interrupts
     asm_inline_outb(SERIAL_DEBUG_COM_PORT + 3, 0x80);    // Enable DLAB (set baud rate divisor)
-    asm_inline_outb(SERIAL_DEBUG_COM_PORT + 0, 0x03);    // Set divisor to 3 (lo byte) 38400 baud
-    asm_inline_outb(SERIAL_DEBUG_COM_PORT + 1, 0x00);    //                  (hi byte)
+    asm_inline_outb(SERIAL_DEBUG_COM_PORT + 0, divisor & 0xFF);  // Divisor lo byte (baud = 115200 / divisor)
+    asm_inline_outb(SERIAL_DEBUG_COM_PORT + 1, divisor >> 8);    //         hi byte
     asm_inline_outb(SERIAL_DEBUG_COM_PORT + 3, 0x03);    // 8 bits, no parity, one stop bit
     asm_inline_outb(SERIAL_DEBUG_COM_PORT + 2, 0xC7);    // Enable FIFO, clear them, with 14-byte threshold
     asm_inline_outb(SERIAL_DEBUG_COM_PORT + 4, 0x0B);    // IRQs enabled, RTS/DSR set
 
+    /*
+        A 16550A reports working FIFOs in the top two bits of the IIR.
+        Older parts only have a single holding register.
+    */
+    _serial_fifo_depth = ((asm_inline_inb(SERIAL_DEBUG_COM_PORT + 2) & 0xC0) == 0xC0)? SERIAL_FIFO_SIZE : 1;
+
     /*
         Perform serial loopback test
     */
@@ -59,69 +135,374 @@ int is_debug_transmit_empty() {
 }
 
 
+/*
+    Take a serial lock with interrupts off. A CPU that already holds it (a panic or an NMI that
+    interrupted a serial write on this CPU) goes ahead without it rather than deadlock, and gets
+    false back so the unlock is skipped.
+*/
+static bool _serial_lock_irqsave(struct serial_lock* lock, uint64_t* rflags){
+    *rflags = cpu_irq_save();
+    if(__atomic_load_n(&lock->owner, __ATOMIC_RELAXED) == cpu_current_id()){
+        return false;
+    }
+    spin_lock(&lock->lock);
+    __atomic_store_n(&lock->owner, cpu_current_id(), __ATOMIC_RELAXED);
+    return true;
+}
+
+static void _serial_unlock_irqrestore(struct serial_lock* lock, bool locked, uint64_t rflags){
+    if(locked){
+        __atomic_store_n(&lock->owner, SERIAL_LOCK_NO_OWNER, __ATOMIC_RELAXED);
+        spin_unlock(&lock->lock);
+    }
+    cpu_irq_restore(rflags);
+}
+
+
+/*
+    Push up to one FIFO's worth of bytes from the ring into the UART.
+    Only call this when the transmitter is known to be empty (THRE set). Caller holds the TX lock.
+*/
+static void _serial_tx_fill_fifo(){
+    uint64_t tail = _serial_tx_tail;
+    uint64_t head = _serial_tx_head;
+    int n = 0;
+    while(tail != head && n < _serial_fifo_depth){
+        asm_inline_outb(SERIAL_DEBUG_COM_PORT, _serial_tx_ring[tail & (SERIAL_TX_RING_SIZE-1)]);
+        tail++;
+        n++;
+    }
+    _serial_tx_tail = tail;
+    if(n > 0){
+        g_serial_tx_stats.fifo_fills++;
+    }
+}
+
+
+/*
+    Copy as much of buf into the TX ring as fits, returns how much did. Caller holds the TX lock.
+*/
+static size_t _serial_tx_push_locked(const char* buf, size_t len){
+    uint64_t head = _serial_tx_head;
+    size_t space = SERIAL_TX_RING_SIZE - (head - _serial_tx_tail);
+    size_t n = (len < space)? len : space;
+    for(size_t i=0; i<n; i++){
+        _serial_tx_ring[(head + i) & (SERIAL_TX_RING_SIZE-1)] = buf[i];
+    }
+    _serial_tx_head = head + n;
+    g_serial_tx_stats.enqueued_bytes += n;
+    return n;
+}
+
+
+/*
+    Copy as much of buf into the TX ring as fits, without blocking.
+    Anything that does not fit is counted as dropped.
+    If the transmitter is idle it gets primed, after which THRE interrupts keep it fed.
+*/
+size_t serial_tx_enqueue(const char* buf, size_t len){
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
+
+    size_t n = _serial_tx_push_locked(buf, len);
+    g_serial_tx_stats.dropped_bytes += len - n;
+    if(n < len){
+        TRACE(TRACE_SERIAL_DROP, len - n);
+    }
+
+    if(is_debug_transmit_empty()){
+        _serial_tx_fill_fifo();
+    }
+
+    _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+    return n;
+}
+
+
+/*
+    Poll the UART until everything queued so far has gone out. The lock is dropped between
+    FIFO refills, so other CPUs (and the IRQ) are only held off for one refill at a time.
+*/
+static void _serial_tx_drain(){
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
+    uint64_t end = _serial_tx_head;
+    while((int64_t)(_serial_tx_tail - end) < 0){
+        if(is_debug_transmit_empty()){
+            _serial_tx_fill_fifo();
+        }
+        _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+        cpu_pause();
+        locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
+    }
+    _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+}
+
+
+/*
+    Synchronously push out everything queued, including a partially filled compression block.
+    Safe to call with interrupts disabled, so this is what panic paths use.
+*/
+void serial_tx_flush(){
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_lz_lock, &rflags);
+    if(serial_lz_pending()){
+        serial_lz_flush(_serial_write_raw_sync);
+    }
+    _serial_unlock_irqrestore(&_serial_lz_lock, locked, rflags);
+    _serial_tx_drain();
+}
+
+
+/*
+    Switch to interrupt driven transmit.
+    Call once the COM1 IRQ has been routed to serial_irq_handler().
+*/
+void serial_tx_enable_irq(){
+    uint64_t rflags = cpu_irq_save();
+    _serial_tx_irq_mode = true;
+    _serial_ier |= 0x02;    // "Transmitter holding register empty" interrupt
+    asm_inline_outb(SERIAL_DEBUG_COM_PORT + 1, _serial_ier);
+    cpu_irq_restore(rflags);
+}
+
+
+/*
+    Deliver every received byte to handler, from the COM1 IRQ.
+*/
+void serial_rx_set_handler(serial_rx_handler_t handler){
+    uint64_t rflags = cpu_irq_save();
+    _serial_rx_handler = handler;
+    _serial_ier |= 0x01;    // "Received data available" interrupt
+    asm_inline_outb(SERIAL_DEBUG_COM_PORT + 1, _serial_ier);
+    cpu_irq_restore(rflags);
+}
+
+
+// COM1 receive, interrupt context
+static void _serial_command_rx(char c){
+    for(uint32_t i=0; i<_serial_command_count; i++){
+        if(_serial_commands[i].c == c){
+            _serial_commands[i].requested = true;
+            _serial_command_pending = true;
+        }
+    }
+}
+
+
+/*
+    Run fn from the idle loop whenever c is received. Commands run in registration order.
+*/
+void serial_command_register(char c, serial_command_fn_t fn){
+    uint32_t n = _serial_command_count;
+    if(n == SERIAL_MAX_COMMANDS){
+        debug_serial_printf("serial: no room for command '%c'\n", c);
+        return;
+    }
+    _serial_commands[n] = (struct serial_command){c, fn, false};
+    __atomic_store_n(&_serial_command_count, n + 1, __ATOMIC_RELEASE);
+    serial_rx_set_handler(_serial_command_rx);
+}
+
+
+/*
+    Run the commands that came in since the last call. Any CPU may poll, each request runs once.
+*/
+void serial_command_poll(){
+    if(__builtin_expect(!_serial_command_pending, 1)){
+        return;
+    }
+    _serial_command_pending = false;
+    for(uint32_t i=0; i<_serial_command_count; i++){
+        if(__atomic_exchange_n(&_serial_commands[i].requested, false, __ATOMIC_ACQUIRE)){
+            _serial_commands[i].fn();
+        }
+    }
+}
+
+
+void serial_irq_handler(struct interrupt_frame* frame){
+    (void)frame;
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
+    g_serial_tx_stats.irqs++;
+    // Reading the IIR acknowledges a pending THRE interrupt
+    uint8_t iir = asm_inline_inb(SERIAL_DEBUG_COM_PORT + 2);
+    if((iir & 0x01) == 0 && is_debug_transmit_empty()){
+        _serial_tx_fill_fifo();
+    }
+    _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+    // Draining the receive buffer acknowledges a "data available" interrupt
+    while(_serial_rx_handler != NULL && is_debug_serial_received()){
+        _serial_rx_handler(asm_inline_inb(SERIAL_DEBUG_COM_PORT));
+    }
+}
+
+
 void write_debug_serial(char a) {
-   while (is_debug_transmit_empty() == 0){
-    // Wait until the "transit" of the com port is empty, allowing space for this function to write a byte
-   }
- 
-   asm_inline_outb(SERIAL_DEBUG_COM_PORT,a);
+    writebuf_debug_serial(&a, 1);
 }
 
 
 void writestr_debug_serial(const char* str){
-    for(size_t i=0; str[i] !='\0'; i++){
-        write_debug_serial(str[i]);
+    writebuf_debug_serial(str, kstrlen(str));
+}
+
+
+/*
+    Blocking write below the compression layer. Bytes go into the ring as room frees up, while
+    this CPU feeds the UART itself, so nothing is dropped whatever other CPUs queue meanwhile.
+*/
+static void _serial_write_raw_sync(const char* buf, size_t len){
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
+    for(;;){
+        size_t n = _serial_tx_push_locked(buf, len);
+        buf += n;
+        len -= n;
+        if(is_debug_transmit_empty()){
+            _serial_tx_fill_fifo();
+        }
+        if(len == 0){
+            break;
+        }
+        _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+        cpu_pause();
+        locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
     }
+    _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+    _serial_tx_drain();
 }
 
 
-void writeuint_debug_serial(uint64_t uint_to_write, int base){
-    if(uint_to_write == 0){
-        write_debug_serial('0');
+/*
+    Until interrupts are available the ring is drained synchronously, one FIFO at a time,
+    so nothing is dropped during early boot. Afterwards writes never wait on the UART.
+*/
+static void _serial_write_raw(const char* buf, size_t len){
+    if(_serial_tx_irq_mode){
+        serial_tx_enqueue(buf, len);
+    }else{
+        _serial_write_raw_sync(buf, len);
+    }
+}
+
+
+/*
+    Emit for compressed output. A frame is queued whole or not at all: one cut short by a full ring
+    would throw the host decoder out of sync. A frame that doesn't fit goes out synchronously.
+*/
+static void _serial_write_frame(const char* buf, size_t len){
+    if(_serial_tx_irq_mode){
+        uint64_t rflags;
+        bool locked = _serial_lock_irqsave(&_serial_tx_lock, &rflags);
+        bool fits = SERIAL_TX_RING_SIZE - (_serial_tx_head - _serial_tx_tail) >= len;
+        if(fits){
+            _serial_tx_push_locked(buf, len);
+            if(is_debug_transmit_empty()){
+                _serial_tx_fill_fifo();
+            }
+        }
+        _serial_unlock_irqrestore(&_serial_tx_lock, locked, rflags);
+        if(fits){
+            return;
+        }
+    }
+    _serial_write_raw_sync(buf, len);
+}
+
+
+/*
+    Blocking write, nothing can be dropped.
+    Used for binary dumps that must arrive intact. In compressed mode the data is sent as
+    a complete frame before returning.
+*/
+void serial_tx_write_sync(const char* buf, size_t len){
+    if(!_serial_compress){
+        _serial_write_raw_sync(buf, len);
         return;
     }
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_lz_lock, &rflags);
+    serial_lz_write(buf, len, _serial_write_raw_sync);
+    serial_lz_flush(_serial_write_raw_sync);
+    _serial_unlock_irqrestore(&_serial_lz_lock, locked, rflags);
+}
 
-    char str[65];
 
-    int str_idx = 0;
-    while(uint_to_write != 0){
-        int r = uint_to_write % base;
-        str[str_idx++] = (r>9)? (r-10)+'a' : r + '0';
-        uint_to_write = uint_to_write / base;
+void writebuf_debug_serial(const char* buf, size_t len){
+    if(!_serial_compress){
+        _serial_write_raw(buf, len);
+        return;
     }
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_lz_lock, &rflags);
+    serial_lz_write(buf, len, _serial_write_frame);
+    _serial_unlock_irqrestore(&_serial_lz_lock, locked, rflags);
+}
+
+
+/*
+    Send a partially filled compression block as a frame now, without waiting for the UART.
+    Called after every log drain (the sink's flush) and from the idle loop, so the tail of the
+    log is not left sitting in the stage until it fills.
+*/
+void serial_flush_staged(){
+    if(!_serial_compress || !serial_lz_pending()){
+        return;
+    }
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_lz_lock, &rflags);
+    serial_lz_flush(_serial_write_frame);
+    _serial_unlock_irqrestore(&_serial_lz_lock, locked, rflags);
+}
+
 
-    for(int i=str_idx-1; i>=0; i--){
-        write_debug_serial(str[i]);
+/*
+    Turn LZ4 framing of serial output on or off (see serialcompress.h).
+    Anything still staged is sent before switching off.
+*/
+void serial_set_compression(bool enabled){
+    uint64_t rflags;
+    bool locked = _serial_lock_irqsave(&_serial_lz_lock, &rflags);
+    if(!enabled && serial_lz_pending()){
+        serial_lz_flush(_serial_write_frame);
     }
+    _serial_compress = enabled;
+    _serial_unlock_irqrestore(&_serial_lz_lock, locked, rflags);
 }
 
 
+void writeuint_debug_serial(uint64_t uint_to_write, int base){
+    char str[65];
+    int len = ksnprintf(str, sizeof(str), (base == 16)? "%lx" : "%lu", uint_to_write);
+    writebuf_debug_serial(str, len);
+}
+
+
+/*
+    Goes through the kernel log like kprintf(), so it keeps its place among other CPUs' messages and
+    reaches the host through the registered sinks. writestr/writebuf_debug_serial() are the raw UART path.
+*/
 void debug_serial_printf(const char* fmt, ...){
     va_list args;
     va_start(args, fmt);
-    for(int i=0; fmt[i]!='\0'; i++){
-        if(fmt[i] == '%'){
-            i++;
-            switch(fmt[i]){
-                case 'u':
-                {
-                    writeuint_debug_serial(va_arg(args, uint64_t), 10);
-                    break;
-                }
-                case 'x':
-                {
-                    writeuint_debug_serial(va_arg(args, uint64_t), 16);
-                    break;
-                }
-                case 's':
-                {
-                    writestr_debug_serial(va_arg(args, const char*));
-                    break;
-                }
-            }
-        }else{
-            write_debug_serial(fmt[i]);
-        }
-    }
+    kvprintf(fmt, args);
     va_end(args);
-}
\ No newline at end of file
+}
+
+
+/*
+    A 32 byte write through the normal (ring buffered) path, starting from an empty ring each time
+*/
+static void _serial_bench_drain(void* arg){
+    (void)arg;
+    serial_tx_flush();
+}
+
+static void _serial_bench_write(void* arg){
+    (void)arg;
+    writebuf_debug_serial("kbench serial write payload....\n", 32);
+}
+
+KBENCH(serial_write_32, .fn = _serial_bench_write, .before = _serial_bench_drain, .samples = 64);
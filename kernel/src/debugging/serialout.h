@@ -3,23 +3,75 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdarg.h>
 
+#include "kprint.h"
+
+struct interrupt_frame;
+
 #define SERIAL_DEBUG_COM_PORT   0x3f8 // COM1
+#define SERIAL_DEBUG_IRQ        4     // COM1 ISA IRQ line
 #define SERIAL_TEST_BYTE        0x69
 #define SERIAL_LOOPBACK_MODE    0x1E
 #define SERIAL_NORMAL_MODE      0x0F
 
+/*
+    Baud rate = SERIAL_BASE_BAUD / divisor, so a divisor of 1 is the fastest rate (115200)
+*/
+#define SERIAL_BASE_BAUD                115200
+#define SERIAL_BAUD_TO_DIVISOR(baud)    (SERIAL_BASE_BAUD / (baud))
+#ifndef SERIAL_DEBUG_BAUD_DIVISOR
+#define SERIAL_DEBUG_BAUD_DIVISOR       SERIAL_BAUD_TO_DIVISOR(115200)
+#endif
+
+#define SERIAL_FIFO_SIZE        16      // 16550A transmit FIFO depth
+#define SERIAL_TX_RING_SIZE     0x4000  // Must be a power of 2
+
+struct serial_tx_stats{
+    uint64_t enqueued_bytes;
+    uint64_t dropped_bytes;  // Bytes thrown away because the ring was full
+    uint64_t fifo_fills;     // Number of times the FIFO was (re)filled
+    uint64_t irqs;           // THRE interrupts taken
+};
+
+extern struct serial_tx_stats g_serial_tx_stats;
+
+typedef void (*serial_rx_handler_t)(char c);
+
+/*
+    Single byte commands received on COM1 (e.g. 'P' dumps the profiler's samples). The IRQ only
+    flags them, serial_command_poll() runs them from the idle loop.
+*/
+#define SERIAL_MAX_COMMANDS 8
+
+typedef void (*serial_command_fn_t)(void);
+
 uint8_t asm_inline_inb(uint16_t port);
 void asm_inline_outb(uint16_t port, uint8_t data);
 
 int init_debug_serial();
+int init_debug_serial_divisor(uint16_t divisor);
 int is_debug_serial_received();
 char read_debug_serial();
 int is_debug_transmit_empty();
 void write_debug_serial(char a);
 void writestr_debug_serial(const char* str);
+void writebuf_debug_serial(const char* buf, size_t len);
 void writeuint_debug_serial(uint64_t uint_to_write, int base);
-void debug_serial_printf(const char* fmt, ...);
+void debug_serial_printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+size_t serial_tx_enqueue(const char* buf, size_t len);
+void serial_tx_flush();
+void serial_tx_write_sync(const char* buf, size_t len);
+void serial_tx_enable_irq();
+void serial_set_compression(bool enabled);
+void serial_flush_staged();
+void serial_rx_set_handler(serial_rx_handler_t handler);
+void serial_command_register(char c, serial_command_fn_t fn);
+void serial_command_poll();
+void serial_irq_handler(struct interrupt_frame* frame);
+
+extern const struct kprint_sink g_serial_sink;
 
-#endif
\ No newline at end of file
+#endif
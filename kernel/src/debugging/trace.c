@@ -0,0 +1,93 @@
+#include "trace.h"
+
+#include "util/cpu.h"
+#include "debugging/serialout.h"
+#include "debugging/dmesg.h"
+#include "time/tsc.h"
+
+volatile bool g_trace_enabled[TRACE_EVENT_COUNT] = {0};
+static bool _trace_all_enabled = false;
+
+static struct trace_record _trace_ring[TRACE_RING_ENTRIES];
+static volatile uint64_t _trace_head = 0; // Total records ever emitted
+
+void trace_emit(uint16_t event, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3){
+    uint64_t slot = __atomic_fetch_add(&_trace_head, 1, __ATOMIC_RELAXED);
+    struct trace_record* rec = &_trace_ring[slot & (TRACE_RING_ENTRIES-1)];
+    rec->event = event;
+    rec->cpu = cpu_current_id();
+    rec->reserved = 0;
+    rec->tsc = cpu_rdtsc();
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    rec->args[3] = a3;
+}
+
+void trace_enable(enum trace_event_id event, bool enabled){
+    if(event < TRACE_EVENT_COUNT){
+        g_trace_enabled[event] = enabled;
+    }
+}
+
+void trace_enable_all(bool enabled){
+    for(int i=0; i<TRACE_EVENT_COUNT; i++){
+        g_trace_enabled[i] = enabled;
+    }
+    _trace_all_enabled = enabled;
+}
+
+static void _trace_toggle(){
+    trace_enable_all(!_trace_all_enabled);
+    debug_serial_printf("trace: %s, %lu records so far\n", _trace_all_enabled? "on" : "off", trace_count());
+}
+
+static void _trace_dump_cmd(){
+    dmesg_pause();
+    trace_dump();
+    dmesg_resume();
+}
+
+/*
+    Enable everything with KCONFIG_TRACE and hook up the serial commands. Called early in kmain,
+    only needs the serial port.
+*/
+void trace_init(){
+#ifdef KCONFIG_TRACE
+    trace_enable_all(true);
+#endif
+    serial_command_register(TRACE_CMD_TOGGLE, _trace_toggle);
+    serial_command_register(TRACE_CMD_DUMP, _trace_dump_cmd);
+}
+
+void trace_reset(){
+    _trace_head = 0;
+}
+
+uint64_t trace_count(){
+    return _trace_head;
+}
+
+/*
+    Send the ring contents over serial as one binary frame (see trace.h).
+    Output bypasses the kprint sinks, it is only meaningful to tools/trace_decode.py.
+    Flushes synchronously, so this is safe to call from the panic path.
+*/
+void trace_dump(){
+    uint64_t head = _trace_head;
+    uint64_t count = (head < TRACE_RING_ENTRIES)? head : TRACE_RING_ENTRIES;
+
+    struct trace_dump_header header = {
+        .magic = TRACE_DUMP_MAGIC,
+        .version = TRACE_DUMP_VERSION,
+        .record_size = sizeof(struct trace_record),
+        .record_count = count,
+        .lost_records = head - count,
+        .tsc_hz = tsc_hz()
+    };
+    serial_tx_write_sync((const char*)&header, sizeof(header));
+    for(uint64_t i=head-count; i<head; i++){
+        serial_tx_write_sync((const char*)&_trace_ring[i & (TRACE_RING_ENTRIES-1)], sizeof(struct trace_record));
+    }
+    serial_tx_write_sync(TRACE_DUMP_END_MAGIC, 4);
+}
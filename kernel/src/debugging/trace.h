@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Binary structured trace log.
+
+    Trace points record an event id, TSC timestamp, CPU and up to 4 u64 arguments into a ring.
+    Nothing is formatted in the kernel: trace_dump() sends the raw records over serial and
+    tools/trace_decode.py turns them back into text using the format strings below.
+    The decoder parses this table directly, so keep one X() entry per line.
+
+    A disabled trace point costs a single load + predicted-not-taken branch.
+    Every event starts disabled. Built with TRACE=1 (KCONFIG_TRACE) all of them are enabled from
+    the start of kmain; at run time TRACE_CMD_TOGGLE over COM1 switches all of them on or off and
+    TRACE_CMD_DUMP sends the ring (see serial_command_register()).
+*/
+#define TRACE_EVENTS(X) \
+    X(TRACE_BOOT_STAGE,     "boot stage %u") \
+    X(TRACE_PMM_ALLOC,      "pmm alloc n_pages=%u phys=0x%x scanned=%u") \
+    X(TRACE_PMM_FREE,       "pmm free page=%u") \
+    X(TRACE_VMM_MAP,        "vmm map phys=0x%x virt=0x%x flags=0x%x") \
+    X(TRACE_VMM_NEW_TABLE,  "vmm new table phys=0x%x parent=0x%x index=%u") \
+    X(TRACE_SERIAL_DROP,    "serial tx dropped=%u")
+
+enum trace_event_id{
+#define TRACE_X_ENUM(id, fmt) id,
+    TRACE_EVENTS(TRACE_X_ENUM)
+#undef TRACE_X_ENUM
+    TRACE_EVENT_COUNT
+};
+
+#define TRACE_RING_ENTRIES  4096 // Must be a power of 2
+#define TRACE_CMD_TOGGLE    'T'
+#define TRACE_CMD_DUMP      'D'
+#define TRACE_MAX_ARGS      4
+
+struct trace_record{
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t reserved;
+    uint64_t tsc;
+    uint64_t args[TRACE_MAX_ARGS];
+};
+
+/*
+    Dump framing, all little endian:
+        struct trace_dump_header
+        record_count * struct trace_record (oldest first)
+        TRACE_DUMP_END_MAGIC (4 bytes)
+*/
+#define TRACE_DUMP_MAGIC        "MTRC"
+#define TRACE_DUMP_END_MAGIC    "CRTM"
+#define TRACE_DUMP_VERSION      1
+
+struct trace_dump_header{
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t record_count;
+    uint32_t lost_records;  // Overwritten because the ring wrapped
+    uint64_t tsc_hz;        // 0 if the TSC has not been calibrated
+};
+
+extern volatile bool g_trace_enabled[TRACE_EVENT_COUNT];
+
+void trace_init();
+void trace_emit(uint16_t event, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3);
+void trace_enable(enum trace_event_id event, bool enabled);
+void trace_enable_all(bool enabled);
+void trace_reset();
+uint64_t trace_count();
+void trace_dump();
+
+#define _TRACE_EMIT_ARGS(id, a0, a1, a2, a3, ...) \
+    trace_emit((id), (uint64_t)(a0), (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3))
+
+#define TRACE(id, ...) do{ \
+    if(__builtin_expect(g_trace_enabled[(id)], 0)){ \
+        _TRACE_EMIT_ARGS((id), ##__VA_ARGS__, 0, 0, 0, 0); \
+    } \
+}while(0)
+
+#endif
@@ -0,0 +1,68 @@
+#include "pci.h"
+
+#include "util/cpu.h"
+
+static inline uint32_t _pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset){
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) | ((uint32_t)(func & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset){
+    asm_inline_outl(PCI_CONFIG_ADDRESS, _pci_address(bus, slot, func, offset));
+    return asm_inline_inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset){
+    asm_inline_outl(PCI_CONFIG_ADDRESS, _pci_address(bus, slot, func, offset));
+    return asm_inline_inw(PCI_CONFIG_DATA + (offset & 0x2));
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value){
+    asm_inline_outl(PCI_CONFIG_ADDRESS, _pci_address(bus, slot, func, offset));
+    asm_inline_outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value){
+    asm_inline_outl(PCI_CONFIG_ADDRESS, _pci_address(bus, slot, func, offset));
+    asm_inline_outw(PCI_CONFIG_DATA + (offset & 0x2), value);
+}
+
+/*
+    Brute force scan of every bus/slot/function for a matching device.
+    Only used at boot, so the ~64k config reads don't matter.
+*/
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct pci_device* out){
+    for(int bus=0; bus<256; bus++){
+        for(int slot=0; slot<32; slot++){
+            if(pci_config_read16(bus, slot, 0, PCI_REG_VENDOR_ID) == 0xFFFF){
+                continue; // Nothing in this slot
+            }
+            bool multifunction = pci_config_read16(bus, slot, 0, PCI_REG_HEADER_TYPE) & 0x80;
+            for(int func=0; func<(multifunction? 8 : 1); func++){
+                if(pci_config_read16(bus, slot, func, PCI_REG_VENDOR_ID) != vendor_id
+                    || pci_config_read16(bus, slot, func, PCI_REG_DEVICE_ID) != device_id){
+                    continue;
+                }
+                uint32_t class_reg = pci_config_read32(bus, slot, func, PCI_REG_CLASS);
+                out->bus = bus;
+                out->slot = slot;
+                out->func = func;
+                out->vendor_id = vendor_id;
+                out->device_id = device_id;
+                out->class_code = class_reg >> 24;
+                out->subclass = (class_reg >> 16) & 0xFF;
+                out->irq_line = pci_config_read16(bus, slot, func, PCI_REG_INTERRUPT) & 0xFF;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint32_t pci_read_bar(const struct pci_device* dev, int bar){
+    return pci_config_read32(dev->bus, dev->slot, dev->func, PCI_REG_BAR0 + bar*4);
+}
+
+void pci_enable(const struct pci_device* dev, uint16_t command_bits){
+    uint16_t command = pci_config_read16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    pci_config_write16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, command | command_bits);
+}
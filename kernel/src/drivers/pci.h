@@ -0,0 +1,48 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    PCI configuration space access through the legacy 0xCF8/0xCFC mechanism
+*/
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+#define PCI_REG_VENDOR_ID   0x00
+#define PCI_REG_DEVICE_ID   0x02
+#define PCI_REG_COMMAND     0x04
+#define PCI_REG_CLASS       0x08
+#define PCI_REG_HEADER_TYPE 0x0E
+#define PCI_REG_BAR0        0x10
+#define PCI_REG_INTERRUPT   0x3C
+
+#define PCI_COMMAND_IO          0x01
+#define PCI_COMMAND_MEMORY      0x02
+#define PCI_COMMAND_BUS_MASTER  0x04
+
+#define PCI_BAR_IO              0x01
+
+struct pci_device{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t irq_line;
+};
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value);
+
+bool pci_find_device(uint16_t vendor_id, uint16_t device_id, struct pci_device* out);
+uint32_t pci_read_bar(const struct pci_device* dev, int bar);
+void pci_enable(const struct pci_device* dev, uint16_t command_bits);
+
+#endif
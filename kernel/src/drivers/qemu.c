@@ -0,0 +1,68 @@
+#include "qemu.h"
+
+#include "util/cpu.h"
+#include "debugging/serialout.h" // asm_inline_inb/outb
+
+static void _qemu_fwcfg_read_bytes(void* buf, size_t len){
+    uint8_t* bytes = buf;
+    for(size_t i=0; i<len; i++){
+        bytes[i] = asm_inline_inb(QEMU_FWCFG_DATA_PORT);
+    }
+}
+
+static uint32_t _qemu_fwcfg_read_be32(){
+    uint8_t bytes[4];
+    _qemu_fwcfg_read_bytes(bytes, 4);
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+bool qemu_fwcfg_present(){
+    char signature[4];
+    qemu_fwcfg_read(QEMU_FWCFG_SIGNATURE, signature, 4);
+    return signature[0] == 'Q' && signature[1] == 'E' && signature[2] == 'M' && signature[3] == 'U';
+}
+
+/*
+    Select an item and read its first len bytes
+*/
+void qemu_fwcfg_read(uint16_t select, void* buf, size_t len){
+    asm_inline_outw(QEMU_FWCFG_SELECTOR_PORT, select);
+    _qemu_fwcfg_read_bytes(buf, len);
+}
+
+/*
+    Look a file up in the fw_cfg directory. The directory is big endian:
+    u32 count, then count * {u32 size, u16 select, u16 reserved, char name[56]}
+*/
+bool qemu_fwcfg_find_file(const char* name, uint16_t* select, uint32_t* size){
+    if(!qemu_fwcfg_present()){
+        return false;
+    }
+    asm_inline_outw(QEMU_FWCFG_SELECTOR_PORT, QEMU_FWCFG_FILE_DIR);
+    uint32_t count = _qemu_fwcfg_read_be32();
+    for(uint32_t i=0; i<count; i++){
+        uint32_t file_size = _qemu_fwcfg_read_be32();
+        uint8_t select_be[4];
+        _qemu_fwcfg_read_bytes(select_be, 4);
+        char file_name[QEMU_FWCFG_NAME_SIZE];
+        _qemu_fwcfg_read_bytes(file_name, QEMU_FWCFG_NAME_SIZE);
+
+        size_t j = 0;
+        while(j < QEMU_FWCFG_NAME_SIZE && name[j] != '\0' && name[j] == file_name[j]){
+            j++;
+        }
+        if(name[j] == '\0' && (j == QEMU_FWCFG_NAME_SIZE || file_name[j] == '\0')){
+            *select = ((uint16_t)select_be[0] << 8) | select_be[1];
+            *size = file_size;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Stop the VM. Does nothing if the device isn't attached, so callers should halt afterwards.
+*/
+void qemu_debug_exit(uint8_t code){
+    asm_inline_outb(QEMU_DEBUG_EXIT_PORT, code);
+}
@@ -0,0 +1,32 @@
+#ifndef QEMU_H
+#define QEMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    QEMU specific devices, used by test/profiling runs to configure and stop the VM.
+*/
+
+/*
+    fw_cfg: named blobs passed on the QEMU command line with -fw_cfg name=opt/...,string=...
+*/
+#define QEMU_FWCFG_SELECTOR_PORT    0x510
+#define QEMU_FWCFG_DATA_PORT        0x511
+#define QEMU_FWCFG_SIGNATURE        0x0000
+#define QEMU_FWCFG_FILE_DIR         0x0019
+#define QEMU_FWCFG_NAME_SIZE        56
+
+/*
+    isa-debug-exit: -device isa-debug-exit,iobase=0xf4,iosize=0x04
+    QEMU exits with status (code << 1) | 1
+*/
+#define QEMU_DEBUG_EXIT_PORT        0xf4
+
+bool qemu_fwcfg_present();
+bool qemu_fwcfg_find_file(const char* name, uint16_t* select, uint32_t* size);
+void qemu_fwcfg_read(uint16_t select, void* buf, size_t len);
+void qemu_debug_exit(uint8_t code);
+
+#endif
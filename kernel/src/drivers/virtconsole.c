@@ -0,0 +1,158 @@
+#include "virtconsole.h"
+
+#include "drivers/pci.h"
+#include "util/cpu.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+
+struct virtconsole_stats g_virtconsole_stats = {0};
+
+const struct kprint_sink g_virtconsole_sink = {
+    .name = "virtconsole",
+    .write = virtconsole_write,
+    .flush = virtconsole_flush
+};
+
+static bool _virtconsole_present = false;
+static struct virtq _virtconsole_txq;
+
+/*
+    TX buffer pool. A buffer is either being filled (_cur), owned by the device, or free.
+*/
+static uint64_t _virtconsole_buf_phys = 0;
+static char* _virtconsole_buf_virt = NULL;
+static bool _virtconsole_buf_busy[VIRTCONSOLE_TX_BUFFERS];
+static int _virtconsole_n_bufs = 0;
+static int _virtconsole_desc_to_buf[VIRTQ_MAX_SIZE];
+static int _virtconsole_cur = -1;
+static size_t _virtconsole_cur_len = 0;
+static bool _virtconsole_need_kick = false;
+
+
+bool virtconsole_init(){
+    struct pci_device dev;
+    if(!pci_find_device(VIRTIO_PCI_VENDOR_ID, VIRTCONSOLE_PCI_DEVICE_ID, &dev)){
+        return false;
+    }
+    uint32_t bar0 = pci_read_bar(&dev, 0);
+    if(!(bar0 & PCI_BAR_IO)){
+        return false; // Modern-only device, no legacy I/O window
+    }
+    uint16_t iobase = bar0 & 0xFFFC;
+    pci_enable(&dev, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    /*
+        Legacy init sequence: reset, ACK, DRIVER, negotiate, queues, DRIVER_OK.
+        No features are needed: without MULTIPORT the console is port 0 on queues 0/1.
+    */
+    asm_inline_outb(iobase + VIRTIO_PCI_STATUS, 0);
+    asm_inline_outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    asm_inline_outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    asm_inline_inl(iobase + VIRTIO_PCI_HOST_FEATURES);
+    asm_inline_outl(iobase + VIRTIO_PCI_GUEST_FEATURES, 0);
+
+    if(!virtq_setup_legacy(&_virtconsole_txq, iobase, VIRTCONSOLE_QUEUE_TX0)){
+        asm_inline_outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    _virtconsole_buf_phys = (uint64_t)pmm_alloc_pages(VIRTCONSOLE_TX_BUFFERS);
+    _virtconsole_buf_virt = (char*)vmm_identity_map_n_pages(_virtconsole_buf_phys, VIRTCONSOLE_TX_BUFFERS, 0x3);
+    // Never more buffers than descriptors, so submitting a buffer can't fail
+    _virtconsole_n_bufs = (_virtconsole_txq.size < VIRTCONSOLE_TX_BUFFERS)? _virtconsole_txq.size : VIRTCONSOLE_TX_BUFFERS;
+    for(int i=0; i<_virtconsole_n_bufs; i++){
+        _virtconsole_buf_busy[i] = false;
+    }
+
+    asm_inline_outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    _virtconsole_present = true;
+    return true;
+}
+
+bool virtconsole_present(){
+    return _virtconsole_present;
+}
+
+static void _virtconsole_reclaim(){
+    int id;
+    while((id = virtq_pop_used(&_virtconsole_txq, NULL)) >= 0){
+        _virtconsole_buf_busy[_virtconsole_desc_to_buf[id]] = false;
+    }
+}
+
+/*
+    Pick a free buffer to fill. Returns false if the device still owns all of them.
+*/
+static bool _virtconsole_take_buffer(){
+    _virtconsole_reclaim();
+    for(int i=0; i<_virtconsole_n_bufs; i++){
+        if(!_virtconsole_buf_busy[i]){
+            _virtconsole_cur = i;
+            _virtconsole_cur_len = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Hand the buffer being filled to the device (without notifying it yet)
+*/
+static void _virtconsole_submit(){
+    if(_virtconsole_cur < 0 || _virtconsole_cur_len == 0){
+        return;
+    }
+    int id = virtq_push(&_virtconsole_txq, _virtconsole_buf_phys + _virtconsole_cur*PAGE_SIZE, _virtconsole_cur_len, 0);
+    _virtconsole_desc_to_buf[id] = _virtconsole_cur;
+    _virtconsole_buf_busy[_virtconsole_cur] = true;
+    g_virtconsole_stats.buffers++;
+    _virtconsole_cur = -1;
+    _virtconsole_cur_len = 0;
+    _virtconsole_need_kick = true;
+}
+
+/*
+    Append to the current DMA buffer. Full buffers are queued but the device is only
+    notified on virtconsole_flush().
+*/
+void virtconsole_write(const char* buf, size_t len){
+    if(!_virtconsole_present){
+        return;
+    }
+    while(len > 0){
+        if(_virtconsole_cur < 0 && !_virtconsole_take_buffer()){
+            // Let the device catch up on what is already queued, then retry once
+            virtconsole_flush();
+            if(!_virtconsole_take_buffer()){
+                g_virtconsole_stats.dropped_bytes += len;
+                return;
+            }
+        }
+        char* dst = _virtconsole_buf_virt + _virtconsole_cur*PAGE_SIZE;
+        size_t space = PAGE_SIZE - _virtconsole_cur_len;
+        size_t n = (len < space)? len : space;
+        for(size_t i=0; i<n; i++){
+            dst[_virtconsole_cur_len + i] = buf[i];
+        }
+        _virtconsole_cur_len += n;
+        g_virtconsole_stats.bytes += n;
+        buf += n;
+        len -= n;
+        if(_virtconsole_cur_len == PAGE_SIZE){
+            _virtconsole_submit();
+        }
+    }
+}
+
+void virtconsole_flush(){
+    if(!_virtconsole_present){
+        return;
+    }
+    _virtconsole_submit();
+    if(_virtconsole_need_kick){
+        virtq_kick(&_virtconsole_txq);
+        g_virtconsole_stats.kicks++;
+        _virtconsole_need_kick = false;
+    }
+    _virtconsole_reclaim();
+}
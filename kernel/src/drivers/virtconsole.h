@@ -0,0 +1,36 @@
+#ifndef VIRTCONSOLE_H
+#define VIRTCONSOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "drivers/virtio.h"
+#include "debugging/kprint.h"
+
+/*
+    virtio-console (virtio-serial PCI) log channel.
+    Log text is packed into page sized DMA buffers on the port 0 transmit queue; a buffer is
+    only handed to the device when it fills or the sink is flushed, and each flush is a single notify.
+*/
+#define VIRTCONSOLE_PCI_DEVICE_ID   0x1003  // Transitional console device
+#define VIRTCONSOLE_QUEUE_RX0       0
+#define VIRTCONSOLE_QUEUE_TX0       1
+#define VIRTCONSOLE_TX_BUFFERS      16
+
+struct virtconsole_stats{
+    uint64_t bytes;
+    uint64_t buffers;
+    uint64_t kicks;
+    uint64_t dropped_bytes; // Every buffer was still owned by the device
+};
+
+extern struct virtconsole_stats g_virtconsole_stats;
+extern const struct kprint_sink g_virtconsole_sink;
+
+bool virtconsole_init();
+bool virtconsole_present();
+void virtconsole_write(const char* buf, size_t len);
+void virtconsole_flush();
+
+#endif
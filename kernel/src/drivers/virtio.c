@@ -0,0 +1,108 @@
+#include "virtio.h"
+
+#include "util/cpu.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+
+static inline uint64_t _virtq_align(uint64_t x){
+    return (x + VIRTQ_ALIGN - 1) & ~(uint64_t)(VIRTQ_ALIGN - 1);
+}
+
+/*
+    Allocate and register queue `index` of a legacy virtio device.
+    The device dictates the queue size; returns false if the queue doesn't exist.
+*/
+bool virtq_setup_legacy(struct virtq* q, uint16_t iobase, uint16_t index){
+    asm_inline_outw(iobase + VIRTIO_PCI_QUEUE_SELECT, index);
+    uint16_t size = asm_inline_inw(iobase + VIRTIO_PCI_QUEUE_SIZE);
+    if(size == 0 || size > VIRTQ_MAX_SIZE){
+        return false;
+    }
+
+    // Legacy layout: descriptors + avail ring, then the used ring on the next aligned boundary
+    uint64_t used_offset = _virtq_align(sizeof(struct virtq_desc)*size + sizeof(uint16_t)*(3 + size));
+    uint64_t total = used_offset + _virtq_align(sizeof(uint16_t)*3 + sizeof(struct virtq_used_elem)*size);
+    int n_pages = total / PAGE_SIZE;
+
+    uint64_t phys = (uint64_t)pmm_alloc_pages(n_pages);
+    uint8_t* virt = (uint8_t*)vmm_identity_map_n_pages(phys, n_pages, 0x3);
+    for(uint64_t i=0; i<total; i++){
+        virt[i] = 0;
+    }
+
+    q->iobase = iobase;
+    q->index = index;
+    q->size = size;
+    q->desc = (volatile struct virtq_desc*)virt;
+    q->avail = (volatile struct virtq_avail*)(virt + sizeof(struct virtq_desc)*size);
+    q->used = (volatile struct virtq_used*)(virt + used_offset);
+    q->last_used_idx = 0;
+
+    // Chain every descriptor into the free list
+    for(uint16_t i=0; i<size; i++){
+        q->free_next[i] = i + 1;
+    }
+    q->free_head = 0;
+    q->num_free = size;
+
+    // We poll the used ring, so don't bother the guest with interrupts
+    q->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+    asm_inline_outl(iobase + VIRTIO_PCI_QUEUE_PFN, phys / PAGE_SIZE);
+    return true;
+}
+
+/*
+    Queue one buffer for the device without notifying it.
+    Returns the descriptor id, or -1 if the queue is full.
+*/
+int virtq_push(struct virtq* q, uint64_t phys_addr, uint32_t len, uint16_t flags){
+    if(q->num_free == 0){
+        return -1;
+    }
+    uint16_t id = q->free_head;
+    q->free_head = q->free_next[id];
+    q->num_free--;
+
+    q->desc[id].addr = phys_addr;
+    q->desc[id].len = len;
+    q->desc[id].flags = flags;
+    q->desc[id].next = 0;
+
+    uint16_t avail_idx = q->avail->idx;
+    q->avail->ring[avail_idx % q->size] = id;
+    // The ring entry must be visible before the index that publishes it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    q->avail->idx = avail_idx + 1;
+    return id;
+}
+
+/*
+    Tell the device new buffers are available. One notify covers everything pushed since the last one.
+*/
+void virtq_kick(struct virtq* q){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    asm_inline_outw(q->iobase + VIRTIO_PCI_QUEUE_NOTIFY, q->index);
+}
+
+/*
+    Reclaim one buffer the device has finished with.
+    Returns its descriptor id, or -1 if there is nothing new.
+*/
+int virtq_pop_used(struct virtq* q, uint32_t* len){
+    if(q->last_used_idx == q->used->idx){
+        return -1;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    volatile struct virtq_used_elem* elem = &q->used->ring[q->last_used_idx % q->size];
+    uint16_t id = elem->id;
+    if(len != NULL){
+        *len = elem->len;
+    }
+    q->last_used_idx++;
+
+    q->free_next[id] = q->free_head;
+    q->free_head = id;
+    q->num_free++;
+    return id;
+}
@@ -0,0 +1,80 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+/*
+    Legacy (virtio 0.9.5 / transitional) PCI transport.
+    Registers live in I/O BAR0, queues are physically contiguous and 4KiB aligned.
+*/
+#define VIRTIO_PCI_VENDOR_ID            0x1AF4
+
+#define VIRTIO_PCI_HOST_FEATURES        0x00
+#define VIRTIO_PCI_GUEST_FEATURES       0x04
+#define VIRTIO_PCI_QUEUE_PFN            0x08
+#define VIRTIO_PCI_QUEUE_SIZE           0x0C
+#define VIRTIO_PCI_QUEUE_SELECT         0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY         0x10
+#define VIRTIO_PCI_STATUS               0x12
+#define VIRTIO_PCI_ISR                  0x13
+#define VIRTIO_PCI_DEVICE_CONFIG        0x14 // Without MSI-X
+
+#define VIRTIO_STATUS_ACKNOWLEDGE       0x01
+#define VIRTIO_STATUS_DRIVER            0x02
+#define VIRTIO_STATUS_DRIVER_OK         0x04
+#define VIRTIO_STATUS_FAILED            0x80
+
+#define VIRTQ_DESC_F_NEXT               0x01
+#define VIRTQ_DESC_F_WRITE              0x02
+#define VIRTQ_AVAIL_F_NO_INTERRUPT      0x01
+
+#define VIRTQ_ALIGN                     PAGE_SIZE
+#define VIRTQ_MAX_SIZE                  256
+
+struct virtq_desc{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+}__attribute__((packed));
+
+struct virtq_avail{
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+}__attribute__((packed));
+
+struct virtq_used_elem{
+    uint32_t id;
+    uint32_t len;
+}__attribute__((packed));
+
+struct virtq_used{
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+}__attribute__((packed));
+
+struct virtq{
+    uint16_t iobase;
+    uint16_t index;
+    uint16_t size;
+    uint16_t num_free;
+    uint16_t free_head;
+    uint16_t last_used_idx;
+    volatile struct virtq_desc* desc;
+    volatile struct virtq_avail* avail;
+    volatile struct virtq_used* used;
+    uint16_t free_next[VIRTQ_MAX_SIZE];
+};
+
+bool virtq_setup_legacy(struct virtq* q, uint16_t iobase, uint16_t index);
+int virtq_push(struct virtq* q, uint64_t phys_addr, uint32_t len, uint16_t flags);
+void virtq_kick(struct virtq* q);
+int virtq_pop_used(struct virtq* q, uint32_t* len);
+
+#endif
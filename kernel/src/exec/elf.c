@@ -0,0 +1,148 @@
+#include "elf.h"
+
+#include "constants.h"
+#include "memory/pmm.h"
+#include "memory/physmap.h"
+#include "util/kstring.h"
+
+#define ELF_ET_EXEC         2
+#define ELF_EM_X86_64       62
+#define ELF_CLASS_64        2
+#define ELF_DATA_LSB        1
+
+static const char* _elf_status_names[] = {
+    [ELF_OK] = "ok",
+    [ELF_ERR_HEADER] = "not an x86-64 executable",
+    [ELF_ERR_TRUNCATED] = "truncated image",
+    [ELF_ERR_RANGE] = "segment outside user space",
+    [ELF_ERR_OVERLAP] = "segments overlap",
+};
+
+const char* elf_status_str(enum elf_status status){
+    return _elf_status_names[status];
+}
+
+
+static bool _elf_header_ok(const struct elf64_header* header, uint64_t image_size){
+    const uint8_t* ident = header->ident;
+    if(ident[0] != 0x7F || ident[1] != 'E' || ident[2] != 'L' || ident[3] != 'F'){
+        return false;
+    }
+    return ident[4] == ELF_CLASS_64 && ident[5] == ELF_DATA_LSB && header->type == ELF_ET_EXEC
+        && header->machine == ELF_EM_X86_64 && header->phentsize == sizeof(struct elf64_phdr)
+        && header->phoff <= image_size;
+}
+
+
+/*
+    A fresh page owned by the address space, filled with the part of the image that falls into it
+    (src_len bytes from src at offset dst_off) and zero elsewhere.
+*/
+static uint64_t _elf_private_page(const uint8_t* src, uint64_t dst_off, uint64_t src_len){
+    uint64_t phys = (uint64_t)pmm_alloc_pages(1);
+    vmm_identity_map_page(phys, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_NO_EXECUTE);
+    uint8_t* page = (uint8_t*)translateaddr_idmap_p2v(phys);
+    memset(page, 0, PAGE_SIZE);
+    if(src_len > 0){
+        memcpy(page + dst_off, src, src_len);
+    }
+    return phys;
+}
+
+
+static enum elf_status _elf_load_segment(struct vmm_space* space, uint64_t image_phys, uint64_t image_size,
+                                         const struct elf64_phdr* phdr, struct elf_load_info* info){
+    const uint8_t* image = (const uint8_t*)translateaddr_idmap_p2v(image_phys);
+    uint64_t flags = VMM_FLAG_PRESENT | VMM_FLAG_USER;
+    if(phdr->flags & ELF_PF_W){
+        flags |= VMM_FLAG_WRITE;
+    }
+    if(!(phdr->flags & ELF_PF_X)){
+        flags |= VMM_FLAG_NO_EXECUTE;
+    }
+    // File bytes can come straight from the image only if they sit at the same page offset there
+    bool can_share = !(phdr->flags & ELF_PF_W) && ((image_phys + phdr->offset) % PAGE_SIZE) == (phdr->vaddr % PAGE_SIZE);
+
+    uint64_t file_end = phdr->vaddr + phdr->filesz;
+    uint64_t first_page = phdr->vaddr & ~(uint64_t)(PAGE_SIZE-1);
+    uint64_t end = phdr->vaddr + phdr->memsz;
+    for(uint64_t page=first_page; page<end; page+=PAGE_SIZE){
+        if(vmm_space_translate(space, page) != 0){
+            return ELF_ERR_OVERLAP;
+        }
+
+        // Part of [page, page+PAGE_SIZE) that holds file data
+        uint64_t data_start = (page > phdr->vaddr)? page : phdr->vaddr;
+        uint64_t data_end = (page + PAGE_SIZE < file_end)? page + PAGE_SIZE : file_end;
+        uint64_t data_len = (data_end > data_start)? data_end - data_start : 0;
+        uint64_t src_offset = phdr->offset + (data_start - phdr->vaddr);
+
+        // The file page behind it, whole and with no .bss in it
+        uint64_t page_offset = src_offset - (data_start - page);
+        bool bss = end > file_end && page + PAGE_SIZE > file_end;
+        if(can_share && !bss && data_len > 0 && src_offset >= data_start - page && page_offset + PAGE_SIZE <= image_size){
+            vmm_space_map(space, image_phys + page_offset, page, flags);
+            info->pages_shared++;
+        }else{
+            uint64_t phys = _elf_private_page(image + src_offset, data_start - page, data_len);
+            vmm_space_map(space, phys, page, flags | VMM_FLAG_OWNED);
+            info->pages_copied++;
+        }
+    }
+    return ELF_OK;
+}
+
+
+/*
+    Map the executable at image_phys (direct mapped, image_size bytes) into space, plus a user stack.
+    On failure whatever was mapped stays in space: the caller destroys it.
+*/
+enum elf_status elf_load(struct vmm_space* space, uint64_t image_phys, uint64_t image_size, struct elf_load_info* info){
+    *info = (struct elf_load_info){0};
+    if(image_size < sizeof(struct elf64_header)){
+        return ELF_ERR_TRUNCATED;
+    }
+    const uint8_t* image = (const uint8_t*)translateaddr_idmap_p2v(image_phys);
+    const struct elf64_header* header = (const struct elf64_header*)image;
+    if(!_elf_header_ok(header, image_size)){
+        return ELF_ERR_HEADER;
+    }
+    if((uint64_t)header->phnum * sizeof(struct elf64_phdr) > image_size - header->phoff){
+        return ELF_ERR_TRUNCATED;
+    }
+    if(header->entry >= VMM_USER_TOP){
+        return ELF_ERR_RANGE;
+    }
+
+    const struct elf64_phdr* phdrs = (const struct elf64_phdr*)(image + header->phoff);
+    for(uint16_t i=0; i<header->phnum; i++){
+        const struct elf64_phdr* phdr = &phdrs[i];
+        if(phdr->type != ELF_PT_LOAD || phdr->memsz == 0){
+            continue;
+        }
+        if(phdr->filesz > phdr->memsz || phdr->offset > image_size || phdr->filesz > image_size - phdr->offset){
+            return ELF_ERR_TRUNCATED;
+        }
+        if(phdr->vaddr >= VMM_USER_TOP || phdr->memsz > VMM_USER_TOP - phdr->vaddr){
+            return ELF_ERR_RANGE;
+        }
+        enum elf_status status = _elf_load_segment(space, image_phys, image_size, phdr, info);
+        if(status != ELF_OK){
+            return status;
+        }
+    }
+
+    // Stack, with the unmapped page below it as a guard
+    for(int i=1; i<=ELF_USER_STACK_PAGES; i++){
+        uint64_t page = ELF_USER_STACK_TOP - i*PAGE_SIZE;
+        if(vmm_space_translate(space, page) != 0){
+            return ELF_ERR_OVERLAP;
+        }
+        uint64_t phys = _elf_private_page(NULL, 0, 0);
+        vmm_space_map(space, phys, page, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_USER | VMM_FLAG_NO_EXECUTE | VMM_FLAG_OWNED);
+        info->pages_copied++;
+    }
+    info->entry = header->entry;
+    info->stack_top = ELF_USER_STACK_TOP;
+    return ELF_OK;
+}
@@ -0,0 +1,75 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory/vmm.h"
+
+/*
+    ELF64 executable loader (static, non-PIE x86-64 images).
+
+    The image is read in place through the direct map. A page of a PT_LOAD segment is mapped
+    straight from the image, with no copy, when the user can't write it, its file offset and
+    virtual address agree modulo the page size, the whole file page lies inside the image and it
+    has no .bss to zero: read-only text and data of a page aligned image cost no memory at all
+    (like mmap, the rest of the file page comes along). Everything else (writable data, the page
+    where file data ends and .bss starts, misaligned segments) gets a private copy owned by the
+    address space.
+*/
+#define ELF_USER_STACK_TOP      0x0000600000000000UL
+#define ELF_USER_STACK_PAGES    4
+
+#define ELF_PT_LOAD     1
+#define ELF_PF_X        0x1
+#define ELF_PF_W        0x2
+#define ELF_PF_R        0x4
+
+struct elf64_header{
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+}__attribute__((packed));
+
+struct elf64_phdr{
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+}__attribute__((packed));
+
+enum elf_status{
+    ELF_OK,
+    ELF_ERR_HEADER,         // Not an x86-64 ELF64 executable
+    ELF_ERR_TRUNCATED,      // Headers or segment data past the end of the image
+    ELF_ERR_RANGE,          // Segment or entry point outside user space
+    ELF_ERR_OVERLAP,        // Two segments share a page
+};
+
+struct elf_load_info{
+    uint64_t entry;
+    uint64_t stack_top;
+    uint32_t pages_shared;  // Mapped from the image
+    uint32_t pages_copied;  // Private copies, .bss and stack
+};
+
+enum elf_status elf_load(struct vmm_space* space, uint64_t image_phys, uint64_t image_size, struct elf_load_info* info);
+const char* elf_status_str(enum elf_status status);
+
+#endif
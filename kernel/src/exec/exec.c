@@ -0,0 +1,254 @@
+#include "exec.h"
+
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+#include "syscall/syscall.h"
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "debugging/kprint.h"
+
+struct exec_process{
+    bool in_use;
+    const char* name;
+    struct vmm_space* space;
+    struct elf_load_info info;
+};
+
+DEFINE_SPINLOCK(_exec_pool_lock, "exec_pool");
+static struct exec_process _exec_processes[EXEC_MAX_PROCESSES];
+
+
+static struct exec_process* _exec_process_alloc(){
+    uint64_t rflags = spin_lock_irqsave(&_exec_pool_lock);
+    struct exec_process* process = NULL;
+    for(int i=0; i<EXEC_MAX_PROCESSES; i++){
+        if(!_exec_processes[i].in_use){
+            process = &_exec_processes[i];
+            *process = (struct exec_process){0};
+            process->in_use = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&_exec_pool_lock, rflags);
+    return process;
+}
+
+static void _exec_process_free(struct exec_process* process){
+    if(process->space != NULL){
+        vmm_space_destroy(process->space);
+    }
+    uint64_t rflags = spin_lock_irqsave(&_exec_pool_lock);
+    process->in_use = false;
+    spin_unlock_irqrestore(&_exec_pool_lock, rflags);
+}
+
+
+static void _exec_thread(void* arg){
+    struct exec_process* process = (struct exec_process*)arg;
+    uint64_t code = usermode_enter(process->info.entry, process->info.stack_top, 0, 0);
+    kprintf("exec: %s exited with %ld\n", process->name, (int64_t)code);
+
+    // Back to the kernel's address space before this one goes away
+    uint64_t rflags = cpu_irq_save();
+    sched_current()->space = NULL;
+    vmm_space_switch(&g_vmm_kernel_space);
+    cpu_irq_restore(rflags);
+    _exec_process_free(process);
+}
+
+
+/*
+    Page faults. Writes to copy-on-write pages of the current space get their page, anything else
+    user code does wrong ends the program. Faults the kernel causes itself still panic.
+*/
+static void _exec_page_fault(struct interrupt_frame* frame){
+    uint64_t addr = cpu_read_cr2();
+    struct thread* thread = sched_current();
+    struct vmm_space* space = (thread != NULL)? thread->space : NULL;
+
+    uint64_t cow_fault = VMM_FAULT_PRESENT | VMM_FAULT_WRITE;
+    if(space != NULL && addr < VMM_USER_TOP && (frame->error_code & cow_fault) == cow_fault){
+        if(vmm_space_cow_fault(space, addr)){
+            return;
+        }
+    }
+
+    if((frame->cs & 3) == 3){
+        kprintf("exec: %s: page fault at 0x%lx (err=0x%lx) rip=0x%lx, killed\n",
+                thread->name, addr, frame->error_code, frame->rip);
+        usermode_terminate(-SYSCALL_EFAULT);
+    }
+    interrupt_unhandled_exception(frame);
+}
+
+void exec_init(){
+    interrupt_register_handler(INTERRUPT_VECTOR_PAGE_FAULT, _exec_page_fault);
+}
+
+
+/*
+    Hand a process with its space loaded to a new thread on this CPU
+*/
+static struct thread* _exec_start(struct exec_process* process, int priority){
+    // The space must be set before the thread can first be switched in
+    uint64_t rflags = cpu_irq_save();
+    struct thread* thread = sched_thread_create(process->name, _exec_thread, process, priority);
+    if(thread != NULL){
+        thread->space = process->space;
+    }
+    cpu_irq_restore(rflags);
+    if(thread == NULL){
+        kprintf("exec: %s: thread pool exhausted\n", process->name);
+        _exec_process_free(process);
+    }
+    return thread;
+}
+
+static struct exec_process* _exec_process_create(const char* name){
+    struct exec_process* process = _exec_process_alloc();
+    if(process == NULL){
+        kprintf("exec: %s: process table full\n", name);
+        return NULL;
+    }
+    process->name = name;
+    return process;
+}
+
+static bool _exec_load(const char* name, uint64_t image_phys, uint64_t image_size,
+                       struct vmm_space** space, struct elf_load_info* info){
+    *space = vmm_space_create();
+    if(*space == NULL){
+        kprintf("exec: %s: out of address spaces\n", name);
+        return false;
+    }
+
+    uint64_t start = cpu_rdtsc();
+    enum elf_status status = elf_load(*space, image_phys, image_size, info);
+    uint64_t cycles = cpu_rdtsc() - start;
+    if(status != ELF_OK){
+        kprintf("exec: %s: %s\n", name, elf_status_str(status));
+        vmm_space_destroy(*space);
+        *space = NULL;
+        return false;
+    }
+    kprintf("exec: %s loaded in %lu cycles, %u pages mapped from the image, %u copied, entry 0x%lx\n",
+            name, cycles, info->pages_shared, info->pages_copied, info->entry);
+    return true;
+}
+
+
+/*
+    Load the executable at image_phys (direct mapped) into a new address space and start a thread
+    running it on this CPU. Returns NULL, after saying why, if it can't be loaded.
+*/
+struct thread* exec_spawn(const char* name, uint64_t image_phys, uint64_t image_size, int priority){
+    struct exec_process* process = _exec_process_create(name);
+    if(process == NULL){
+        return NULL;
+    }
+    if(!_exec_load(name, image_phys, image_size, &process->space, &process->info)){
+        _exec_process_free(process);
+        return NULL;
+    }
+    return _exec_start(process, priority);
+}
+
+
+/*
+    Templates. Loading one is an exec_spawn() without the thread, spawning from it clones its space.
+*/
+bool exec_template_load(struct exec_template* tmpl, const char* name, uint64_t image_phys, uint64_t image_size){
+    *tmpl = (struct exec_template){0};
+    tmpl->name = name;
+    return _exec_load(name, image_phys, image_size, &tmpl->space, &tmpl->info);
+}
+
+struct thread* exec_spawn_template(const struct exec_template* tmpl, int priority){
+    struct exec_process* process = _exec_process_create(tmpl->name);
+    if(process == NULL){
+        return NULL;
+    }
+    process->space = vmm_space_clone(tmpl->space);
+    if(process->space == NULL){
+        kprintf("exec: %s: out of address spaces\n", tmpl->name);
+        _exec_process_free(process);
+        return NULL;
+    }
+    process->info = tmpl->info;
+    return _exec_start(process, priority);
+}
+
+/*
+    Processes spawned from the template keep their references to its pages, it can go at any time
+*/
+void exec_template_destroy(struct exec_template* tmpl){
+    if(tmpl->space != NULL){
+        vmm_space_destroy(tmpl->space);
+        tmpl->space = NULL;
+    }
+}
+
+
+static void _exec_bench_destroy(struct vmm_space** spaces, int n){
+    for(int i=0; i<n; i++){
+        if(spaces[i] != NULL){
+            vmm_space_destroy(spaces[i]);
+        }
+    }
+}
+
+/*
+    Fresh loads vs copy-on-write clones of a loaded template: cycles, and pages taken from the PMM,
+    per address space. Then a few processes from the template, whose writes go through COW faults.
+*/
+void exec_bench(const char* name, uint64_t image_phys, uint64_t image_size){
+    struct vmm_space* spaces[EXEC_BENCH_ROUNDS];
+    struct elf_load_info info;
+
+    uint64_t free_before = g_pmm_stats.free_pages;
+    uint64_t start = cpu_rdtsc();
+    for(int i=0; i<EXEC_BENCH_ROUNDS; i++){
+        spaces[i] = vmm_space_create();
+        if(spaces[i] == NULL || elf_load(spaces[i], image_phys, image_size, &info) != ELF_OK){
+            kprintf("exec bench: %s: load failed\n", name);
+            _exec_bench_destroy(spaces, i + 1);
+            return;
+        }
+    }
+    uint64_t load_cycles = (cpu_rdtsc() - start) / EXEC_BENCH_ROUNDS;
+    uint64_t load_pages = (free_before - g_pmm_stats.free_pages) / EXEC_BENCH_ROUNDS;
+    _exec_bench_destroy(spaces, EXEC_BENCH_ROUNDS);
+
+    struct exec_template tmpl;
+    if(!exec_template_load(&tmpl, name, image_phys, image_size)){
+        return;
+    }
+    struct vmm_cow_stats cow_before = g_vmm_cow_stats;
+    free_before = g_pmm_stats.free_pages;
+    start = cpu_rdtsc();
+    for(int i=0; i<EXEC_BENCH_ROUNDS; i++){
+        spaces[i] = vmm_space_clone(tmpl.space);
+        if(spaces[i] == NULL){
+            kprintf("exec bench: %s: clone failed\n", name);
+            _exec_bench_destroy(spaces, i);
+            exec_template_destroy(&tmpl);
+            return;
+        }
+    }
+    uint64_t clone_cycles = (cpu_rdtsc() - start) / EXEC_BENCH_ROUNDS;
+    uint64_t clone_pages = (free_before - g_pmm_stats.free_pages) / EXEC_BENCH_ROUNDS;
+    _exec_bench_destroy(spaces, EXEC_BENCH_ROUNDS);
+
+    kprintf("exec bench: %s fresh load %lu cycles (%lu ns) %lu pages, COW clone %lu cycles (%lu ns) %lu pages\n",
+            name, load_cycles, tsc_cycles_to_ns(load_cycles), load_pages,
+            clone_cycles, tsc_cycles_to_ns(clone_cycles), clone_pages);
+    kprintf("exec bench: per clone %lu pages shared, %lu tables copied\n",
+            (g_vmm_cow_stats.pages_shared - cow_before.pages_shared) / EXEC_BENCH_ROUNDS,
+            (g_vmm_cow_stats.tables_copied - cow_before.tables_copied) / EXEC_BENCH_ROUNDS);
+
+    for(int i=0; i<3; i++){
+        exec_spawn_template(&tmpl, SCHED_PRIORITY_NORMAL);
+    }
+    exec_template_destroy(&tmpl);
+}
@@ -0,0 +1,39 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sched/sched.h"
+#include "exec/elf.h"
+
+/*
+    User processes: an executable loaded into a fresh address space (elf.h), run by a kernel thread
+    that drops into it with usermode_enter(). The thread's space is loaded whenever it is switched
+    in. When the program exits the address space is destroyed and the thread ends.
+*/
+#define EXEC_MAX_PROCESSES  32
+#define EXEC_BENCH_ROUNDS   16
+
+/*
+    A loaded executable that never runs itself. Every process spawned from it starts as a
+    copy-on-write clone of its space (vmm_space_clone()), so it costs the page tables, and the
+    pages it writes to, instead of a full load.
+*/
+struct exec_template{
+    const char* name;
+    struct vmm_space* space;
+    struct elf_load_info info;
+};
+
+void exec_init();
+struct thread* exec_spawn(const char* name, uint64_t image_phys, uint64_t image_size, int priority);
+
+bool exec_template_load(struct exec_template* tmpl, const char* name, uint64_t image_phys, uint64_t image_size);
+struct thread* exec_spawn_template(const struct exec_template* tmpl, int priority);
+void exec_template_destroy(struct exec_template* tmpl);
+
+void exec_bench(const char* name, uint64_t image_phys, uint64_t image_size);
+
+#endif
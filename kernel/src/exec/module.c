@@ -0,0 +1,62 @@
+#include "module.h"
+
+#include "constants.h"
+#include "memory/physmap.h"
+#include "memory/vmm.h"
+#include "util/kstring.h"
+#include "debugging/kprint.h"
+
+static struct boot_module _modules[MODULE_MAX];
+static uint32_t _module_count = 0;
+
+
+/*
+    Copy the module list out of the response. Must run before vmm_setup() switches away from
+    Limine's page tables, the response and the paths in it are only reachable through its HHDM.
+*/
+void module_capture_limine(const struct limine_module_response* response){
+    for(uint64_t i=0; i<response->module_count && _module_count<MODULE_MAX; i++){
+        struct limine_file* file = response->modules[i];
+        struct boot_module* module = &_modules[_module_count++];
+        size_t len = 0;
+        while(file->path[len] != '\0' && len < MODULE_PATH_MAX-1){
+            module->path[len] = file->path[len];
+            len++;
+        }
+        module->path[len] = '\0';
+        module->phys = translateaddr_idmap_v2p_limine((uint64_t)file->address);
+        module->size = file->size;
+    }
+}
+
+// Direct map every module, after vmm_setup()
+void module_map(){
+    for(uint32_t i=0; i<_module_count; i++){
+        uint64_t first_page = _modules[i].phys & ~(uint64_t)(PAGE_SIZE-1);
+        uint64_t end = _modules[i].phys + _modules[i].size;
+        int n_pages = (end - first_page + PAGE_SIZE-1) / PAGE_SIZE;
+        vmm_identity_map_n_pages(first_page, n_pages, VMM_FLAG_PRESENT | VMM_FLAG_NO_EXECUTE);
+        kprintf("Module %s: %lu bytes at 0x%lx\n", _modules[i].path, _modules[i].size, _modules[i].phys);
+    }
+}
+
+uint32_t module_count(){
+    return _module_count;
+}
+
+const struct boot_module* module_get(uint32_t i){
+    return (i < _module_count)? &_modules[i] : NULL;
+}
+
+const struct boot_module* module_find(const char* path){
+    for(uint32_t i=0; i<_module_count; i++){
+        if(kstrcmp(_modules[i].path, path) == 0){
+            return &_modules[i];
+        }
+    }
+    return NULL;
+}
+
+const uint8_t* module_data(const struct boot_module* module){
+    return (const uint8_t*)translateaddr_idmap_p2v(module->phys);
+}
@@ -0,0 +1,33 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "third-party/limine.h"
+
+/*
+    Files Limine loaded next to the kernel (module_path in limine.conf).
+
+    Limine puts them in KERNEL_AND_MODULES memory, which the PMM never hands out, so they stay
+    where they are for good: module_map() direct maps them once and the contents are read
+    (or mapped into address spaces) in place, never copied.
+*/
+#define MODULE_MAX          16
+#define MODULE_PATH_MAX     64
+
+struct boot_module{
+    char path[MODULE_PATH_MAX];
+    uint64_t phys;
+    uint64_t size;
+};
+
+void module_capture_limine(const struct limine_module_response* response);
+void module_map();
+uint32_t module_count();
+const struct boot_module* module_get(uint32_t i);
+const struct boot_module* module_find(const char* path);
+const uint8_t* module_data(const struct boot_module* module);
+
+#endif
@@ -0,0 +1,230 @@
+#include "initramfs.h"
+
+#include "memory/physmap.h"
+#include "util/checksum.h"
+#include "util/kformat.h"
+#include "util/kstring.h"
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "debugging/kprint.h"
+
+#define USTAR_BLOCK_SIZE    512
+#define USTAR_TYPE_FILE     '0'
+#define USTAR_TYPE_FILE_OLD '\0'
+#define USTAR_TYPE_DIR      '5'
+
+struct ustar_header{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];          // "ustar\0" (POSIX) or "ustar " (GNU)
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+}__attribute__((packed));
+
+_Static_assert(sizeof(struct ustar_header) == USTAR_BLOCK_SIZE, "USTAR header is one block");
+
+static struct initramfs_file _files[INITRAMFS_MAX_FILES];
+static uint32_t _file_count = 0;
+static uint16_t _index[INITRAMFS_HASH_SLOTS];  // File number + 1, 0 for an empty slot
+static char _paths[INITRAMFS_PATH_POOL];
+static size_t _paths_used = 0;
+
+
+// Octal header field, ends at the first NUL or space
+static uint64_t _ustar_octal(const char* field, size_t len){
+    uint64_t value = 0;
+    for(size_t i=0; i<len && field[i]>='0' && field[i]<='7'; i++){
+        value = value*8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static bool _ustar_header_ok(const struct ustar_header* header){
+    if(memcmp(header->magic, "ustar", 5) != 0){
+        return false;
+    }
+    // Checksum: sum of the header bytes, with the checksum field itself counted as spaces
+    const uint8_t* bytes = (const uint8_t*)header;
+    uint64_t sum = 0;
+    for(size_t i=0; i<USTAR_BLOCK_SIZE; i++){
+        bool in_checksum = i >= offsetof(struct ustar_header, checksum) && i < offsetof(struct ustar_header, checksum) + sizeof(header->checksum);
+        sum += in_checksum? ' ' : bytes[i];
+    }
+    return sum == _ustar_octal(header->checksum, sizeof(header->checksum));
+}
+
+
+static size_t _ustar_field_len(const char* field, size_t max){
+    size_t len = 0;
+    while(len < max && field[len] != '\0'){
+        len++;
+    }
+    return len;
+}
+
+static bool _path_append(const char* str, size_t len){
+    if(_paths_used + len >= INITRAMFS_PATH_POOL){
+        return false;
+    }
+    memcpy(&_paths[_paths_used], str, len);
+    _paths_used += len;
+    return true;
+}
+
+/*
+    "/" + prefix + "/" + name into the path pool, without "./", leading or trailing slashes.
+    NULL when the pool is full.
+*/
+static const char* _initramfs_store_path(const struct ustar_header* header, size_t* out_len){
+    const char* name = header->name;
+    size_t name_len = _ustar_field_len(header->name, sizeof(header->name));
+    const char* prefix = header->prefix;
+    size_t prefix_len = _ustar_field_len(header->prefix, sizeof(header->prefix));
+    if(prefix_len == 0){
+        prefix = name;
+        prefix_len = name_len;
+        name_len = 0;
+    }
+    while(prefix_len > 0 && (prefix[0] == '/' || prefix[0] == '.')){
+        if(prefix[0] == '.' && !(prefix_len > 1 && prefix[1] == '/')){
+            break;      // A dot file, not "./"
+        }
+        prefix++;
+        prefix_len--;
+    }
+
+    const char* start = &_paths[_paths_used];
+    bool ok = _path_append("/", 1) && _path_append(prefix, prefix_len);
+    if(name_len > 0){
+        ok = ok && _path_append("/", 1) && _path_append(name, name_len);
+    }
+    if(!ok){
+        return NULL;
+    }
+    while(_paths_used - (start - _paths) > 1 && _paths[_paths_used-1] == '/'){
+        _paths_used--;
+    }
+    _paths[_paths_used++] = '\0';
+    *out_len = _paths_used - (start - _paths) - 1;
+    return start;
+}
+
+
+// Index a file, a later entry for the same path replaces the earlier one (like extracting the archive)
+static void _initramfs_index(uint32_t file_number){
+    struct initramfs_file* file = &_files[file_number];
+    uint32_t slot = file->hash & (INITRAMFS_HASH_SLOTS - 1);
+    while(_index[slot] != 0){
+        struct initramfs_file* other = &_files[_index[slot] - 1];
+        if(other->hash == file->hash && kstrcmp(other->path, file->path) == 0){
+            *other = *file;
+            _file_count--;
+            return;
+        }
+        slot = (slot + 1) & (INITRAMFS_HASH_SLOTS - 1);
+    }
+    _index[slot] = file_number + 1;
+}
+
+
+/*
+    Walk the archive and build the index. The module must be direct mapped (module_map()).
+    Returns false if it isn't a USTAR archive, stops indexing (and says so) once a table is full.
+*/
+bool initramfs_init(const struct boot_module* module){
+    uint64_t start_tsc = cpu_rdtsc();
+    const uint8_t* archive = module_data(module);
+    uint64_t offset = 0;
+    uint64_t skipped = 0;
+    while(offset + USTAR_BLOCK_SIZE <= module->size){
+        const struct ustar_header* header = (const struct ustar_header*)(archive + offset);
+        if(header->name[0] == '\0'){
+            break;      // End of archive: zero blocks
+        }
+        if(!_ustar_header_ok(header)){
+            kprintf("initramfs: bad header at offset 0x%lx\n", offset);
+            return _file_count > 0;
+        }
+        uint64_t size = _ustar_octal(header->size, sizeof(header->size));
+        uint64_t data_offset = offset + USTAR_BLOCK_SIZE;
+        if(size > module->size - data_offset){
+            kprintf("initramfs: %.100s is truncated\n", header->name);
+            return _file_count > 0;
+        }
+        offset = data_offset + ((size + USTAR_BLOCK_SIZE-1) & ~(uint64_t)(USTAR_BLOCK_SIZE-1));
+
+        bool is_dir = header->typeflag == USTAR_TYPE_DIR;
+        if(!is_dir && header->typeflag != USTAR_TYPE_FILE && header->typeflag != USTAR_TYPE_FILE_OLD){
+            skipped++;  // Links, devices, pax headers
+            continue;
+        }
+        if(_file_count == INITRAMFS_MAX_FILES){
+            kprintf("initramfs: more than %u files, the rest are left out\n", INITRAMFS_MAX_FILES);
+            break;
+        }
+        size_t saved_paths_used = _paths_used;
+        size_t path_len;
+        const char* path = _initramfs_store_path(header, &path_len);
+        if(path == NULL){
+            kprintf("initramfs: path pool full, the rest is left out\n");
+            break;
+        }
+        if(memcmp(path, INITRAMFS_PAD_DIR, sizeof(INITRAMFS_PAD_DIR)-1) == 0 || kstrcmp(path, "/.pad") == 0){
+            _paths_used = saved_paths_used;
+            continue;
+        }
+
+        uint32_t file_number = _file_count++;
+        _files[file_number] = (struct initramfs_file){
+            .path = path,
+            .phys = module->phys + data_offset,
+            .size = is_dir? 0 : size,
+            .hash = fnv1a32(path, path_len),
+            .is_dir = is_dir,
+        };
+        _initramfs_index(file_number);
+    }
+
+    uint64_t ns = tsc_cycles_to_ns(cpu_rdtsc() - start_tsc);
+    kprintf("initramfs: %u files indexed in %lu us (%lu entries skipped), %lu KiB archive\n",
+            _file_count, ns / 1000, skipped, module->size / 1024);
+    return true;
+}
+
+
+const struct initramfs_file* initramfs_find(const char* path){
+    uint32_t hash = fnv1a32(path, kstrlen(path));
+    uint32_t slot = hash & (INITRAMFS_HASH_SLOTS - 1);
+    while(_index[slot] != 0){
+        const struct initramfs_file* file = &_files[_index[slot] - 1];
+        if(file->hash == hash && kstrcmp(file->path, path) == 0){
+            return file;
+        }
+        slot = (slot + 1) & (INITRAMFS_HASH_SLOTS - 1);
+    }
+    return NULL;
+}
+
+const uint8_t* initramfs_data(const struct initramfs_file* file){
+    return (const uint8_t*)translateaddr_idmap_p2v(file->phys);
+}
+
+uint32_t initramfs_count(){
+    return _file_count;
+}
+
+const struct initramfs_file* initramfs_get(uint32_t i){
+    return (i < _file_count)? &_files[i] : NULL;
+}
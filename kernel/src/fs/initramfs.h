@@ -0,0 +1,42 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "exec/module.h"
+
+/*
+    Read-only filesystem from a USTAR archive loaded as a boot module (/boot/initramfs.tar,
+    built by tools/mkinitramfs.py).
+
+    initramfs_init() walks the archive once and builds a directory table with an open addressed
+    hash index (FNV-1a of the path, linear probing), so a lookup costs a hash and usually one
+    compare, however many files there are. Nothing is copied: file contents are read in place from
+    the module's pages through the direct map, and a page aligned file can be mapped straight
+    into an address space (mkinitramfs.py page aligns every file, see INITRAMFS_PAD_DIR).
+
+    Paths are absolute, "/fonts/zap-vga09.psf". The archive's "./" or "/" prefixes are dropped.
+*/
+#define INITRAMFS_MODULE_PATH   "/boot/initramfs.tar"
+#define INITRAMFS_MAX_FILES     256
+#define INITRAMFS_HASH_SLOTS    512     // Power of two, at least twice INITRAMFS_MAX_FILES
+#define INITRAMFS_PATH_POOL     16384   // Bytes for all the paths
+#define INITRAMFS_PAD_DIR       "/.pad/"    // Alignment padding entries, not indexed
+
+struct initramfs_file{
+    const char* path;
+    uint64_t phys;      // Contents, inside the module
+    uint64_t size;
+    uint32_t hash;
+    bool is_dir;
+};
+
+bool initramfs_init(const struct boot_module* module);
+const struct initramfs_file* initramfs_find(const char* path);
+const uint8_t* initramfs_data(const struct initramfs_file* file);
+uint32_t initramfs_count();
+const struct initramfs_file* initramfs_get(uint32_t i);
+
+#endif
@@ -1,13 +1,40 @@
 #include "graphics.h"
 
+static const psf1_header* _graphics_font = NULL;
+static int _graphics_font_glyphs = 0;
+
+/*
+    Use the PSF1 font at psf (size bytes), which must stay mapped. Rejected, keeping the current
+    font, unless the magic is right and every glyph is there.
+*/
+bool graphics_set_font(const uint8_t* psf, size_t size){
+    const psf1_header* header = (const psf1_header*)psf;
+    if(size < sizeof(psf1_header) || header->magic[0] != PSF1_MAGIC0 || header->magic[1] != PSF1_MAGIC1 || header->charsize == 0){
+        return false;
+    }
+    int glyphs = (header->mode & PSF1_MODE512)? 512 : 256;
+    if(size < sizeof(psf1_header) + (size_t)glyphs*header->charsize){
+        return false;
+    }
+    _graphics_font = header;
+    _graphics_font_glyphs = glyphs;
+    return true;
+}
+
+const psf1_header* graphics_font(){
+    return _graphics_font;
+}
+
 void serial_dump_psf_info(){
     writestr_debug_serial("INFO: Dumping PSF information...\n");
-    writestr_debug_serial(" _binary_zap_vga09_psf_start: 0x");
-    writeuint_debug_serial((uint64_t)&_binary_zap_vga09_psf_start, 16);
-    writestr_debug_serial("\n _binary_zap_vga09_psf_end: 0x");
-    writeuint_debug_serial((uint64_t)&_binary_zap_vga09_psf_end, 16);
+    psf1_header* psf = (psf1_header*)_graphics_font;
+    if(psf == NULL){
+        writestr_debug_serial(" No font loaded\n");
+        return;
+    }
+    writestr_debug_serial(" Font: 0x");
+    writeuint_debug_serial((uint64_t)psf, 16);
     writestr_debug_serial("\n");
-    psf1_header* psf = (psf1_header*)&_binary_zap_vga09_psf_start;
     if(psf->magic[0] == PSF1_MAGIC0 && psf->magic[1] == PSF1_MAGIC1){
         writestr_debug_serial(" PSF1 Magic: Valid (0x36, 0x04)\n");
     }else{
@@ -28,8 +55,11 @@ void draw_psf_char(const struct limine_framebuffer* framebuffer, int row_offset,
     /*
         Set up the pointers required to draw a character
     */
-    psf1_header* header = (psf1_header*)&_binary_zap_vga09_psf_start;
-    uint8_t* char_start = (uint8_t*)&_binary_zap_vga09_psf_start + 4 + (char_idx*9);
+    const psf1_header* header = _graphics_font;
+    if(header == NULL || char_idx < 0 || char_idx >= _graphics_font_glyphs){
+        return;
+    }
+    const uint8_t* char_start = (const uint8_t*)header + sizeof(psf1_header) + (char_idx*header->charsize);
 
     /*
         Column offset changes with different BPP values
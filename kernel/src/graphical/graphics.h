@@ -1,6 +1,10 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "third-party/limine.h" // For limine framebuffer info struct
 #include "debugging/serialout.h"
 
@@ -23,9 +27,14 @@ typedef struct {
 } psf1_header;
 
 
-extern uint64_t _binary_zap_vga09_psf_start;
-extern uint64_t _binary_zap_vga09_psf_end;
+/*
+    Console font, PSF1 with 8 pixel wide glyphs. It comes from the initramfs, so it can be swapped
+    without relinking: nothing is drawn until graphics_set_font() has accepted one.
+*/
+#define GRAPHICS_FONT_PATH  "/fonts/zap-vga09.psf"
 
+bool graphics_set_font(const uint8_t* psf, size_t size);
+const psf1_header* graphics_font();
 void serial_dump_psf_info();
 void draw_psf_char(const struct limine_framebuffer* framebuffer, int row_offset, int col_offset, int char_idx);
 void draw_psf_str(const struct limine_framebuffer* framebuffer, int row_offset, int col_offset, const char* str);
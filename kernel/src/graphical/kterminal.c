@@ -1,19 +1,37 @@
 #include "kterminal.h"
 
+#include "debugging/kbench.h"
+
 int G_KTERM_CROW = 0;
+int G_KTERM_CCOL = 0;
 int G_KTERM_MAXROW = 0;
 int G_KTERM_MAXCOL = 0;
 struct limine_framebuffer* G_KTERM_FRAMEBUFF = NULL;
 
+// Protects the cursor (G_KTERM_CROW/G_KTERM_CCOL) and the framebuffer contents
+DEFINE_SPINLOCK(_kterm_lock, "kterm");
+
+const struct kprint_sink g_kterm_sink = {
+    .name = "kterm",
+    .write = kterm_write
+};
+
+/*
+    Without a font (graphics_set_font()) the terminal stays off, and writes to it are dropped.
+*/
 void kterm_init(struct limine_framebuffer* framebuffer){
+    const psf1_header* psf_info = graphics_font();
+    if(psf_info == NULL){
+        G_KTERM_FRAMEBUFF = NULL;
+        return;
+    }
     G_KTERM_FRAMEBUFF = framebuffer;
 
     /*
         Figure out the maximum number of rows we can put on the screen
     */
-    psf1_header* psf_info = (psf1_header*)&_binary_zap_vga09_psf_start;
-    G_KTERM_MAXROW = G_KTERM_FRAMEBUFF->height / psf_info->charsize + 1;
-    G_KTERM_MAXCOL = G_KTERM_FRAMEBUFF->width / 9;
+    G_KTERM_MAXROW = G_KTERM_FRAMEBUFF->height / (psf_info->charsize + 1);
+    G_KTERM_MAXCOL = G_KTERM_FRAMEBUFF->width / KTERM_CHAR_WIDTH;
 }
 
 
@@ -28,85 +46,66 @@ void kterm_scroll_check(){
     }
 }
 
-void kterm_write_newline(const char* str){
-    /*
-        TODO handle strings that wont fit onto one line
-    */
-    draw_psf_str(G_KTERM_FRAMEBUFF, G_KTERM_CROW*(((psf1_header*)&_binary_zap_vga09_psf_start)->charsize+1), 0, str);
+static void _kterm_newline(){
+    G_KTERM_CCOL = 0;
     G_KTERM_CROW++;
     kterm_scroll_check();
 }
 
-
-int kterm_printuint(int col, uint64_t uint_to_write, int base){
-    if(uint_to_write == 0){
-        draw_psf_char(G_KTERM_FRAMEBUFF, G_KTERM_CROW*(((psf1_header*)&_binary_zap_vga09_psf_start)->charsize+1), col*8, '0');
-        return col++;
+/*
+    Write a buffer at the current cursor position.
+    '\n' moves to the next row, lines that are too long wrap onto the next row.
+*/
+static void _kterm_write_locked(const char* buf, size_t len){
+    int row_height = graphics_font()->charsize+1;
+    for(size_t i=0; i<len; i++){
+        if(buf[i] == '\n'){
+            _kterm_newline();
+            continue;
+        }
+        if(G_KTERM_CCOL >= G_KTERM_MAXCOL){
+            _kterm_newline();
+        }
+        draw_psf_char(G_KTERM_FRAMEBUFF, G_KTERM_CROW*row_height, G_KTERM_CCOL*KTERM_CHAR_WIDTH, (unsigned char)buf[i]);
+        G_KTERM_CCOL++;
     }
+}
 
-    char str[65];
-    int str_idx = 0;
-    while(uint_to_write != 0){
-        int r = uint_to_write % base;
-        str[str_idx++] = (r>9)? (r-10)+'a' : r + '0';
-        uint_to_write = uint_to_write / base;
+void kterm_write(const char* buf, size_t len){
+    if(G_KTERM_FRAMEBUFF == NULL){
+        return;
     }
+    uint64_t rflags = spin_lock_irqsave(&_kterm_lock);
+    _kterm_write_locked(buf, len);
+    spin_unlock_irqrestore(&_kterm_lock, rflags);
+}
 
-    for(int i=str_idx-1; i>=0; i--){
-        draw_psf_char(G_KTERM_FRAMEBUFF, G_KTERM_CROW*(((psf1_header*)&_binary_zap_vga09_psf_start)->charsize+1), col*8, str[i]);
-        col++;
+void kterm_write_newline(const char* str){
+    if(G_KTERM_FRAMEBUFF == NULL){
+        return;
     }
-
-    return col-1;
+    uint64_t rflags = spin_lock_irqsave(&_kterm_lock);
+    _kterm_write_locked(str, kstrlen(str));
+    _kterm_newline();
+    spin_unlock_irqrestore(&_kterm_lock, rflags);
 }
 
-
-/*
-    %u = uint32 b10
-    %x = uint32 hex
-*/
 void kterm_printf_newline(const char* fmt, ...){
-    int col = 0;
+    char buf[KPRINT_BUF_SIZE];
     va_list args;
     va_start(args, fmt);
-    for(int i=0; fmt[i]!='\0'; i++){
-        if(fmt[i] == '%'){
-            i++;
-            switch(fmt[i]){
-                case 'u':
-                {
-                    col = kterm_printuint(col, va_arg(args, uint64_t), 10);
-                    break;
-                }
-                case 'x':
-                {
-                    col = kterm_printuint(col, va_arg(args, uint64_t), 16);
-                    break;
-                }
-                case 's':
-                {   
-                    int si = 0;
-                    const char* sstr = va_arg(args, const char*);
-                    while(sstr[si] != 0){
-                        draw_psf_char(G_KTERM_FRAMEBUFF, G_KTERM_CROW*(((psf1_header*)&_binary_zap_vga09_psf_start)->charsize+1), col*8, sstr[si]);
-                        si++;
-                        col++;
-                    }
-                    col--;
-                    break;
-                }
-            }
-        }else{
-            /*
-                TODO handle strings that wont fit onto one line
-            */
-            draw_psf_char(G_KTERM_FRAMEBUFF, G_KTERM_CROW*(((psf1_header*)&_binary_zap_vga09_psf_start)->charsize+1), col*8, fmt[i]);
-        }
-        col++;
-    }
+    int len = kvsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
-    G_KTERM_CROW++;
-    kterm_scroll_check();
+    if(len > (int)sizeof(buf)-1){
+        len = sizeof(buf)-1;
+    }
+    if(G_KTERM_FRAMEBUFF == NULL){
+        return;
+    }
+    uint64_t rflags = spin_lock_irqsave(&_kterm_lock);
+    _kterm_write_locked(buf, len);
+    _kterm_newline();
+    spin_unlock_irqrestore(&_kterm_lock, rflags);
 }
 
 
@@ -123,4 +122,13 @@ void kterm_clear(){
         *(uint32_t*)(framebuffer) = colour_black;
         framebuffer += 4;
     }
-}
\ No newline at end of file
+}
+
+
+// One glyph in the top left cell, straight to the framebuffer like _kterm_write_locked()
+static void _kterm_bench_glyph(void* arg){
+    (void)arg;
+    draw_psf_char(G_KTERM_FRAMEBUFF, 0, 0, 'M');
+}
+
+KBENCH(glyph_draw, .fn = _kterm_bench_glyph);
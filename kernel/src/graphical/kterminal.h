@@ -5,12 +5,18 @@
 
 #include "third-party/limine.h"
 #include "graphics.h"
+#include "debugging/kprint.h"
+#include "sync/spinlock.h"
+
+#define KTERM_CHAR_WIDTH 9 // 8px glyph + 1px gap, matches draw_psf_str
+
+extern const struct kprint_sink g_kterm_sink;
 
 void kterm_init(struct limine_framebuffer* framebuffer);
-int kterm_printuint(int col, uint64_t uint_to_write, int base);
-void kterm_printf_newline(const char* fmt, ...);
+void kterm_write(const char* buf, size_t len);
+void kterm_printf_newline(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 void kterm_write_newline(const char* str);
 void kterm_clear();
 void kterm_set_framebuff_addr(uint64_t* framebuffer_addr);
 
-#endif
\ No newline at end of file
+#endif
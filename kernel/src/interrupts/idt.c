@@ -0,0 +1,183 @@
+#include "idt.h"
+
+#include "util/cpu.h"
+#include "memory/gdt.h"
+#include "interrupts/pic.h"
+#include "sched/sched.h"
+#include "debugging/kprint.h"
+#include "debugging/panic.h"
+
+__attribute__((aligned(16)))
+static struct idt_entry _idt_entries[IDT_SIZE];
+static struct idt_pointer _idt_pointer;
+
+/*
+    Dispatch table, indexed by vector. NULL means unhandled.
+*/
+static interrupt_handler_t _interrupt_handlers[IDT_SIZE] = {0};
+
+__attribute__((aligned(CACHE_LINE_SIZE)))
+struct interrupt_vector_stats g_interrupt_stats[KERNEL_MAX_CPUS][IDT_SIZE] = {0};
+
+// NMIs nobody registered for, per CPU. Only reported by interrupt_stats_dump(): printing from
+// NMI context could deadlock on a lock the interrupted code holds
+static uint64_t _interrupt_spurious_nmis[KERNEL_MAX_CPUS] = {0};
+
+static const char* _interrupt_exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound range exceeded",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor segment overrun",
+    "Invalid TSS", "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating point", "Alignment check", "Machine check",
+    "SIMD floating point", "Virtualisation", "Control protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Hypervisor injection",
+    "VMM communication", "Security", "Reserved"
+};
+
+
+void idt_set_gate(uint8_t vector, uint64_t handler_addr, uint8_t type_attr, uint8_t ist){
+    struct idt_entry* entry = &_idt_entries[vector];
+    entry->offset_low = handler_addr & 0xFFFF;
+    entry->selector = KERNEL_CODE_SELECTOR;
+    entry->ist = ist & 0x7;
+    entry->type_attr = type_attr;
+    entry->offset_mid = (handler_addr >> 16) & 0xFFFF;
+    entry->offset_high = handler_addr >> 32;
+    entry->reserved = 0;
+}
+
+
+void idt_load(){
+    asm volatile("lidt %0" :: "m"(_idt_pointer));
+}
+
+
+/*
+    Point every vector at its entry stub and load the IDT.
+    Also remaps the legacy PIC (all lines masked) so ISA IRQs can't collide with exceptions.
+*/
+void idt_setup(){
+    for(int i=0; i<IDT_SIZE; i++){
+        idt_set_gate(i, isr_stub_table[i], IDT_GATE_INTERRUPT, 0);
+    }
+    // On their own stacks (memory/gdt.h), entered through isr_paranoid
+    idt_set_gate(INTERRUPT_VECTOR_NMI, isr_stub_table[INTERRUPT_VECTOR_NMI], IDT_GATE_INTERRUPT, GDT_IST_NMI);
+    idt_set_gate(INTERRUPT_VECTOR_DOUBLE_FAULT, isr_stub_table[INTERRUPT_VECTOR_DOUBLE_FAULT], IDT_GATE_INTERRUPT, GDT_IST_DOUBLE_FAULT);
+    idt_set_gate(INTERRUPT_VECTOR_MACHINE_CHECK, isr_stub_table[INTERRUPT_VECTOR_MACHINE_CHECK], IDT_GATE_INTERRUPT, GDT_IST_MACHINE_CHECK);
+    _idt_pointer.limit = sizeof(_idt_entries) - 1;
+    _idt_pointer.base = (uint64_t)&_idt_entries;
+    idt_load();
+    pic_setup();
+}
+
+
+void interrupt_register_handler(uint8_t vector, interrupt_handler_t handler){
+    _interrupt_handlers[vector] = handler;
+}
+
+
+/*
+    Route a legacy ISA IRQ to handler and unmask it. EOI is sent by the dispatcher.
+*/
+void interrupt_register_irq(uint8_t irq, interrupt_handler_t handler){
+    interrupt_register_handler(PIC_VECTOR_BASE + irq, handler);
+    pic_unmask(irq);
+}
+
+
+/*
+    Panic with the exception's frame. Also for handlers that only deal with some of their faults.
+*/
+void interrupt_unhandled_exception(struct interrupt_frame* frame){
+    uint64_t cr2 = cpu_read_cr2();
+    kpanic("%s (vector %lu) err=0x%lx rip=0x%lx cs=0x%lx rflags=0x%lx rsp=0x%lx cr2=0x%lx",
+           _interrupt_exception_names[frame->vector], frame->vector, frame->error_code,
+           frame->rip, frame->cs, frame->rflags, frame->rsp, cr2);
+}
+
+
+/*
+    Charge a handled vector to the executing CPU. Plain increments are enough: only this CPU writes
+    its row, and an IST vector landing in the middle of this only touches its own entry.
+*/
+static inline void _interrupt_account(uint8_t vector, uint64_t start){
+    struct interrupt_vector_stats* stats = &g_interrupt_stats[cpu_current_id()][vector];
+    stats->count++;
+    stats->cycles += cpu_rdtsc() - start;
+}
+
+
+/*
+    Common C entry point for every vector (called from isr_common).
+*/
+void interrupt_dispatch(struct interrupt_frame* frame){
+    uint64_t start = cpu_rdtsc();
+    uint8_t vector = frame->vector;
+    bool is_pic_irq = vector >= PIC_VECTOR_BASE && vector < PIC_VECTOR_BASE + PIC_IRQ_COUNT;
+
+    if(is_pic_irq && pic_is_spurious(vector - PIC_VECTOR_BASE)){
+        return;
+    }
+
+    interrupt_handler_t handler = _interrupt_handlers[vector];
+    if(handler != NULL){
+        handler(frame);
+    }else if(vector < 32){
+        interrupt_unhandled_exception(frame);
+    }
+
+    if(is_pic_irq){
+        pic_send_eoi(vector - PIC_VECTOR_BASE);
+    }
+
+    _interrupt_account(vector, start);
+
+    // Preemption point, this may switch threads and come back here much later
+    sched_irq_exit();
+}
+
+
+/*
+    C entry for the IST vectors (called from isr_paranoid). They can land on any instruction, with
+    interrupts disabled, inside a lock or halfway through a thread switch, so nothing here may
+    block, take a lock or reschedule: the handler runs and the interrupted code resumes.
+    An NMI without a handler (a stray IPI, a chipset or watchdog source) is counted and ignored,
+    only the fault vectors panic when unhandled.
+*/
+void interrupt_dispatch_paranoid(struct interrupt_frame* frame){
+    uint64_t start = cpu_rdtsc();
+    uint8_t vector = frame->vector;
+    interrupt_handler_t handler = _interrupt_handlers[vector];
+    if(handler == NULL){
+        if(vector != INTERRUPT_VECTOR_NMI){
+            interrupt_unhandled_exception(frame);
+        }
+        _interrupt_spurious_nmis[cpu_current_id()]++;
+        return;
+    }
+    handler(frame);
+    _interrupt_account(vector, start);
+}
+
+
+void interrupt_stats_dump(){
+    kprintf("Interrupt stats (vector: count, total cycles, avg cycles):\n");
+    for(int i=0; i<IDT_SIZE; i++){
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+        for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+            count += g_interrupt_stats[id][i].count;
+            cycles += g_interrupt_stats[id][i].cycles;
+        }
+        if(count == 0){
+            continue;
+        }
+        kprintf("  0x%02x: %lu, %lu, %lu\n", i, count, cycles, cycles / count);
+    }
+    uint64_t spurious_nmis = 0;
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        spurious_nmis += _interrupt_spurious_nmis[id];
+    }
+    if(spurious_nmis != 0){
+        kprintf("  spurious NMIs: %lu\n", spurious_nmis);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+#define IDT_SIZE                256
+#define IDT_GATE_INTERRUPT      0x8E    // Present, DPL0, 64-bit interrupt gate
+#define IDT_GATE_INTERRUPT_USER 0xEE    // Present, DPL3 (reachable with int from ring 3)
+#define KERNEL_CODE_SELECTOR    0x08
+
+#define INTERRUPT_VECTOR_NMI            2
+#define INTERRUPT_VECTOR_DOUBLE_FAULT   8
+#define INTERRUPT_VECTOR_PAGE_FAULT     14
+#define INTERRUPT_VECTOR_MACHINE_CHECK  18
+
+struct idt_entry{
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type_attr;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+}__attribute__((packed));
+
+struct idt_pointer{
+    uint16_t limit;
+    uint64_t base;
+}__attribute__((packed));
+
+/*
+    What the entry stubs (isr-stubs.nas) leave on the stack.
+    Only caller-clobbered registers (+ rbp) are saved.
+*/
+struct interrupt_frame{
+    uint64_t rbp;
+    uint64_t r11;
+    uint64_t r10;
+    uint64_t r9;
+    uint64_t r8;
+    uint64_t rdi;
+    uint64_t rsi;
+    uint64_t rdx;
+    uint64_t rcx;
+    uint64_t rax;
+    uint64_t vector;
+    uint64_t error_code;
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+};
+
+typedef void (*interrupt_handler_t)(struct interrupt_frame* frame);
+
+struct interrupt_vector_stats{
+    uint64_t count;
+    uint64_t cycles;    // TSC cycles spent in the handler
+};
+
+// Per CPU, each CPU only updates its own row; interrupt_stats_dump() sums them
+extern struct interrupt_vector_stats g_interrupt_stats[KERNEL_MAX_CPUS][IDT_SIZE];
+extern const uint64_t isr_stub_table[IDT_SIZE];
+
+void idt_setup();
+void idt_load();
+void idt_set_gate(uint8_t vector, uint64_t handler_addr, uint8_t type_attr, uint8_t ist);
+void interrupt_register_handler(uint8_t vector, interrupt_handler_t handler);
+void interrupt_register_irq(uint8_t irq, interrupt_handler_t handler);
+void interrupt_dispatch(struct interrupt_frame* frame);
+void interrupt_dispatch_paranoid(struct interrupt_frame* frame);
+__attribute__((noreturn)) void interrupt_unhandled_exception(struct interrupt_frame* frame);
+void interrupt_stats_dump();
+
+static inline void interrupts_enable(){
+    asm volatile("sti" ::: "memory");
+}
+
+static inline void interrupts_disable(){
+    asm volatile("cli" ::: "memory");
+}
+
+#endif
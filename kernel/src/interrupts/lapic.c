@@ -0,0 +1,148 @@
+#include "lapic.h"
+
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+
+struct lapic_info g_lapic = {0};
+
+
+void lapic_eoi(){
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+
+uint32_t lapic_id(){
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+
+/*
+    Interrupt to one CPU. The ICR is written in two halves, so keep interrupts off
+    until the APIC has accepted it.
+*/
+static void _lapic_send_icr(uint32_t apic_id, uint32_t icr_low){
+    uint64_t rflags = cpu_irq_save();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, icr_low);
+    while(lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING){
+        cpu_pause();
+    }
+    cpu_irq_restore(rflags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector){
+    _lapic_send_icr(apic_id, LAPIC_ICR_ASSERT | vector);
+}
+
+// Delivered through vector 2 whatever the target's interrupt flag
+void lapic_send_nmi(uint32_t apic_id){
+    _lapic_send_icr(apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_DELIVERY_NMI);
+}
+
+
+static void _lapic_spurious_handler(struct interrupt_frame* frame){
+    (void)frame;    // Spurious interrupts must not be acknowledged
+}
+
+
+/*
+    Count timer ticks over a fixed TSC interval. The TSC must already be calibrated.
+*/
+static uint64_t _lapic_timer_calibrate(){
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+
+    uint64_t interval_cycles = tsc_ns_to_cycles(LAPIC_CALIBRATION_MS * NS_PER_MS);
+    uint64_t start = cpu_rdtsc_ordered();
+    lapic_write(LAPIC_REG_TIMER_INITIAL, UINT32_MAX);
+    while(cpu_rdtsc_ordered() - start < interval_cycles){
+        cpu_pause();
+    }
+    uint32_t elapsed_ticks = UINT32_MAX - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+
+    return (uint64_t)elapsed_ticks * (1000 / LAPIC_CALIBRATION_MS);
+}
+
+
+/*
+    Enable the executing CPU's local APIC. Every CPU sees its own APIC at the same address,
+    so the mapping made by lapic_setup() is shared.
+*/
+void lapic_init_cpu(){
+    cpu_wrmsr(LAPIC_BASE_MSR, cpu_rdmsr(LAPIC_BASE_MSR) | LAPIC_BASE_MSR_ENABLE);
+    lapic_write(LAPIC_REG_SPURIOUS, LAPIC_SPURIOUS_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+
+/*
+    Map and enable the local APIC, and calibrate its timer against the TSC.
+    Requires the IDT, and ktime_init() to have run. Returns false if the TSC isn't calibrated.
+*/
+bool lapic_setup(){
+    if(!g_tsc_clock.calibrated){
+        return false;
+    }
+
+    uint64_t base_phys = cpu_rdmsr(LAPIC_BASE_MSR) & 0x000FFFFFFFFFF000UL;
+    g_lapic.regs = (volatile uint32_t*)vmm_identity_map_page(base_phys, VMM_FLAGS_MMIO);
+    interrupt_register_handler(LAPIC_SPURIOUS_VECTOR, _lapic_spurious_handler);
+    lapic_init_cpu();
+
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    g_lapic.tsc_deadline = ecx & (1 << 24);
+
+    g_lapic.timer_hz = _lapic_timer_calibrate();
+    g_lapic.timer_mult = (g_lapic.timer_hz << TSC_SHIFT) / NS_PER_SEC;
+    return g_lapic.timer_hz != 0;
+}
+
+
+static uint32_t _lapic_ns_to_ticks(uint64_t ns){
+    uint64_t ticks = ((unsigned __int128)ns * g_lapic.timer_mult) >> TSC_SHIFT;
+    if(ticks == 0){
+        return 1;
+    }
+    return (ticks > UINT32_MAX)? UINT32_MAX : ticks;
+}
+
+
+void lapic_timer_periodic(uint64_t period_ns){
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, _lapic_ns_to_ticks(period_ns));
+}
+
+
+/*
+    Fire once after delta_ns. Deltas beyond the 32-bit counter range fire early at the maximum,
+    the caller is expected to re-arm.
+*/
+void lapic_timer_oneshot(uint64_t delta_ns){
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, _lapic_ns_to_ticks(delta_ns));
+}
+
+
+/*
+    Fire when the TSC reaches tsc. Only valid if g_lapic.tsc_deadline.
+*/
+void lapic_timer_deadline(uint64_t tsc){
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+    // The LVT write has to land before the MSR write (SDM 10.5.4.1)
+    asm volatile("mfence" ::: "memory");
+    cpu_wrmsr(LAPIC_TSC_DEADLINE_MSR, tsc);
+}
+
+
+void lapic_timer_stop(){
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+    if(g_lapic.tsc_deadline){
+        cpu_wrmsr(LAPIC_TSC_DEADLINE_MSR, 0);
+    }
+}
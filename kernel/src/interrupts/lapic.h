@@ -0,0 +1,72 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LAPIC_BASE_MSR          0x1B
+#define LAPIC_BASE_MSR_ENABLE   (1 << 11)
+#define LAPIC_TSC_DEADLINE_MSR  0x6E0
+
+/*
+    Register offsets into the xAPIC MMIO page
+*/
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SPURIOUS      0x0F0
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SPURIOUS_ENABLE   (1 << 8)
+#define LAPIC_LVT_MASKED        (1 << 16)
+#define LAPIC_TIMER_ONESHOT     (0 << 17)
+#define LAPIC_TIMER_PERIODIC    (1 << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+#define LAPIC_TIMER_DIVIDE_16   0x3
+#define LAPIC_ICR_DELIVERY_NMI  (4 << 8)
+#define LAPIC_ICR_PENDING       (1 << 12)
+#define LAPIC_ICR_ASSERT        (1 << 14)
+
+/*
+    Vectors, above the remapped PIC range
+*/
+#define LAPIC_TIMER_VECTOR      0x40
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+#define LAPIC_CALIBRATION_MS    10
+
+struct lapic_info{
+    volatile uint32_t* regs;
+    uint64_t timer_hz;          // Timer input clock after the divider
+    uint64_t timer_mult;        // Timer ticks per ns << TSC_SHIFT
+    bool tsc_deadline;          // CPUID.01h:ECX[24]
+};
+
+extern struct lapic_info g_lapic;
+
+bool lapic_setup();
+void lapic_init_cpu();
+void lapic_eoi();
+uint32_t lapic_id();
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_nmi(uint32_t apic_id);
+
+void lapic_timer_periodic(uint64_t period_ns);
+void lapic_timer_oneshot(uint64_t delta_ns);
+void lapic_timer_deadline(uint64_t tsc);
+void lapic_timer_stop();
+
+static inline uint32_t lapic_read(uint32_t reg){
+    return g_lapic.regs[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value){
+    g_lapic.regs[reg / 4] = value;
+}
+
+#endif
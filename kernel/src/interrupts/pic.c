@@ -0,0 +1,60 @@
+#include "pic.h"
+
+#include "debugging/serialout.h" // asm_inline_inb/outb
+
+static inline void _pic_io_wait(){
+    asm_inline_outb(0x80, 0); // Unused port, gives the old PICs time to settle
+}
+
+/*
+    Reinitialise both PICs with vector offsets 0x20/0x28 and every line masked
+*/
+void pic_setup(){
+    asm_inline_outb(PIC1_COMMAND, 0x11); _pic_io_wait();    // ICW1: init, expect ICW4
+    asm_inline_outb(PIC2_COMMAND, 0x11); _pic_io_wait();
+    asm_inline_outb(PIC1_DATA, PIC_VECTOR_BASE); _pic_io_wait();        // ICW2: vector offsets
+    asm_inline_outb(PIC2_DATA, PIC_VECTOR_BASE + 8); _pic_io_wait();
+    asm_inline_outb(PIC1_DATA, 0x04); _pic_io_wait();       // ICW3: slave on IRQ2
+    asm_inline_outb(PIC2_DATA, 0x02); _pic_io_wait();       //       slave cascade identity
+    asm_inline_outb(PIC1_DATA, 0x01); _pic_io_wait();       // ICW4: 8086 mode
+    asm_inline_outb(PIC2_DATA, 0x01); _pic_io_wait();
+
+    asm_inline_outb(PIC1_DATA, 0xFF & ~(1 << 2));   // Everything masked apart from the cascade
+    asm_inline_outb(PIC2_DATA, 0xFF);
+}
+
+void pic_mask(uint8_t irq){
+    uint16_t port = (irq < 8)? PIC1_DATA : PIC2_DATA;
+    asm_inline_outb(port, asm_inline_inb(port) | (1 << (irq & 7)));
+}
+
+void pic_unmask(uint8_t irq){
+    uint16_t port = (irq < 8)? PIC1_DATA : PIC2_DATA;
+    asm_inline_outb(port, asm_inline_inb(port) & ~(1 << (irq & 7)));
+}
+
+void pic_send_eoi(uint8_t irq){
+    if(irq >= 8){
+        asm_inline_outb(PIC2_COMMAND, PIC_EOI);
+    }
+    asm_inline_outb(PIC1_COMMAND, PIC_EOI);
+}
+
+/*
+    IRQ 7/15 fire spuriously when a request goes away before it is acknowledged.
+    Check the in-service register to tell them apart from the real thing.
+*/
+bool pic_is_spurious(uint8_t irq){
+    if(irq != 7 && irq != 15){
+        return false;
+    }
+    uint16_t command = (irq == 7)? PIC1_COMMAND : PIC2_COMMAND;
+    asm_inline_outb(command, 0x0B); // Read ISR
+    if(asm_inline_inb(command) & 0x80){
+        return false;
+    }
+    if(irq == 15){
+        asm_inline_outb(PIC1_COMMAND, PIC_EOI); // The master still saw the cascade line
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Legacy 8259 PIC pair, remapped so ISA IRQs 0-15 land on vectors 0x20-0x2F
+*/
+#define PIC1_COMMAND    0x20
+#define PIC1_DATA       0x21
+#define PIC2_COMMAND    0xA0
+#define PIC2_DATA       0xA1
+
+#define PIC_VECTOR_BASE 0x20
+#define PIC_IRQ_COUNT   16
+#define PIC_EOI         0x20
+
+void pic_setup();
+void pic_mask(uint8_t irq);
+void pic_unmask(uint8_t irq);
+void pic_send_eoi(uint8_t irq);
+bool pic_is_spurious(uint8_t irq);
+
+#endif
@@ -0,0 +1,374 @@
+#include "ring.h"
+
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "sched/sched.h"
+#include "sync/futex.h"
+#include "util/cpu.h"
+#include "util/kstring.h"
+#include "time/tsc.h"
+#include "debugging/kprint.h"
+#include "debugging/panic.h"
+
+DEFINE_SPINLOCK(_ipc_pool_lock, "ipc_pool");
+static struct ipc_ring _ipc_rings[IPC_MAX_RINGS];
+
+
+/*
+    Ring of data_pages pages (a power of two), zeroed. NULL if the size is bad or the pool is full.
+*/
+struct ipc_ring* ipc_ring_create(uint32_t data_pages){
+    if(data_pages == 0 || data_pages > IPC_RING_MAX_PAGES || (data_pages & (data_pages - 1)) != 0){
+        return NULL;
+    }
+    uint64_t rflags = spin_lock_irqsave(&_ipc_pool_lock);
+    struct ipc_ring* ring = NULL;
+    for(int i=0; i<IPC_MAX_RINGS; i++){
+        if(!_ipc_rings[i].in_use){
+            ring = &_ipc_rings[i];
+            *ring = (struct ipc_ring){0};
+            ring->in_use = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&_ipc_pool_lock, rflags);
+    if(ring == NULL){
+        return NULL;
+    }
+
+    ring->data_pages = data_pages;
+    ring->phys = (uint64_t)pmm_alloc_pages(1 + data_pages);
+    void* virt = (void*)vmm_identity_map_n_pages(ring->phys, 1 + data_pages, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_NO_EXECUTE);
+    memset(virt, 0, (1 + (uint64_t)data_pages) * PAGE_SIZE);
+    ((struct ipc_ring_header*)virt)->size = data_pages * PAGE_SIZE;
+    return ring;
+}
+
+/*
+    Free the ring's pages. Fails while it is still mapped somewhere.
+*/
+bool ipc_ring_destroy(struct ipc_ring* ring){
+    if(__atomic_load_n(&ring->maps, __ATOMIC_ACQUIRE) != 0){
+        return false;
+    }
+    for(uint32_t i=0; i<1 + ring->data_pages; i++){
+        pmm_free_page_physaddr(ring->phys + (uint64_t)i*PAGE_SIZE);
+    }
+    uint64_t rflags = spin_lock_irqsave(&_ipc_pool_lock);
+    ring->in_use = false;
+    spin_unlock_irqrestore(&_ipc_pool_lock, rflags);
+    return true;
+}
+
+
+/*
+    Map the whole ring, header first, at virt (page aligned) in space. Below VMM_USER_TOP the
+    mapping is user accessible.
+*/
+void ipc_ring_map(struct ipc_ring* ring, struct vmm_space* space, uint64_t virt){
+    uint64_t flags = VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_NO_EXECUTE;
+    if(virt < VMM_USER_TOP){
+        flags |= VMM_FLAG_USER;
+    }
+    for(uint32_t i=0; i<1 + ring->data_pages; i++){
+        vmm_space_map(space, ring->phys + (uint64_t)i*PAGE_SIZE, virt + (uint64_t)i*PAGE_SIZE, flags);
+    }
+    __atomic_add_fetch(&ring->maps, 1, __ATOMIC_RELEASE);
+}
+
+void ipc_ring_unmap(struct ipc_ring* ring, struct vmm_space* space, uint64_t virt){
+    for(uint32_t i=0; i<1 + ring->data_pages; i++){
+        vmm_space_unmap(space, virt + (uint64_t)i*PAGE_SIZE);
+    }
+    __atomic_sub_fetch(&ring->maps, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+    Ends, from a mapping in the calling thread's address space
+*/
+static void _ipc_ring_attach(struct ipc_ring_end* end, uint64_t virt){
+    *end = (struct ipc_ring_end){0};
+    end->header = (struct ipc_ring_header*)virt;
+    end->data = (uint8_t*)(virt + PAGE_SIZE);
+    end->mask = end->header->size - 1;
+}
+
+void ipc_ring_attach_producer(struct ipc_ring_end* end, uint64_t virt){
+    _ipc_ring_attach(end, virt);
+    end->pos = __atomic_load_n(&end->header->head, __ATOMIC_RELAXED);
+    end->other = __atomic_load_n(&end->header->tail, __ATOMIC_ACQUIRE);
+}
+
+void ipc_ring_attach_consumer(struct ipc_ring_end* end, uint64_t virt){
+    _ipc_ring_attach(end, virt);
+    end->pos = __atomic_load_n(&end->header->tail, __ATOMIC_RELAXED);
+    end->other = __atomic_load_n(&end->header->head, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+    Free space (producer) and data (consumer). The shared index is only reread when the cached
+    one doesn't leave want bytes.
+*/
+static uint32_t _ipc_ring_free(struct ipc_ring_end* end, uint32_t want){
+    uint32_t size = end->mask + 1;
+    uint32_t free = size - (end->pos - end->other);
+    if(free < want){
+        end->other = __atomic_load_n(&end->header->tail, __ATOMIC_ACQUIRE);
+        free = size - (end->pos - end->other);
+    }
+    return free;
+}
+
+static uint32_t _ipc_ring_avail(struct ipc_ring_end* end, uint32_t want){
+    uint32_t avail = end->other - end->pos;
+    if(avail < want){
+        end->other = __atomic_load_n(&end->header->head, __ATOMIC_ACQUIRE);
+        avail = end->other - end->pos;
+    }
+    return avail;
+}
+
+static inline uint32_t _ipc_ring_want(struct ipc_ring_end* end, size_t len){
+    return (len < end->mask + 1)? (uint32_t)len : end->mask + 1;
+}
+
+/*
+    Sleep on the other side's index while it still reads seen. waiting is our flag, the other
+    side wakes us only when it is set, so it has to be visible before the index is checked again.
+*/
+static void _ipc_ring_sleep(struct ipc_ring_end* end, volatile uint32_t* index, volatile uint32_t* waiting, uint32_t seen){
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(index, __ATOMIC_SEQ_CST) == seen){
+        futex_wait(index, seen);
+        end->sleeps++;
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+
+/*
+    After publishing our index: true if the other side sleeps and needs a futex_wake(). The flag
+    is cleared here so later publishes don't wake it again, and only written when it was set,
+    as the common case shouldn't take the other side's cache line exclusive.
+*/
+static inline bool _ipc_ring_take_waiter(volatile uint32_t* waiting){
+    return __atomic_load_n(waiting, __ATOMIC_SEQ_CST) && __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+    Zero-copy access: reserve()/peek() return the contiguous free space/data at the current
+    position (*len bytes, 0 when full/empty), commit()/consume() publish how much of it was used.
+*/
+void* ipc_ring_reserve(struct ipc_ring_end* end, size_t* len){
+    uint32_t free = _ipc_ring_free(end, 1);
+    uint32_t offset = end->pos & end->mask;
+    uint32_t contiguous = end->mask + 1 - offset;
+    *len = (free < contiguous)? free : contiguous;
+    return end->data + offset;
+}
+
+void ipc_ring_commit(struct ipc_ring_end* end, size_t len){
+    end->pos += (uint32_t)len;
+    // Store then load, both seq_cst: pairs with _ipc_ring_sleep(), no wake-up can be missed
+    __atomic_store_n(&end->header->head, end->pos, __ATOMIC_SEQ_CST);
+    if(_ipc_ring_take_waiter(&end->header->consumer_waiting)){
+        futex_wake(&end->header->head, 1);
+    }
+}
+
+void* ipc_ring_peek(struct ipc_ring_end* end, size_t* len){
+    uint32_t avail = _ipc_ring_avail(end, 1);
+    uint32_t offset = end->pos & end->mask;
+    uint32_t contiguous = end->mask + 1 - offset;
+    *len = (avail < contiguous)? avail : contiguous;
+    return end->data + offset;
+}
+
+void ipc_ring_consume(struct ipc_ring_end* end, size_t len){
+    end->pos += (uint32_t)len;
+    __atomic_store_n(&end->header->tail, end->pos, __ATOMIC_SEQ_CST);
+    if(_ipc_ring_take_waiter(&end->header->producer_waiting)){
+        futex_wake(&end->header->tail, 1);
+    }
+}
+
+
+/*
+    Copying access, at most two memcpy()s (around the wrap) and one publish per call.
+    write()/read() return how much they managed without waiting.
+*/
+size_t ipc_ring_write(struct ipc_ring_end* end, const void* buf, size_t len){
+    uint32_t n = _ipc_ring_free(end, _ipc_ring_want(end, len));
+    if(n > len){
+        n = len;
+    }
+    if(n == 0){
+        return 0;
+    }
+    uint32_t offset = end->pos & end->mask;
+    uint32_t first = end->mask + 1 - offset;
+    if(first > n){
+        first = n;
+    }
+    memcpy(end->data + offset, buf, first);
+    memcpy(end->data, (const uint8_t*)buf + first, n - first);
+    ipc_ring_commit(end, n);
+    return n;
+}
+
+size_t ipc_ring_read(struct ipc_ring_end* end, void* buf, size_t len){
+    uint32_t n = _ipc_ring_avail(end, _ipc_ring_want(end, len));
+    if(n > len){
+        n = len;
+    }
+    if(n == 0){
+        return 0;
+    }
+    uint32_t offset = end->pos & end->mask;
+    uint32_t first = end->mask + 1 - offset;
+    if(first > n){
+        first = n;
+    }
+    memcpy(buf, end->data + offset, first);
+    memcpy((uint8_t*)buf + first, end->data, n - first);
+    ipc_ring_consume(end, n);
+    return n;
+}
+
+/*
+    Blocking versions: write_all() sleeps whenever the ring is full until all of buf is in,
+    read_wait() sleeps while it is empty and returns as soon as it got anything.
+*/
+void ipc_ring_write_all(struct ipc_ring_end* end, const void* buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        size_t n = ipc_ring_write(end, (const uint8_t*)buf + done, len - done);
+        if(n == 0){
+            _ipc_ring_sleep(end, &end->header->tail, &end->header->producer_waiting, end->other);
+        }
+        done += n;
+    }
+}
+
+size_t ipc_ring_read_wait(struct ipc_ring_end* end, void* buf, size_t len){
+    for(;;){
+        size_t n = ipc_ring_read(end, buf, len);
+        if(n != 0 || len == 0){
+            return n;
+        }
+        _ipc_ring_sleep(end, &end->header->head, &end->header->consumer_waiting, end->other);
+    }
+}
+
+
+/*
+    Throughput between two threads, each in its own address space with the ring mapped at a
+    different address. Threads stay on the CPU that creates them, so both share this one: the
+    producer fills the ring and sleeps, the consumer drains it and sleeps, and every lap costs
+    two switches (and CR3 loads) on top of the copies.
+*/
+struct _ipc_bench_side{
+    struct vmm_space* space;
+    uint64_t virt;
+    uint64_t sleeps;
+};
+
+static struct _ipc_bench_side _ipc_bench_sides[2];
+static uint8_t _ipc_bench_src[IPC_BENCH_CHUNK];
+static uint8_t _ipc_bench_dst[IPC_BENCH_CHUNK];
+static volatile uint32_t _ipc_bench_running;
+static volatile uint64_t _ipc_bench_start;
+static volatile uint64_t _ipc_bench_end;
+static volatile uint64_t _ipc_bench_received;
+
+static void _ipc_bench_finish(){
+    // Off the bench space before ipc_ring_bench() can destroy it
+    uint64_t rflags = cpu_irq_save();
+    sched_current()->space = NULL;
+    vmm_space_switch(&g_vmm_kernel_space);
+    cpu_irq_restore(rflags);
+    __atomic_sub_fetch(&_ipc_bench_running, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&_ipc_bench_running, 1);
+}
+
+static void _ipc_bench_producer(void* arg){
+    struct _ipc_bench_side* side = (struct _ipc_bench_side*)arg;
+    struct ipc_ring_end end;
+    ipc_ring_attach_producer(&end, side->virt);
+    _ipc_bench_start = cpu_rdtsc();
+    for(uint64_t sent=0; sent<IPC_BENCH_BYTES; sent+=IPC_BENCH_CHUNK){
+        ipc_ring_write_all(&end, _ipc_bench_src, IPC_BENCH_CHUNK);
+    }
+    side->sleeps = end.sleeps;
+    _ipc_bench_finish();
+}
+
+static void _ipc_bench_consumer(void* arg){
+    struct _ipc_bench_side* side = (struct _ipc_bench_side*)arg;
+    struct ipc_ring_end end;
+    ipc_ring_attach_consumer(&end, side->virt);
+    uint64_t received = 0;
+    while(received < IPC_BENCH_BYTES){
+        received += ipc_ring_read_wait(&end, _ipc_bench_dst, IPC_BENCH_CHUNK);
+    }
+    _ipc_bench_end = cpu_rdtsc();
+    _ipc_bench_received = received;
+    side->sleeps = end.sleeps;
+    _ipc_bench_finish();
+}
+
+void ipc_ring_bench(){
+    struct ipc_ring* ring = ipc_ring_create(IPC_BENCH_RING_PAGES);
+    if(ring == NULL){
+        kprintf("IPC ring bench: no ring\n");
+        return;
+    }
+    _ipc_bench_sides[0] = (struct _ipc_bench_side){vmm_space_create(), IPC_BENCH_PRODUCER_VIRT, 0};
+    _ipc_bench_sides[1] = (struct _ipc_bench_side){vmm_space_create(), IPC_BENCH_CONSUMER_VIRT, 0};
+    if(_ipc_bench_sides[0].space == NULL || _ipc_bench_sides[1].space == NULL){
+        kprintf("IPC ring bench: out of address spaces\n");
+        for(int i=0; i<2; i++){
+            if(_ipc_bench_sides[i].space != NULL){
+                vmm_space_destroy(_ipc_bench_sides[i].space);
+            }
+        }
+        ipc_ring_destroy(ring);
+        return;
+    }
+    for(int i=0; i<2; i++){
+        ipc_ring_map(ring, _ipc_bench_sides[i].space, _ipc_bench_sides[i].virt);
+    }
+    memset(_ipc_bench_src, 0xA5, sizeof(_ipc_bench_src));
+
+    // Spaces set before either thread can run
+    _ipc_bench_running = 2;
+    uint64_t rflags = cpu_irq_save();
+    struct thread* producer = sched_thread_create("ipc-producer", _ipc_bench_producer, &_ipc_bench_sides[0], SCHED_PRIORITY_NORMAL);
+    struct thread* consumer = sched_thread_create("ipc-consumer", _ipc_bench_consumer, &_ipc_bench_sides[1], SCHED_PRIORITY_NORMAL);
+    if(producer == NULL || consumer == NULL){
+        kpanic("IPC ring bench: thread pool exhausted");
+    }
+    producer->space = _ipc_bench_sides[0].space;
+    consumer->space = _ipc_bench_sides[1].space;
+    cpu_irq_restore(rflags);
+
+    uint32_t running;
+    while((running = __atomic_load_n(&_ipc_bench_running, __ATOMIC_SEQ_CST)) != 0){
+        futex_wait(&_ipc_bench_running, running);
+    }
+
+    uint64_t ns = tsc_cycles_to_ns(_ipc_bench_end - _ipc_bench_start);
+    uint64_t mb_per_s = (ns != 0)? _ipc_bench_received * 1000 / ns : 0;
+    kprintf("IPC ring: %lu MiB through %u KiB in %lu chunks of %lu bytes, %lu.%03lu GB/s, %lu producer / %lu consumer sleeps\n",
+            _ipc_bench_received >> 20, IPC_BENCH_RING_PAGES * PAGE_SIZE / 1024, IPC_BENCH_BYTES / IPC_BENCH_CHUNK,
+            (uint64_t)IPC_BENCH_CHUNK, mb_per_s / 1000, mb_per_s % 1000, _ipc_bench_sides[0].sleeps, _ipc_bench_sides[1].sleeps);
+
+    for(int i=0; i<2; i++){
+        ipc_ring_unmap(ring, _ipc_bench_sides[i].space, _ipc_bench_sides[i].virt);
+        vmm_space_destroy(_ipc_bench_sides[i].space);
+    }
+    ipc_ring_destroy(ring);
+}
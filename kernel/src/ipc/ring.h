@@ -0,0 +1,92 @@
+#ifndef IPC_RING_H
+#define IPC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+/*
+    Single-producer/single-consumer byte ring in shared memory, for bulk data between tasks
+    without the kernel copying it.
+
+    A ring is one header page followed by a power of two number of data pages, taken from the
+    PMM in one piece. ipc_ring_map() maps all of it into an address space, so producer and
+    consumer can sit in different spaces, at different addresses. The mappings aren't owned
+    (VMM_FLAG_OWNED): destroying a space leaves the pages to the ring.
+
+    head (bytes written) and tail (bytes read) are free running and each on its own cache line,
+    written only by its side. Each side keeps a copy of the other's index in its struct
+    ipc_ring_end and only rereads the shared one when the copy says the ring is full (or empty),
+    so in the steady state the cache lines bounce once per batch, not once per write.
+    An empty ring puts the consumer to sleep on head, a full one the producer on tail, with
+    futex_wait() (sync/futex.h); the other side only calls futex_wake() when the *_waiting flag
+    says someone sleeps.
+*/
+#define IPC_MAX_RINGS           16
+#define IPC_RING_MAX_PAGES      1024
+
+#define IPC_BENCH_RING_PAGES    64
+#define IPC_BENCH_CHUNK         PAGE_SIZE
+#define IPC_BENCH_BYTES         (256UL << 20)
+#define IPC_BENCH_PRODUCER_VIRT 0x500000000000UL
+#define IPC_BENCH_CONSUMER_VIRT 0x580000000000UL
+
+struct vmm_space;
+
+struct ipc_ring_header{
+    // Producer's line
+    volatile uint32_t head;
+    volatile uint32_t producer_waiting;     // Producer sleeps on tail
+    uint8_t _pad0[CACHE_LINE_SIZE - 2*sizeof(uint32_t)];
+    // Consumer's line
+    volatile uint32_t tail;
+    volatile uint32_t consumer_waiting;     // Consumer sleeps on head
+    uint8_t _pad1[CACHE_LINE_SIZE - 2*sizeof(uint32_t)];
+    // Read only after ipc_ring_create()
+    uint32_t size;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+_Static_assert(sizeof(struct ipc_ring_header) <= PAGE_SIZE, "ring header must fit its page");
+
+struct ipc_ring{
+    bool in_use;
+    uint64_t phys;              // Header page, then the data pages
+    uint32_t data_pages;
+    uint32_t maps;              // Live ipc_ring_map()s, the ring can't be destroyed before they go
+};
+
+/*
+    One side's view of a mapped ring, private to that side
+*/
+struct ipc_ring_end{
+    struct ipc_ring_header* header;
+    uint8_t* data;
+    uint32_t mask;
+    uint32_t pos;               // Own index: head for the producer, tail for the consumer
+    uint32_t other;             // Last seen value of the other side's index
+    uint64_t sleeps;
+};
+
+struct ipc_ring* ipc_ring_create(uint32_t data_pages);
+bool ipc_ring_destroy(struct ipc_ring* ring);
+void ipc_ring_map(struct ipc_ring* ring, struct vmm_space* space, uint64_t virt);
+void ipc_ring_unmap(struct ipc_ring* ring, struct vmm_space* space, uint64_t virt);
+
+void ipc_ring_attach_producer(struct ipc_ring_end* end, uint64_t virt);
+void ipc_ring_attach_consumer(struct ipc_ring_end* end, uint64_t virt);
+
+void* ipc_ring_reserve(struct ipc_ring_end* end, size_t* len);
+void ipc_ring_commit(struct ipc_ring_end* end, size_t len);
+void* ipc_ring_peek(struct ipc_ring_end* end, size_t* len);
+void ipc_ring_consume(struct ipc_ring_end* end, size_t len);
+
+size_t ipc_ring_write(struct ipc_ring_end* end, const void* buf, size_t len);
+size_t ipc_ring_read(struct ipc_ring_end* end, void* buf, size_t len);
+void ipc_ring_write_all(struct ipc_ring_end* end, const void* buf, size_t len);
+size_t ipc_ring_read_wait(struct ipc_ring_end* end, void* buf, size_t len);
+
+void ipc_ring_bench();
+
+#endif
@@ -7,6 +7,12 @@
 #include "constants.h"
 #include "util/utility.h"
 #include "debugging/serialout.h"
+#include "debugging/kprint.h"
+#include "debugging/dmesg.h"
+#include "debugging/trace.h"
+#include "debugging/bootprof.h"
+#include "debugging/profile.h"
+#include "debugging/kbench.h"
 
 #include "graphical/graphics.h"
 #include "graphical/kterminal.h"
@@ -15,6 +21,30 @@
 #include "memory/vmm.h"
 #include "memory/gdt.h"
 
+#include "interrupts/idt.h"
+#include "interrupts/lapic.h"
+
+#include "drivers/virtconsole.h"
+#include "drivers/qemu.h"
+
+#include "time/tsc.h"
+#include "time/clockevent.h"
+#include "time/timerwheel.h"
+
+#include "smp/percpu.h"
+#include "smp/smp.h"
+
+#include "sched/sched.h"
+#include "sched/kparallel.h"
+#include "syscall/syscall.h"
+
+#include "exec/module.h"
+#include "exec/exec.h"
+#include "ipc/ring.h"
+#include "fs/initramfs.h"
+
+#include "sync/lockstat.h"
+
 /*
     Limine bootloader requests, see limine docs/examples for all the info
 */
@@ -57,6 +87,19 @@ static volatile struct limine_hhdm_request hhdm_request = {
     .revision = 0
 };
 
+__attribute__((used, section(".requests")))
+static volatile struct limine_smp_request smp_request = {
+    .id = LIMINE_SMP_REQUEST,
+    .revision = 0,
+    .flags = 0 // xAPIC, the LAPIC driver uses MMIO
+};
+
+__attribute__((used, section(".requests")))
+static volatile struct limine_module_request module_request = {
+    .id = LIMINE_MODULE_REQUEST,
+    .revision = 0
+};
+
 __attribute__((used, section(".requests_end_marker")))
 static volatile LIMINE_REQUESTS_END_MARKER;
 
@@ -71,15 +114,30 @@ static volatile LIMINE_REQUESTS_END_MARKER;
     Kernel entry point
 */
 void kmain(void) {
+    // GS base -> per-CPU block, so cpu_current_id() (used by logging) is valid from here on
+    percpu_init(0);
+    bootprof_begin("serial init");
+
     /*
         Init debug serial comms
     */
     init_debug_serial();
+    kprint_register_sink(&g_serial_sink);
+    trace_init();
     debug_serial_printf("Kernel booting...\n");
 
+    /*
+        Start the kernel clock. Only needs port I/O, so do it first and every later stage can be timed.
+    */
+    bootprof_begin("tsc calibration");
+    debug_serial_printf("Calibrating TSC... ");
+    ktime_init();
+    kprintf("%lu kHz%s\n", tsc_hz() / 1000, g_tsc_clock.invariant? " (invariant)" : "");
+
     /*
         Sanity checks
     */
+    bootprof_begin("sanity checks");
     debug_serial_printf("Performing sanity checks... ");
     // Ensure the bootloader actually understands base revision (see spec).
     if (LIMINE_BASE_REVISION_SUPPORTED == false) {
@@ -108,21 +166,23 @@ void kmain(void) {
     }
     debug_serial_printf("OK\n");
 
-    /*
-        Temp debugging kterm
-    */
-    kterm_init(framebuffer_request.response->framebuffers[0]);
-
     /*
         Copy some useful bits of limine request/response info to nice neat structs on the stack.
     */
     struct limine_kernel_address_response k_kerneladdr_info = *kernel_address_request.response;
     struct limine_memmap_response k_memmap_info = *memmap_request.response;
     struct limine_framebuffer k_framebuffer = *framebuffer_request.response->framebuffers[0];
+    if(smp_request.response != NULL){
+        smp_capture_limine(smp_request.response);
+    }
+    if(module_request.response != NULL){
+        module_capture_limine(module_request.response);
+    }
 
     /*
         Set up PMM
     */
+    bootprof_begin("pmm setup");
     debug_serial_printf("Setting up PMM...\n");
     pmm_setup_bytemap(k_memmap_info);
     debug_serial_printf("PMM setup OK\n");
@@ -131,20 +191,96 @@ void kmain(void) {
         Set up VMM - this function will create basic mappings that allow the kernel to continue to execute.
         This provides VERY minimal mapping. ONLY kernel + stack + page table + bytemap will be mapped.
     */
+    bootprof_begin("vmm setup");
     debug_serial_printf("Setting up VMM... ");
-    vmm_setup(k_memmap_info);
+    vmm_setup(k_memmap_info, k_kerneladdr_info.physical_base);
+    module_map();
+
+    /*
+        Initramfs: the console font and user programs, read in place from the boot module
+    */
+    bootprof_begin("initramfs");
+    const struct boot_module* initramfs_module = module_find(INITRAMFS_MODULE_PATH);
+    if(initramfs_module == NULL || !initramfs_init(initramfs_module)){
+        kprintf("No initramfs, kterm stays off\n");
+    }
+    const struct initramfs_file* font = initramfs_find(GRAPHICS_FONT_PATH);
+    if(font == NULL || !graphics_set_font(initramfs_data(font), font->size)){
+        kprintf("No usable font at %s, kterm stays off\n", GRAPHICS_FONT_PATH);
+    }
 
     /*
         Set up GDT
         Limine provides one that works, but its best we are in control of it.
     */
+    bootprof_begin("gdt setup");
     debug_serial_printf("Setting up GDT... ");
     gdt_setup();
     debug_serial_printf("OK\n");
 
+    /*
+        Set up IDT + PIC, then switch the debug UART over to interrupt driven transmit
+    */
+    bootprof_begin("idt setup");
+    debug_serial_printf("Setting up IDT... ");
+    idt_setup();
+    interrupt_register_irq(SERIAL_DEBUG_IRQ, serial_irq_handler);
+    serial_tx_enable_irq();
+    interrupts_enable();
+    debug_serial_printf("OK\n");
+
+    /*
+        Ring 3 entry: SYSCALL MSRs and the int 0x80 gate
+    */
+    syscall_init();
+    exec_init();
+
+    /*
+        Sampling profiler. Built with PROFILE=1 it runs from here, so the rest of boot is profiled.
+    */
+    profile_init();
+#ifdef KCONFIG_PROFILE
+    profile_start(PROFILE_DEFAULT_HZ);
+#endif
+    serial_command_register(PMM_STATS_CMD_DUMP, pmm_stats_dump);     // PMM statistics on demand
+
+    /*
+        LAPIC timer, tickless: it is only armed when something asks for a deadline
+    */
+    bootprof_begin("lapic timer");
+    debug_serial_printf("Setting up LAPIC timer... ");
+    bool have_timers = clockevent_init();
+    if(have_timers){
+        kprintf("%lu kHz, %s\n", g_lapic.timer_hz / 1000, g_lapic.tsc_deadline? "TSC-deadline" : "one-shot");
+        timer_wheel_init();
+    }else{
+        kprintf("unavailable\n");
+    }
+
+    /*
+        Scheduler: from here on kmain is a thread, and becomes this CPU's idle thread at the end
+    */
+    sched_init_cpu();
+    kparallel_init();
+
+    /*
+        With timers running the kernel log is drained from them, printing no longer waits on the sinks
+    */
+    if(have_timers){
+        dmesg_set_deferred(true);
+    }
+
+    /*
+        Bring up the other cores. Each gets its own stack, GDT/TSS and per-CPU block, then idles.
+    */
+    bootprof_begin("smp bring-up");
+    smp_start_aps();
+    smp_report();
+
     /*
         Map memmap response to new virtual address
     */
+    bootprof_begin("memmap remap");
     debug_serial_printf("Remapping limine memmap... ");
     k_memmap_info.entries = (struct limine_memmap_entry**)(vmm_identity_map_page(
                                 translateaddr_idmap_v2p_limine((uint64_t)k_memmap_info.entries), 0x3
@@ -163,6 +299,7 @@ void kmain(void) {
     /*
         Set up framebuffer + kterm
     */
+    bootprof_begin("framebuffer map");
     debug_serial_printf("Mapping framebuffer... ");
     uint64_t framebuffer_physical_address = translateaddr_idmap_v2p_limine((uint64_t)k_framebuffer.address);
     uint64_t framebuffer_length_bytes = (k_framebuffer.height * k_framebuffer.width * k_framebuffer.bpp) / 8;
@@ -172,13 +309,30 @@ void kmain(void) {
     }
     k_framebuffer.address = (void*)(framebuffer_physical_address + VMM_IDENTITY_MAP_OFFSET);
     debug_serial_printf("OK\n");
+    bootprof_begin("kterm init");
     debug_serial_printf("Initialising kterm... ");
     kterm_init(&k_framebuffer); // Now kterm can be initialised on the framebuffer
+    kprint_register_sink(&g_kterm_sink);
     debug_serial_printf("OK\n");
 
+    /*
+        Kernel log channel: prefer virtio-console (shared memory, one notify per batch),
+        fall back to COM1 when the device is absent.
+    */
+    bootprof_begin("virtconsole probe");
+    debug_serial_printf("Probing virtio-console... ");
+    if(virtconsole_init()){
+        kprint_register_sink_replay(&g_virtconsole_sink);
+        kprint_unregister_sink(&g_serial_sink);
+        debug_serial_printf("OK, kernel log continues on virtio-console\n");
+    }else{
+        debug_serial_printf("not present, kernel log stays on COM1\n");
+    }
+
     /*
         Print logo
     */
+    bootprof_begin("logo");
     kterm_printf_newline("=========================================================================================");
     kterm_printf_newline("|                                                                    @@@@       -@@@:   |");
     kterm_printf_newline("| .@@@  @@@@ @@@@@@@ @@@   @@ @@@@@@@@   @@@    @@  @@@@@@         @@@@@@@@   @@@@@@@@@ |");
@@ -192,60 +346,22 @@ void kmain(void) {
     /*
         Print system information
     */
-    kterm_printf_newline("Framebuffer (virtual) address: 0x%x", k_framebuffer.address);
-    kterm_printf_newline("Framebuffer height: %u", k_framebuffer.height);
-    kterm_printf_newline("Framebuffer width: %u", k_framebuffer.width);
-    kterm_printf_newline("Framebuffer BPP: %u", k_framebuffer.bpp);
-    kterm_printf_newline("Bytemap base: 0x%x", g_kbytemap_info.base_phys);
-    kterm_printf_newline("Bytemap size (bytes): %u (0x%x), (n_pages): %u", g_kbytemap_info.size_npages * PAGE_SIZE, g_kbytemap_info.size_npages * PAGE_SIZE, g_kbytemap_info.size_npages);
-    kterm_printf_newline("Kernel physical base addr=0x%x Virtual base addr=0x%x", k_kerneladdr_info.physical_base, k_kerneladdr_info.virtual_base);
-    kterm_printf_newline("Kernel stack size = 0x%x", KERNEL_STACK_SIZE);
-    kterm_printf_newline("MMAP:");
-    size_t usableMemSize = 0;
-    size_t usableSections = 0;
-    size_t totalMemory = 0;
-    for(uint64_t i=0; i<k_memmap_info.entry_count; i++){
-        totalMemory += k_memmap_info.entries[i]->length;
-        char* typestr;
-        switch(k_memmap_info.entries[i]->type){
-            case LIMINE_MEMMAP_USABLE:
-                typestr = "MEMMAP_USABLE";
-                usableMemSize += k_memmap_info.entries[i]->length;
-                usableSections++;
-                break;
-            case LIMINE_MEMMAP_RESERVED:
-                typestr = "MEMMAP_RESERVED";
-                totalMemory -= k_memmap_info.entries[i]->length;
-                break;
-            case LIMINE_MEMMAP_ACPI_RECLAIMABLE:
-                typestr = "MEMMAP_ACPI_RECLAIMABLE";
-                break;
-            case LIMINE_MEMMAP_ACPI_NVS:
-                typestr = "MEMMAP_ACPI_NVS";
-                break;
-            case LIMINE_MEMMAP_BAD_MEMORY:
-                typestr = "MEMMAP_BAD_MEMORY";
-                break;
-            case LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE:
-                typestr = "MEMMAP_BOOTLOADER_RECLAIMABLE";
-                break;
-            case LIMINE_MEMMAP_KERNEL_AND_MODULES:
-                typestr = "MEMMAP_KERNEL_AND_MODULES";
-                break;
-            case LIMINE_MEMMAP_FRAMEBUFFER:
-                typestr = "MEMMAP_FRAMEBUFFER";
-                break;
-            default:
-                typestr = "UNKNOWN";
-                break;
-        }
-        kterm_printf_newline("  Base=0x%x Length=0x%x Type=%s", 
-                k_memmap_info.entries[i]->base,
-                k_memmap_info.entries[i]->length,
-                typestr);
-    }
-    kterm_printf_newline("Usable mem size: %u bytes across %u sections", usableMemSize, usableSections);
-    kterm_printf_newline("Total mem size (not incl MEMMAP_RESERVED): %u bytes", totalMemory);
+    bootprof_begin("sysinfo + pmm stats");
+    kprintf("Framebuffer (virtual) address: %p\n", k_framebuffer.address);
+    kprintf("Framebuffer height: %lu\n", k_framebuffer.height);
+    kprintf("Framebuffer width: %lu\n", k_framebuffer.width);
+    kprintf("Framebuffer BPP: %u\n", k_framebuffer.bpp);
+    kprintf("Bytemap base: 0x%lx\n", g_kbytemap_info.base_phys);
+    kprintf("Bytemap size (bytes): %u (0x%x), (n_pages): %u\n", g_kbytemap_info.size_npages * PAGE_SIZE, g_kbytemap_info.size_npages * PAGE_SIZE, g_kbytemap_info.size_npages);
+    kprintf("Kernel physical base addr=0x%lx Virtual base addr=0x%lx\n", k_kerneladdr_info.physical_base, k_kerneladdr_info.virtual_base);
+    kprintf("Kernel stack size = 0x%x\n", KERNEL_STACK_SIZE);
+    pmm_stats_dump();
+
+    /*
+        Boot stage timings. make bootprof asks (through fw_cfg) for the VM to be stopped at the
+        end of kmain, after the benchmarks.
+    */
+    bootprof_report();
     
     /*
         Bootloader reclaimable sections could now be set to usable sections, as we will no longer
@@ -259,12 +375,63 @@ void kmain(void) {
     uint64_t test_physaddr = (uint64_t)pmm_alloc_pages(1);
     uint64_t* test_virtaddr_arr = (uint64_t*)vmm_map_phys2virt(test_physaddr, 0xffffffffffff0000, 0x3);
     test_virtaddr_arr[0] = 0xffffffffffff0000;
-    kterm_printf_newline("0x%x", test_virtaddr_arr[0]);
+    kprintf("0x%lx\n", test_virtaddr_arr[0]);
     uint64_t test_physaddr2 = (uint64_t)pmm_alloc_pages(1);
     uint64_t* test_virtaddr_arr2 = (uint64_t*)vmm_map_phys2virt(test_physaddr2, 0x0000000133700000, 0x3);
     test_virtaddr_arr2[0] = 0x0000000133700000;
-    kterm_printf_newline("0x%x", test_virtaddr_arr2[0]);
+    kprintf("0x%lx\n", test_virtaddr_arr2[0]);
+
+    /*
+        First user program (user/), mapped straight from the initramfs
+    */
+    const struct initramfs_file* hello = initramfs_find("/bin/hello");
+    if(hello != NULL){
+        exec_spawn("hello", hello->phys, hello->size, SCHED_PRIORITY_NORMAL);
+    }
+    // Bad buffers passed to write(), must come back -EFAULT rather than fault the kernel (exits with 0)
+    const struct initramfs_file* efault = initramfs_find("/bin/efault");
+    if(efault != NULL){
+        exec_spawn("efault", efault->phys, efault->size, SCHED_PRIORITY_NORMAL);
+    }
 
+    /*
+        Microbenchmarks, with BENCH=1 or when make kbench asks for them through fw_cfg
+    */
+    if(kbench_requested()){
+        kbench_run_all();
+    }
+#ifdef KCONFIG_BENCH
+    timer_wheel_bench();
+    sched_bench_pingpong();
+    syscall_bench();
+    kparallel_bench();
+    ipc_ring_bench();
+    if(hello != NULL){
+        exec_bench("hello", hello->phys, hello->size);
+    }
+#endif
+#ifdef KCONFIG_LOCKSTAT
+    lockstat_dump();
+#endif
+
+    /*
+        Send anything the enabled trace points recorded to the host (tools/trace_decode.py).
+        The log is held back meanwhile, the dump goes to the UART directly.
+    */
+    if(trace_count() > 0){
+        dmesg_pause();
+        trace_dump();
+        dmesg_resume();
+    }
+#ifdef KCONFIG_PROFILE
+    profile_dump();     // tools/profile_symbolize.py
+#endif
+    dmesg_drain();
+    serial_tx_flush();
+    if(bootprof_exit_requested()){
+        qemu_debug_exit(0);
+    }
 
-    khalt();
+    sched_become_idle();
+    kidle();
 }
@@ -1,8 +1,8 @@
 #include "gdt.h"
 
-#define GDT_SIZE 5
-
-gdt_entry_t gdt_entries[GDT_SIZE] = {0};
+#include "smp/percpu.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
 
 gdt_entry_t gdt_create_entry(uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity){
     gdt_entry_t entry;
@@ -16,13 +16,49 @@ gdt_entry_t gdt_create_entry(uint32_t base, uint32_t limit, uint8_t access, uint
     return entry;
 }
 
+/*
+    Top of the executing CPU's stack for IST entry ist, mapped on first use. The slot's lowest page
+    stays unmapped as the guard.
+*/
+static uint64_t _gdt_ist_stack(uint32_t cpu_id, int ist){
+    uint64_t slot = GDT_IST_REGION_BASE + ((uint64_t)cpu_id * GDT_IST_COUNT + (ist - 1)) * GDT_IST_SLOT_SIZE;
+    uint64_t base = slot + PAGE_SIZE;
+    if(vmm_space_translate(&g_vmm_kernel_space, base) == 0){
+        for(int i=0; i<GDT_IST_STACK_PAGES; i++){
+            uint64_t phys = (uint64_t)pmm_alloc_pages(1);
+            vmm_map_phys2virt(phys, base + i*PAGE_SIZE, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_NO_EXECUTE);
+        }
+    }
+    return base + GDT_IST_STACK_PAGES*PAGE_SIZE;
+}
+
+/*
+    Build and load the executing CPU's GDT and TSS (both live in its per-CPU block).
+    GS base must already point at the per-CPU block.
+*/
 void gdt_setup(){
     asm("cli");
+    struct percpu* cpu = percpu_current();
+    gdt_entry_t* gdt_entries = cpu->gdt;
+
     gdt_entries[0] = gdt_create_entry(0, 0, 0, 0);
-    gdt_entries[1] = gdt_create_entry(0, 0xFFFFF, 0x9A, 0xCF);
+    gdt_entries[1] = gdt_create_entry(0, 0xFFFFF, 0x9A, 0xAF); // L bit set, D clear: 64-bit code
     gdt_entries[2] = gdt_create_entry(0, 0xFFFFF, 0x92, 0xCF);
-    gdt_entries[3] = gdt_create_entry(0, 0xFFFFF, 0xFA, 0xCF);
-    gdt_entries[4] = gdt_create_entry(0, 0xFFFFF, 0xF2, 0xCF);
-    gdt_set_gdt((sizeof(gdt_entry_t)*GDT_SIZE)-1, (uintptr_t)&gdt_entries);
-    //gdt_reload_segments();
-}
\ No newline at end of file
+    gdt_entries[3] = gdt_create_entry(0, 0xFFFFF, 0xF2, 0xCF);
+    gdt_entries[4] = gdt_create_entry(0, 0xFFFFF, 0xFA, 0xAF); // DPL3 64-bit code
+
+    // System descriptors are 16 bytes, the second entry holds bits 32-63 of the base
+    uint64_t tss_base = (uint64_t)&cpu->tss;
+    cpu->tss.iomap_base = sizeof(struct tss); // No I/O permission bitmap
+    for(int ist=1; ist<=GDT_IST_COUNT; ist++){
+        cpu->tss.ist[ist - 1] = _gdt_ist_stack(cpu->cpu_id, ist);
+    }
+    gdt_entries[5] = gdt_create_entry(tss_base & 0xFFFFFFFF, sizeof(struct tss) - 1, 0x89, 0x00);
+    gdt_entries[6] = (gdt_entry_t){0};
+    gdt_entries[6].limit_low = (tss_base >> 32) & 0xFFFF;
+    gdt_entries[6].base_low = (tss_base >> 48) & 0xFFFF;
+
+    gdt_set_gdt((sizeof(gdt_entry_t)*GDT_SIZE)-1, (uintptr_t)gdt_entries);
+    gdt_reload_segments();
+    asm volatile("ltr %w0" :: "r"(GDT_TSS));
+}
@@ -3,6 +3,36 @@
 
 #include <stdint.h>
 
+#include "constants.h"
+
+/*
+    Null, kernel code/data, user data/code, then the 16 byte TSS descriptor (two entries).
+    SYSRET derives both user selectors from one base (see syscall_init_cpu()), which fixes the
+    user data-then-code order right after kernel data.
+*/
+#define GDT_SIZE                7
+#define GDT_KERNEL_CODE         0x08
+#define GDT_KERNEL_DATA         0x10
+#define GDT_USER_DATA           0x18
+#define GDT_USER_CODE           0x20
+#define GDT_TSS                 0x28
+
+/*
+    Interrupt stack table. The exceptions that can hit at any instruction (NMI, machine check) or
+    mean the current stack can't be trusted (double fault, e.g. a kernel stack overflow into its
+    guard page) switch to a known-good stack of their own CPU. Each is GDT_IST_STACK_PAGES PMM
+    pages with an unmapped guard page below, in a per CPU slot above GDT_IST_REGION_BASE.
+    #PF stays on the thread's stack: its handlers can switch threads, which an IST stack, reused
+    by the next fault on the CPU, can't survive.
+*/
+#define GDT_IST_DOUBLE_FAULT    1
+#define GDT_IST_NMI             2
+#define GDT_IST_MACHINE_CHECK   3
+#define GDT_IST_COUNT           3
+#define GDT_IST_STACK_PAGES     2
+#define GDT_IST_REGION_BASE     0xffffff4000000000UL
+#define GDT_IST_SLOT_SIZE       ((GDT_IST_STACK_PAGES + 1) * PAGE_SIZE)   // Guard page + stack
+
 struct gdt_entry_struct{
     uint16_t limit_low; // lim 0-15
     uint16_t base_low; // base 0-15
@@ -13,9 +43,22 @@ struct gdt_entry_struct{
 }__attribute__((packed));
 typedef struct gdt_entry_struct gdt_entry_t;
 
+/*
+    64-bit task state segment. Only used for the privilege-change and IST stacks.
+*/
+struct tss{
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+}__attribute__((packed));
+
 gdt_entry_t gdt_create_entry(uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity);
 void gdt_setup();
 extern void gdt_set_gdt(uint16_t limit, uintptr_t base);
-//extern void gdt_reload_segments();
+extern void gdt_reload_segments();
 
 #endif
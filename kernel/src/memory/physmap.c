@@ -0,0 +1,33 @@
+#include "physmap.h"
+
+#include "vmm.h"
+
+/*
+    Translate limine identity mapped pages to physical addr.
+    DOES NOT WORK FOR HIGHER-HALF KERNEL ADDRS!
+    Use limine provided kernel address information to translate
+    higher half addrs to physical addrs
+*/
+uint64_t translateaddr_idmap_v2p_limine(uint64_t lvaddr){
+    return lvaddr - 0xffff800000000000;
+}
+
+uint64_t translateaddr_idmap_p2v_limine(uint64_t addr){
+    return addr + 0xffff800000000000;
+}
+
+uint64_t translateaddr_idmap_v2p(uint64_t vaddr){
+    if(g_vmm_usingLiminePageTables){
+        return translateaddr_idmap_v2p_limine(vaddr);
+    } else {
+        return vaddr - VMM_IDENTITY_MAP_OFFSET;
+    }
+}
+
+uint64_t translateaddr_idmap_p2v(uint64_t addr){
+    if(g_vmm_usingLiminePageTables){
+        return translateaddr_idmap_p2v_limine(addr);
+    } else {
+        return addr + VMM_IDENTITY_MAP_OFFSET;
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef PHYSMAP_H
+#define PHYSMAP_H
+
+#include <stdint.h>
+
+/*
+    Physical <-> virtual translation for memory reached through a direct map: Limine's HHDM
+    until vmm_switchCR3(), VMM_IDENTITY_MAP_OFFSET after it.
+    Kept out of vmm.c so hosted builds (tools/hosted) can point these at a host memory arena.
+*/
+uint64_t translateaddr_idmap_v2p_limine(uint64_t lvaddr);
+uint64_t translateaddr_idmap_p2v_limine(uint64_t addr);
+
+uint64_t translateaddr_idmap_v2p(uint64_t vaddr);
+uint64_t translateaddr_idmap_p2v(uint64_t addr);
+
+#endif
@@ -1,33 +1,54 @@
 #include "pmm.h"
 
+#include "debugging/kbench.h"
+#include "debugging/kprint.h"
+
 struct bytemap_info g_kbytemap_info = {0, 0};
 uint32_t _pmm_bytemap_free_page_cache = 0;
+struct pmm_stats g_pmm_stats = {0};
+
+// Protects the bytemap, _pmm_bytemap_free_page_cache and g_pmm_stats
+DEFINE_MCS_LOCK(_pmm_lock, "pmm");
+
+// Copy of the memmap for pmm_stats_dump(), Limine's goes away with its page tables
+static struct limine_memmap_entry _pmm_regions[PMM_STATS_MAX_REGIONS];
+static uint64_t _pmm_region_count = 0;
 
 
 void pmm_setup_bytemap(struct limine_memmap_response memmap_response){
-    // Get size of all memory
+    g_pmm_stats = (struct pmm_stats){0};
+    _pmm_region_count = 0;
+    for(uint64_t i=0; i<memmap_response.entry_count && i<PMM_STATS_MAX_REGIONS; i++){
+        _pmm_regions[_pmm_region_count++] = *memmap_response.entries[i];
+    }
+
+    // The bytemap is indexed by page number, so it has to reach the end of the highest RAM section
+    // (holes included). Reserved/MMIO ranges above it never get an entry.
     size_t totalMemory = 0;
     for(uint64_t i=0; i<memmap_response.entry_count; i++){
-        totalMemory += memmap_response.entries[i]->length;
+        uint64_t type = memmap_response.entries[i]->type;
+        uint64_t end = memmap_response.entries[i]->base + memmap_response.entries[i]->length;
+        if((type == LIMINE_MEMMAP_USABLE || type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE || type == LIMINE_MEMMAP_KERNEL_AND_MODULES) && end > totalMemory){
+            totalMemory = end;
+        }
     }
-    
+
+    uint32_t bytemap_size_npages = ((totalMemory / PAGE_SIZE) / PAGE_SIZE) + 1;
+    uint32_t bytemap_size_bytes = bytemap_size_npages * 0x1000;
+
     // Find first section in mmap that can fit the entire bytemap as one continuous chunk
     uint64_t bytemap_base = UINT64_MAX;
     for(uint64_t i=0; i<memmap_response.entry_count; i++){
-        if(memmap_response.entries[i]->type == LIMINE_MEMMAP_USABLE && memmap_response.entries[i]->length > totalMemory / PAGE_SIZE){
+        if(memmap_response.entries[i]->type == LIMINE_MEMMAP_USABLE && memmap_response.entries[i]->length >= bytemap_size_bytes){
             bytemap_base = memmap_response.entries[i]->base;
-            debug_serial_printf("Found mem section usable for bytemap at base addr: 0x%x with length 0x%x\n", bytemap_base, memmap_response.entries[i]->length);
+            debug_serial_printf("Found mem section usable for bytemap at base addr: 0x%lx with length 0x%lx\n", bytemap_base, memmap_response.entries[i]->length);
             break;
         }
     }
     if(bytemap_base == UINT64_MAX){
-        debug_serial_printf("FATAL ERR: no usable memory section found for bytemap\n");
-        khalt();
+        kpanic("no usable memory section found for bytemap");
     }
 
-    uint32_t bytemap_size_npages = ((totalMemory / PAGE_SIZE) / PAGE_SIZE) + 1;
-    uint32_t bytemap_size_bytes = bytemap_size_npages * 0x1000;
-
     // Fill the bytemap with PAGE_USED
     uint64_t bytemap_base_virtual = translateaddr_idmap_p2v(bytemap_base);
     for(uint32_t i=0; i < bytemap_size_bytes; i++) {
@@ -40,18 +61,21 @@ void pmm_setup_bytemap(struct limine_memmap_response memmap_response){
             uint64_t usable_section_base = memmap_response.entries[i]->base;
             uint64_t usable_section_base_page = usable_section_base / PAGE_SIZE;
             uint64_t usable_section_len_pages = memmap_response.entries[i]->length / PAGE_SIZE;
-            debug_serial_printf("Usable section at base 0x%x (page no %u) with len %u pages\n", usable_section_base, usable_section_base_page, usable_section_len_pages);
+            debug_serial_printf("Usable section at base 0x%lx (page no %lu) with len %lu pages\n", usable_section_base, usable_section_base_page, usable_section_len_pages);
             for(uint64_t i=usable_section_base_page; i<usable_section_base_page+usable_section_len_pages; i++){
                 ((uint8_t*)bytemap_base_virtual)[i] = 0b00000001;
             }
+            g_pmm_stats.total_pages += usable_section_len_pages;
         }
     }
 
     // Now mark the pages the bytemap itself is sitting in as used
-    uint32_t bytemap_start_page = (bytemap_base/PAGE_SIZE)-1;
+    uint32_t bytemap_start_page = bytemap_base/PAGE_SIZE;
     for(uint32_t i=0; i<bytemap_size_npages; i++){
         ((uint8_t*)bytemap_base_virtual)[bytemap_start_page+i] = 0b00000000;
     }
+    g_pmm_stats.total_pages -= bytemap_size_npages;
+    g_pmm_stats.free_pages = g_pmm_stats.total_pages;
 
     // Now the bytemap can be used to find free pages of memory
     g_kbytemap_info.base_phys = bytemap_base;
@@ -60,7 +84,23 @@ void pmm_setup_bytemap(struct limine_memmap_response memmap_response){
 
 
 
-void* pmm_alloc_pages(const int n_pages){
+static inline uint32_t _pmm_stats_bucket(uint64_t value){
+    uint32_t bucket = (value == 0)? 0 : 64 - __builtin_clzll(value);
+    return (bucket < PMM_STATS_BUCKETS)? bucket : PMM_STATS_BUCKETS - 1;
+}
+
+static void _pmm_stats_alloc(int n_pages, uint64_t scanned){
+    g_pmm_stats.alloc_calls++;
+    g_pmm_stats.alloc_size_hist[_pmm_stats_bucket(n_pages)]++;
+    g_pmm_stats.scan_hist[_pmm_stats_bucket(scanned)]++;
+    g_pmm_stats.scanned += scanned;
+    if(scanned > g_pmm_stats.scanned_max){
+        g_pmm_stats.scanned_max = scanned;
+    }
+}
+
+
+static void* _pmm_alloc_pages_locked(const int n_pages){
     void* allocStartAddr = NULL;
 
     // Find N free pages in the bytemap
@@ -69,34 +109,55 @@ void* pmm_alloc_pages(const int n_pages){
 
     uint8_t* bytemap_vaddr = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
 
-    for(uint32_t i=_pmm_bytemap_free_page_cache; i<g_kbytemap_info.size_npages*0x1000; i++){
-        if(bytemap_vaddr[i] & 0b00000001){
-            for(int j=0; j<n_pages; j++){
-                if(!(bytemap_vaddr[i+j] & 0b00000001)){
-                    i+=j;
-                    break;
-                }
-                if(j==n_pages-1){
-                    allocStartAddr = (void*)(long)(i*PAGE_SIZE);
-                    // mark from i to i+n_pages as used
-                    for(int np = 0; np < n_pages; np++){
-                        bytemap_vaddr[i+np] = 0b00000000;
+    // Scan up from _pmm_bytemap_free_page_cache first, then wrap around to everything below it
+    uint32_t n_entries = g_kbytemap_info.size_npages*0x1000;
+    for(int pass=0; pass<2; pass++){
+        uint32_t start = (pass == 0)? _pmm_bytemap_free_page_cache : 0;
+        uint32_t end = (pass == 0)? n_entries : _pmm_bytemap_free_page_cache + n_pages - 1;
+        if(end > n_entries){
+            end = n_entries;
+        }
+        for(uint32_t i=start; i+n_pages<=end; i++){
+            if(bytemap_vaddr[i] & 0b00000001){
+                for(int j=0; j<n_pages; j++){
+                    if(!(bytemap_vaddr[i+j] & 0b00000001)){
+                        i+=j;
+                        break;
+                    }
+                    if(j==n_pages-1){
+                        allocStartAddr = (void*)((uint64_t)i*PAGE_SIZE);
+                        // mark from i to i+n_pages as used
+                        for(int np = 0; np < n_pages; np++){
+                            bytemap_vaddr[i+np] = 0b00000000;
+                        }
+                        TRACE(TRACE_PMM_ALLOC, n_pages, (uint64_t)allocStartAddr, i - start);
+                        _pmm_stats_alloc(n_pages, (pass == 0)? i - start : (n_entries - _pmm_bytemap_free_page_cache) + i);
+                        g_pmm_stats.alloc_pages += n_pages;
+                        g_pmm_stats.free_pages -= n_pages;
+                        g_pmm_stats.wraps += pass;
+                        _pmm_bytemap_free_page_cache = i+n_pages;
+                        return allocStartAddr;
                     }
-                    _pmm_bytemap_free_page_cache = i+n_pages;
-                    return allocStartAddr;
                 }
             }
         }
-
-        // If exhausted everything above _pmm_bytemap_free_page_cache, then check everything below it.
-        // todo (we wont come close to running out of memory for now.)
     }
+    g_pmm_stats.alloc_failed++;
+    _pmm_stats_alloc(n_pages, n_entries);
+    return NULL;
+}
+
+void* pmm_alloc_pages(const int n_pages){
+    struct mcs_node node;
+    uint64_t rflags = mcs_lock_irqsave(&_pmm_lock, &node);
+    void* allocStartAddr = _pmm_alloc_pages_locked(n_pages);
+    mcs_unlock_irqrestore(&_pmm_lock, &node, rflags);
 
     // We could trust the caller to check for null addr from this function,
     // but right now nah
-    debug_serial_printf("FATAL ERR: PMM_OOM\n");
-    khalt();
-
+    if(allocStartAddr == NULL){
+        kpanic("PMM_OOM");
+    }
     return allocStartAddr;
 }
 
@@ -104,11 +165,174 @@ void* pmm_alloc_pages(const int n_pages){
 
 void pmm_free_page(const int pageN){
     uint8_t* bytemap_vaddr = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
-    bytemap_vaddr[pageN] |= 0b00000001;
+    struct mcs_node node;
+    uint64_t rflags = mcs_lock_irqsave(&_pmm_lock, &node);
+    if(bytemap_vaddr[pageN] >> PMM_PAGE_REF_SHIFT){
+        // Shared: somebody else still has it
+        bytemap_vaddr[pageN] -= 1 << PMM_PAGE_REF_SHIFT;
+        g_pmm_stats.ref_drops++;
+        mcs_unlock_irqrestore(&_pmm_lock, &node, rflags);
+        return;
+    }
+    g_pmm_stats.free_calls++;
+    if(bytemap_vaddr[pageN] & PMM_PAGE_FREE){
+        g_pmm_stats.double_frees++;
+    }else{
+        g_pmm_stats.free_pages++;
+    }
+    bytemap_vaddr[pageN] = PMM_PAGE_FREE;
+    mcs_unlock_irqrestore(&_pmm_lock, &node, rflags);
+    TRACE(TRACE_PMM_FREE, pageN);
 }
 
 
 
 void pmm_free_page_physaddr(uint64_t physical_address){
     pmm_free_page(physical_address / PAGE_SIZE);
-}
\ No newline at end of file
+}
+
+
+/*
+    One more reference to a used page: it takes one more free to release it.
+    Returns false, taking nothing, if the page is free or already has PMM_PAGE_REF_MAX extra references.
+*/
+bool pmm_page_ref(uint64_t physical_address){
+    uint8_t* bytemap_vaddr = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint64_t pageN = physical_address / PAGE_SIZE;
+    struct mcs_node node;
+    uint64_t rflags = mcs_lock_irqsave(&_pmm_lock, &node);
+    uint8_t entry = bytemap_vaddr[pageN];
+    bool ok = !(entry & PMM_PAGE_FREE) && (entry >> PMM_PAGE_REF_SHIFT) < PMM_PAGE_REF_MAX;
+    if(ok){
+        bytemap_vaddr[pageN] = entry + (1 << PMM_PAGE_REF_SHIFT);
+        g_pmm_stats.refs++;
+    }
+    mcs_unlock_irqrestore(&_pmm_lock, &node, rflags);
+    return ok;
+}
+
+// References held to a page, 0 if it is free
+uint32_t pmm_page_refcount(uint64_t physical_address){
+    uint8_t* bytemap_vaddr = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint8_t entry = bytemap_vaddr[physical_address / PAGE_SIZE];
+    return (entry & PMM_PAGE_FREE)? 0 : (entry >> PMM_PAGE_REF_SHIFT) + 1;
+}
+
+
+
+static void _pmm_fragmentation_locked(struct pmm_fragmentation* out){
+    uint8_t* bytemap_vaddr = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint64_t n_entries = (uint64_t)g_kbytemap_info.size_npages*PAGE_SIZE;
+    *out = (struct pmm_fragmentation){0};
+    uint64_t run = 0;
+    for(uint64_t i=0; i<=n_entries; i++){
+        if(i < n_entries && (bytemap_vaddr[i] & 0b00000001)){
+            out->free_pages++;
+            run++;
+            continue;
+        }
+        if(run > 0){
+            out->free_runs++;
+            if(run > out->largest_run){
+                out->largest_run = run;
+            }
+        }
+        run = 0;
+    }
+    if(out->free_pages > 0){
+        out->fragmentation_permille = 1000 - (uint32_t)(out->largest_run * 1000 / out->free_pages);
+    }
+}
+
+void pmm_fragmentation(struct pmm_fragmentation* out){
+    struct mcs_node node;
+    uint64_t rflags = mcs_lock_irqsave(&_pmm_lock, &node);
+    _pmm_fragmentation_locked(out);
+    mcs_unlock_irqrestore(&_pmm_lock, &node, rflags);
+}
+
+
+const char* pmm_memmap_type_str(uint64_t type){
+    switch(type){
+        case LIMINE_MEMMAP_USABLE:                  return "USABLE";
+        case LIMINE_MEMMAP_RESERVED:                return "RESERVED";
+        case LIMINE_MEMMAP_ACPI_RECLAIMABLE:        return "ACPI_RECLAIMABLE";
+        case LIMINE_MEMMAP_ACPI_NVS:                return "ACPI_NVS";
+        case LIMINE_MEMMAP_BAD_MEMORY:              return "BAD_MEMORY";
+        case LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE:  return "BOOTLOADER_RECLAIMABLE";
+        case LIMINE_MEMMAP_KERNEL_AND_MODULES:      return "KERNEL_AND_MODULES";
+        case LIMINE_MEMMAP_FRAMEBUFFER:             return "FRAMEBUFFER";
+        default:                                    return "UNKNOWN";
+    }
+}
+
+
+static void _pmm_stats_print_hist(const char* name, const uint64_t* hist){
+    char line[KPRINT_BUF_SIZE];
+    size_t len = ksnprintf(line, sizeof(line), "  %s:", name);
+    for(uint32_t b=0; b<PMM_STATS_BUCKETS && len<sizeof(line); b++){
+        if(hist[b] == 0){
+            continue;
+        }
+        uint64_t low = (b == 0)? 0 : 1UL << (b-1);
+        if(b <= 1){
+            len += ksnprintf(line+len, sizeof(line)-len, " %lu=%lu", low, hist[b]);
+        }else if(b == PMM_STATS_BUCKETS-1){
+            len += ksnprintf(line+len, sizeof(line)-len, " %lu+=%lu", low, hist[b]);
+        }else{
+            len += ksnprintf(line+len, sizeof(line)-len, " %lu-%lu=%lu", low, (1UL << b) - 1, hist[b]);
+        }
+    }
+    kprintf("%s\n", line);
+}
+
+/*
+    Print the counters, the fragmentation of free memory and how many pages of every memmap region
+    are free. Everything is snapshotted under the lock and printed after it is dropped.
+*/
+void pmm_stats_dump(){
+    static uint64_t region_free[PMM_STATS_MAX_REGIONS];
+    struct pmm_fragmentation frag;
+    struct pmm_stats stats;
+
+    struct mcs_node node;
+    uint64_t rflags = mcs_lock_irqsave(&_pmm_lock, &node);
+    stats = g_pmm_stats;
+    _pmm_fragmentation_locked(&frag);
+    uint8_t* bytemap_vaddr = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint64_t n_entries = (uint64_t)g_kbytemap_info.size_npages*PAGE_SIZE;
+    for(uint64_t r=0; r<_pmm_region_count; r++){
+        region_free[r] = 0;
+        uint64_t first = _pmm_regions[r].base / PAGE_SIZE;
+        uint64_t end = (_pmm_regions[r].base + _pmm_regions[r].length) / PAGE_SIZE;
+        for(uint64_t i=first; i<end && i<n_entries; i++){
+            region_free[r] += bytemap_vaddr[i] & 0b00000001;
+        }
+    }
+    mcs_unlock_irqrestore(&_pmm_lock, &node, rflags);
+
+    kprintf("PMM: %lu of %lu pages free (%lu of %lu MiB), %lu runs, largest %lu pages, fragmentation %u.%03u\n",
+            stats.free_pages, stats.total_pages, stats.free_pages * PAGE_SIZE >> 20, stats.total_pages * PAGE_SIZE >> 20,
+            frag.free_runs, frag.largest_run, frag.fragmentation_permille / 1000, frag.fragmentation_permille % 1000);
+    kprintf("  %-29s %-22s %10s %10s\n", "region", "type", "free", "used");
+    for(uint64_t r=0; r<_pmm_region_count; r++){
+        uint64_t n_pages = _pmm_regions[r].length / PAGE_SIZE;
+        kprintf("  0x%012lx-0x%012lx %-22s %10lu %10lu\n", _pmm_regions[r].base, _pmm_regions[r].base + _pmm_regions[r].length - 1,
+                pmm_memmap_type_str(_pmm_regions[r].type), region_free[r], n_pages - region_free[r]);
+    }
+    kprintf("  allocs %lu (%lu pages, %lu failed, %lu wrapped), frees %lu (%lu double), shared refs %lu taken, %lu dropped\n",
+            stats.alloc_calls, stats.alloc_pages, stats.alloc_failed, stats.wraps, stats.free_calls, stats.double_frees,
+            stats.refs, stats.ref_drops);
+    kprintf("  entries scanned %lu, max %lu, mean %lu\n", stats.scanned, stats.scanned_max,
+            stats.alloc_calls? stats.scanned / stats.alloc_calls : 0);
+    _pmm_stats_print_hist("alloc pages", stats.alloc_size_hist);
+    _pmm_stats_print_hist("scan length", stats.scan_hist);
+}
+
+
+static void _pmm_bench_alloc_free(void* arg){
+    (void)arg;
+    pmm_free_page_physaddr((uint64_t)pmm_alloc_pages(1));
+}
+
+KBENCH(pmm_alloc_free_page, .fn = _pmm_bench_alloc_free);
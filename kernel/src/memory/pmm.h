@@ -7,11 +7,21 @@
 
 #include "util/utility.h"
 #include "debugging/serialout.h"
+#include "debugging/panic.h"
+#include "debugging/trace.h"
+#include "sync/spinlock.h"
 
 #include "vmm.h"
 
 #include "constants.h"
 
+/*
+    Bytemap entry bits, see the layout at the end of this file
+*/
+#define PMM_PAGE_FREE           0x01
+#define PMM_PAGE_REF_SHIFT      1
+#define PMM_PAGE_REF_MAX        127     // Extra references a used page can hold
+
 struct bytemap_info{
     uint64_t base_phys;
     uint32_t size_npages;
@@ -19,10 +29,57 @@ struct bytemap_info{
 
 extern struct bytemap_info g_kbytemap_info;
 
+/*
+    Allocator counters, always on. They are updated under the PMM lock, next to the bytemap
+    accesses they count, so they cost a few adds per call.
+    Histograms use log2 buckets: bucket 0 counts zeroes, bucket b counts values in [2^(b-1), 2^b),
+    the last bucket everything above.
+*/
+#define PMM_STATS_BUCKETS       16
+#define PMM_STATS_MAX_REGIONS   64      // Memmap entries remembered for the per region breakdown
+#define PMM_STATS_CMD_DUMP      'M'     // Serial command, see serial_command_register()
+
+struct pmm_stats{
+    uint64_t total_pages;       // Usable pages at setup, minus the bytemap
+    uint64_t free_pages;
+    uint64_t alloc_calls;
+    uint64_t alloc_pages;
+    uint64_t alloc_failed;
+    uint64_t free_calls;
+    uint64_t double_frees;      // Frees of pages that were already free
+    uint64_t refs;              // pmm_page_ref() calls that took a reference
+    uint64_t ref_drops;         // Frees that only dropped a reference to a shared page
+    uint64_t wraps;             // Allocations that found nothing above the free page cache
+    uint64_t scanned;           // Bytemap entries stepped over before the allocated run, all calls
+    uint64_t scanned_max;
+    uint64_t alloc_size_hist[PMM_STATS_BUCKETS];    // By n_pages
+    uint64_t scan_hist[PMM_STATS_BUCKETS];          // By bytemap entries stepped over
+};
+
+/*
+    Free memory layout, computed by walking the bytemap.
+    fragmentation_permille = 1000 * (1 - largest_run / free_pages): 0 when all free memory is one
+    run, approaching 1000 as it splinters into small runs.
+*/
+struct pmm_fragmentation{
+    uint64_t free_pages;
+    uint64_t free_runs;
+    uint64_t largest_run;
+    uint32_t fragmentation_permille;
+};
+
+extern struct pmm_stats g_pmm_stats;
+
 void pmm_setup_bytemap(struct limine_memmap_response memmap_response);
 void* pmm_alloc_pages(const int n_pages);
 void pmm_free_page(const int pageN);
 void pmm_free_page_physaddr(uint64_t physical_address);
+bool pmm_page_ref(uint64_t physical_address);
+uint32_t pmm_page_refcount(uint64_t physical_address);
+
+void pmm_fragmentation(struct pmm_fragmentation* out);
+void pmm_stats_dump();
+const char* pmm_memmap_type_str(uint64_t type);
 
 #endif
 
@@ -32,5 +89,7 @@ void pmm_free_page_physaddr(uint64_t physical_address);
     Each byte represents a page of memory (0x1000 bytes)
     The byte contains the following information (counting from LSB as 1st bit):
         1st bit : PAGE_FREE : 1=FREE, 0=USED
-        2nd bit -- 8th bit  : unused for now
+        2nd bit -- 8th bit  : references to a used page beyond the first (copy-on-write sharing).
+                              A free drops one of these while there are any, and only frees the
+                              page once it is down to a single owner.
 */
\ No newline at end of file
@@ -1,41 +1,23 @@
 #include "vmm.h"
 
-bool g_vmm_usingLiminePageTables = true;
+#include "debugging/kbench.h"
+#include "util/kstring.h"
 
-uint64_t* _vmm_PML4_physAddr = NULL;
+#define VMM_PTE_ADDR_MASK       0x000FFFFFFFFFF000UL
+#define VMM_PML4_INDEX(addr)    (((addr) >> 39) & 0b111111111)
 
-/*
-    Translate limine identity mapped pages to physical addr.
-    DOES NOT WORK FOR HIGHER-HALF KERNEL ADDRS!
-    Use limine provided kernel address information to translate
-    higher half addrs to physical addrs
-*/
-uint64_t translateaddr_idmap_v2p_limine(uint64_t lvaddr){
-    return lvaddr - 0xffff800000000000;
-}
+bool g_vmm_usingLiminePageTables = true;
 
-uint64_t translateaddr_idmap_p2v_limine(uint64_t addr){
-    return addr + 0xffff800000000000;
-}
+uint64_t* _vmm_PML4_physAddr = NULL;
 
-uint64_t translateaddr_idmap_v2p(uint64_t vaddr){
-    if(g_vmm_usingLiminePageTables){
-        return translateaddr_idmap_v2p_limine(vaddr);
-    } else {
-        return vaddr - VMM_IDENTITY_MAP_OFFSET;
-    }
-}
+struct vmm_space g_vmm_kernel_space = {0, true};
+struct vmm_cow_stats g_vmm_cow_stats;
 
-uint64_t translateaddr_idmap_p2v(uint64_t addr){
-    if(g_vmm_usingLiminePageTables){
-        return translateaddr_idmap_p2v_limine(addr);
-    } else {
-        return addr + VMM_IDENTITY_MAP_OFFSET;
-    }
-}
+// Address space pool, like the scheduler's thread pool. Protected by _vmm_lock.
+static struct vmm_space _vmm_spaces[VMM_MAX_SPACES];
 
 
-void vmm_setup(const struct limine_memmap_response memmap_response){
+void vmm_setup(const struct limine_memmap_response memmap_response, uint64_t kernel_physical_base){
     // Allocate a page for PML4
     _vmm_PML4_physAddr = (uint64_t*)pmm_alloc_pages(1);
     // Zero out PML4 (using its virtual address from limine, as we have not yet switched to our own page tables)
@@ -51,15 +33,19 @@ void vmm_setup(const struct limine_memmap_response memmap_response){
         Map kernel
         ===
     */
-    // Get kernel base + len
-    uint64_t kernel_physical_addr;
-    uint64_t kernel_length;
+    // Get kernel base + len. Boot modules are KERNEL_AND_MODULES entries too: pick the kernel's by its base.
+    uint64_t kernel_physical_addr = 0;
+    uint64_t kernel_length = 0;
     for(uint64_t i=0; i<memmap_response.entry_count; i++){
-        if(memmap_response.entries[i]->type == LIMINE_MEMMAP_KERNEL_AND_MODULES){
-            kernel_physical_addr = memmap_response.entries[i]->base;
-            kernel_length = memmap_response.entries[i]->length;
+        struct limine_memmap_entry* entry = memmap_response.entries[i];
+        if(entry->type == LIMINE_MEMMAP_KERNEL_AND_MODULES && kernel_physical_base >= entry->base && kernel_physical_base < entry->base + entry->length){
+            kernel_physical_addr = entry->base;
+            kernel_length = entry->length;
         }
     }
+    if(kernel_length == 0){
+        kpanic("vmm: no memmap entry holds the kernel (0x%lx)", kernel_physical_base);
+    }
     // Map kernel to higher half 0xffffffff80000000
     for(int i=0; i<(int)(kernel_length / PAGE_SIZE)+1; i++){
         vmm_map_phys2virt(kernel_physical_addr + (i*PAGE_SIZE), 0xffffffff80000000 + (i*PAGE_SIZE), 0x03);
@@ -71,8 +57,7 @@ void vmm_setup(const struct limine_memmap_response memmap_response){
         ===
     */
     // Map stack
-    uint64_t rsp_val;
-    asm("mov %%rsp, %0" : "=r"(rsp_val));
+    uint64_t rsp_val = cpu_read_rsp();
     //kterm_printf_newline("RSP (virtual): 0x%x", rsp_val);
     uint64_t rsp_val_phys = translateaddr_idmap_v2p(rsp_val);
     //kterm_printf_newline("RSP (translated to physical): 0x%x", rsp_val);
@@ -86,6 +71,16 @@ void vmm_setup(const struct limine_memmap_response memmap_response){
         ===
     */
     vmm_identity_map_n_pages(g_kbytemap_info.base_phys, g_kbytemap_info.size_npages, 0x3);
+
+    /*
+        Create every top-level entry address spaces share with the kernel (about 1.2MiB of tables),
+        so the copies vmm_space_create() takes never go out of date.
+        Still single threaded here, _vmm_lock isn't needed.
+    */
+    for(uint64_t i=VMM_PML4_INDEX(VMM_USER_TOP); i<512; i++){
+        vmm_iterate_table((uint64_t)_vmm_PML4_physAddr, i, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    }
+    g_vmm_kernel_space.pml4_phys = (uint64_t)_vmm_PML4_physAddr;
     
     /*
         Switch to new page table
@@ -95,6 +90,16 @@ void vmm_setup(const struct limine_memmap_response memmap_response){
     debug_serial_printf("OK!\n");
 }
 
+/*
+    Protects the page tables. Held across a whole mapping, including any tables it allocates.
+*/
+DEFINE_SPINLOCK(_vmm_lock, "vmm");
+
+static uint64_t _vmm_map_phys2virt_locked(uint64_t pml4_phys, uint64_t phys_addr, uint64_t virt_addr, uint64_t flags);
+
+/*
+    Caller must hold _vmm_lock.
+*/
 uint64_t vmm_iterate_table(uint64_t table_physical_address, uint16_t offset, uint64_t flags){
     uint64_t flagFilter = 0b1000000000000000000000000000000000000000000000000000111111111111; // These bits are allowed to be set by the flags parameter.
     uint64_t* table_virtual_address = (uint64_t*)translateaddr_idmap_p2v((uint64_t)table_physical_address);
@@ -113,7 +118,7 @@ uint64_t vmm_iterate_table(uint64_t table_physical_address, uint16_t offset, uin
         }
 
         // Identity map page so that it can be read/written in order to zero it (if post- cr3 switch), but also in order to fill it with data later on.
-        vmm_identity_map_page(next_table_physical_address, 0x3);
+        _vmm_map_phys2virt_locked((uint64_t)_vmm_PML4_physAddr, next_table_physical_address, next_table_physical_address + VMM_IDENTITY_MAP_OFFSET, 0x3);
 
         // Once we are on our own, we can only zero out a page after it has been identity mapped.
         // Im still not 100% sure if this is bug free. Needs testing...
@@ -124,9 +129,11 @@ uint64_t vmm_iterate_table(uint64_t table_physical_address, uint16_t offset, uin
             }
         }
 
-        // Apply flags to table entry
-        table_virtual_address[offset] |= flags;
+        TRACE(TRACE_VMM_NEW_TABLE, next_table_physical_address, table_physical_address, offset);
     }
+    // Apply flags to table entry. Also to existing tables: a user page under a table first
+    // created for kernel mappings needs the user bit on every level above it.
+    table_virtual_address[offset] |= flags;
     return next_table_physical_address;
 }
 
@@ -136,6 +143,13 @@ uint64_t vmm_iterate_table(uint64_t table_physical_address, uint16_t offset, uin
     Creates additional tables as required.
 */
 uint64_t vmm_map_phys2virt(uint64_t phys_addr, uint64_t virt_addr, uint64_t flags){
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    uint64_t res = _vmm_map_phys2virt_locked((uint64_t)_vmm_PML4_physAddr, phys_addr, virt_addr, flags);
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return res;
+}
+
+static uint64_t _vmm_map_phys2virt_locked(uint64_t pml4_phys, uint64_t phys_addr, uint64_t virt_addr, uint64_t flags){
     /*
         Extract page table offsets from virtual address
     */
@@ -162,16 +176,45 @@ uint64_t vmm_map_phys2virt(uint64_t phys_addr, uint64_t virt_addr, uint64_t flag
     uint64_t PTE = (flags) 
                     | ((phys_addr / PAGE_SIZE) << PAGE_BITSIZE);
 
-    uint64_t PDP_physAddr = vmm_iterate_table((uint64_t)_vmm_PML4_physAddr, va_PML4_offset, flags);
-    uint64_t PD_physAddr = vmm_iterate_table(PDP_physAddr, va_PDP_offset, flags);
+    // Caching/NX bits only make sense on the leaf entry
+    uint64_t table_flags = flags & VMM_TABLE_FLAGS_MASK;
+    uint64_t PDP_physAddr = vmm_iterate_table(pml4_phys, va_PML4_offset, table_flags);
+    uint64_t PD_physAddr = vmm_iterate_table(PDP_physAddr, va_PDP_offset, table_flags);
 
-    uint64_t PT_physAddr = vmm_iterate_table(PD_physAddr, va_PD_offset, flags);
+    uint64_t PT_physAddr = vmm_iterate_table(PD_physAddr, va_PD_offset, table_flags);
     uint64_t* PT_virtAddr = (uint64_t*)translateaddr_idmap_p2v((uint64_t)PT_physAddr);
     PT_virtAddr[va_PT_offset] = PTE;
+    TRACE(TRACE_VMM_MAP, phys_addr, virt_addr, flags);
 
     return virt_addr;
 }
 
+/*
+    Find the leaf PTE for virt_addr without creating tables. Caller must hold _vmm_lock.
+*/
+static uint64_t* _vmm_lookup_pte(uint64_t pml4_phys, uint64_t virt_addr){
+    uint64_t table_physical_address = pml4_phys;
+    for(int shift=39; shift>12; shift-=9){
+        uint64_t* table = (uint64_t*)translateaddr_idmap_p2v(table_physical_address);
+        uint64_t entry = table[(virt_addr >> shift) & 0b111111111];
+        if(!(entry & VMM_FLAG_PRESENT)){
+            return NULL;
+        }
+        table_physical_address = entry & VMM_PTE_ADDR_MASK;
+    }
+    uint64_t* PT_virtAddr = (uint64_t*)translateaddr_idmap_p2v(table_physical_address);
+    return &PT_virtAddr[(virt_addr >> 12) & 0b111111111];
+}
+
+/*
+    Remove the mapping for one page and flush it from this CPU's TLB.
+    Returns the physical address it pointed to, or 0 if nothing was mapped.
+    Other CPUs are not shot down, only use this for mappings no other CPU has touched.
+*/
+uint64_t vmm_unmap_page(uint64_t virt_addr){
+    return vmm_space_unmap(&g_vmm_kernel_space, virt_addr);
+}
+
 uint64_t vmm_identity_map_page(uint64_t phys_addr, uint64_t flags){
     return vmm_map_phys2virt(phys_addr, phys_addr + VMM_IDENTITY_MAP_OFFSET, flags);
 }
@@ -188,6 +231,267 @@ uint64_t vmm_identity_map_n_pages(uint64_t phys_base_addr, int n_pages, uint64_t
 }
 
 void vmm_switchCR3(){
-    asm volatile("mov %0, %%cr3" :: "r"((uint64_t)_vmm_PML4_physAddr));
+    cpu_write_cr3((uint64_t)_vmm_PML4_physAddr);
     g_vmm_usingLiminePageTables = false;
-}
\ No newline at end of file
+}
+
+
+/*
+    New address space: empty user half, the kernel's top-level entries above VMM_USER_TOP.
+    Returns NULL when the pool is exhausted.
+*/
+struct vmm_space* vmm_space_create(){
+    uint64_t pml4_phys = (uint64_t)pmm_alloc_pages(1);
+    vmm_identity_map_page(pml4_phys, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    uint64_t* pml4 = (uint64_t*)translateaddr_idmap_p2v(pml4_phys);
+    uint64_t* kernel_pml4 = (uint64_t*)translateaddr_idmap_p2v((uint64_t)_vmm_PML4_physAddr);
+
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    struct vmm_space* space = NULL;
+    for(int i=0; i<VMM_MAX_SPACES; i++){
+        if(!_vmm_spaces[i].in_use){
+            space = &_vmm_spaces[i];
+            space->in_use = true;
+            space->pml4_phys = pml4_phys;
+            break;
+        }
+    }
+    if(space != NULL){
+        for(uint64_t i=0; i<512; i++){
+            pml4[i] = (i < VMM_PML4_INDEX(VMM_USER_TOP))? 0 : kernel_pml4[i];
+        }
+    }
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+
+    if(space == NULL){
+        pmm_free_page_physaddr(pml4_phys);
+    }
+    return space;
+}
+
+
+// Free the tables below table_phys (a level 4/3/2 table) and the pages they map as VMM_FLAG_OWNED
+static void _vmm_space_free_tables(uint64_t table_phys, int level, uint64_t first, uint64_t end){
+    uint64_t* table = (uint64_t*)translateaddr_idmap_p2v(table_phys);
+    for(uint64_t i=first; i<end; i++){
+        if(!(table[i] & VMM_FLAG_PRESENT)){
+            continue;
+        }
+        uint64_t next_phys = table[i] & VMM_PTE_ADDR_MASK;
+        if(level > 1){
+            _vmm_space_free_tables(next_phys, level - 1, 0, 512);
+            pmm_free_page_physaddr(next_phys);
+        }else if(table[i] & VMM_FLAG_OWNED){
+            pmm_free_page_physaddr(next_phys);
+        }
+    }
+}
+
+/*
+    Free the user half of an address space (tables and owned pages) and the space itself.
+    It must not be loaded on any CPU.
+*/
+void vmm_space_destroy(struct vmm_space* space){
+    if(space == &g_vmm_kernel_space){
+        kpanic("vmm: can't destroy the kernel address space");
+    }
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    _vmm_space_free_tables(space->pml4_phys, 4, 0, VMM_PML4_INDEX(VMM_USER_TOP));
+    pmm_free_page_physaddr(space->pml4_phys);
+    space->pml4_phys = 0;
+    space->in_use = false;
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+}
+
+
+uint64_t vmm_space_map(struct vmm_space* space, uint64_t phys_addr, uint64_t virt_addr, uint64_t flags){
+    if(space != &g_vmm_kernel_space && virt_addr >= VMM_USER_TOP){
+        kpanic("vmm: 0x%lx is in the shared kernel half", virt_addr);
+    }
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    uint64_t res = _vmm_map_phys2virt_locked(space->pml4_phys, phys_addr, virt_addr, flags);
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return res;
+}
+
+
+// vmm_unmap_page() for any address space
+uint64_t vmm_space_unmap(struct vmm_space* space, uint64_t virt_addr){
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    uint64_t phys_addr = 0;
+    uint64_t* pte = _vmm_lookup_pte(space->pml4_phys, virt_addr);
+    if(pte != NULL && (*pte & VMM_FLAG_PRESENT)){
+        phys_addr = *pte & VMM_PTE_ADDR_MASK;
+        *pte = 0;
+        cpu_invlpg(virt_addr);
+    }
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return phys_addr;
+}
+
+
+// Physical address virt_addr maps to in space, 0 if it isn't mapped
+uint64_t vmm_space_translate(struct vmm_space* space, uint64_t virt_addr){
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    uint64_t phys_addr = 0;
+    uint64_t* pte = _vmm_lookup_pte(space->pml4_phys, virt_addr);
+    if(pte != NULL && (*pte & VMM_FLAG_PRESENT)){
+        phys_addr = (*pte & VMM_PTE_ADDR_MASK) | (virt_addr & (PAGE_SIZE - 1));
+    }
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return phys_addr;
+}
+
+
+/*
+    True if every page of [virt_addr, virt_addr+len) is present and user accessible in space.
+    For syscalls that read user memory in ring 0, where a page fault would be fatal.
+*/
+bool vmm_space_user_range_mapped(struct vmm_space* space, uint64_t virt_addr, uint64_t len){
+    if(len == 0){
+        return true;
+    }
+    uint64_t required = VMM_FLAG_PRESENT | VMM_FLAG_USER;
+    bool mapped = true;
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    uint64_t last = (virt_addr + len - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    for(uint64_t page = virt_addr & ~(uint64_t)(PAGE_SIZE - 1); ; page += PAGE_SIZE){
+        uint64_t* pte = _vmm_lookup_pte(space->pml4_phys, page);
+        if(pte == NULL || (*pte & required) != required){
+            mapped = false;
+            break;
+        }
+        if(page == last){
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return mapped;
+}
+
+
+void vmm_space_switch(struct vmm_space* space){
+    cpu_write_cr3(space->pml4_phys);
+}
+
+
+// A page for a clone, direct mapped. Caller must hold _vmm_lock.
+static uint64_t _vmm_alloc_page_locked(){
+    uint64_t phys = (uint64_t)pmm_alloc_pages(1);
+    _vmm_map_phys2virt_locked((uint64_t)_vmm_PML4_physAddr, phys, phys + VMM_IDENTITY_MAP_OFFSET, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    return phys;
+}
+
+// Copy the tables under src_table (a level 4/3/2/1 table) into dst_table, sharing the owned pages
+static void _vmm_clone_table(uint64_t src_table_phys, uint64_t dst_table_phys, int level, uint64_t first, uint64_t end){
+    uint64_t* src = (uint64_t*)translateaddr_idmap_p2v(src_table_phys);
+    uint64_t* dst = (uint64_t*)translateaddr_idmap_p2v(dst_table_phys);
+    for(uint64_t i=first; i<end; i++){
+        uint64_t entry = src[i];
+        if(!(entry & VMM_FLAG_PRESENT)){
+            continue;
+        }
+        uint64_t phys = entry & VMM_PTE_ADDR_MASK;
+        if(level > 1){
+            uint64_t table_phys = _vmm_alloc_page_locked();
+            memset((void*)translateaddr_idmap_p2v(table_phys), 0, PAGE_SIZE);
+            dst[i] = table_phys | (entry & ~VMM_PTE_ADDR_MASK);
+            g_vmm_cow_stats.tables_copied++;
+            _vmm_clone_table(phys, table_phys, level - 1, 0, 512);
+            continue;
+        }
+        if(entry & VMM_FLAG_OWNED){
+            if(!pmm_page_ref(phys)){
+                // Out of reference bits: this clone gets its own copy right away
+                uint64_t copy_phys = _vmm_alloc_page_locked();
+                memcpy((void*)translateaddr_idmap_p2v(copy_phys), (void*)translateaddr_idmap_p2v(phys), PAGE_SIZE);
+                dst[i] = copy_phys | (entry & ~VMM_PTE_ADDR_MASK);
+                continue;
+            }
+            g_vmm_cow_stats.pages_shared++;
+            if(entry & (VMM_FLAG_WRITE | VMM_FLAG_COW)){
+                entry = (entry & ~VMM_FLAG_WRITE) | VMM_FLAG_COW;
+                src[i] = entry;
+            }
+        }
+        dst[i] = entry;
+    }
+}
+
+/*
+    New address space with the same user mappings as src, copy-on-write (see struct vmm_cow_stats).
+    Only the page tables are copied. src's TLB entries are flushed on this CPU, so it must not be
+    live on any other. Returns NULL when the pool is exhausted.
+*/
+struct vmm_space* vmm_space_clone(struct vmm_space* src){
+    struct vmm_space* dst = vmm_space_create();
+    if(dst == NULL){
+        return NULL;
+    }
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    _vmm_clone_table(src->pml4_phys, dst->pml4_phys, 4, 0, VMM_PML4_INDEX(VMM_USER_TOP));
+    g_vmm_cow_stats.clones++;
+    // Writable TLB entries for pages that just became copy-on-write
+    if((cpu_read_cr3() & VMM_PTE_ADDR_MASK) == src->pml4_phys){
+        cpu_write_cr3(src->pml4_phys);
+    }
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return dst;
+}
+
+
+/*
+    Write fault at virt_addr in space: if it hit a copy-on-write page, give this space a writable
+    page (its own copy unless nobody else holds the page any more) and return true so the write
+    can be retried. False for any other fault.
+*/
+bool vmm_space_cow_fault(struct vmm_space* space, uint64_t virt_addr){
+    uint64_t rflags = spin_lock_irqsave(&_vmm_lock);
+    uint64_t* pte = _vmm_lookup_pte(space->pml4_phys, virt_addr);
+    if(pte == NULL || (*pte & (VMM_FLAG_PRESENT | VMM_FLAG_COW)) != (VMM_FLAG_PRESENT | VMM_FLAG_COW)){
+        spin_unlock_irqrestore(&_vmm_lock, rflags);
+        return false;
+    }
+    g_vmm_cow_stats.faults++;
+    uint64_t phys = *pte & VMM_PTE_ADDR_MASK;
+    if(pmm_page_refcount(phys) > 1){
+        uint64_t copy_phys = _vmm_alloc_page_locked();
+        memcpy((void*)translateaddr_idmap_p2v(copy_phys), (void*)translateaddr_idmap_p2v(phys), PAGE_SIZE);
+        *pte = copy_phys | (*pte & ~VMM_PTE_ADDR_MASK);
+        pmm_free_page_physaddr(phys);   // Drops this space's reference
+        g_vmm_cow_stats.copies++;
+    }else{
+        g_vmm_cow_stats.reuses++;
+    }
+    *pte = (*pte | VMM_FLAG_WRITE) & ~VMM_FLAG_COW;
+    cpu_invlpg(virt_addr);
+    spin_unlock_irqrestore(&_vmm_lock, rflags);
+    return true;
+}
+
+
+/*
+    Map and unmap one page at a fixed scratch address. The page tables above it are created by
+    the first sample and reused after that.
+*/
+#define VMM_BENCH_VADDR 0xfffffe0000000000UL
+
+static uint64_t _vmm_bench_page = 0;
+
+static void _vmm_bench_setup(void* arg){
+    (void)arg;
+    _vmm_bench_page = (uint64_t)pmm_alloc_pages(1);
+}
+
+static void _vmm_bench_teardown(void* arg){
+    (void)arg;
+    pmm_free_page_physaddr(_vmm_bench_page);
+}
+
+static void _vmm_bench_map_unmap(void* arg){
+    (void)arg;
+    vmm_map_phys2virt(_vmm_bench_page, VMM_BENCH_VADDR, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    vmm_unmap_page(VMM_BENCH_VADDR);
+}
+
+KBENCH(vmm_map_unmap_page, .fn = _vmm_bench_map_unmap, .setup = _vmm_bench_setup, .teardown = _vmm_bench_teardown);
@@ -10,26 +10,93 @@
 
 #include "util/utility.h"
 #include "debugging/serialout.h"
+#include "debugging/trace.h"
+#include "sync/spinlock.h"
+#include "util/cpu.h"
 
 #include "pmm.h"
+#include "physmap.h"
 
 #define VMM_IDENTITY_MAP_OFFSET 0x666000000000
 
-extern bool g_vmm_usingLiminePageTables;
+/*
+    Page table entry flags
+*/
+#define VMM_FLAG_PRESENT        (1UL << 0)
+#define VMM_FLAG_WRITE          (1UL << 1)
+#define VMM_FLAG_USER           (1UL << 2)
+#define VMM_FLAG_WRITE_THROUGH  (1UL << 3)
+#define VMM_FLAG_CACHE_DISABLE  (1UL << 4)
+#define VMM_FLAG_OWNED          (1UL << 9)  // Software bit: the page belongs to the address space, freed with it
+#define VMM_FLAG_COW            (1UL << 10) // Software bit: writable, but shared read-only until the first write
+#define VMM_FLAG_NO_EXECUTE     (1UL << 63)
+
+// Device registers: uncached, so reads/writes reach the device in program order
+#define VMM_FLAGS_MMIO          (VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_WRITE_THROUGH | VMM_FLAG_CACHE_DISABLE)
+// Only these flags are propagated to the intermediate tables created for a mapping
+#define VMM_TABLE_FLAGS_MASK    (VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_USER)
+
+/*
+    Address spaces. Each has its own PML4, but everything from VMM_USER_TOP up (the direct map and
+    the kernel's higher half) points at the kernel's tables: vmm_setup() creates all of those
+    top-level entries up front, so kernel mappings made later show up in every address space.
+    User mappings must stay below VMM_USER_TOP.
+*/
+#define VMM_USER_TOP            (VMM_IDENTITY_MAP_OFFSET & ~((1UL << 39) - 1))
+#define VMM_MAX_SPACES          64
+
+/*
+    Page fault error code bits
+*/
+#define VMM_FAULT_PRESENT       (1UL << 0)  // Protection violation, not a missing page
+#define VMM_FAULT_WRITE         (1UL << 1)
+#define VMM_FAULT_USER          (1UL << 2)
 
-uint64_t translateaddr_idmap_v2p_limine(uint64_t lvaddr);
-uint64_t translateaddr_idmap_p2v_limine(uint64_t addr);
+struct vmm_space{
+    uint64_t pml4_phys;
+    bool in_use;
+};
 
-uint64_t translateaddr_idmap_v2p(uint64_t vaddr);
-uint64_t translateaddr_idmap_p2v(uint64_t addr);
+/*
+    Copy-on-write. vmm_space_clone() gives the clone the same owned pages, with a PMM reference
+    each (pmm_page_ref()), and turns every writable one read-only + VMM_FLAG_COW in both spaces.
+    The first write to such a page faults into vmm_space_cow_fault(): the last space holding the
+    page just gets write access back, any other makes its private copy.
+    Owned read-only pages are shared the same way, but never become writable. Pages the space
+    doesn't own (mapped from the initramfs, shared memory) keep their mapping as it is.
+*/
+struct vmm_cow_stats{
+    uint64_t clones;
+    uint64_t pages_shared;      // Owned pages clones took a reference to
+    uint64_t tables_copied;
+    uint64_t faults;
+    uint64_t copies;            // Faults that copied the page
+    uint64_t reuses;            // Faults on the last reference, made writable in place
+};
+
+extern struct vmm_cow_stats g_vmm_cow_stats;
+
+extern bool g_vmm_usingLiminePageTables;
+extern struct vmm_space g_vmm_kernel_space;
 
 void _vmm_internaL_zeropage(uint64_t* page);
 
-void vmm_setup(const struct limine_memmap_response memmap_req);
+void vmm_setup(const struct limine_memmap_response memmap_req, uint64_t kernel_physical_base);
 uint64_t vmm_iterate_table(uint64_t table_physical_address, uint16_t offset, uint64_t flags);
 uint64_t vmm_map_phys2virt(uint64_t phys_addr, uint64_t virt_addr, uint64_t flags);
+uint64_t vmm_unmap_page(uint64_t virt_addr);
 uint64_t vmm_identity_map_page(uint64_t phys_addr, uint64_t flags);
 uint64_t vmm_identity_map_n_pages(uint64_t phys_base_addr, int n_pages, uint64_t flags);
 void vmm_switchCR3();
 
+struct vmm_space* vmm_space_create();
+void vmm_space_destroy(struct vmm_space* space);
+uint64_t vmm_space_map(struct vmm_space* space, uint64_t phys_addr, uint64_t virt_addr, uint64_t flags);
+uint64_t vmm_space_unmap(struct vmm_space* space, uint64_t virt_addr);
+uint64_t vmm_space_translate(struct vmm_space* space, uint64_t virt_addr);
+bool vmm_space_user_range_mapped(struct vmm_space* space, uint64_t virt_addr, uint64_t len);
+void vmm_space_switch(struct vmm_space* space);
+struct vmm_space* vmm_space_clone(struct vmm_space* src);
+bool vmm_space_cow_fault(struct vmm_space* space, uint64_t virt_addr);
+
 #endif
\ No newline at end of file
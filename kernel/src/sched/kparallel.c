@@ -0,0 +1,294 @@
+#include "kparallel.h"
+
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "smp/smp.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+#include "interrupts/lapic.h"
+#include "debugging/kprint.h"
+#include "debugging/serialout.h"
+
+static struct kparallel_deque _kparallel_deques[KERNEL_MAX_CPUS];
+static bool _kparallel_ipi_ready = false;
+
+
+/*
+    Owner side. Only the CPU owning the deque calls these, with interrupts off so a thread switch
+    can't interleave two owners on the same deque.
+*/
+static bool _kparallel_push(struct kparallel_deque* dq, struct kparallel_range range){
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if(b - t >= KPARALLEL_DEQUE_SIZE){
+        return false;
+    }
+    dq->ranges[b & (KPARALLEL_DEQUE_SIZE-1)] = range;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static bool _kparallel_pop(struct kparallel_deque* dq, struct kparallel_range* range){
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    // The bottom store must be visible before top is read, or a thief could take the same entry
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if(t > b){
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *range = dq->ranges[b & (KPARALLEL_DEQUE_SIZE-1)];
+    if(t < b){
+        return true;
+    }
+
+    // Last entry: race the thieves for it
+    bool won = __atomic_compare_exchange_n(&dq->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+
+/*
+    Thief side, any CPU.
+    The entry is copied before the CAS. It can't be overwritten while top still points at it
+    (the owner never laps a live entry), so a successful CAS means the copy is intact.
+*/
+static bool _kparallel_steal(struct kparallel_deque* dq, struct kparallel_range* range){
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if(t >= b){
+        return false;
+    }
+    *range = *(volatile struct kparallel_range*)&dq->ranges[t & (KPARALLEL_DEQUE_SIZE-1)];
+    return __atomic_compare_exchange_n(&dq->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+
+/*
+    Run a range, splitting off upper halves for other CPUs until it is down to the grain.
+*/
+static void _kparallel_run(struct kparallel_deque* dq, struct kparallel_range range){
+    struct kparallel_job* job = range.job;
+    uint64_t rflags = cpu_irq_save();
+    while(range.end - range.start > job->grain){
+        uint64_t mid = range.start + (range.end - range.start) / 2;
+        struct kparallel_range upper = {job, mid, range.end};
+        if(!_kparallel_push(dq, upper)){
+            break;
+        }
+        range.end = mid;
+    }
+    cpu_irq_restore(rflags);
+
+    job->fn(range.start, range.end, job->arg);
+    dq->executed++;
+    // Last access to the job, the caller may return (and drop it off its stack) after this
+    __atomic_add_fetch(&job->done, range.end - range.start, __ATOMIC_RELEASE);
+}
+
+
+/*
+    Run one range from the local deque, or failing that one stolen from another CPU.
+    Returns false if there was nothing to do anywhere.
+*/
+bool kparallel_help(){
+    uint32_t self = cpu_current_id();
+    struct kparallel_deque* dq = &_kparallel_deques[self];
+    struct kparallel_range range;
+
+    uint64_t rflags = cpu_irq_save();
+    bool found = _kparallel_pop(dq, &range);
+    cpu_irq_restore(rflags);
+    if(found){
+        _kparallel_run(dq, range);
+        return true;
+    }
+
+    // Round robin over the other CPUs, starting after the last victim
+    for(uint32_t i=1; i<KERNEL_MAX_CPUS; i++){
+        uint32_t victim = (dq->next_victim + i) % KERNEL_MAX_CPUS;
+        if(victim == self || !g_percpu[victim].online){
+            continue;
+        }
+        if(_kparallel_steal(&_kparallel_deques[victim], &range)){
+            dq->next_victim = victim;
+            dq->steals++;
+            _kparallel_run(dq, range);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*
+    True if any deque still holds a range. kidle() checks this with interrupts off after
+    kparallel_help() came back empty, so work published in between (its wake IPI already taken
+    and gone) is picked up instead of slept through.
+*/
+bool kparallel_has_work(){
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        struct kparallel_deque* dq = &_kparallel_deques[id];
+        int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+        int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+        if(t < b){
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void _kparallel_wake_handler(struct interrupt_frame* frame){
+    (void)frame;    // Only here to get the CPU out of hlt, kidle() does the rest
+    lapic_eoi();
+}
+
+static void _kparallel_wake_others(){
+    if(!_kparallel_ipi_ready){
+        return;
+    }
+    // The pushed range must be visible before a woken CPU looks for it
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t self = cpu_current_id();
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        if(id != self && g_percpu[id].online){
+            lapic_send_ipi(g_percpu[id].lapic_id, KPARALLEL_WAKE_VECTOR);
+        }
+    }
+}
+
+
+/*
+    Requires the LAPIC. Without it kparallel_for() still works, but only the calling CPU runs.
+*/
+void kparallel_init(){
+    if(g_lapic.regs == NULL){
+        return;
+    }
+    interrupt_register_handler(KPARALLEL_WAKE_VECTOR, _kparallel_wake_handler);
+    _kparallel_ipi_ready = true;
+}
+
+
+/*
+    Call fn over [start, end) in pieces of at most about grain indices, on as many CPUs as pick
+    them up, and return once all of them have finished. The calling CPU works too.
+    fn must be safe to run concurrently on disjoint ranges.
+*/
+void kparallel_for(uint64_t start, uint64_t end, uint64_t grain, kparallel_fn_t fn, void* arg){
+    if(end <= start){
+        return;
+    }
+    if(grain == 0){
+        grain = 1;
+    }
+    if(g_smp_online_cpus == 1 || end - start <= grain){
+        fn(start, end, arg);
+        return;
+    }
+
+    struct kparallel_job job = {fn, arg, grain, end - start, 0};
+    struct kparallel_deque* dq = &_kparallel_deques[cpu_current_id()];
+    uint64_t rflags = cpu_irq_save();
+    bool pushed = _kparallel_push(dq, (struct kparallel_range){&job, start, end});
+    cpu_irq_restore(rflags);
+    if(!pushed){
+        fn(start, end, arg);
+        return;
+    }
+    _kparallel_wake_others();
+
+    // Help with whatever is around (this job or others) until ours is complete
+    while(__atomic_load_n(&job.done, __ATOMIC_ACQUIRE) < job.total){
+        if(!kparallel_help()){
+            cpu_pause();
+        }
+    }
+}
+
+
+void kparallel_stats_dump(){
+    kprintf("kparallel (cpu: ranges run, steals):\n");
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        if(g_percpu[id].online){
+            kprintf("  cpu%u: %lu, %lu\n", id, _kparallel_deques[id].executed, _kparallel_deques[id].steals);
+        }
+    }
+}
+
+
+/*
+    Scaling benchmark: each workload runs on the calling CPU alone, then through kparallel_for(),
+    best of KPARALLEL_BENCH_RUNS each. Boot with different -smp counts to compare
+    (make kparallel-scaling).
+*/
+#define KPARALLEL_BENCH_RUNS        5
+#define KPARALLEL_BENCH_ZERO_PAGES  16384   // 64 MiB
+
+static void _kparallel_bench_zero(uint64_t start, uint64_t end, void* arg){
+    uint8_t* base = arg;
+    uint64_t* words = (uint64_t*)(base + start*PAGE_SIZE);
+    uint64_t n = (end - start) * PAGE_SIZE / sizeof(uint64_t);
+    for(uint64_t i=0; i<n; i++){
+        words[i] = 0;
+    }
+}
+
+// PMM metadata pass: count free pages in the bytemap, one atomic add per range
+static uint64_t _kparallel_bench_free_pages;
+static void _kparallel_bench_count_free(uint64_t start, uint64_t end, void* arg){
+    const uint8_t* bytemap = arg;
+    uint64_t free = 0;
+    for(uint64_t i=start; i<end; i++){
+        free += bytemap[i] & 1;
+    }
+    __atomic_add_fetch(&_kparallel_bench_free_pages, free, __ATOMIC_RELAXED);
+}
+
+static void _kparallel_bench_one(const char* name, uint64_t n, uint64_t grain, kparallel_fn_t fn, void* arg){
+    uint64_t serial = UINT64_MAX;
+    uint64_t parallel = UINT64_MAX;
+    for(int run=0; run<KPARALLEL_BENCH_RUNS; run++){
+        uint64_t start = cpu_rdtsc_ordered();
+        fn(0, n, arg);
+        uint64_t mid = cpu_rdtsc_ordered();
+        kparallel_for(0, n, grain, fn, arg);
+        uint64_t end = cpu_rdtsc_ordered();
+        if(mid - start < serial){
+            serial = mid - start;
+        }
+        if(end - mid < parallel){
+            parallel = end - mid;
+        }
+    }
+    uint64_t serial_us = tsc_cycles_to_ns(serial) / NS_PER_US;
+    uint64_t parallel_us = tsc_cycles_to_ns(parallel) / NS_PER_US;
+    uint64_t speedup_x100 = serial * 100 / (parallel? parallel : 1);
+    kprintf("kparallel %s: %lu us on 1 CPU, %lu us on %u CPUs (%lu.%02lux)\n",
+            name, serial_us, parallel_us, g_smp_online_cpus, speedup_x100 / 100, speedup_x100 % 100);
+    debug_serial_printf("KPARALLEL workload=%s cpus=%u serial_us=%lu parallel_us=%lu\n",
+                        name, g_smp_online_cpus, serial_us, parallel_us);
+}
+
+void kparallel_bench(){
+    uint64_t zero_phys = (uint64_t)pmm_alloc_pages(KPARALLEL_BENCH_ZERO_PAGES);
+    void* zero_buf = (void*)vmm_identity_map_n_pages(zero_phys, KPARALLEL_BENCH_ZERO_PAGES, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    _kparallel_bench_one("zero-pages", KPARALLEL_BENCH_ZERO_PAGES, 64, _kparallel_bench_zero, zero_buf);
+    for(uint64_t i=0; i<KPARALLEL_BENCH_ZERO_PAGES; i++){
+        pmm_free_page_physaddr(zero_phys + i*PAGE_SIZE);
+    }
+
+    // Read-only pass over live metadata, a racing allocation only skews the (unused) count
+    void* bytemap = (void*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint64_t bytemap_len = (uint64_t)g_kbytemap_info.size_npages * PAGE_SIZE;
+    _kparallel_bench_one("pmm-bytemap-scan", bytemap_len, 16 * 1024, _kparallel_bench_count_free, bytemap);
+
+    kparallel_stats_dump();
+}
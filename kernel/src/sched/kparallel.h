@@ -0,0 +1,55 @@
+#ifndef KPARALLEL_H
+#define KPARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+/*
+    Work-stealing fork/join for bulk kernel work.
+
+    Every CPU owns a Chase-Lev deque of index ranges. The owner pushes and pops at the bottom
+    without atomics on the fast path, other CPUs steal from the top with a CAS. A CPU running a
+    range larger than the grain splits it in half, pushes the upper half and keeps going on the
+    lower one, so idle CPUs can always steal the biggest pieces still left.
+    Idle CPUs are woken with an IPI when work is published and steal from kidle() until every
+    deque is empty.
+*/
+#define KPARALLEL_DEQUE_SIZE    64      // Power of two. A full deque just stops splitting.
+#define KPARALLEL_WAKE_VECTOR   0x41
+
+typedef void (*kparallel_fn_t)(uint64_t start, uint64_t end, void* arg);
+
+struct kparallel_job{
+    kparallel_fn_t fn;
+    void* arg;
+    uint64_t grain;
+    uint64_t total;
+    uint64_t done;              // Indices finished, the caller waits for this to reach total
+};
+
+struct kparallel_range{
+    struct kparallel_job* job;
+    uint64_t start;
+    uint64_t end;
+};
+
+struct kparallel_deque{
+    int64_t top __attribute__((aligned(CACHE_LINE_SIZE)));     // Thieves
+    int64_t bottom __attribute__((aligned(CACHE_LINE_SIZE)));  // Owner
+    struct kparallel_range ranges[KPARALLEL_DEQUE_SIZE];
+    uint32_t next_victim;
+    uint64_t executed;
+    uint64_t steals;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+void kparallel_init();
+void kparallel_for(uint64_t start, uint64_t end, uint64_t grain, kparallel_fn_t fn, void* arg);
+bool kparallel_help();
+bool kparallel_has_work();
+void kparallel_stats_dump();
+void kparallel_bench();
+
+#endif
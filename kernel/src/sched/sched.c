@@ -0,0 +1,377 @@
+#include "sched.h"
+
+#include "util/cpu.h"
+#include "smp/percpu.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+#include "interrupts/lapic.h"
+#include "debugging/kprint.h"
+#include "debugging/panic.h"
+
+extern void sched_context_switch(uint64_t* save_rsp, uint64_t load_rsp);
+extern void sched_thread_entry();
+
+static struct sched_cpu _sched_cpus[KERNEL_MAX_CPUS];
+
+/*
+    Thread structs come from a fixed pool; a thread's index also picks its stack slot.
+*/
+static struct thread _sched_threads[SCHED_MAX_THREADS];
+DEFINE_SPINLOCK(_sched_pool_lock, "sched_pool");
+__attribute__((unused)) static struct lock_class _sched_rq_class = LOCK_CLASS_INIT("sched_rq");
+
+
+static inline struct sched_cpu* _sched_cpu_current(){
+    return &_sched_cpus[cpu_current_id()];
+}
+
+struct thread* sched_current(){
+    return _sched_cpu_current()->current;
+}
+
+
+static struct thread* _sched_thread_alloc(){
+    uint64_t rflags = spin_lock_irqsave(&_sched_pool_lock);
+    struct thread* thread = NULL;
+    for(uint32_t i=0; i<SCHED_MAX_THREADS; i++){
+        if(_sched_threads[i].state == THREAD_FREE){
+            thread = &_sched_threads[i];
+            *thread = (struct thread){0};
+            thread->id = i;
+            thread->state = THREAD_RUNNABLE;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&_sched_pool_lock, rflags);
+    return thread;
+}
+
+
+static void _sched_thread_free(struct thread* thread){
+    if(thread->stack_base != 0){
+        for(int i=0; i<SCHED_STACK_PAGES; i++){
+            uint64_t phys = vmm_unmap_page(thread->stack_base + i*PAGE_SIZE);
+            if(phys != 0){
+                pmm_free_page_physaddr(phys);
+            }
+        }
+    }
+    __atomic_store_n(&thread->state, THREAD_FREE, __ATOMIC_RELEASE);
+}
+
+
+/*
+    Run queue operations, called with the CPU's lock held
+*/
+static void _sched_enqueue(struct sched_cpu* rq, struct thread* thread){
+    int prio = thread->priority;
+    thread->next = NULL;
+    if(rq->tail[prio] != NULL){
+        rq->tail[prio]->next = thread;
+    }else{
+        rq->head[prio] = thread;
+    }
+    rq->tail[prio] = thread;
+    rq->nonempty |= 1 << prio;
+    rq->nr_queued++;
+}
+
+static struct thread* _sched_dequeue(struct sched_cpu* rq){
+    if(rq->nonempty == 0){
+        return NULL;
+    }
+    int prio = __builtin_ctz(rq->nonempty);
+    struct thread* thread = rq->head[prio];
+    rq->head[prio] = thread->next;
+    if(rq->head[prio] == NULL){
+        rq->tail[prio] = NULL;
+        rq->nonempty &= ~(1 << prio);
+    }
+    thread->next = NULL;
+    rq->nr_queued--;
+    return thread;
+}
+
+
+static void _sched_slice_expired(struct ktimer* timer, void* arg){
+    (void)timer;
+    ((struct sched_cpu*)arg)->need_resched = true;
+}
+
+
+/*
+    Second half of a switch, run by the thread being switched to: reap the previous thread if it
+    exited and drop the run queue lock taken by _sched_switch().
+*/
+static void _sched_finish_switch(struct sched_cpu* rq){
+    struct thread* dead = rq->dead;
+    rq->dead = NULL;
+    spin_unlock(&rq->lock);
+    if(dead != NULL){
+        _sched_thread_free(dead);
+    }
+}
+
+
+/*
+    Pick the next thread and switch to it. Interrupts must be disabled.
+    The current thread is re-queued unless it is the idle thread or has exited.
+*/
+static void _sched_switch(){
+    struct sched_cpu* rq = _sched_cpu_current();
+    spin_lock(&rq->lock);
+    rq->need_resched = false;
+
+    struct thread* prev = rq->current;
+    bool prev_runnable = prev->state == THREAD_RUNNING;
+    if(prev_runnable && prev != rq->idle){
+        prev->state = THREAD_RUNNABLE;
+        _sched_enqueue(rq, prev);
+    }
+
+    struct thread* next = _sched_dequeue(rq);
+    if(next == NULL){
+        next = (rq->idle != NULL)? rq->idle : prev;
+    }
+    if(next->state == THREAD_DEAD){
+        kpanic("cpu%u: no thread left to run", cpu_current_id());
+    }
+    next->state = THREAD_RUNNING;
+    if(next == prev){
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    // Only time slice while something else is waiting
+    if(rq->nr_queued > 0){
+        ktimer_arm_after(&rq->slice_timer, SCHED_TIMESLICE_NS);
+    }else{
+        ktimer_cancel(&rq->slice_timer);
+    }
+
+    if(prev->state == THREAD_DEAD){
+        rq->dead = prev;
+    }
+    rq->current = next;
+    rq->switches++;
+    next->switches_in++;
+    if(next->kernel_rsp != 0){
+        percpu_set_kernel_stack(next->kernel_rsp);
+    }
+    if(next->space != prev->space){
+        vmm_space_switch((next->space != NULL)? next->space : &g_vmm_kernel_space);
+    }
+    sched_context_switch(&prev->rsp, next->rsp);
+
+    // Running as prev again, possibly much later
+    _sched_finish_switch(_sched_cpu_current());
+}
+
+
+static void _sched_wake_handler(struct interrupt_frame* frame){
+    (void)frame;    // need_resched is already set, sched_irq_exit() switches
+    lapic_eoi();
+}
+
+
+/*
+    Turn the calling context (kmain on the BSP, smp_ap_main on APs) into this CPU's first thread.
+*/
+void sched_init_cpu(){
+    struct sched_cpu* rq = _sched_cpu_current();
+    spin_lock_init(&rq->lock, &_sched_rq_class);
+    ktimer_init(&rq->slice_timer, _sched_slice_expired, rq);
+    if(cpu_current_id() == 0 && g_lapic.regs != NULL){
+        interrupt_register_handler(SCHED_WAKE_VECTOR, _sched_wake_handler);
+    }
+
+    struct thread* thread = _sched_thread_alloc();
+    if(thread == NULL){
+        kpanic("sched: thread pool exhausted");
+    }
+    thread->name = (cpu_current_id() == 0)? "kmain" : "ap";
+    thread->cpu = cpu_current_id();
+    thread->priority = SCHED_PRIORITY_NORMAL;
+    thread->state = THREAD_RUNNING;
+    rq->current = thread;
+}
+
+
+/*
+    The calling thread becomes the idle thread: it is only picked when nothing else is runnable.
+*/
+void sched_become_idle(){
+    struct sched_cpu* rq = _sched_cpu_current();
+    uint64_t rflags = spin_lock_irqsave(&rq->lock);
+    rq->idle = rq->current;
+    rq->idle->priority = SCHED_PRIORITIES;
+    spin_unlock_irqrestore(&rq->lock, rflags);
+}
+
+
+/*
+    C entry of a new thread, reached through sched_thread_entry on its first switch-in.
+*/
+void sched_thread_start(struct thread* thread){
+    _sched_finish_switch(_sched_cpu_current());
+    asm volatile("sti" ::: "memory");
+    thread->fn(thread->arg);
+    sched_thread_exit();
+}
+
+
+/*
+    Create a thread on the calling CPU. It runs once the caller yields, is preempted, or takes an
+    interrupt (if it has a higher priority than the caller).
+*/
+struct thread* sched_thread_create(const char* name, thread_fn_t fn, void* arg, int priority){
+    struct thread* thread = _sched_thread_alloc();
+    if(thread == NULL){
+        return NULL;
+    }
+    thread->name = name;
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->priority = (priority < SCHED_PRIORITIES)? priority : SCHED_PRIORITIES-1;
+    thread->cpu = cpu_current_id();
+
+    /*
+        Stack: slot per thread id, the lowest page of the slot stays unmapped as a guard
+    */
+    uint64_t slot = SCHED_STACK_REGION_BASE + (uint64_t)thread->id * SCHED_STACK_SLOT_SIZE;
+    thread->stack_base = slot + PAGE_SIZE;
+    for(int i=0; i<SCHED_STACK_PAGES; i++){
+        uint64_t phys = (uint64_t)pmm_alloc_pages(1);
+        vmm_map_phys2virt(phys, thread->stack_base + i*PAGE_SIZE, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_NO_EXECUTE);
+    }
+
+    /*
+        Initial frame, popped by sched_context_switch: rbx, rbp, r12-r15 then the return address
+    */
+    uint64_t* sp = (uint64_t*)(thread->stack_base + SCHED_STACK_PAGES*PAGE_SIZE);
+    *--sp = 0;                              // Keeps rsp 16-byte aligned + 8 at thread entry, like after a call
+    *--sp = (uint64_t)sched_thread_entry;
+    *--sp = 0;                              // rbx
+    *--sp = 0;                              // rbp
+    *--sp = (uint64_t)thread;               // r12
+    *--sp = 0;                              // r13
+    *--sp = 0;                              // r14
+    *--sp = 0;                              // r15
+    thread->rsp = (uint64_t)sp;
+
+    struct sched_cpu* rq = _sched_cpu_current();
+    uint64_t rflags = spin_lock_irqsave(&rq->lock);
+    _sched_enqueue(rq, thread);
+    if(thread->priority < rq->current->priority){
+        rq->need_resched = true;
+    }
+    spin_unlock_irqrestore(&rq->lock, rflags);
+    return thread;
+}
+
+
+void sched_yield(){
+    uint64_t rflags = cpu_irq_save();
+    _sched_switch();
+    cpu_irq_restore(rflags);
+}
+
+
+/*
+    Blocking, see sched.h. Both with interrupts disabled.
+*/
+void sched_block_prepare(){
+    __atomic_store_n(&sched_current()->state, THREAD_BLOCKED, __ATOMIC_RELEASE);
+}
+
+void sched_block(){
+    _sched_switch();
+}
+
+/*
+    Make a blocked thread runnable again on its CPU. False if it wasn't blocked.
+*/
+bool sched_wake(struct thread* thread){
+    struct sched_cpu* rq = &_sched_cpus[thread->cpu];
+    uint64_t rflags = spin_lock_irqsave(&rq->lock);
+    bool woken = thread->state == THREAD_BLOCKED;
+    bool kick = false;
+    if(woken){
+        // May still be running if it hasn't reached sched_block() yet, _sched_switch() copes
+        thread->state = THREAD_RUNNABLE;
+        _sched_enqueue(rq, thread);
+        if(thread->priority < rq->current->priority){
+            rq->need_resched = true;
+            kick = thread->cpu != cpu_current_id();
+        }
+    }
+    spin_unlock_irqrestore(&rq->lock, rflags);
+    if(kick && g_lapic.regs != NULL){
+        lapic_send_ipi(g_percpu[thread->cpu].lapic_id, SCHED_WAKE_VECTOR);
+    }
+    return woken;
+}
+
+
+void sched_thread_exit(){
+    cpu_irq_save();
+    sched_current()->state = THREAD_DEAD;
+    _sched_switch();
+    kpanic("sched: dead thread was scheduled");
+}
+
+
+bool sched_has_runnable(){
+    return _sched_cpu_current()->nr_queued > 0;
+}
+
+
+/*
+    Called at the end of every interrupt: switch if a time slice ran out or a higher priority
+    thread became runnable. Before sched_init_cpu() there is nothing to switch to.
+*/
+void sched_irq_exit(){
+    struct sched_cpu* rq = _sched_cpu_current();
+    if(__builtin_expect(rq->need_resched, 0) && rq->current != NULL){
+        _sched_switch();
+    }
+}
+
+
+/*
+    Two threads yielding to each other, above the priority of everything else, so every yield is
+    a switch between them.
+*/
+#define SCHED_BENCH_ROUNDS 100000
+
+static volatile uint64_t _sched_bench_start;
+static volatile uint64_t _sched_bench_end;
+
+static void _sched_bench_thread(void* arg){
+    bool first = arg != NULL;
+    if(first){
+        sched_yield();  // Let the partner reach its loop too
+        _sched_bench_start = cpu_rdtsc();
+    }
+    for(int i=0; i<SCHED_BENCH_ROUNDS; i++){
+        sched_yield();
+    }
+    if(!first){
+        _sched_bench_end = cpu_rdtsc();
+    }
+}
+
+void sched_bench_pingpong(){
+    // Create both before either can run, otherwise the first would just yield to itself
+    uint64_t rflags = cpu_irq_save();
+    sched_thread_create("ping", _sched_bench_thread, (void*)1, SCHED_PRIORITY_HIGH);
+    sched_thread_create("pong", _sched_bench_thread, NULL, SCHED_PRIORITY_HIGH);
+    cpu_irq_restore(rflags);
+    sched_yield();  // Returns once both have exited
+
+    uint64_t switches = 2 * (uint64_t)SCHED_BENCH_ROUNDS;
+    uint64_t cycles = _sched_bench_end - _sched_bench_start;
+    kprintf("Context switch ping-pong: %lu switches, %lu cycles/switch (%lu ns)\n",
+            switches, cycles / switches, tsc_cycles_to_ns(cycles) / switches);
+}
@@ -0,0 +1,100 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "sync/spinlock.h"
+#include "time/tsc.h"
+#include "time/timerwheel.h"
+
+/*
+    Preemptive kernel threads with per-CPU run queues.
+
+    Each CPU has a FIFO per priority level (0 is the highest) and always runs the first thread
+    of the highest non-empty level. Threads are created on, and stay on, the CPU that creates them.
+    Equal-priority threads are time sliced: while others are waiting, a ktimer marks the running
+    thread for preemption after SCHED_TIMESLICE_NS, and the switch happens on interrupt exit.
+    The context that called sched_init_cpu() becomes the CPU's idle thread once it calls
+    sched_become_idle(), and runs only when the queues are empty.
+
+    A thread waiting for something leaves the run queues: it marks itself with sched_block_prepare()
+    while whatever it waits for is still protected by the waker's lock, drops that lock and calls
+    sched_block(). sched_wake() from any CPU queues it again, and kicks that CPU with an IPI if the
+    thread should preempt what it runs. A wake between the two calls makes sched_block() return
+    right away. Waiters must recheck their condition, sched_block() can also return early when
+    there is nothing else to switch to.
+
+    Stacks are SCHED_STACK_PAGES PMM pages mapped in a dedicated region, each with an unmapped
+    guard page below it, so an overflow faults instead of corrupting a neighbour.
+*/
+#define SCHED_MAX_THREADS       256
+#define SCHED_PRIORITIES        4
+#define SCHED_PRIORITY_HIGH     0
+#define SCHED_PRIORITY_NORMAL   1
+#define SCHED_PRIORITY_LOW      3
+#define SCHED_TIMESLICE_NS      (10 * NS_PER_MS)
+#define SCHED_WAKE_VECTOR       0x43
+
+#define SCHED_STACK_PAGES       4
+#define SCHED_STACK_REGION_BASE 0xffffff0000000000UL
+#define SCHED_STACK_SLOT_SIZE   ((SCHED_STACK_PAGES + 1) * PAGE_SIZE)   // Guard page + stack
+
+enum thread_state{
+    THREAD_FREE,
+    THREAD_RUNNABLE,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+typedef void (*thread_fn_t)(void* arg);
+
+struct vmm_space;
+
+struct thread{
+    uint64_t rsp;               // Saved stack pointer while switched out
+    uint32_t id;
+    uint32_t cpu;
+    int priority;
+    enum thread_state state;
+    const char* name;
+    thread_fn_t fn;
+    void* arg;
+    uint64_t stack_base;        // Lowest mapped stack address, 0 for boot/AP contexts
+    uint64_t kernel_rsp;        // Kernel stack for entries from ring 3, 0 unless in usermode_enter()
+    struct vmm_space* space;    // Address space loaded while it runs, NULL for the kernel's
+    uint64_t switches_in;
+    struct thread* next;        // Run queue link
+};
+
+struct sched_cpu{
+    struct spinlock lock;
+    uint32_t nonempty;          // Bit per priority level with queued threads
+    uint32_t nr_queued;
+    struct thread* head[SCHED_PRIORITIES];
+    struct thread* tail[SCHED_PRIORITIES];
+    struct thread* current;
+    struct thread* idle;
+    struct thread* dead;        // Exited thread waiting to be reaped by the next one to run
+    bool need_resched;
+    struct ktimer slice_timer;
+    uint64_t switches;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+void sched_init_cpu();
+void sched_become_idle();
+struct thread* sched_thread_create(const char* name, thread_fn_t fn, void* arg, int priority);
+void sched_yield();
+void sched_block_prepare();
+void sched_block();
+bool sched_wake(struct thread* thread);
+__attribute__((noreturn)) void sched_thread_exit();
+bool sched_has_runnable();
+void sched_irq_exit();
+struct thread* sched_current();
+void sched_bench_pingpong();
+
+#endif
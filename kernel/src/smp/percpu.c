@@ -0,0 +1,14 @@
+#include "percpu.h"
+
+struct percpu g_percpu[KERNEL_MAX_CPUS];
+
+/*
+    Point the executing CPU's GS base at its per-CPU block.
+    The BSP calls this before anything else in kmain, so cpu_current_id() works everywhere.
+*/
+void percpu_init(uint32_t cpu_id){
+    struct percpu* cpu = &g_percpu[cpu_id];
+    cpu->self = cpu;
+    cpu->cpu_id = cpu_id;
+    cpu_wrmsr(CPU_MSR_GS_BASE, (uint64_t)cpu);
+}
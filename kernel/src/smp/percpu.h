@@ -0,0 +1,56 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "util/cpu.h"
+#include "memory/gdt.h"
+
+/*
+    Per-CPU data block, reached through the GS base of the CPU that owns it.
+    The first fields have fixed offsets, they are read from assembly and from cpu_current_id().
+*/
+struct percpu{
+    struct percpu* self;        // 0: lets percpu_current() read a plain pointer out of GS
+    uint32_t cpu_id;            // 8: CPU_PERCPU_ID_OFFSET
+    uint32_t lapic_id;          // 12
+    uint64_t stack_top;         // 16: PERCPU_STACK_TOP_OFFSET, loaded by the AP trampoline
+    uint64_t kernel_rsp;        // 24: stack for SYSCALL entry (syscall-entry.nas), same as TSS RSP0
+    uint64_t user_rsp;          // 32: user rsp, saved by the SYSCALL entry before switching stacks
+    bool online;
+    gdt_entry_t gdt[GDT_SIZE];
+    struct tss tss;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+#define PERCPU_STACK_TOP_OFFSET 16
+#define PERCPU_KERNEL_RSP_OFFSET 24
+#define PERCPU_USER_RSP_OFFSET  32
+
+_Static_assert(offsetof(struct percpu, cpu_id) == CPU_PERCPU_ID_OFFSET, "cpu_current_id() offset");
+_Static_assert(offsetof(struct percpu, stack_top) == PERCPU_STACK_TOP_OFFSET, "ap-trampoline.nas offset");
+_Static_assert(offsetof(struct percpu, kernel_rsp) == PERCPU_KERNEL_RSP_OFFSET, "syscall-entry.nas offset");
+_Static_assert(offsetof(struct percpu, user_rsp) == PERCPU_USER_RSP_OFFSET, "syscall-entry.nas offset");
+
+extern struct percpu g_percpu[KERNEL_MAX_CPUS];
+
+void percpu_init(uint32_t cpu_id);
+
+static inline struct percpu* percpu_current(){
+    struct percpu* cpu;
+    asm volatile("movq %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+/*
+    Stack the CPU switches to when entering from ring 3, through SYSCALL or an interrupt
+*/
+static inline void percpu_set_kernel_stack(uint64_t rsp){
+    struct percpu* cpu = percpu_current();
+    cpu->kernel_rsp = rsp;
+    cpu->tss.rsp[0] = rsp;
+}
+
+#endif
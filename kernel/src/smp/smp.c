@@ -0,0 +1,106 @@
+#include "smp.h"
+
+#include "time/tsc.h"
+#include "time/clockevent.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+#include "interrupts/lapic.h"
+#include "sched/sched.h"
+#include "syscall/syscall.h"
+#include "debugging/kprint.h"
+
+extern void smp_ap_trampoline(struct limine_smp_info* info);
+
+volatile uint32_t g_smp_online_cpus = 1;    // The BSP
+uint32_t g_smp_cpu_count = 1;
+
+/*
+    Physical addresses of Limine's per-AP info blocks, indexed by our CPU id.
+    Captured while Limine's HHDM is still mapped.
+*/
+static uint64_t _smp_info_phys[KERNEL_MAX_CPUS];
+static uint64_t _smp_limine_cpu_count = 1;
+
+
+/*
+    Copy what is needed out of the SMP response. Must run before vmm_setup() switches away
+    from Limine's page tables. CPU 0 is always the BSP, APs are numbered in Limine's order.
+*/
+void smp_capture_limine(const struct limine_smp_response* response){
+    g_percpu[0].lapic_id = response->bsp_lapic_id;
+    _smp_limine_cpu_count = response->cpu_count;
+
+    uint32_t next_id = 1;
+    for(uint64_t i=0; i<response->cpu_count && next_id<KERNEL_MAX_CPUS; i++){
+        struct limine_smp_info* info = response->cpus[i];
+        if(info->lapic_id == response->bsp_lapic_id){
+            continue;
+        }
+        g_percpu[next_id].cpu_id = next_id;
+        g_percpu[next_id].lapic_id = info->lapic_id;
+        _smp_info_phys[next_id] = translateaddr_idmap_v2p_limine((uint64_t)info);
+        next_id++;
+    }
+    g_smp_cpu_count = next_id;
+}
+
+
+/*
+    Give each AP a stack and per-CPU block, then release it from Limine's spin loop by
+    writing goto_address. Waits (bounded) for every AP to report in.
+*/
+void smp_start_aps(){
+    for(uint32_t id=1; id<g_smp_cpu_count; id++){
+        struct percpu* cpu = &g_percpu[id];
+        uint64_t stack_phys = (uint64_t)pmm_alloc_pages(SMP_AP_STACK_PAGES);
+        uint64_t stack_virt = vmm_identity_map_n_pages(stack_phys, SMP_AP_STACK_PAGES, 0x3);
+        cpu->stack_top = stack_virt + SMP_AP_STACK_PAGES * PAGE_SIZE;
+
+        // The info block may straddle a page boundary
+        uint64_t info_phys = _smp_info_phys[id];
+        vmm_identity_map_page(info_phys & ~(uint64_t)(PAGE_SIZE-1), 0x3);
+        vmm_identity_map_page((info_phys + sizeof(struct limine_smp_info) - 1) & ~(uint64_t)(PAGE_SIZE-1), 0x3);
+        struct limine_smp_info* info = (struct limine_smp_info*)translateaddr_idmap_p2v(info_phys);
+
+        info->extra_argument = (uint64_t)cpu;
+        __atomic_store_n(&info->goto_address, smp_ap_trampoline, __ATOMIC_RELEASE);
+    }
+
+    uint64_t deadline = ktime_ns() + SMP_AP_START_TIMEOUT_MS * NS_PER_MS;
+    while(__atomic_load_n(&g_smp_online_cpus, __ATOMIC_ACQUIRE) < g_smp_cpu_count && ktime_ns() < deadline){
+        cpu_pause();
+    }
+}
+
+
+/*
+    C entry for APs, on the kernel's page tables and the stack from smp_start_aps().
+*/
+void smp_ap_main(struct percpu* cpu){
+    percpu_init(cpu->cpu_id);
+    gdt_setup();
+    idt_load();
+    syscall_init_cpu();
+    lapic_init_cpu();
+    clockevent_cancel();
+    sched_init_cpu();
+    sched_become_idle();
+
+    cpu->online = true;
+    __atomic_add_fetch(&g_smp_online_cpus, 1, __ATOMIC_RELEASE);
+    kidle();
+}
+
+
+void smp_report(){
+    g_percpu[0].online = true;
+    char line[KPRINT_BUF_SIZE];
+    int len = ksnprintf(line, sizeof(line), "SMP: %u of %lu CPUs online (", g_smp_online_cpus, _smp_limine_cpu_count);
+    for(uint32_t id=0; id<g_smp_cpu_count && len<(int)sizeof(line); id++){
+        if(g_percpu[id].online){
+            len += ksnprintf(line + len, sizeof(line) - len, "%scpu%u=lapic%u", (id == 0)? "" : " ", id, g_percpu[id].lapic_id);
+        }
+    }
+    kprintf("%s)\n", line);
+}
@@ -0,0 +1,22 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "third-party/limine.h"
+
+#include "smp/percpu.h"
+
+#define SMP_AP_STACK_PAGES      (KERNEL_STACK_SIZE / PAGE_SIZE)
+#define SMP_AP_START_TIMEOUT_MS 1000
+
+extern volatile uint32_t g_smp_online_cpus;
+extern uint32_t g_smp_cpu_count;
+
+void smp_capture_limine(const struct limine_smp_response* response);
+void smp_start_aps();
+void smp_ap_main(struct percpu* cpu);
+void smp_report();
+
+#endif
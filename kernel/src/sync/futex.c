@@ -0,0 +1,92 @@
+#include "futex.h"
+
+#include "sched/sched.h"
+#include "memory/vmm.h"
+#include "util/cpu.h"
+
+__attribute__((unused)) static struct lock_class _futex_bucket_class = LOCK_CLASS_INIT("futex_bucket");
+static struct futex_bucket _futex_buckets[FUTEX_BUCKETS] = {
+    [0 ... FUTEX_BUCKETS-1] = { .lock = SPINLOCK_INIT(&_futex_bucket_class) },
+};
+
+
+// Physical address of addr in the current thread's space, 0 if it isn't mapped
+static uint64_t _futex_key(const volatile uint32_t* addr){
+    struct thread* thread = sched_current();
+    struct vmm_space* space = (thread != NULL && thread->space != NULL)? thread->space : &g_vmm_kernel_space;
+    return vmm_space_translate(space, (uint64_t)addr);
+}
+
+static inline struct futex_bucket* _futex_bucket(uint64_t key){
+    return &_futex_buckets[(((key >> 2) * 0x9E3779B97F4A7C15UL) >> 32) % FUTEX_BUCKETS];
+}
+
+
+/*
+    Sleep while *addr == expected, until a futex_wake() on the same word. May return FUTEX_WOKEN
+    without a wake; callers recheck their condition either way.
+*/
+enum futex_status futex_wait(const volatile uint32_t* addr, uint32_t expected){
+    uint64_t key = _futex_key(addr);
+    if(key == 0){
+        return FUTEX_FAULT;
+    }
+    struct futex_bucket* bucket = _futex_bucket(key);
+    struct futex_waiter waiter = {key, sched_current(), false, NULL};
+
+    uint64_t rflags = cpu_irq_save();
+    spin_lock(&bucket->lock);
+    if(__atomic_load_n(addr, __ATOMIC_SEQ_CST) != expected){
+        spin_unlock(&bucket->lock);
+        cpu_irq_restore(rflags);
+        return FUTEX_AGAIN;
+    }
+    waiter.next = bucket->head;
+    bucket->head = &waiter;
+    sched_block_prepare();
+    spin_unlock(&bucket->lock);
+    sched_block();
+
+    // Returned without being woken: take the waiter back off the list
+    spin_lock(&bucket->lock);
+    if(!waiter.woken){
+        struct futex_waiter** link = &bucket->head;
+        while(*link != &waiter){
+            link = &(*link)->next;
+        }
+        *link = waiter.next;
+    }
+    spin_unlock(&bucket->lock);
+    cpu_irq_restore(rflags);
+    return FUTEX_WOKEN;
+}
+
+
+/*
+    Wake up to count threads waiting on addr, returns how many were woken
+*/
+int futex_wake(const volatile uint32_t* addr, int count){
+    uint64_t key = _futex_key(addr);
+    if(key == 0){
+        return 0;
+    }
+    struct futex_bucket* bucket = _futex_bucket(key);
+    int woken = 0;
+
+    uint64_t rflags = spin_lock_irqsave(&bucket->lock);
+    struct futex_waiter** link = &bucket->head;
+    while(*link != NULL && woken < count){
+        struct futex_waiter* waiter = *link;
+        if(waiter->key != key){
+            link = &waiter->next;
+            continue;
+        }
+        *link = waiter->next;
+        // The waiter lives on its thread's stack: done with it before the thread can run
+        waiter->woken = true;
+        sched_wake(waiter->thread);
+        woken++;
+    }
+    spin_unlock_irqrestore(&bucket->lock, rflags);
+    return woken;
+}
@@ -0,0 +1,45 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "sync/spinlock.h"
+
+/*
+    Futex-style wait/wake on a 32-bit word. futex_wait() sleeps only if the word still holds the
+    value the caller last saw, checked under the same lock futex_wake() takes, so a wake can't be
+    lost between the caller's check and its sleep.
+
+    Waiters are keyed by the word's physical address, so tasks that map the same memory at
+    different addresses, in different address spaces, wait on the same futex. Buckets are a small
+    hash of the key; a bucket's waiters sit on the waiting threads' stacks.
+*/
+#define FUTEX_BUCKETS           64
+
+struct thread;
+
+struct futex_waiter{
+    uint64_t key;
+    struct thread* thread;
+    bool woken;
+    struct futex_waiter* next;
+};
+
+struct futex_bucket{
+    struct spinlock lock;
+    struct futex_waiter* head;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+enum futex_status{
+    FUTEX_WOKEN,
+    FUTEX_AGAIN,        // The word didn't hold the expected value
+    FUTEX_FAULT,        // Not mapped in the current address space
+};
+
+enum futex_status futex_wait(const volatile uint32_t* addr, uint32_t expected);
+int futex_wake(const volatile uint32_t* addr, int count);
+
+#endif
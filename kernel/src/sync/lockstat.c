@@ -0,0 +1,77 @@
+#include "lockstat.h"
+
+#include "debugging/kprint.h"
+
+static struct lock_class* _lockstat_classes = NULL;
+
+#ifdef KCONFIG_LOCKSTAT
+
+static void _lockstat_register(struct lock_class* class){
+    bool expected = false;
+    if(!__atomic_compare_exchange_n(&class->registered, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+        return;
+    }
+    struct lock_class* head = __atomic_load_n(&_lockstat_classes, __ATOMIC_RELAXED);
+    do{
+        class->next = head;
+    }while(!__atomic_compare_exchange_n(&_lockstat_classes, &head, class, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void _lockstat_max(uint64_t* max, uint64_t value){
+    uint64_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while(value > current && !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    }
+}
+
+/*
+    Counters are updated atomically, a class can cover many lock instances held on different CPUs
+*/
+void lockstat_acquired(struct lock_class* class, uint64_t wait_cycles, bool contended){
+    if(__builtin_expect(!class->registered, 0)){
+        _lockstat_register(class);
+    }
+    __atomic_add_fetch(&class->acquisitions, 1, __ATOMIC_RELAXED);
+    if(contended){
+        __atomic_add_fetch(&class->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&class->wait_cycles, wait_cycles, __ATOMIC_RELAXED);
+        _lockstat_max(&class->wait_cycles_max, wait_cycles);
+    }
+}
+
+void lockstat_released(struct lock_class* class, uint64_t hold_cycles){
+    __atomic_add_fetch(&class->hold_cycles, hold_cycles, __ATOMIC_RELAXED);
+    _lockstat_max(&class->hold_cycles_max, hold_cycles);
+}
+
+#endif
+
+
+/*
+    Print every class that has been acquired, in registration order (most recent first).
+    Cycle counts are raw TSC cycles.
+*/
+void lockstat_dump(){
+#ifdef KCONFIG_LOCKSTAT
+    kprintf("Lock statistics (cycles):\n");
+    kprintf("  %-20s %10s %10s %14s %10s %14s %10s\n", "class", "acquired", "contended", "wait total", "wait max", "hold total", "hold max");
+    for(struct lock_class* class = __atomic_load_n(&_lockstat_classes, __ATOMIC_ACQUIRE); class != NULL; class = class->next){
+        kprintf("  %-20s %10lu %10lu %14lu %10lu %14lu %10lu\n", class->name, class->acquisitions, class->contended,
+                class->wait_cycles, class->wait_cycles_max, class->hold_cycles, class->hold_cycles_max);
+    }
+#else
+    (void)_lockstat_classes;
+    kprintf("Lock statistics not compiled in (make LOCKSTAT=1)\n");
+#endif
+}
+
+
+void lockstat_reset(){
+    for(struct lock_class* class = __atomic_load_n(&_lockstat_classes, __ATOMIC_ACQUIRE); class != NULL; class = class->next){
+        class->acquisitions = 0;
+        class->contended = 0;
+        class->wait_cycles = 0;
+        class->wait_cycles_max = 0;
+        class->hold_cycles = 0;
+        class->hold_cycles_max = 0;
+    }
+}
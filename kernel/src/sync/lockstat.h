@@ -0,0 +1,34 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Lock contention statistics, per lock class (every lock defined with the same class shares one entry).
+    Only compiled in with KCONFIG_LOCKSTAT (make LOCKSTAT=1), otherwise locks carry no class and
+    the hooks compile away.
+*/
+struct lock_class{
+    const char* name;
+    uint64_t acquisitions;
+    uint64_t contended;         // Acquisitions that had to wait
+    uint64_t wait_cycles;
+    uint64_t wait_cycles_max;
+    uint64_t hold_cycles;
+    uint64_t hold_cycles_max;
+    struct lock_class* next;    // Registry, classes are linked in on first acquisition
+    bool registered;
+};
+
+#define LOCK_CLASS_INIT(class_name) { .name = (class_name) }
+
+#ifdef KCONFIG_LOCKSTAT
+void lockstat_acquired(struct lock_class* class, uint64_t wait_cycles, bool contended);
+void lockstat_released(struct lock_class* class, uint64_t hold_cycles);
+#endif
+
+void lockstat_dump();
+void lockstat_reset();
+
+#endif
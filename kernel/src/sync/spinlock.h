@@ -0,0 +1,186 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+#include "util/cpu.h"
+#include "sync/lockstat.h"
+
+/*
+    Ticket spinlock: FIFO fair, one cache line shared by all waiters. Good for short, lightly
+    contended critical sections.
+    The _irqsave variants disable interrupts on the local CPU first; use them for any lock that is
+    also taken from an interrupt handler.
+*/
+struct spinlock{
+    union{
+        uint32_t word;
+        struct{
+            uint16_t owner;     // Ticket being served
+            uint16_t next;      // Next ticket to hand out
+        };
+    };
+#ifdef KCONFIG_LOCKSTAT
+    struct lock_class* class;
+    uint64_t acquired_tsc;
+#endif
+};
+
+/*
+    MCS queue lock: each waiter spins on its own node, so handover only touches the next waiter's
+    cache line. Better for locks that are contended by many CPUs. The node must stay valid
+    (usually on the caller's stack) until unlock.
+*/
+struct mcs_node{
+    struct mcs_node* next;
+    bool locked;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct mcs_lock{
+    struct mcs_node* tail;
+#ifdef KCONFIG_LOCKSTAT
+    struct lock_class* class;
+    uint64_t acquired_tsc;
+#endif
+};
+
+#ifdef KCONFIG_LOCKSTAT
+#define SPINLOCK_INIT(class_ptr)    { .word = 0, .class = (class_ptr) }
+#define MCS_LOCK_INIT(class_ptr)    { .tail = NULL, .class = (class_ptr) }
+#else
+#define SPINLOCK_INIT(class_ptr)    { .word = 0 }
+#define MCS_LOCK_INIT(class_ptr)    { .tail = NULL }
+#endif
+
+// File-scope lock with its own lock class
+#define DEFINE_SPINLOCK(var, class_name) \
+    __attribute__((unused)) static struct lock_class var##_class = LOCK_CLASS_INIT(class_name); \
+    static struct spinlock var = SPINLOCK_INIT(&var##_class)
+#define DEFINE_MCS_LOCK(var, class_name) \
+    __attribute__((unused)) static struct lock_class var##_class = LOCK_CLASS_INIT(class_name); \
+    static struct mcs_lock var = MCS_LOCK_INIT(&var##_class)
+
+
+static inline void spin_lock_init(struct spinlock* lock, struct lock_class* class){
+    lock->word = 0;
+#ifdef KCONFIG_LOCKSTAT
+    lock->class = class;
+#else
+    (void)class;
+#endif
+}
+
+static inline void spin_lock(struct spinlock* lock){
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+#ifdef KCONFIG_LOCKSTAT
+    uint64_t start = cpu_rdtsc();
+    bool contended = false;
+#endif
+    while(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket){
+#ifdef KCONFIG_LOCKSTAT
+        contended = true;
+#endif
+        cpu_pause();
+    }
+#ifdef KCONFIG_LOCKSTAT
+    lock->acquired_tsc = cpu_rdtsc();
+    lockstat_acquired(lock->class, lock->acquired_tsc - start, contended);
+#endif
+}
+
+static inline bool spin_trylock(struct spinlock* lock){
+    uint32_t old = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+    if((old & 0xFFFF) != (old >> 16)){
+        return false;
+    }
+    if(!__atomic_compare_exchange_n(&lock->word, &old, old + 0x10000, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+        return false;
+    }
+#ifdef KCONFIG_LOCKSTAT
+    lock->acquired_tsc = cpu_rdtsc();
+    lockstat_acquired(lock->class, 0, false);
+#endif
+    return true;
+}
+
+static inline void spin_unlock(struct spinlock* lock){
+#ifdef KCONFIG_LOCKSTAT
+    lockstat_released(lock->class, cpu_rdtsc() - lock->acquired_tsc);
+#endif
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(struct spinlock* lock){
+    uint64_t rflags = cpu_irq_save();
+    spin_lock(lock);
+    return rflags;
+}
+
+static inline void spin_unlock_irqrestore(struct spinlock* lock, uint64_t rflags){
+    spin_unlock(lock);
+    cpu_irq_restore(rflags);
+}
+
+
+static inline void mcs_lock_init(struct mcs_lock* lock, struct lock_class* class){
+    lock->tail = NULL;
+#ifdef KCONFIG_LOCKSTAT
+    lock->class = class;
+#else
+    (void)class;
+#endif
+}
+
+static inline void mcs_lock(struct mcs_lock* lock, struct mcs_node* node){
+    node->next = NULL;
+    node->locked = true;
+#ifdef KCONFIG_LOCKSTAT
+    uint64_t start = cpu_rdtsc();
+#endif
+    struct mcs_node* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if(prev != NULL){
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while(__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)){
+            cpu_pause();
+        }
+    }
+#ifdef KCONFIG_LOCKSTAT
+    lock->acquired_tsc = cpu_rdtsc();
+    lockstat_acquired(lock->class, lock->acquired_tsc - start, prev != NULL);
+#endif
+}
+
+static inline void mcs_unlock(struct mcs_lock* lock, struct mcs_node* node){
+#ifdef KCONFIG_LOCKSTAT
+    lockstat_released(lock->class, cpu_rdtsc() - lock->acquired_tsc);
+#endif
+    struct mcs_node* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if(next == NULL){
+        // No known successor: try to swing the tail back to empty
+        struct mcs_node* expected = node;
+        if(__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+            return;
+        }
+        // A waiter swapped itself in but hasn't linked to us yet
+        while((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL){
+            cpu_pause();
+        }
+    }
+    __atomic_store_n(&next->locked, false, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t mcs_lock_irqsave(struct mcs_lock* lock, struct mcs_node* node){
+    uint64_t rflags = cpu_irq_save();
+    mcs_lock(lock, node);
+    return rflags;
+}
+
+static inline void mcs_unlock_irqrestore(struct mcs_lock* lock, struct mcs_node* node, uint64_t rflags){
+    mcs_unlock(lock, node);
+    cpu_irq_restore(rflags);
+}
+
+#endif
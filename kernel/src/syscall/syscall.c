@@ -0,0 +1,210 @@
+#include "syscall.h"
+
+#include "constants.h"
+#include "util/cpu.h"
+#include "smp/percpu.h"
+#include "memory/gdt.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+#include "interrupts/idt.h"
+#include "sched/sched.h"
+#include "sync/futex.h"
+#include "time/tsc.h"
+#include "debugging/kprint.h"
+
+// Cleared on SYSCALL: TF, IF, DF, NT and AC, the kernel runs with none of them set by the user
+#define SYSCALL_SFMASK          0x44700UL
+
+/*
+    Handlers. Same signature for all of them, unused arguments are simply ignored.
+*/
+static int64_t _sys_null(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5){
+    (void)a0; (void)a1; (void)a2; (void)a3; (void)a4; (void)a5;
+    return 0;
+}
+
+static int64_t _sys_exit(uint64_t code, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5){
+    (void)a1; (void)a2; (void)a3; (void)a4; (void)a5;
+    usermode_terminate(code);
+}
+
+static int64_t _sys_write(uint64_t buf, uint64_t len, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5){
+    (void)a2; (void)a3; (void)a4; (void)a5;
+    if(!syscall_user_readable(buf, len)){
+        return -SYSCALL_EFAULT;
+    }
+    kprint_write((const char*)buf, len);
+    return len;
+}
+
+static int64_t _sys_yield(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5){
+    (void)a0; (void)a1; (void)a2; (void)a3; (void)a4; (void)a5;
+    sched_yield();
+    return 0;
+}
+
+// Futex words must be aligned user memory
+static bool _sys_futex_addr_ok(uint64_t addr){
+    return (addr & 3) == 0 && syscall_user_range_ok(addr, sizeof(uint32_t));
+}
+
+static int64_t _sys_futex_wait(uint64_t addr, uint64_t expected, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5){
+    (void)a2; (void)a3; (void)a4; (void)a5;
+    if(!_sys_futex_addr_ok(addr)){
+        return -SYSCALL_EINVAL;
+    }
+    switch(futex_wait((const volatile uint32_t*)addr, (uint32_t)expected)){
+        case FUTEX_WOKEN:
+            return 0;
+        case FUTEX_AGAIN:
+            return -SYSCALL_EAGAIN;
+        default:
+            return -SYSCALL_EFAULT;
+    }
+}
+
+static int64_t _sys_futex_wake(uint64_t addr, uint64_t count, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5){
+    (void)a2; (void)a3; (void)a4; (void)a5;
+    if(!_sys_futex_addr_ok(addr)){
+        return -SYSCALL_EINVAL;
+    }
+    return futex_wake((const volatile uint32_t*)addr, (count > INT32_MAX)? INT32_MAX : (int)count);
+}
+
+const syscall_fn_t g_syscall_table[SYSCALL_COUNT] = {
+    [SYSCALL_NULL] = _sys_null,
+    [SYSCALL_EXIT] = _sys_exit,
+    [SYSCALL_WRITE] = _sys_write,
+    [SYSCALL_YIELD] = _sys_yield,
+    [SYSCALL_FUTEX_WAIT] = _sys_futex_wait,
+    [SYSCALL_FUTEX_WAKE] = _sys_futex_wake,
+};
+
+
+// int 0x80: same numbers and registers, through the generic interrupt path
+static void _syscall_int_handler(struct interrupt_frame* frame){
+    if(frame->rax >= SYSCALL_COUNT){
+        frame->rax = -SYSCALL_ENOSYS;
+        return;
+    }
+    frame->rax = g_syscall_table[frame->rax](frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9);
+}
+
+
+/*
+    Program the executing CPU's SYSCALL MSRs. Every CPU has to, they are not shared.
+*/
+void syscall_init_cpu(){
+    cpu_wrmsr(CPU_MSR_EFER, cpu_rdmsr(CPU_MSR_EFER) | CPU_EFER_SCE);
+    // SYSCALL loads CS = STAR[47:32], SS = that + 8. SYSRET loads SS = STAR[63:48] + 8 and
+    // CS = STAR[63:48] + 16, both with RPL 3: hence user data before user code in the GDT.
+    cpu_wrmsr(CPU_MSR_STAR, ((uint64_t)GDT_KERNEL_DATA << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    cpu_wrmsr(CPU_MSR_LSTAR, (uint64_t)syscall_entry);
+    cpu_wrmsr(CPU_MSR_SFMASK, SYSCALL_SFMASK);
+    // What swapgs hands to user code
+    cpu_wrmsr(CPU_MSR_KERNEL_GS_BASE, 0);
+}
+
+
+/*
+    BSP: open int 0x80 to ring 3 (the IDT is shared) and set up this CPU.
+*/
+void syscall_init(){
+    idt_set_gate(SYSCALL_INT_VECTOR, isr_stub_table[SYSCALL_INT_VECTOR], IDT_GATE_INTERRUPT_USER, 0);
+    interrupt_register_handler(SYSCALL_INT_VECTOR, _syscall_int_handler);
+    syscall_init_cpu();
+}
+
+
+bool syscall_user_range_ok(uint64_t addr, uint64_t len){
+    return addr < VMM_USER_TOP && len <= VMM_USER_TOP - addr;
+}
+
+/*
+    For buffers the kernel reads directly: in the user half and mapped for user access in the
+    caller's space, so reading them can't fault in ring 0.
+*/
+bool syscall_user_readable(uint64_t addr, uint64_t len){
+    if(!syscall_user_range_ok(addr, len)){
+        return false;
+    }
+    struct thread* thread = sched_current();
+    struct vmm_space* space = (thread != NULL && thread->space != NULL)? thread->space : &g_vmm_kernel_space;
+    return vmm_space_user_range_mapped(space, addr, len);
+}
+
+
+/*
+    Stop the user code this thread runs, usermode_enter() returns code. From its syscalls or from
+    exceptions it raised, on the kernel stack usermode_enter() set up.
+    The stack top is the thread's own: the per-CPU copy may belong to whichever thread was switched
+    in on this CPU, or this thread may have moved, since the syscall entered with interrupts on.
+*/
+void usermode_terminate(int64_t code){
+    struct thread* thread = sched_current();
+    uint64_t kernel_rsp;
+    if(thread != NULL){
+        kernel_rsp = thread->kernel_rsp;
+        thread->kernel_rsp = 0;
+    }else{
+        kernel_rsp = percpu_current()->kernel_rsp;  // No scheduler yet, nothing else runs here
+    }
+    usermode_exit(code, kernel_rsp);
+}
+
+/*
+    From usermode_enter(): rsp is the kernel stack for everything that enters from ring 3 until
+    the thread exits user mode. The scheduler reloads it whenever the thread is switched in.
+*/
+void usermode_set_kernel_stack(uint64_t rsp){
+    percpu_set_kernel_stack(rsp);
+    struct thread* thread = sched_current();
+    if(thread != NULL){
+        thread->kernel_rsp = rsp;
+    }
+}
+
+
+/*
+    Null syscall round trip from ring 3, SYSCALL vs int 0x80. The loop (usermode_bench_code in
+    syscall-entry.nas) runs in a user page, the time per round trip is the best of a few runs.
+*/
+#define SYSCALL_BENCH_CODE      0x0000000000400000UL
+#define SYSCALL_BENCH_STACK     0x0000000000800000UL    // One page
+#define SYSCALL_BENCH_ROUNDS    100000
+#define SYSCALL_BENCH_RUNS      5
+
+extern const uint8_t usermode_bench_code[];
+extern const uint8_t usermode_bench_code_end[];
+
+static uint64_t _syscall_bench_mode(uint64_t use_int80){
+    uint64_t best = UINT64_MAX;
+    for(int run=0; run<SYSCALL_BENCH_RUNS; run++){
+        uint64_t start = cpu_rdtsc();
+        usermode_enter(SYSCALL_BENCH_CODE, SYSCALL_BENCH_STACK + PAGE_SIZE, SYSCALL_BENCH_ROUNDS, use_int80);
+        uint64_t cycles = cpu_rdtsc() - start;
+        if(cycles < best){
+            best = cycles;
+        }
+    }
+    return best / SYSCALL_BENCH_ROUNDS;
+}
+
+void syscall_bench(){
+    uint64_t code_phys = (uint64_t)pmm_alloc_pages(1);
+    uint64_t stack_phys = (uint64_t)pmm_alloc_pages(1);
+    uint8_t* code = (uint8_t*)vmm_identity_map_page(code_phys, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    for(size_t i=0; i<(size_t)(usermode_bench_code_end - usermode_bench_code); i++){
+        code[i] = usermode_bench_code[i];
+    }
+    vmm_map_phys2virt(code_phys, SYSCALL_BENCH_CODE, VMM_FLAG_PRESENT | VMM_FLAG_USER);
+    vmm_map_phys2virt(stack_phys, SYSCALL_BENCH_STACK, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_USER | VMM_FLAG_NO_EXECUTE);
+
+    uint64_t syscall_cycles = _syscall_bench_mode(0);
+    uint64_t int80_cycles = _syscall_bench_mode(1);
+    kprintf("Null syscall round trip: SYSCALL %lu cycles (%lu ns), int 0x80 %lu cycles (%lu ns)\n",
+            syscall_cycles, tsc_cycles_to_ns(syscall_cycles), int80_cycles, tsc_cycles_to_ns(int80_cycles));
+
+    pmm_free_page_physaddr(vmm_unmap_page(SYSCALL_BENCH_CODE));
+    pmm_free_page_physaddr(vmm_unmap_page(SYSCALL_BENCH_STACK));
+}
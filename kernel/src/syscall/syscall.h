@@ -0,0 +1,50 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Ring 3 entry through SYSCALL/SYSRET (syscall-entry.nas), plus the same table behind int 0x80
+    for comparison.
+
+    A kernel thread runs user code with usermode_enter(), which returns when the code calls
+    SYSCALL_EXIT. While the thread is in user mode its kernel stack (struct thread.kernel_rsp) is
+    loaded into the TSS RSP0 and the per-CPU SYSCALL stack whenever it is switched in.
+    GS holds the user base in ring 3: every entry from ring 3 swaps to the kernel's with swapgs.
+
+    Numbers and SYSCALL_ENOSYS are mirrored in syscall-entry.nas.
+*/
+#define SYSCALL_NULL        0
+#define SYSCALL_EXIT        1   // (code)
+#define SYSCALL_WRITE       2   // (buf, len): to the kernel console
+#define SYSCALL_YIELD       3
+#define SYSCALL_FUTEX_WAIT  4   // (addr, expected): sync/futex.h, 0 once woken
+#define SYSCALL_FUTEX_WAKE  5   // (addr, count): number of waiters woken
+#define SYSCALL_COUNT       6
+
+#define SYSCALL_ENOSYS      38
+#define SYSCALL_EFAULT      14
+#define SYSCALL_EAGAIN      11
+#define SYSCALL_EINVAL      22
+
+#define SYSCALL_INT_VECTOR  0x80
+
+typedef int64_t (*syscall_fn_t)(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5);
+
+extern const syscall_fn_t g_syscall_table[SYSCALL_COUNT];
+
+void syscall_init();
+void syscall_init_cpu();
+bool syscall_user_range_ok(uint64_t addr, uint64_t len);
+bool syscall_user_readable(uint64_t addr, uint64_t len);
+void usermode_set_kernel_stack(uint64_t rsp);
+__attribute__((noreturn)) void usermode_terminate(int64_t code);
+void syscall_bench();
+
+extern void syscall_entry();
+extern uint64_t usermode_enter(uint64_t entry, uint64_t user_rsp, uint64_t arg0, uint64_t arg1);
+extern __attribute__((noreturn)) void usermode_exit(uint64_t code, uint64_t kernel_rsp);
+
+#endif
@@ -0,0 +1,200 @@
+#include "clockevent.h"
+
+#include "constants.h"
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "interrupts/idt.h"
+#include "interrupts/lapic.h"
+#include "sched/sched.h"
+#include "sched/kparallel.h"
+#include "smp/percpu.h"
+#include "debugging/kprint.h"
+#include "debugging/serialout.h"
+
+static clockevent_handler_t _clockevent_handler = NULL;
+
+/*
+    Each CPU programs its own LAPIC timer
+*/
+struct clockevent_cpu{
+    enum clockevent_mode mode;
+    uint64_t deadline_ns;
+    struct clockevent_stats stats;
+    struct idle_stats idle;
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct clockevent_cpu _clockevent_cpus[KERNEL_MAX_CPUS];
+
+static inline struct clockevent_cpu* _clockevent_current(){
+    return &_clockevent_cpus[cpu_current_id()];
+}
+
+
+static void _clockevent_arm(struct clockevent_cpu* ce, uint64_t deadline_ns, uint64_t now_ns){
+    ce->stats.programs++;
+    if(g_lapic.tsc_deadline){
+        lapic_timer_deadline(g_tsc_clock.boot_tsc + tsc_ns_to_cycles(deadline_ns));
+    }else{
+        lapic_timer_oneshot((deadline_ns > now_ns)? deadline_ns - now_ns : 0);
+    }
+}
+
+
+static void _clockevent_interrupt(struct interrupt_frame* frame){
+    (void)frame;
+    lapic_eoi();
+    uint64_t now = ktime_ns();
+    struct clockevent_cpu* ce = _clockevent_current();
+
+    if(ce->mode == CLOCKEVENT_ONESHOT){
+        if(ce->deadline_ns == CLOCKEVENT_NO_DEADLINE){
+            return;
+        }
+        if(now < ce->deadline_ns){
+            // The one-shot counter ran out before a deadline that didn't fit in 32 bits
+            ce->stats.early_fires++;
+            _clockevent_arm(ce, ce->deadline_ns, now);
+            return;
+        }
+        uint64_t late = now - ce->deadline_ns;
+        if(late > ce->stats.max_late_ns){
+            ce->stats.max_late_ns = late;
+        }
+        ce->deadline_ns = CLOCKEVENT_NO_DEADLINE;
+    }
+
+    ce->stats.fires++;
+    if(_clockevent_handler != NULL){
+        _clockevent_handler(now);
+    }
+}
+
+
+/*
+    Bring up the LAPIC and route its timer here. Starts with no deadline programmed.
+*/
+bool clockevent_init(){
+    if(!lapic_setup()){
+        return false;
+    }
+    interrupt_register_handler(LAPIC_TIMER_VECTOR, _clockevent_interrupt);
+    for(int i=0; i<KERNEL_MAX_CPUS; i++){
+        _clockevent_cpus[i].mode = CLOCKEVENT_ONESHOT;
+        _clockevent_cpus[i].deadline_ns = CLOCKEVENT_NO_DEADLINE;
+    }
+    lapic_timer_stop();
+    serial_command_register(CLOCKEVENT_STATS_CMD_DUMP, clockevent_stats_dump);
+    return true;
+}
+
+
+void clockevent_set_handler(clockevent_handler_t handler){
+    _clockevent_handler = handler;
+}
+
+
+/*
+    Fire the handler once, at or soon after deadline_ns (ktime). Replaces any earlier deadline.
+    May be called from the handler itself.
+*/
+void clockevent_program(uint64_t deadline_ns){
+    uint64_t rflags = cpu_irq_save();
+    struct clockevent_cpu* ce = _clockevent_current();
+    ce->mode = CLOCKEVENT_ONESHOT;
+    ce->deadline_ns = deadline_ns;
+    _clockevent_arm(ce, deadline_ns, ktime_ns());
+    cpu_irq_restore(rflags);
+}
+
+
+void clockevent_set_periodic(uint64_t period_ns){
+    uint64_t rflags = cpu_irq_save();
+    struct clockevent_cpu* ce = _clockevent_current();
+    ce->mode = CLOCKEVENT_PERIODIC;
+    ce->deadline_ns = CLOCKEVENT_NO_DEADLINE;
+    lapic_timer_periodic(period_ns);
+    cpu_irq_restore(rflags);
+}
+
+
+void clockevent_cancel(){
+    uint64_t rflags = cpu_irq_save();
+    struct clockevent_cpu* ce = _clockevent_current();
+    ce->mode = CLOCKEVENT_ONESHOT;
+    ce->deadline_ns = CLOCKEVENT_NO_DEADLINE;
+    lapic_timer_stop();
+    cpu_irq_restore(rflags);
+}
+
+
+uint64_t clockevent_next_deadline(){
+    return _clockevent_current()->deadline_ns;
+}
+
+
+/*
+    Every CPU's counters are read without stopping it, so the totals are only approximately
+    consistent with each other.
+*/
+void clockevent_stats_dump(){
+    struct clockevent_stats total = {0};
+    struct idle_stats idle = {0};
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        const struct clockevent_cpu* ce = &_clockevent_cpus[id];
+        total.fires += ce->stats.fires;
+        total.early_fires += ce->stats.early_fires;
+        total.programs += ce->stats.programs;
+        if(ce->stats.max_late_ns > total.max_late_ns){
+            total.max_late_ns = ce->stats.max_late_ns;
+        }
+        idle.wakeups += ce->idle.wakeups;
+        idle.idle_ns += ce->idle.idle_ns;
+    }
+    kprintf("clockevent: %lu fires, %lu early, %lu programmed, max late %lu ns\n",
+            total.fires, total.early_fires, total.programs, total.max_late_ns);
+    kprintf("idle: %lu wakeups, %lu ms\n", idle.wakeups, idle.idle_ns / NS_PER_MS);
+    for(uint32_t id=0; id<KERNEL_MAX_CPUS; id++){
+        if(g_percpu[id].online){
+            kprintf("  cpu%u: %lu fires, %lu wakeups, %lu ms idle\n", id, _clockevent_cpus[id].stats.fires,
+                    _clockevent_cpus[id].idle.wakeups, _clockevent_cpus[id].idle.idle_ns / NS_PER_MS);
+        }
+    }
+}
+
+
+/*
+    Idle loop, for when kmain has nothing left to do. Helps with kparallel_for() work and runs
+    queued threads, otherwise sleeps until the next interrupt. With no deadline programmed the
+    timer stays off, so an idle CPU only wakes for device interrupts. Both kinds of work are
+    re-checked with interrupts off, and sti;hlt is atomic with respect to interrupts (sti only
+    takes effect after the next instruction), so a wakeup can't slip in before the hlt.
+    Every path back to the top of the loop turns interrupts on again, the polling and helping
+    there must not run with them masked.
+*/
+void kidle(){
+    for(;;){
+        serial_command_poll();
+        serial_flush_staged();
+        if(kparallel_help()){
+            continue;
+        }
+        // Check again with interrupts off, so work published before the hlt is not missed
+        asm volatile("cli" ::: "memory");
+        if(kparallel_has_work()){
+            asm volatile("sti" ::: "memory");
+            continue;
+        }
+        if(sched_has_runnable()){
+            // sched_yield() comes back with the IF it was entered with, off here
+            sched_yield();
+            asm volatile("sti" ::: "memory");
+            continue;
+        }
+        uint64_t start = ktime_ns();
+        asm volatile("sti; hlt" ::: "memory");
+        // Still this CPU: the idle loop never migrates
+        struct idle_stats* idle = &_clockevent_current()->idle;
+        idle->wakeups++;
+        idle->idle_ns += ktime_ns() - start;
+    }
+}
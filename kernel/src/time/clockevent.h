@@ -0,0 +1,50 @@
+#ifndef CLOCKEVENT_H
+#define CLOCKEVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Timer interrupt source for the kernel, on top of the LAPIC timer.
+
+    Tickless by default: nothing fires unless a deadline has been programmed with
+    clockevent_program(). The TSC-deadline mode is used when the CPU supports it,
+    the count-down one-shot mode otherwise. A periodic tick is available for users that want one.
+*/
+#define CLOCKEVENT_NO_DEADLINE  UINT64_MAX
+
+typedef void (*clockevent_handler_t)(uint64_t now_ns);
+
+enum clockevent_mode{
+    CLOCKEVENT_OFF,
+    CLOCKEVENT_PERIODIC,
+    CLOCKEVENT_ONESHOT,
+};
+
+/*
+    Kept per CPU, the handler and kidle() update them locally. clockevent_stats_dump() sums them.
+*/
+struct clockevent_stats{
+    uint64_t fires;         // Handler invocations
+    uint64_t early_fires;   // Interrupts that arrived before the deadline and were re-armed
+    uint64_t programs;
+    uint64_t max_late_ns;   // Worst observed delay between deadline and handler
+};
+
+struct idle_stats{
+    uint64_t wakeups;
+    uint64_t idle_ns;
+};
+
+#define CLOCKEVENT_STATS_CMD_DUMP   'C'     // Serial command, see serial_command_register()
+
+bool clockevent_init();
+void clockevent_set_handler(clockevent_handler_t handler);
+void clockevent_program(uint64_t deadline_ns);
+void clockevent_set_periodic(uint64_t period_ns);
+void clockevent_cancel();
+uint64_t clockevent_next_deadline();
+void clockevent_stats_dump();
+void kidle();
+
+#endif
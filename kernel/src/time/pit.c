@@ -0,0 +1,47 @@
+#include "pit.h"
+
+#include "debugging/serialout.h" // asm_inline_inb/outb
+
+/*
+    Arm channel 2 in mode 0 (interrupt on terminal count) with the speaker disconnected.
+    OUT2 goes high once count ticks have elapsed.
+*/
+void pit_ch2_start(uint16_t count){
+    uint8_t speaker = asm_inline_inb(PIT_SPEAKER_PORT);
+    speaker = (speaker & ~PIT_SPEAKER_ENABLE) & ~PIT_SPEAKER_GATE2;
+    asm_inline_outb(PIT_SPEAKER_PORT, speaker);
+
+    asm_inline_outb(PIT_COMMAND, 0xB0); // Channel 2, lo/hi byte access, mode 0, binary
+    asm_inline_outb(PIT_CHANNEL2_DATA, count & 0xFF);
+    asm_inline_outb(PIT_CHANNEL2_DATA, count >> 8);
+
+    // Raising the gate starts the countdown
+    asm_inline_outb(PIT_SPEAKER_PORT, speaker | PIT_SPEAKER_GATE2);
+}
+
+bool pit_ch2_expired(){
+    return asm_inline_inb(PIT_SPEAKER_PORT) & PIT_SPEAKER_OUT2;
+}
+
+
+/*
+    Channel 0 in mode 2 (rate generator): IRQ 0 fires every PIT_FREQUENCY_HZ / hz input ticks.
+*/
+void pit_ch0_periodic(uint32_t hz){
+    uint32_t count = PIT_FREQUENCY_HZ / hz;
+    if(count > UINT16_MAX){
+        count = 0;  // 0 means 65536, the slowest rate
+    }
+    asm_inline_outb(PIT_COMMAND, 0x34); // Channel 0, lo/hi byte access, mode 2, binary
+    asm_inline_outb(PIT_CHANNEL0_DATA, count & 0xFF);
+    asm_inline_outb(PIT_CHANNEL0_DATA, count >> 8);
+}
+
+/*
+    Mode 0 with a count that is never reloaded: OUT0 goes high once and stays there.
+*/
+void pit_ch0_stop(){
+    asm_inline_outb(PIT_COMMAND, 0x30); // Channel 0, lo/hi byte access, mode 0, binary
+    asm_inline_outb(PIT_CHANNEL0_DATA, 0);
+    asm_inline_outb(PIT_CHANNEL0_DATA, 0);
+}
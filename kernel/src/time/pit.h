@@ -0,0 +1,29 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    8253/8254 programmable interval timer.
+    Channel 2 is a one-shot reference for calibrating faster clocks. Its gate and output are wired
+    to the PC speaker port (0x61), so it can be polled without an IRQ.
+    Channel 0 drives ISA IRQ 0, and is only used as a periodic tick by the sampling profiler.
+*/
+#define PIT_FREQUENCY_HZ    1193182
+#define PIT_IRQ             0
+#define PIT_CHANNEL0_DATA   0x40
+#define PIT_CHANNEL2_DATA   0x42
+#define PIT_COMMAND         0x43
+#define PIT_SPEAKER_PORT    0x61
+
+#define PIT_SPEAKER_GATE2   0x01
+#define PIT_SPEAKER_ENABLE  0x02
+#define PIT_SPEAKER_OUT2    0x20
+
+void pit_ch2_start(uint16_t count);
+bool pit_ch2_expired();
+void pit_ch0_periodic(uint32_t hz);
+void pit_ch0_stop();
+
+#endif
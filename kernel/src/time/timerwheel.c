@@ -0,0 +1,411 @@
+#include "timerwheel.h"
+
+#include "util/cpu.h"
+#include "time/tsc.h"
+#include "time/clockevent.h"
+#include "debugging/kprint.h"
+#include "debugging/panic.h"
+
+static struct timer_wheel _timer_wheels[KERNEL_MAX_CPUS];
+
+
+static inline struct timer_wheel* _timer_wheel_current(){
+    return &_timer_wheels[cpu_current_id()];
+}
+
+static inline uint64_t _timer_rotr64(uint64_t x, unsigned n){
+    n &= 63;
+    return (n == 0)? x : (x >> n) | (x << (64 - n));
+}
+
+
+static void _timer_wheel_enqueue(struct timer_wheel* wheel, struct ktimer* timer){
+    uint64_t expires = timer->expires_tick;
+    if(expires < wheel->now_tick){
+        expires = wheel->now_tick;
+    }
+    uint64_t delta = expires - wheel->now_tick;
+    if(delta > TIMER_WHEEL_MAX_DELTA){
+        expires = wheel->now_tick + TIMER_WHEEL_MAX_DELTA;
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+
+    int level = 0;
+    while(level < TIMER_WHEEL_LEVELS-1 && delta >= (1UL << (TIMER_WHEEL_SLOT_BITS * (level+1)))){
+        level++;
+    }
+    int slot = (expires >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+
+    struct ktimer** head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if(*head != NULL){
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+    timer->wheel = wheel;
+    timer->level = level;
+    timer->slot = slot;
+    wheel->occupied[level] |= 1UL << slot;
+}
+
+
+static void _timer_wheel_unlink(struct timer_wheel* wheel, struct ktimer* timer){
+    *timer->pprev = timer->next;
+    if(timer->next != NULL){
+        timer->next->pprev = timer->pprev;
+    }
+    if(wheel->slots[timer->level][timer->slot] == NULL){
+        wheel->occupied[timer->level] &= ~(1UL << timer->slot);
+    }
+    timer->pprev = NULL;
+    timer->next = NULL;
+}
+
+
+static void _timer_wheel_add(struct timer_wheel* wheel, struct ktimer* timer){
+    _timer_wheel_enqueue(wheel, timer);
+    wheel->pending++;
+}
+
+
+static bool _timer_wheel_remove(struct timer_wheel* wheel, struct ktimer* timer){
+    if(timer->pprev == NULL){
+        return false;
+    }
+    _timer_wheel_unlink(wheel, timer);
+    wheel->pending--;
+    return true;
+}
+
+
+/*
+    Re-hash the slots of the higher levels that come due now that level 0 has wrapped.
+*/
+static void _timer_wheel_cascade(struct timer_wheel* wheel){
+    for(int level=1; level<TIMER_WHEEL_LEVELS; level++){
+        int slot = (wheel->now_tick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+        struct ktimer* list = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1UL << slot);
+        while(list != NULL){
+            struct ktimer* next = list->next;
+            _timer_wheel_enqueue(wheel, list);
+            list = next;
+        }
+        if(slot != 0){
+            break;
+        }
+    }
+}
+
+
+/*
+    Process every tick up to and including target_tick.
+    Runs of empty level 0 slots are skipped, so long idle periods cost one step per 64 ticks.
+*/
+static void _timer_wheel_advance(struct timer_wheel* wheel, uint64_t target_tick){
+    while(wheel->now_tick <= target_tick){
+        uint64_t tick = wheel->now_tick;
+        int slot = tick & TIMER_WHEEL_SLOT_MASK;
+        if(slot == 0){
+            _timer_wheel_cascade(wheel);
+        }
+
+        /*
+            Detach the slot and move time on before running callbacks, so a callback that re-arms
+            for "now" lands in the next tick rather than this list. The batch stays a proper list
+            (the first entry's pprev points at the local head) and timers are taken off it one at
+            a time, so a callback can cancel or re-arm any timer still waiting in it.
+        */
+        struct ktimer* batch = wheel->slots[0][slot];
+        wheel->slots[0][slot] = NULL;
+        wheel->occupied[0] &= ~(1UL << slot);
+        wheel->now_tick = tick + 1;
+        if(batch != NULL){
+            batch->pprev = &batch;
+        }
+
+        while(batch != NULL){
+            struct ktimer* timer = batch;
+            batch = timer->next;
+            if(batch != NULL){
+                batch->pprev = &batch;
+            }
+            timer->pprev = NULL;
+            timer->next = NULL;
+            if(timer->expires_tick > tick){
+                // Was clamped to TIMER_WHEEL_MAX_DELTA, still not due
+                _timer_wheel_enqueue(wheel, timer);
+                continue;
+            }
+            wheel->pending--;
+            timer->fn(timer, timer->arg);
+        }
+
+        uint64_t next_slot = wheel->now_tick & TIMER_WHEEL_SLOT_MASK;
+        if(next_slot != 0 && (wheel->occupied[0] >> next_slot) == 0){
+            uint64_t boundary = (wheel->now_tick | TIMER_WHEEL_SLOT_MASK) + 1;
+            wheel->now_tick = (boundary < target_tick + 1)? boundary : target_tick + 1;
+        }
+    }
+}
+
+
+/*
+    Earliest tick at which the wheel has work: the next occupied level 0 slot, or the next cascade
+    of an occupied higher level slot.
+*/
+static uint64_t _timer_wheel_next_tick(const struct timer_wheel* wheel){
+    if(wheel->pending == 0){
+        return TIMER_WHEEL_NO_TICK;
+    }
+    uint64_t best = TIMER_WHEEL_NO_TICK;
+    for(int level=0; level<TIMER_WHEEL_LEVELS; level++){
+        uint64_t occupied = wheel->occupied[level];
+        if(occupied == 0){
+            continue;
+        }
+        int shift = TIMER_WHEEL_SLOT_BITS * level;
+        uint64_t index = (wheel->now_tick >> shift) & TIMER_WHEEL_SLOT_MASK;
+        uint64_t candidate;
+        if(level == 0){
+            candidate = wheel->now_tick + __builtin_ctzl(_timer_rotr64(occupied, index));
+        }else{
+            // Slots cascade on ticks aligned to the level, the current slot too if now_tick is aligned
+            uint64_t first = (wheel->now_tick & ((1UL << shift) - 1)) != 0;
+            uint64_t distance = first + __builtin_ctzl(_timer_rotr64(occupied, index + first));
+            candidate = ((wheel->now_tick >> shift) + distance) << shift;
+        }
+        if(candidate < best){
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+
+static void _timer_wheel_reprogram(struct timer_wheel* wheel){
+    uint64_t next = _timer_wheel_next_tick(wheel);
+    if(next == wheel->programmed_tick){
+        return;
+    }
+    wheel->programmed_tick = next;
+    if(next == TIMER_WHEEL_NO_TICK){
+        clockevent_cancel();
+    }else{
+        clockevent_program(next << TIMER_WHEEL_TICK_SHIFT);
+    }
+}
+
+
+/*
+    Clockevent handler: run everything due on this CPU and arm the next wakeup.
+*/
+void timer_wheel_run(uint64_t now_ns){
+    struct timer_wheel* wheel = _timer_wheel_current();
+    // The one-shot that brought us here has been consumed
+    wheel->programmed_tick = TIMER_WHEEL_NO_TICK;
+    _timer_wheel_advance(wheel, now_ns >> TIMER_WHEEL_TICK_SHIFT);
+    _timer_wheel_reprogram(wheel);
+}
+
+
+/*
+    Requires clockevent_init() to have succeeded, otherwise timers are queued but never run.
+*/
+void timer_wheel_init(){
+    uint64_t now_tick = ktime_ns() >> TIMER_WHEEL_TICK_SHIFT;
+    for(int i=0; i<KERNEL_MAX_CPUS; i++){
+        _timer_wheels[i].now_tick = now_tick;
+        _timer_wheels[i].programmed_tick = TIMER_WHEEL_NO_TICK;
+    }
+    clockevent_set_handler(timer_wheel_run);
+}
+
+
+void ktimer_init(struct ktimer* timer, ktimer_fn_t fn, void* arg){
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->wheel = NULL;
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+
+/*
+    Wheels have no lock, only their own CPU touches them (with interrupts off). A pending timer can
+    only be re-armed or cancelled on the CPU it was armed on.
+*/
+static void _timer_wheel_check_owner(const struct ktimer* timer, const struct timer_wheel* wheel){
+    if(timer->pprev != NULL && timer->wheel != wheel){
+        kpanic("ktimer %p is pending on cpu%ld's wheel, touched from cpu%u",
+               timer, (long)(timer->wheel - _timer_wheels), cpu_current_id());
+    }
+}
+
+
+/*
+    (Re)arm a timer to run at expires_ns (ktime), rounded up to the next tick.
+*/
+void ktimer_arm(struct ktimer* timer, uint64_t expires_ns){
+    uint64_t rflags = cpu_irq_save();
+    struct timer_wheel* wheel = _timer_wheel_current();
+    _timer_wheel_check_owner(timer, wheel);
+    if(timer->pprev != NULL){
+        _timer_wheel_remove(timer->wheel, timer);
+    }
+    timer->expires_tick = (expires_ns + TIMER_WHEEL_TICK_NS - 1) >> TIMER_WHEEL_TICK_SHIFT;
+    _timer_wheel_add(wheel, timer);
+    if(timer->expires_tick < wheel->programmed_tick){
+        _timer_wheel_reprogram(wheel);
+    }
+    cpu_irq_restore(rflags);
+}
+
+
+void ktimer_arm_after(struct ktimer* timer, uint64_t delay_ns){
+    ktimer_arm(timer, ktime_ns() + delay_ns);
+}
+
+
+/*
+    Returns true if the timer was pending. The clockevent is left armed, an early wakeup
+    just finds nothing to do.
+*/
+bool ktimer_cancel(struct ktimer* timer){
+    uint64_t rflags = cpu_irq_save();
+    _timer_wheel_check_owner(timer, _timer_wheel_current());
+    bool was_pending = false;
+    if(timer->pprev != NULL){
+        was_pending = _timer_wheel_remove(timer->wheel, timer);
+    }
+    cpu_irq_restore(rflags);
+    return was_pending;
+}
+
+
+/*
+    Stress benchmark on a private wheel driven with synthetic time, so it neither depends on nor
+    disturbs the real timer interrupt.
+*/
+#define TIMER_BENCH_TIMERS  4096
+#define TIMER_BENCH_ROUNDS  512
+
+static struct timer_wheel _timer_bench_wheel;
+static struct ktimer _timer_bench_timers[TIMER_BENCH_TIMERS];
+static uint64_t _timer_bench_fired;
+
+static void _timer_bench_callback(struct ktimer* timer, void* arg){
+    (void)timer;
+    (void)arg;
+    _timer_bench_fired++;
+}
+
+static uint64_t _timer_bench_rand(uint64_t* state){
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return *state >> 33;
+}
+
+/*
+    Callbacks that cancel or re-arm timers still waiting in the same expiry batch. Three timers due
+    in one tick run newest first; the first one to run acts on the second, the third must still run.
+*/
+struct timer_selftest{
+    struct ktimer timers[3];
+    uint32_t fired[3];
+    bool rearm;             // Re-arm the victim 5 ticks later instead of cancelling it
+};
+
+static void _timer_selftest_callback(struct ktimer* timer, void* arg){
+    struct timer_selftest* test = arg;
+    int index = timer - test->timers;
+    test->fired[index]++;
+    if(index == 2){
+        struct ktimer* victim = &test->timers[1];
+        _timer_wheel_remove(&_timer_bench_wheel, victim);
+        if(test->rearm){
+            victim->expires_tick = _timer_bench_wheel.now_tick + 5;
+            _timer_wheel_add(&_timer_bench_wheel, victim);
+        }
+    }
+}
+
+static bool _timer_selftest_run(bool rearm){
+    struct timer_wheel* wheel = &_timer_bench_wheel;
+    struct timer_selftest test = {.rearm = rearm};
+    uint64_t due = wheel->now_tick + 3;
+    for(int i=0; i<3; i++){
+        ktimer_init(&test.timers[i], _timer_selftest_callback, &test);
+        test.timers[i].expires_tick = due;
+        _timer_wheel_add(wheel, &test.timers[i]);
+    }
+    _timer_wheel_advance(wheel, due + 10);
+    uint32_t expect_victim = rearm? 1 : 0;
+    bool ok = test.fired[0] == 1 && test.fired[1] == expect_victim && test.fired[2] == 1 && wheel->pending == 0;
+    if(!ok){
+        kprintf("  self-test (%s) FAILED: fired %u %u %u, %lu still pending\n", rearm? "re-arm" : "cancel",
+                test.fired[0], test.fired[1], test.fired[2], wheel->pending);
+    }
+    return ok;
+}
+
+static void _timer_bench_report(const char* what, uint64_t cycles, uint64_t ops){
+    uint64_t ns_x10 = tsc_cycles_to_ns(cycles) * 10 / ops;
+    kprintf("  %-8s %lu ops, %lu.%lu ns/op\n", what, ops, ns_x10 / 10, ns_x10 % 10);
+}
+
+void timer_wheel_bench(){
+    struct timer_wheel* wheel = &_timer_bench_wheel;
+    *wheel = (struct timer_wheel){0};
+    wheel->programmed_tick = TIMER_WHEEL_NO_TICK;
+    for(int i=0; i<TIMER_BENCH_TIMERS; i++){
+        ktimer_init(&_timer_bench_timers[i], _timer_bench_callback, NULL);
+    }
+    uint64_t rng = 0x1234;
+    uint64_t arm_cycles = 0, cancel_cycles = 0, expire_cycles = 0;
+    bool selftest_ok = _timer_selftest_run(false) && _timer_selftest_run(true);
+
+    /*
+        Arm/cancel: expiries spread over every level
+    */
+    for(int round=0; round<TIMER_BENCH_ROUNDS; round++){
+        uint64_t start = cpu_rdtsc();
+        for(int i=0; i<TIMER_BENCH_TIMERS; i++){
+            struct ktimer* timer = &_timer_bench_timers[i];
+            timer->expires_tick = wheel->now_tick + 1 + (_timer_bench_rand(&rng) & TIMER_WHEEL_MAX_DELTA);
+            _timer_wheel_add(wheel, timer);
+        }
+        uint64_t mid = cpu_rdtsc();
+        for(int i=0; i<TIMER_BENCH_TIMERS; i++){
+            _timer_wheel_remove(wheel, &_timer_bench_timers[i]);
+        }
+        uint64_t end = cpu_rdtsc();
+        arm_cycles += mid - start;
+        cancel_cycles += end - mid;
+    }
+
+    /*
+        Expiry: near-term timers (up to 16k ticks, so levels 0-2 and cascades), run to completion
+    */
+    _timer_bench_fired = 0;
+    for(int round=0; round<TIMER_BENCH_ROUNDS/2; round++){
+        for(int i=0; i<TIMER_BENCH_TIMERS; i++){
+            struct ktimer* timer = &_timer_bench_timers[i];
+            timer->expires_tick = wheel->now_tick + (_timer_bench_rand(&rng) & 0x3FFF);
+            _timer_wheel_add(wheel, timer);
+        }
+        uint64_t start = cpu_rdtsc();
+        _timer_wheel_advance(wheel, wheel->now_tick + 0x4000);
+        expire_cycles += cpu_rdtsc() - start;
+    }
+
+    uint64_t arm_ops = (uint64_t)TIMER_BENCH_ROUNDS * TIMER_BENCH_TIMERS;
+    kprintf("Timer wheel benchmark (self-test %s):\n", selftest_ok? "ok" : "FAILED");
+    _timer_bench_report("arm", arm_cycles, arm_ops);
+    _timer_bench_report("cancel", cancel_cycles, arm_ops);
+    _timer_bench_report("expire", expire_cycles, _timer_bench_fired);
+    if(_timer_bench_fired != arm_ops / 2 || wheel->pending != 0){
+        kprintf("  MISMATCH: fired %lu of %lu, %lu still pending\n", _timer_bench_fired, arm_ops / 2, wheel->pending);
+    }
+}
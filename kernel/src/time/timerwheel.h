@@ -0,0 +1,68 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+/*
+    Hierarchical timer wheel for deferred callbacks (timeouts, flush batching, watchdogs).
+
+    Time is counted in ticks of 2^TIMER_WHEEL_TICK_SHIFT ns (~1.05 ms). There are TIMER_WHEEL_LEVELS
+    levels of 64 slots. Level n holds timers due within 64^(n+1) ticks, hashed by the level's
+    bits of the expiry tick. Level 0 slots are run directly. A higher-level slot is cascaded
+    (re-hashed into the levels below) when the lower levels wrap around.
+    Arm and cancel are O(1) (intrusive doubly linked slots), and expiry is amortised O(1) per timer.
+
+    There is one wheel per CPU. A timer is queued on the wheel of the CPU that arms it, and must be
+    cancelled on that CPU too. Callbacks run from the timer interrupt with interrupts disabled.
+    The wheel is tickless: the clockevent is only programmed for the next occupied tick.
+*/
+#define TIMER_WHEEL_TICK_SHIFT  20
+#define TIMER_WHEEL_TICK_NS     (1UL << TIMER_WHEEL_TICK_SHIFT)
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_SLOT_BITS   6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK   (TIMER_WHEEL_SLOTS - 1)
+// Timers further out than this are parked at the end of the last level and re-queued when reached
+#define TIMER_WHEEL_MAX_DELTA   ((1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+#define TIMER_WHEEL_NO_TICK     UINT64_MAX
+
+struct ktimer;
+typedef void (*ktimer_fn_t)(struct ktimer* timer, void* arg);
+
+struct ktimer{
+    struct ktimer* next;
+    struct ktimer** pprev;          // NULL while not queued
+    struct timer_wheel* wheel;
+    uint64_t expires_tick;
+    ktimer_fn_t fn;
+    void* arg;
+    uint8_t level;
+    uint8_t slot;
+};
+
+struct timer_wheel{
+    uint64_t now_tick;              // Next tick to be processed
+    uint64_t pending;
+    uint64_t programmed_tick;       // Tick the clockevent is armed for
+    uint64_t occupied[TIMER_WHEEL_LEVELS];  // Bit per non-empty slot
+    struct ktimer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+}__attribute__((aligned(CACHE_LINE_SIZE)));
+
+void timer_wheel_init();
+void timer_wheel_run(uint64_t now_ns);
+void timer_wheel_bench();
+
+void ktimer_init(struct ktimer* timer, ktimer_fn_t fn, void* arg);
+void ktimer_arm(struct ktimer* timer, uint64_t expires_ns);
+void ktimer_arm_after(struct ktimer* timer, uint64_t delay_ns);
+bool ktimer_cancel(struct ktimer* timer);
+
+static inline bool ktimer_pending(const struct ktimer* timer){
+    return timer->pprev != NULL;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "tsc.h"
+
+#include "time/pit.h"
+#include "debugging/kprint.h"
+
+struct tsc_clock g_tsc_clock = {0};
+
+
+/*
+    One timed PIT interval. Returns the TSC cycles it took, or 0 if the PIT never fired.
+*/
+static uint64_t _tsc_measure_pit_interval(uint16_t pit_ticks){
+    pit_ch2_start(pit_ticks);
+    uint64_t start = cpu_rdtsc_ordered();
+    for(uint64_t spins=0; !pit_ch2_expired(); spins++){
+        if(spins > TSC_CALIBRATION_MAX_SPINS){
+            return 0;
+        }
+    }
+    return cpu_rdtsc_ordered() - start;
+}
+
+
+/*
+    Fallback for machines without a usable PIT: CPUID leaf 0x15 (crystal ratio) or 0x16 (base MHz).
+*/
+static uint64_t _tsc_hz_from_cpuid(){
+    uint32_t max_leaf, ebx, ecx, edx;
+    cpu_cpuid(0, 0, &max_leaf, &ebx, &ecx, &edx);
+    if(max_leaf >= 0x15){
+        uint32_t denominator, numerator, crystal_hz;
+        cpu_cpuid(0x15, 0, &denominator, &numerator, &crystal_hz, &edx);
+        if(denominator != 0 && numerator != 0 && crystal_hz != 0){
+            return (uint64_t)crystal_hz * numerator / denominator;
+        }
+    }
+    if(max_leaf >= 0x16){
+        uint32_t base_mhz;
+        cpu_cpuid(0x16, 0, &base_mhz, &ebx, &ecx, &edx);
+        return (uint64_t)(base_mhz & 0xFFFF) * 1000000;
+    }
+    return 0;
+}
+
+
+static uint64_t _tsc_calibrate(){
+    const uint16_t pit_ticks = PIT_FREQUENCY_HZ * TSC_CALIBRATION_MS / 1000;
+
+    /*
+        Anything that delays us (SMIs, VM exits) can only make an interval look longer,
+        so the shortest of a few runs is the best estimate.
+    */
+    uint64_t best = UINT64_MAX;
+    for(int i=0; i<TSC_CALIBRATION_RUNS; i++){
+        uint64_t cycles = _tsc_measure_pit_interval(pit_ticks);
+        if(cycles != 0 && cycles < best){
+            best = cycles;
+        }
+    }
+    if(best == UINT64_MAX){
+        return _tsc_hz_from_cpuid();
+    }
+    return best * PIT_FREQUENCY_HZ / pit_ticks;
+}
+
+
+/*
+    Calibrate the TSC and start the kernel clock. Call as early as possible in kmain,
+    everything before this reads as time 0.
+    Only needs port I/O, so it does not depend on the PMM/VMM/IDT.
+*/
+void ktime_init(){
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if(eax >= 0x80000007){
+        cpu_cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        g_tsc_clock.invariant = edx & (1 << 8);
+    }
+
+    g_tsc_clock.boot_tsc = cpu_rdtsc();
+    uint64_t hz = _tsc_calibrate();
+    if(hz == 0){
+        kprintf("TSC calibration failed, ktime will not advance\n");
+        return;
+    }
+
+    /*
+        Division only happens here. mult_inv is computed from kHz so (hz << 32) can't overflow.
+    */
+    g_tsc_clock.hz = hz;
+    g_tsc_clock.mult = (NS_PER_SEC << TSC_SHIFT) / hz;
+    g_tsc_clock.mult_inv = ((hz / 1000) << TSC_SHIFT) / NS_PER_MS;
+    g_tsc_clock.calibrated = true;
+}
@@ -0,0 +1,65 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util/cpu.h"
+
+/*
+    Kernel clock based on the time stamp counter.
+
+    The TSC frequency is measured at boot against PIT channel 2 and turned into
+    fixed-point factors, so converting cycles <-> ns is a multiply and a shift:
+        ns = (cycles * mult) >> TSC_SHIFT
+    The 64x64 multiply is done in 128 bits so it can't overflow for any uptime.
+*/
+#define TSC_SHIFT                   32
+#define TSC_CALIBRATION_MS          10
+#define TSC_CALIBRATION_RUNS        5
+#define TSC_CALIBRATION_MAX_SPINS   100000000
+
+#define NS_PER_US   1000UL
+#define NS_PER_MS   1000000UL
+#define NS_PER_SEC  1000000000UL
+
+struct tsc_clock{
+    uint64_t hz;
+    uint64_t mult;          // ns per cycle << TSC_SHIFT
+    uint64_t mult_inv;      // cycles per ns << TSC_SHIFT
+    uint64_t boot_tsc;      // ktime_ns() counts from here
+    bool invariant;         // CPUID reports a constant rate TSC that keeps running in deep C-states
+    bool calibrated;
+};
+
+extern struct tsc_clock g_tsc_clock;
+
+void ktime_init();
+
+static inline uint64_t tsc_hz(){
+    return g_tsc_clock.hz;
+}
+
+static inline uint64_t tsc_cycles_to_ns(uint64_t cycles){
+    return ((unsigned __int128)cycles * g_tsc_clock.mult) >> TSC_SHIFT;
+}
+
+static inline uint64_t tsc_ns_to_cycles(uint64_t ns){
+    return ((unsigned __int128)ns * g_tsc_clock.mult_inv) >> TSC_SHIFT;
+}
+
+/*
+    Nanoseconds since ktime_init(). Returns 0 until the TSC is calibrated.
+*/
+static inline uint64_t ktime_ns(){
+    return tsc_cycles_to_ns(cpu_rdtsc() - g_tsc_clock.boot_tsc);
+}
+
+/*
+    Converts a raw TSC stamp (e.g. from a trace or dmesg record) to ktime.
+*/
+static inline uint64_t ktime_from_tsc(uint64_t tsc){
+    return (tsc > g_tsc_clock.boot_tsc)? tsc_cycles_to_ns(tsc - g_tsc_clock.boot_tsc) : 0;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#include "checksum.h"
+
+#define ADLER32_MOD 65521
+
+uint32_t adler32(const void* data, size_t len){
+    const uint8_t* p = data;
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while(len > 0){
+        // 5552 is the largest run that can't overflow b before the modulo
+        size_t run = (len < 5552)? len : 5552;
+        len -= run;
+        while(run--){
+            a += *p++;
+            b += a;
+        }
+        a %= ADLER32_MOD;
+        b %= ADLER32_MOD;
+    }
+    return (b << 16) | a;
+}
+
+uint32_t fnv1a32(const void* data, size_t len){
+    const uint8_t* p = data;
+    uint32_t hash = 0x811C9DC5;
+    for(size_t i=0; i<len; i++){
+        hash ^= p[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
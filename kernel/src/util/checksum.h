@@ -0,0 +1,10 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t adler32(const void* data, size_t len);
+uint32_t fnv1a32(const void* data, size_t len);
+
+#endif
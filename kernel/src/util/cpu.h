@@ -0,0 +1,134 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CPU_RFLAGS_IF 0x200
+
+#define CPU_MSR_EFER            0xC0000080
+#define CPU_MSR_STAR            0xC0000081
+#define CPU_MSR_LSTAR           0xC0000082
+#define CPU_MSR_SFMASK          0xC0000084
+#define CPU_MSR_GS_BASE         0xC0000101
+#define CPU_MSR_KERNEL_GS_BASE  0xC0000102
+
+#define CPU_EFER_SCE            (1UL << 0)  // SYSCALL/SYSRET enable
+
+/*
+    Small inline wrappers around privileged/special x86_64 instructions.
+*/
+
+static inline uint64_t cpu_irq_save(){
+    uint64_t rflags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(rflags) :: "memory");
+    return rflags;
+}
+
+static inline void cpu_irq_restore(uint64_t rflags){
+    if(rflags & CPU_RFLAGS_IF){
+        asm volatile("sti" ::: "memory");
+    }
+}
+
+static inline bool cpu_irq_enabled(){
+    uint64_t rflags;
+    asm volatile("pushfq; pop %0" : "=r"(rflags));
+    return rflags & CPU_RFLAGS_IF;
+}
+
+/*
+    Port I/O wider than a byte (byte access lives in debugging/serialout)
+*/
+static inline uint16_t asm_inline_inw(uint16_t port){
+    uint16_t data;
+    asm volatile("inw %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+static inline void asm_inline_outw(uint16_t port, uint16_t data){
+    asm volatile("outw %0, %1" :: "a"(data), "Nd"(port));
+}
+
+static inline uint32_t asm_inline_inl(uint16_t port){
+    uint32_t data;
+    asm volatile("inl %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+static inline void asm_inline_outl(uint16_t port, uint32_t data){
+    asm volatile("outl %0, %1" :: "a"(data), "Nd"(port));
+}
+
+static inline uint64_t cpu_rdtsc(){
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+    rdtsc that can't be executed ahead of earlier instructions, for timing short intervals
+*/
+static inline uint64_t cpu_rdtsc_ordered(){
+    uint32_t lo, hi;
+    asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t cpu_rdmsr(uint32_t msr){
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpu_wrmsr(uint32_t msr, uint64_t value){
+    asm volatile("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx){
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+/*
+    Index of the executing CPU, read from its per-CPU block through GS (see smp/percpu.h).
+*/
+#define CPU_PERCPU_ID_OFFSET 8
+
+static inline uint32_t cpu_current_id(){
+    uint32_t id;
+    asm volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(CPU_PERCPU_ID_OFFSET));
+    return id;
+}
+
+static inline void cpu_pause(){
+    asm volatile("pause" ::: "memory");
+}
+
+static inline uint64_t cpu_read_rsp(){
+    uint64_t rsp;
+    asm volatile("mov %%rsp, %0" : "=r"(rsp));
+    return rsp;
+}
+
+static inline uint64_t cpu_read_cr3(){
+    uint64_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+static inline void cpu_write_cr3(uint64_t pml4_phys){
+    asm volatile("mov %0, %%cr3" :: "r"(pml4_phys) : "memory");
+}
+
+// Faulting address of the last #PF
+static inline uint64_t cpu_read_cr2(){
+    uint64_t cr2;
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+    return cr2;
+}
+
+static inline void cpu_invlpg(uint64_t virt_addr){
+    asm volatile("invlpg (%0)" :: "r"(virt_addr) : "memory");
+}
+
+#endif
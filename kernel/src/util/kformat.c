@@ -0,0 +1,290 @@
+#include "kformat.h"
+
+#include <stdbool.h>
+
+#define KFORMAT_FLAG_LEFT   0x01
+#define KFORMAT_FLAG_ZERO   0x02
+#define KFORMAT_FLAG_PLUS   0x04
+#define KFORMAT_FLAG_SPACE  0x08
+
+/*
+    Output cursor. Keeps counting past the end of the buffer so the caller
+    can find out how much space the full string would have needed.
+*/
+struct kformat_out{
+    char* buf;
+    size_t size;
+    size_t pos;
+};
+
+static inline void _kformat_putc(struct kformat_out* out, char c){
+    if(out->pos + 1 < out->size){
+        out->buf[out->pos] = c;
+    }
+    out->pos++;
+}
+
+static void _kformat_pad(struct kformat_out* out, char c, int n){
+    for(int i=0; i<n; i++){
+        _kformat_putc(out, c);
+    }
+}
+
+size_t kstrlen(const char* str){
+    size_t len = 0;
+    while(str[len] != '\0'){
+        len++;
+    }
+    return len;
+}
+
+static void _kformat_str(struct kformat_out* out, const char* str, int width, int precision, int flags){
+    if(str == NULL){
+        str = "(null)";
+    }
+    int len = 0;
+    while(str[len] != '\0' && (precision < 0 || len < precision)){
+        len++;
+    }
+    int pad = (width > len)? width - len : 0;
+    if(!(flags & KFORMAT_FLAG_LEFT)){
+        _kformat_pad(out, ' ', pad);
+    }
+    for(int i=0; i<len; i++){
+        _kformat_putc(out, str[i]);
+    }
+    if(flags & KFORMAT_FLAG_LEFT){
+        _kformat_pad(out, ' ', pad);
+    }
+}
+
+static void _kformat_num(struct kformat_out* out, uint64_t value, bool negative, int base, bool upper,
+                         int width, int precision, int flags, const char* prefix){
+    const char* digits = upper? "0123456789ABCDEF" : "0123456789abcdef";
+
+    // Convert the number backwards into a scratch buffer (64 binary digits is the worst case)
+    char tmp[64];
+    int ndigits = 0;
+    do{
+        tmp[ndigits++] = digits[value % base];
+        value /= base;
+    }while(value != 0);
+
+    // An explicit precision of 0 with a value of 0 prints no digits
+    if(precision == 0 && ndigits == 1 && tmp[0] == '0'){
+        ndigits = 0;
+    }
+
+    char sign = 0;
+    if(negative){
+        sign = '-';
+    }else if(flags & KFORMAT_FLAG_PLUS){
+        sign = '+';
+    }else if(flags & KFORMAT_FLAG_SPACE){
+        sign = ' ';
+    }
+
+    int prefix_len = (prefix != NULL)? (int)kstrlen(prefix) : 0;
+    int zeroes = (precision > ndigits)? precision - ndigits : 0;
+    int total = ndigits + zeroes + prefix_len + (sign? 1 : 0);
+
+    // Zero padding fills the width, but only when no precision was given
+    if((flags & KFORMAT_FLAG_ZERO) && !(flags & KFORMAT_FLAG_LEFT) && precision < 0 && width > total){
+        zeroes += width - total;
+        total = width;
+    }
+
+    int pad = (width > total)? width - total : 0;
+    if(!(flags & KFORMAT_FLAG_LEFT)){
+        _kformat_pad(out, ' ', pad);
+    }
+    if(sign){
+        _kformat_putc(out, sign);
+    }
+    for(int i=0; i<prefix_len; i++){
+        _kformat_putc(out, prefix[i]);
+    }
+    _kformat_pad(out, '0', zeroes);
+    for(int i=ndigits-1; i>=0; i--){
+        _kformat_putc(out, tmp[i]);
+    }
+    if(flags & KFORMAT_FLAG_LEFT){
+        _kformat_pad(out, ' ', pad);
+    }
+}
+
+int kvsnprintf(char* buf, size_t size, const char* fmt, va_list args){
+    struct kformat_out out = {buf, size, 0};
+
+    for(size_t i=0; fmt[i]!='\0'; i++){
+        if(fmt[i] != '%'){
+            _kformat_putc(&out, fmt[i]);
+            continue;
+        }
+        i++;
+
+        /*
+            Flags
+        */
+        int flags = 0;
+        for(;; i++){
+            if(fmt[i] == '-'){
+                flags |= KFORMAT_FLAG_LEFT;
+            }else if(fmt[i] == '0'){
+                flags |= KFORMAT_FLAG_ZERO;
+            }else if(fmt[i] == '+'){
+                flags |= KFORMAT_FLAG_PLUS;
+            }else if(fmt[i] == ' '){
+                flags |= KFORMAT_FLAG_SPACE;
+            }else{
+                break;
+            }
+        }
+
+        /*
+            Width + precision
+        */
+        int width = 0;
+        if(fmt[i] == '*'){
+            width = va_arg(args, int);
+            if(width < 0){
+                flags |= KFORMAT_FLAG_LEFT;
+                width = -width;
+            }
+            i++;
+        }else{
+            while(fmt[i] >= '0' && fmt[i] <= '9'){
+                width = width*10 + (fmt[i++] - '0');
+            }
+        }
+        int precision = -1;
+        if(fmt[i] == '.'){
+            i++;
+            precision = 0;
+            if(fmt[i] == '*'){
+                precision = va_arg(args, int);
+                i++;
+            }else{
+                while(fmt[i] >= '0' && fmt[i] <= '9'){
+                    precision = precision*10 + (fmt[i++] - '0');
+                }
+            }
+        }
+
+        /*
+            Length modifier, in bytes of the argument
+        */
+        int length = sizeof(int);
+        if(fmt[i] == 'h'){
+            i++;
+            length = sizeof(short);
+            if(fmt[i] == 'h'){
+                i++;
+                length = sizeof(char);
+            }
+        }else if(fmt[i] == 'l'){
+            i++;
+            length = sizeof(long);
+            if(fmt[i] == 'l'){
+                i++;
+                length = sizeof(long long);
+            }
+        }else if(fmt[i] == 'z'){
+            i++;
+            length = sizeof(size_t);
+        }
+
+        /*
+            Conversion
+        */
+        switch(fmt[i]){
+            case 'd':
+            case 'i':
+            {
+                int64_t value;
+                if(length == 8){
+                    value = va_arg(args, int64_t);
+                }else{
+                    value = va_arg(args, int);
+                    if(length == 2){
+                        value = (short)value;
+                    }else if(length == 1){
+                        value = (signed char)value;
+                    }
+                }
+                uint64_t magnitude = (value < 0)? -(uint64_t)value : (uint64_t)value;
+                _kformat_num(&out, magnitude, value < 0, 10, false, width, precision, flags, NULL);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            {
+                uint64_t value;
+                if(length == 8){
+                    value = va_arg(args, uint64_t);
+                }else{
+                    value = va_arg(args, unsigned int);
+                    if(length == 2){
+                        value = (uint16_t)value;
+                    }else if(length == 1){
+                        value = (uint8_t)value;
+                    }
+                }
+                int base = (fmt[i] == 'u')? 10 : (fmt[i] == 'o')? 8 : 16;
+                flags &= ~(KFORMAT_FLAG_PLUS | KFORMAT_FLAG_SPACE);
+                _kformat_num(&out, value, false, base, fmt[i] == 'X', width, precision, flags, NULL);
+                break;
+            }
+            case 'p':
+            {
+                uint64_t value = (uint64_t)va_arg(args, void*);
+                _kformat_num(&out, value, false, 16, false, width, precision, flags & ~(KFORMAT_FLAG_PLUS | KFORMAT_FLAG_SPACE), "0x");
+                break;
+            }
+            case 'c':
+            {
+                char c[2] = {(char)va_arg(args, int), '\0'};
+                _kformat_str(&out, c, width, -1, flags);
+                break;
+            }
+            case 's':
+            {
+                _kformat_str(&out, va_arg(args, const char*), width, precision, flags);
+                break;
+            }
+            case '%':
+            {
+                _kformat_putc(&out, '%');
+                break;
+            }
+            case '\0':
+            {
+                // Format string ended in the middle of a specifier
+                i--;
+                break;
+            }
+            default:
+            {
+                // Unknown conversion, print it back out so the mistake is visible
+                _kformat_putc(&out, '%');
+                _kformat_putc(&out, fmt[i]);
+                break;
+            }
+        }
+    }
+
+    if(size > 0){
+        buf[(out.pos < size)? out.pos : size-1] = '\0';
+    }
+    return (int)out.pos;
+}
+
+int ksnprintf(char* buf, size_t size, const char* fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
@@ -0,0 +1,21 @@
+#ifndef KFORMAT_H
+#define KFORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+/*
+    Freestanding printf-style formatter.
+    Formats into a caller supplied buffer, always NUL terminates (if size > 0),
+    and returns the length the full output would have had, like snprintf.
+
+    Supported: flags '-' '0' '+' ' ', width (n or *), precision (.n or .*),
+    length modifiers hh h l ll z, conversions d i u x X o p c s %
+*/
+int kvsnprintf(char* buf, size_t size, const char* fmt, va_list args);
+int ksnprintf(char* buf, size_t size, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+size_t kstrlen(const char* str);
+
+#endif
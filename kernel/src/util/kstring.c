@@ -0,0 +1,9 @@
+#include "kstring.h"
+
+int kstrcmp(const char* a, const char* b){
+    while(*a != '\0' && *a == *b){
+        a++;
+        b++;
+    }
+    return (int)(uint8_t)*a - (int)(uint8_t)*b;
+}
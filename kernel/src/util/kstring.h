@@ -0,0 +1,18 @@
+#ifndef KSTRING_H
+#define KSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    memcpy/memset/memmove/memcmp are defined in third-party/gcc-clang-required.c, these are their
+    prototypes. kstrlen() lives with the formatter (kformat.h).
+*/
+void* memcpy(void* dest, const void* src, size_t n);
+void* memset(void* s, int c, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
+int memcmp(const void* s1, const void* s2, size_t n);
+
+int kstrcmp(const char* a, const char* b);
+
+#endif
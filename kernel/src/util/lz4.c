@@ -0,0 +1,98 @@
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5   // The block must end with at least this many literals
+#define LZ4_MF_LIMIT        12  // A match may not start this close to the end
+
+/*
+    Hash table of (position + 1) for each 4 byte prefix seen, 0 means empty.
+    Not reentrant: callers serialise compression.
+*/
+static uint16_t _lz4_table[1 << LZ4_HASH_BITS];
+
+static inline uint32_t _lz4_read32(const uint8_t* p){
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t _lz4_hash(uint32_t seq){
+    return (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/*
+    Write a length that didn't fit in its 4 bit token nibble.
+*/
+static inline uint8_t* _lz4_write_len(uint8_t* op, size_t len){
+    while(len >= 255){
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* _lz4_write_sequence(uint8_t* op, const uint8_t* literals, size_t n_literals,
+                                    uint16_t offset, size_t match_len){
+    uint8_t* token = op++;
+    *token = (n_literals >= 15)? 0xF0 : (uint8_t)(n_literals << 4);
+    if(n_literals >= 15){
+        op = _lz4_write_len(op, n_literals - 15);
+    }
+    for(size_t i=0; i<n_literals; i++){
+        *op++ = literals[i];
+    }
+    if(match_len == 0){
+        return op; // Final literal-only sequence
+    }
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    size_t ml = match_len - LZ4_MIN_MATCH;
+    *token |= (ml >= 15)? 0x0F : (uint8_t)ml;
+    if(ml >= 15){
+        op = _lz4_write_len(op, ml - 15);
+    }
+    return op;
+}
+
+/*
+    Compress src into dst as one LZ4 block.
+    Returns the compressed size, or 0 if the input is too large or dst_cap is below LZ4_BOUND(src_len).
+*/
+size_t lz4_compress_block(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap){
+    if(src_len > LZ4_MAX_BLOCK_SIZE || dst_cap < LZ4_BOUND(src_len)){
+        return 0;
+    }
+    for(size_t i=0; i<(1 << LZ4_HASH_BITS); i++){
+        _lz4_table[i] = 0;
+    }
+
+    uint8_t* op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    if(src_len > LZ4_MF_LIMIT){
+        size_t mf_limit = src_len - LZ4_MF_LIMIT;
+        size_t match_limit = src_len - LZ4_LAST_LITERALS;
+        while(ip < mf_limit){
+            uint32_t seq = _lz4_read32(src + ip);
+            uint32_t h = _lz4_hash(seq);
+            size_t ref = _lz4_table[h];
+            _lz4_table[h] = ip + 1;
+            if(ref == 0 || _lz4_read32(src + ref - 1) != seq){
+                ip++;
+                continue;
+            }
+            ref--;
+
+            size_t len = LZ4_MIN_MATCH;
+            while(ip + len < match_limit && src[ref + len] == src[ip + len]){
+                len++;
+            }
+            op = _lz4_write_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    op = _lz4_write_sequence(op, src + anchor, src_len - anchor, 0, 0);
+    return op - dst;
+}
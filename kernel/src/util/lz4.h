@@ -0,0 +1,17 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    LZ4 block format compressor (greedy, single hash probe).
+    Output is a plain LZ4 block, decodable by any LZ4 implementation.
+*/
+#define LZ4_MAX_BLOCK_SIZE  0xFFFF  // Positions are stored as u16
+#define LZ4_HASH_BITS       12
+#define LZ4_BOUND(n)        ((n) + ((n) / 255) + 16)
+
+size_t lz4_compress_block(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap);
+
+#endif
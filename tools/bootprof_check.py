@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""
+Check the boot stage profile (kernel/src/debugging/bootprof.h) in a serial capture against a baseline.
+
+Usage: tools/bootprof_check.py [serial.log] [--baseline tools/bootprof_baseline.json]
+                               [--threshold 0.5] [--slack-us 500] [--update]
+
+A stage regresses when it takes more than baseline * (1 + threshold) + slack microseconds.
+The absolute slack keeps stages that only take a few microseconds from failing on noise.
+With --update the measured profile becomes the new baseline. When no baseline exists yet the
+measured profile is recorded as one, but nothing was checked, so that is not a pass.
+
+Exit status: 0 checked and no regression (or --update), 1 a stage regressed or the capture has no
+complete profile, 2 no baseline, the profile was recorded as the baseline.
+
+The BOOTPROF lines are plain text, so run with serial compression off (the default).
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+EXIT_NO_BASELINE = 2
+
+STAGE_RE = re.compile(rb"^BOOTPROF stage=(.*) us=(\d+)\r?$")
+TOTAL_RE = re.compile(rb"^BOOTPROF total_us=(\d+)\r?$")
+
+
+def parse_profile(data):
+    """Return (stages, total_us) for the last complete profile in the capture."""
+    profile = {}
+    result = None
+    for line in data.split(b"\n"):
+        m = STAGE_RE.match(line)
+        if m:
+            profile[m.group(1).decode(errors="replace")] = int(m.group(2))
+            continue
+        m = TOTAL_RE.match(line)
+        if m:
+            result = (profile, int(m.group(1)))
+            profile = {}
+    return result
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", default="serial.log")
+    parser.add_argument("--baseline", default=os.path.join(here, "bootprof_baseline.json"))
+    parser.add_argument("--threshold", type=float, default=0.5, help="allowed relative slowdown per stage")
+    parser.add_argument("--slack-us", type=int, default=500, help="allowed absolute slowdown per stage")
+    parser.add_argument("--update", action="store_true", help="write the measured profile as the new baseline")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        parsed = parse_profile(f.read())
+    if parsed is None:
+        print(f"{args.capture}: no complete BOOTPROF table found", file=sys.stderr)
+        return 1
+    stages, total_us = parsed
+
+    baseline = None
+    if not args.update and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    print(f"{'stage':24} {'us':>10} {'baseline':>10} {'limit':>10}")
+    regressions = []
+    unchecked = []
+    for name, us in sorted(stages.items(), key=lambda kv: -kv[1]):
+        if baseline is None or name not in baseline["stages"]:
+            unchecked.append(name)
+            print(f"{name:24} {us:10d} {'-':>10} {'-':>10}")
+            continue
+        base = baseline["stages"][name]
+        limit = int(base * (1 + args.threshold)) + args.slack_us
+        flag = ""
+        if us > limit:
+            regressions.append(name)
+            flag = "  REGRESSED"
+        print(f"{name:24} {us:10d} {base:10d} {limit:10d}{flag}")
+    print(f"{'total':24} {total_us:10d}")
+
+    if baseline is None:
+        with open(args.baseline, "w") as f:
+            json.dump({"stages": stages, "total_us": total_us}, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"baseline written to {args.baseline}")
+        if args.update:
+            return 0
+        print(f"no baseline at {args.baseline}, profile recorded but not checked", file=sys.stderr)
+        return EXIT_NO_BASELINE
+
+    if unchecked:
+        print(f"{len(unchecked)} stage(s) not in the baseline, not checked: {', '.join(unchecked)}")
+    if regressions:
+        print(f"{len(regressions)} stage(s) regressed: {', '.join(regressions)}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,20 @@
+#ifndef HOSTED_H
+#define HOSTED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+#include "util/cpu.h"
+
+extern uint8_t* g_hosted_arena;
+extern uint64_t g_hosted_arena_size;
+extern bool g_hosted_verbose;
+// While set, kpanic("PMM_OOM") jumps here instead of failing, so the driver can judge the OOM
+extern jmp_buf* g_hosted_oom_jmp;
+
+void hosted_fail(const char* fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+// Provided by the driver: print whatever helps reproduce a failure (seed, iteration...)
+void hosted_fail_context();
+
+#endif
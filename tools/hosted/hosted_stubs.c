@@ -0,0 +1,109 @@
+/*
+    Kernel symbols that memory/pmm.c and memory/vmm.c need, reimplemented on the host.
+    Physical memory is an arena of host memory: physical address N lives at g_hosted_arena + N,
+    whichever direct map (Limine's or the kernel's) the kernel code thinks it is using.
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hosted.h"
+
+#include "memory/physmap.h"
+#include "debugging/trace.h"
+#include "debugging/panic.h"
+#include "debugging/serialout.h"
+#include "debugging/kprint.h"
+#include "util/utility.h"
+
+uint64_t g_hosted_rflags = CPU_RFLAGS_IF;
+uint64_t g_hosted_cr3 = 0;
+uint64_t g_hosted_rsp = 0;
+uint64_t g_hosted_invlpg_count = 0;
+
+uint8_t* g_hosted_arena = NULL;
+uint64_t g_hosted_arena_size = 0;
+bool g_hosted_verbose = false;
+jmp_buf* g_hosted_oom_jmp = NULL;
+
+volatile bool g_trace_enabled[TRACE_EVENT_COUNT] = {0};
+
+
+void hosted_fail(const char* fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    hosted_fail_context();
+    abort();
+}
+
+
+/*
+    Both direct maps resolve into the arena. Anything outside it is a kernel bug (or a bad layout).
+*/
+uint64_t translateaddr_idmap_p2v(uint64_t addr){
+    if(addr >= g_hosted_arena_size){
+        hosted_fail("translateaddr_idmap_p2v(0x%lx) outside the 0x%lx byte arena", addr, g_hosted_arena_size);
+    }
+    return (uint64_t)g_hosted_arena + addr;
+}
+
+uint64_t translateaddr_idmap_v2p(uint64_t vaddr){
+    if(vaddr < (uint64_t)g_hosted_arena || vaddr >= (uint64_t)g_hosted_arena + g_hosted_arena_size){
+        hosted_fail("translateaddr_idmap_v2p(0x%lx) outside the arena", vaddr);
+    }
+    return vaddr - (uint64_t)g_hosted_arena;
+}
+
+uint64_t translateaddr_idmap_p2v_limine(uint64_t addr){
+    return translateaddr_idmap_p2v(addr);
+}
+
+uint64_t translateaddr_idmap_v2p_limine(uint64_t lvaddr){
+    return translateaddr_idmap_v2p(lvaddr);
+}
+
+
+void kpanic(const char* fmt, ...){
+    if(g_hosted_oom_jmp != NULL && strcmp(fmt, "PMM_OOM") == 0){
+        longjmp(*g_hosted_oom_jmp, 1);
+    }
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "FAIL: kpanic: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    hosted_fail_context();
+    abort();
+}
+
+void khalt(void){
+    hosted_fail("khalt");
+}
+
+void debug_serial_printf(const char* fmt, ...){
+    if(!g_hosted_verbose){
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+// Only pmm_stats_dump() prints through kprintf, always wanted
+void kprintf(const char* fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void trace_emit(uint16_t event, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3){
+    (void)event; (void)a0; (void)a1; (void)a2; (void)a3;
+}
@@ -0,0 +1,71 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Hosted stand-in for kernel/src/util/cpu.h, found first on the include path.
+    Single threaded: interrupt state is a flag, the CPU id is always 0, and the privileged
+    instructions are recorded instead of executed.
+*/
+#define CPU_RFLAGS_IF 0x200
+
+extern uint64_t g_hosted_rflags;
+extern uint64_t g_hosted_cr3;
+extern uint64_t g_hosted_rsp;
+extern uint64_t g_hosted_invlpg_count;
+
+static inline uint64_t cpu_irq_save(){
+    uint64_t rflags = g_hosted_rflags;
+    g_hosted_rflags &= ~(uint64_t)CPU_RFLAGS_IF;
+    return rflags;
+}
+
+static inline void cpu_irq_restore(uint64_t rflags){
+    g_hosted_rflags |= rflags & CPU_RFLAGS_IF;
+}
+
+static inline bool cpu_irq_enabled(){
+    return g_hosted_rflags & CPU_RFLAGS_IF;
+}
+
+static inline uint64_t cpu_rdtsc(){
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t cpu_rdtsc_ordered(){
+    uint32_t lo, hi;
+    asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint32_t cpu_current_id(){
+    return 0;
+}
+
+static inline void cpu_pause(){
+    asm volatile("pause" ::: "memory");
+}
+
+// vmm_setup() maps the boot stack: report an address inside the arena (see mm_hosted.c)
+static inline uint64_t cpu_read_rsp(){
+    return g_hosted_rsp;
+}
+
+static inline uint64_t cpu_read_cr3(){
+    return g_hosted_cr3;
+}
+
+static inline void cpu_write_cr3(uint64_t pml4_phys){
+    g_hosted_cr3 = pml4_phys;
+}
+
+static inline void cpu_invlpg(uint64_t virt_addr){
+    (void)virt_addr;
+    g_hosted_invlpg_count++;
+}
+
+#endif
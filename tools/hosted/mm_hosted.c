@@ -0,0 +1,612 @@
+/*
+    Hosted driver for the kernel's PMM and VMM (kernel/src/memory/pmm.c, vmm.c).
+
+    The unmodified kernel sources run against a host memory arena standing in for physical memory
+    (hosted_stubs.c) and a synthetic Limine memory map.
+
+    bench: one layout, randomized alloc/free then map/unmap workloads, throughput and fragmentation.
+    fuzz:  many random layouts and interleaved workloads, with full invariant checks every few
+           thousand operations (see _hosted_check()). Any violation aborts with the seed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hosted.h"
+
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+
+extern uint32_t _pmm_bytemap_free_page_cache;
+extern uint64_t* _vmm_PML4_physAddr;
+
+#define HOSTED_MAX_ENTRIES      128
+#define HOSTED_MAX_HELD         8192    // Outstanding PMM allocations
+#define HOSTED_MAX_RUN          64      // Largest PMM allocation, in pages
+#define HOSTED_VMM_SLOTS        8192    // Virtual pages the map/unmap workload cycles through
+#define HOSTED_PTE_ADDR_MASK    0x000FFFFFFFFFF000UL
+
+enum hosted_owner{
+    OWNER_NONE,
+    OWNER_BYTEMAP,
+    OWNER_TABLE,
+    OWNER_PMM_HELD,
+    OWNER_VMM_PAGE,
+};
+
+static const char* _hosted_owner_names[] = {"none", "bytemap", "page table", "pmm allocation", "vmm page"};
+
+struct hosted_alloc{
+    uint64_t phys;
+    int n_pages;
+};
+
+struct hosted_slot{
+    uint64_t virt;
+    uint64_t phys;      // 0 while unmapped
+};
+
+static struct limine_memmap_entry _entries[HOSTED_MAX_ENTRIES];
+static struct limine_memmap_entry* _entry_ptrs[HOSTED_MAX_ENTRIES];
+static uint64_t _entry_count;
+
+static struct hosted_alloc _held[HOSTED_MAX_HELD];
+static int _held_count;
+static uint64_t _held_pages;
+static uint64_t _held_pages_max;
+static struct hosted_slot _slots[HOSTED_VMM_SLOTS];
+static uint64_t _mapped_count;
+static uint64_t _mapped_max;
+static uint64_t _oom_count;
+
+static uint8_t* _owner;
+static uint64_t _rng_state;
+static uint64_t _seed;
+static uint64_t _iteration;
+static uint64_t _op;
+
+
+void hosted_fail_context(){
+    fprintf(stderr, "  seed=%lu iteration=%lu op=%lu\n", _seed, _iteration, _op);
+}
+
+static uint64_t _rand(){
+    // xorshift64*
+    _rng_state ^= _rng_state >> 12;
+    _rng_state ^= _rng_state << 25;
+    _rng_state ^= _rng_state >> 27;
+    return _rng_state * 0x2545F4914F6CDD1DUL;
+}
+
+static uint64_t _rand_below(uint64_t n){
+    return _rand() % n;
+}
+
+static double _now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+    Memory map layouts. The low megabytes always look like a PC booted by Limine: low usable
+    memory, the legacy hole, the bootloader's (reclaimable) area holding the stack, the kernel.
+*/
+static void _layout_add(uint64_t base, uint64_t length, uint64_t type){
+    if(_entry_count == HOSTED_MAX_ENTRIES || length == 0){
+        return;
+    }
+    _entries[_entry_count] = (struct limine_memmap_entry){base, length, type};
+    _entry_ptrs[_entry_count] = &_entries[_entry_count];
+    _entry_count++;
+}
+
+static void _layout_low(){
+    _entry_count = 0;
+    _layout_add(0x1000, 0x9e000, LIMINE_MEMMAP_USABLE);
+    _layout_add(0x9f000, 0x61000, LIMINE_MEMMAP_RESERVED);
+    _layout_add(0x100000, 0x100000, LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE);
+    _layout_add(0x200000, 0x200000, LIMINE_MEMMAP_KERNEL_AND_MODULES);
+    g_hosted_rsp = (uint64_t)g_hosted_arena + 0x1f0000;
+}
+
+// Like QEMU's: RAM up to a PCI hole, then the rest above it
+static void _layout_pc(uint64_t mem){
+    _layout_low();
+    uint64_t hole = (mem / 4 * 3) & ~(uint64_t)0xFFFFF;
+    _layout_add(0x400000, hole - 0x400000, LIMINE_MEMMAP_USABLE);
+    _layout_add(hole, 0x1000000, LIMINE_MEMMAP_FRAMEBUFFER);
+    _layout_add(hole + 0x1000000, mem - hole - 0x1000000, LIMINE_MEMMAP_USABLE);
+}
+
+// Random sections and holes above the low area, with at least one section able to hold the bytemap
+static void _layout_random(uint64_t mem){
+    static const uint64_t types[] = {
+        LIMINE_MEMMAP_USABLE, LIMINE_MEMMAP_USABLE, LIMINE_MEMMAP_USABLE, LIMINE_MEMMAP_USABLE,
+        LIMINE_MEMMAP_RESERVED, LIMINE_MEMMAP_ACPI_RECLAIMABLE, LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE,
+        UINT64_MAX, // Hole, no entry
+    };
+    _layout_low();
+    uint64_t big_len = (mem / PAGE_SIZE / PAGE_SIZE + 2) * PAGE_SIZE * (1 + _rand_below(4));
+    uint64_t big_at = 0x400000 + _rand_below((mem - 0x400000 - big_len) / PAGE_SIZE) * PAGE_SIZE;
+
+    uint64_t cursor = 0x400000;
+    while(cursor < mem && _entry_count < HOSTED_MAX_ENTRIES - 2){
+        if(cursor <= big_at && big_at < cursor + PAGE_SIZE){
+            _layout_add(big_at, big_len, LIMINE_MEMMAP_USABLE);
+            cursor = big_at + big_len;
+            continue;
+        }
+        uint64_t end = cursor + (1 + _rand_below(mem / PAGE_SIZE / 16)) * PAGE_SIZE;
+        if(cursor < big_at && end > big_at){
+            end = big_at;
+        }
+        if(end > mem){
+            end = mem;
+        }
+        uint64_t type = types[_rand_below(sizeof(types) / sizeof(types[0]))];
+        if(type != UINT64_MAX){
+            _layout_add(cursor, end - cursor, type);
+        }
+        cursor = end;
+    }
+}
+
+
+/*
+    Bring the kernel's memory management up from scratch on the current layout
+*/
+static void _hosted_boot(){
+    // Garbage everywhere, so anything the kernel forgets to zero shows up
+    memset(g_hosted_arena, 0xA5, g_hosted_arena_size);
+    memset(_owner, OWNER_NONE, g_hosted_arena_size / PAGE_SIZE);
+    memset(_slots, 0, sizeof(_slots));
+    _held_count = 0;
+    _held_pages = 0;
+    _mapped_count = 0;
+    _oom_count = 0;
+
+    g_kbytemap_info = (struct bytemap_info){0, 0};
+    _pmm_bytemap_free_page_cache = 0;
+    _vmm_PML4_physAddr = NULL;
+    g_vmm_usingLiminePageTables = true;
+
+    struct limine_memmap_response memmap = {.revision = 0, .entry_count = _entry_count, .entries = _entry_ptrs};
+    pmm_setup_bytemap(memmap);
+    vmm_setup(memmap, 0x200000);
+
+    static const uint64_t regions[] = {0x400000, 0x100000000000, 0xffffc00000000000};
+    for(int i=0; i<HOSTED_VMM_SLOTS; i++){
+        // Spread over a few page tables per region so tables get created and shared
+        _slots[i].virt = regions[i % 3] + (uint64_t)(i / 3) * PAGE_SIZE * 7;
+    }
+
+    // Each workload holds at most a quarter of free memory, leaving room for tables and fragmentation
+    uint8_t* bytemap = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint64_t free_pages = 0;
+    for(uint64_t page=0; page<(uint64_t)g_kbytemap_info.size_npages * PAGE_SIZE; page++){
+        free_pages += bytemap[page] & 1;
+    }
+    _held_pages_max = free_pages / 4;
+    _mapped_max = free_pages / 4;
+}
+
+
+/*
+    Invariants
+*/
+static bool _hosted_page_usable(uint64_t page){
+    uint64_t addr = page * PAGE_SIZE;
+    for(uint64_t i=0; i<_entry_count; i++){
+        if(_entries[i].type == LIMINE_MEMMAP_USABLE && addr >= _entries[i].base && addr < _entries[i].base + _entries[i].length){
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _hosted_own(uint64_t page, enum hosted_owner owner){
+    if(page >= g_hosted_arena_size / PAGE_SIZE){
+        hosted_fail("%s page 0x%lx is outside physical memory", _hosted_owner_names[owner], page);
+    }
+    if(_owner[page] != OWNER_NONE){
+        hosted_fail("page 0x%lx is both %s and %s", page, _hosted_owner_names[_owner[page]], _hosted_owner_names[owner]);
+    }
+    if(owner != OWNER_BYTEMAP && !_hosted_page_usable(page)){
+        hosted_fail("%s page 0x%lx is not in usable memory", _hosted_owner_names[owner], page);
+    }
+    _owner[page] = owner;
+}
+
+static void _hosted_own_tables(uint64_t table_phys, int level){
+    _hosted_own(table_phys / PAGE_SIZE, OWNER_TABLE);
+    if(level == 1){
+        return;     // Page table: entries are leaves
+    }
+    uint64_t* table = (uint64_t*)translateaddr_idmap_p2v(table_phys);
+    for(int i=0; i<512; i++){
+        if(table[i] & VMM_FLAG_PRESENT){
+            if((table[i] & (VMM_FLAG_PRESENT | VMM_FLAG_WRITE)) != (VMM_FLAG_PRESENT | VMM_FLAG_WRITE)){
+                hosted_fail("level %d table 0x%lx entry %d has flags 0x%lx", level, table_phys, i, table[i] & 0xFFF);
+            }
+            _hosted_own_tables(table[i] & HOSTED_PTE_ADDR_MASK, level - 1);
+        }else if(table[i] != 0){
+            hosted_fail("level %d table 0x%lx entry %d is not present but 0x%lx", level, table_phys, i, table[i]);
+        }
+    }
+}
+
+// Leaf PTE for virt under pml4_phys, or 0 if a table on the way is missing
+static uint64_t _hosted_walk_space(uint64_t pml4_phys, uint64_t virt){
+    uint64_t table_phys = pml4_phys;
+    for(int shift=39; shift>=12; shift-=9){
+        uint64_t entry = ((uint64_t*)translateaddr_idmap_p2v(table_phys))[(virt >> shift) & 511];
+        if(shift == 12){
+            return entry;
+        }
+        if(!(entry & VMM_FLAG_PRESENT)){
+            return 0;
+        }
+        table_phys = entry & HOSTED_PTE_ADDR_MASK;
+    }
+    return 0;
+}
+
+static uint64_t _hosted_walk(uint64_t virt){
+    return _hosted_walk_space((uint64_t)_vmm_PML4_physAddr, virt);
+}
+
+/*
+    Every page is accounted for exactly once: the bytemap marks a page free if and only if it is
+    usable memory that is not the bytemap, a page table, or held by the workloads. Mappings the
+    workloads made resolve to their pages, the ones they removed don't resolve at all.
+*/
+static void _hosted_check(){
+    memset(_owner, OWNER_NONE, g_hosted_arena_size / PAGE_SIZE);
+    for(uint64_t i=0; i<g_kbytemap_info.size_npages; i++){
+        _hosted_own(g_kbytemap_info.base_phys / PAGE_SIZE + i, OWNER_BYTEMAP);
+    }
+    _hosted_own_tables((uint64_t)_vmm_PML4_physAddr, 4);
+    for(int i=0; i<_held_count; i++){
+        for(int j=0; j<_held[i].n_pages; j++){
+            _hosted_own(_held[i].phys / PAGE_SIZE + j, OWNER_PMM_HELD);
+        }
+    }
+    for(int i=0; i<HOSTED_VMM_SLOTS; i++){
+        uint64_t pte = _hosted_walk(_slots[i].virt);
+        if(_slots[i].phys != 0){
+            _hosted_own(_slots[i].phys / PAGE_SIZE, OWNER_VMM_PAGE);
+            if((pte & HOSTED_PTE_ADDR_MASK) != _slots[i].phys || !(pte & VMM_FLAG_PRESENT)){
+                hosted_fail("0x%lx should map 0x%lx, PTE is 0x%lx", _slots[i].virt, _slots[i].phys, pte);
+            }
+        }else if(pte != 0){
+            hosted_fail("0x%lx was unmapped but its PTE is 0x%lx", _slots[i].virt, pte);
+        }
+    }
+
+    uint8_t* bytemap = (uint8_t*)translateaddr_idmap_p2v(g_kbytemap_info.base_phys);
+    uint64_t n_entries = (uint64_t)g_kbytemap_info.size_npages * PAGE_SIZE;
+    uint64_t arena_pages = g_hosted_arena_size / PAGE_SIZE;
+    uint64_t free_pages = 0;
+    for(uint64_t page=0; page<n_entries; page++){
+        bool expect_free = page < arena_pages && _owner[page] == OWNER_NONE && _hosted_page_usable(page);
+        bool is_free = bytemap[page] & 1;
+        if(expect_free != is_free){
+            hosted_fail("bytemap says page 0x%lx is %s, it should be %s (owner: %s)", page,
+                        is_free? "free" : "used", expect_free? "free" : "used",
+                        page < arena_pages? _hosted_owner_names[_owner[page]] : "beyond memory");
+        }
+        free_pages += is_free;
+    }
+
+    // The PMM's own counters agree with the bytemap
+    struct pmm_fragmentation frag;
+    pmm_fragmentation(&frag);
+    if(g_pmm_stats.free_pages != free_pages || frag.free_pages != free_pages){
+        hosted_fail("%lu free pages, g_pmm_stats says %lu, pmm_fragmentation() %lu", free_pages, g_pmm_stats.free_pages, frag.free_pages);
+    }
+    if(g_pmm_stats.alloc_pages - g_pmm_stats.free_calls != g_pmm_stats.total_pages - free_pages){
+        hosted_fail("%lu pages allocated and %lu freed, but %lu of %lu in use", g_pmm_stats.alloc_pages, g_pmm_stats.free_calls,
+                    g_pmm_stats.total_pages - free_pages, g_pmm_stats.total_pages);
+    }
+}
+
+
+/*
+    pmm_alloc_pages(), except that running out of memory is allowed, as long as it really is out:
+    random layouts and workloads can leave no free run long enough.
+*/
+static bool _hosted_alloc(int n_pages, uint64_t* phys){
+    jmp_buf oom;
+    if(setjmp(oom)){
+        g_hosted_oom_jmp = NULL;
+        struct pmm_fragmentation frag;
+        pmm_fragmentation(&frag);
+        if(frag.largest_run >= (uint64_t)n_pages){
+            hosted_fail("pmm_alloc_pages(%d) ran out of memory with a free run of %lu pages", n_pages, frag.largest_run);
+        }
+        _oom_count++;
+        return false;
+    }
+    g_hosted_oom_jmp = &oom;
+    *phys = (uint64_t)pmm_alloc_pages(n_pages);
+    g_hosted_oom_jmp = NULL;
+    return true;
+}
+
+
+/*
+    Workloads. One call is one operation.
+*/
+static void _hosted_pmm_op(){
+    bool alloc = _held_count == 0 || (_held_count < HOSTED_MAX_HELD && _held_pages < _held_pages_max && (_rand() & 1));
+    if(alloc){
+        // Mostly single pages, some small runs, the occasional large one
+        uint64_t r = _rand_below(100);
+        int n_pages = (r < 80)? 1 : (r < 97)? 2 + _rand_below(7) : 9 + _rand_below(HOSTED_MAX_RUN - 8);
+        uint64_t phys;
+        if(_hosted_alloc(n_pages, &phys)){
+            _held[_held_count++] = (struct hosted_alloc){phys, n_pages};
+            _held_pages += n_pages;
+        }
+    }else{
+        int i = _rand_below(_held_count);
+        for(int j=0; j<_held[i].n_pages; j++){
+            pmm_free_page_physaddr(_held[i].phys + j*PAGE_SIZE);
+        }
+        _held_pages -= _held[i].n_pages;
+        _held[i] = _held[--_held_count];
+    }
+}
+
+static void _hosted_vmm_op(){
+    struct hosted_slot* slot = &_slots[_rand_below(HOSTED_VMM_SLOTS)];
+    if(slot->phys == 0){
+        if(_mapped_count >= _mapped_max || !_hosted_alloc(1, &slot->phys)){
+            return;
+        }
+        _mapped_count++;
+        vmm_map_phys2virt(slot->phys, slot->virt, VMM_FLAG_PRESENT | VMM_FLAG_WRITE);
+    }else{
+        uint64_t phys = vmm_unmap_page(slot->virt);
+        if(phys != slot->phys){
+            hosted_fail("vmm_unmap_page(0x%lx) returned 0x%lx, mapped 0x%lx", slot->virt, phys, slot->phys);
+        }
+        pmm_free_page_physaddr(phys);
+        slot->phys = 0;
+        _mapped_count--;
+    }
+}
+
+/*
+    Address space lifetime in one operation, so _hosted_check() never sees one: the space maps
+    owned pages below VMM_USER_TOP, shares the kernel half, is cloned copy-on-write, and both give
+    everything back when destroyed.
+*/
+static uint64_t _hosted_count_tables(uint64_t table_phys, int level){
+    uint64_t n = 1;
+    uint64_t* table = (uint64_t*)translateaddr_idmap_p2v(table_phys);
+    for(int i=0; level>1 && i<512; i++){
+        if(table[i] & VMM_FLAG_PRESENT){
+            n += _hosted_count_tables(table[i] & HOSTED_PTE_ADDR_MASK, level - 1);
+        }
+    }
+    return n;
+}
+
+static void _hosted_space_op(){
+    uint64_t free_before = g_pmm_stats.free_pages;
+    uint64_t tables_before = _hosted_count_tables((uint64_t)_vmm_PML4_physAddr, 4);
+    struct vmm_space* space = vmm_space_create();
+    if(space == NULL){
+        hosted_fail("vmm_space_create() found no free address space");
+    }
+    uint64_t* pml4 = (uint64_t*)translateaddr_idmap_p2v(space->pml4_phys);
+    uint64_t* kernel_pml4 = (uint64_t*)translateaddr_idmap_p2v((uint64_t)_vmm_PML4_physAddr);
+    for(int i=(VMM_USER_TOP >> 39); i<512; i++){
+        if(pml4[i] != kernel_pml4[i]){
+            hosted_fail("address space PML4 entry %d is 0x%lx, the kernel's 0x%lx", i, pml4[i], kernel_pml4[i]);
+        }
+    }
+
+    // Far enough apart that most pages need their own tables
+    uint64_t base = 0x200000000000 + _rand_below(64) * 0x40000000;
+    int n_pages = 1 + _rand_below(16);
+    uint64_t phys[16];
+    int mapped = 0;
+    while(mapped < n_pages && _mapped_count + mapped < _mapped_max && _hosted_alloc(1, &phys[mapped])){
+        uint64_t virt = base + (uint64_t)mapped * 0x201000;
+        vmm_space_map(space, phys[mapped], virt, VMM_FLAG_PRESENT | VMM_FLAG_WRITE | VMM_FLAG_USER | VMM_FLAG_OWNED);
+        if(vmm_space_translate(space, virt + 0x123) != phys[mapped] + 0x123){
+            hosted_fail("0x%lx in an address space translates to 0x%lx, mapped 0x%lx", virt, vmm_space_translate(space, virt), phys[mapped]);
+        }
+        if(_hosted_walk(virt) != 0){
+            hosted_fail("address space mapping 0x%lx is visible in the kernel's", virt);
+        }
+        // The syscall buffer check: the page itself is, a range running off its end (unmapped) is not
+        if(!vmm_space_user_range_mapped(space, virt, PAGE_SIZE) || vmm_space_user_range_mapped(space, virt + PAGE_SIZE - 8, 16)){
+            hosted_fail("vmm_space_user_range_mapped() wrong around 0x%lx", virt);
+        }
+        mapped++;
+    }
+
+    // Clone, then write to random pages of either space: each must keep seeing its own data
+    for(int i=0; i<mapped; i++){
+        memset((void*)translateaddr_idmap_p2v(phys[i]), i + 1, PAGE_SIZE);
+    }
+    struct vmm_space* clone = vmm_space_clone(space);
+    if(clone == NULL){
+        hosted_fail("vmm_space_clone() found no free address space");
+    }
+    struct vmm_space* spaces[2] = {space, clone};
+    uint8_t expect[2][16];
+    for(int i=0; i<mapped; i++){
+        uint64_t virt = base + (uint64_t)i * 0x201000;
+        for(int s=0; s<2; s++){
+            uint64_t pte = _hosted_walk_space(spaces[s]->pml4_phys, virt);
+            if((pte & HOSTED_PTE_ADDR_MASK) != phys[i] || (pte & VMM_FLAG_WRITE) || !(pte & VMM_FLAG_COW)){
+                hosted_fail("after a clone 0x%lx has PTE 0x%lx in space %d, expected 0x%lx read-only + COW", virt, pte, s, phys[i]);
+            }
+            expect[s][i] = i + 1;
+        }
+        if(pmm_page_refcount(phys[i]) != 2){
+            hosted_fail("cloned page 0x%lx has %u references", phys[i], pmm_page_refcount(phys[i]));
+        }
+    }
+    for(int w=0; w<mapped*2; w++){
+        int s = _rand() & 1;
+        int i = _rand_below(mapped);
+        uint64_t virt = base + (uint64_t)i * 0x201000;
+        bool cow = !(_hosted_walk_space(spaces[s]->pml4_phys, virt) & VMM_FLAG_WRITE);
+        if(vmm_space_cow_fault(spaces[s], virt + _rand_below(PAGE_SIZE)) != cow){
+            hosted_fail("vmm_space_cow_fault() on 0x%lx in space %d should have returned %d", virt, s, cow);
+        }
+        uint64_t pte = _hosted_walk_space(spaces[s]->pml4_phys, virt);
+        if(!(pte & VMM_FLAG_WRITE) || (pte & VMM_FLAG_COW)){
+            hosted_fail("0x%lx in space %d is still copy-on-write after a fault: 0x%lx", virt, s, pte);
+        }
+        expect[s][i] = 0x80 + w;
+        memset((void*)translateaddr_idmap_p2v(pte & HOSTED_PTE_ADDR_MASK), expect[s][i], PAGE_SIZE);
+    }
+    for(int i=0; i<mapped; i++){
+        for(int s=0; s<2; s++){
+            uint64_t virt = base + (uint64_t)i * 0x201000;
+            uint8_t* page = (uint8_t*)translateaddr_idmap_p2v(vmm_space_translate(spaces[s], virt));
+            if(page[0] != expect[s][i] || page[PAGE_SIZE-1] != expect[s][i]){
+                hosted_fail("0x%lx in space %d holds 0x%x, wrote 0x%x", virt, s, page[0], expect[s][i]);
+            }
+        }
+    }
+
+    // The kernel's tables may have grown to direct map the new tables and pages, the rest must come back
+    int first = _rand() & 1;
+    vmm_space_destroy(spaces[first]);
+    vmm_space_destroy(spaces[!first]);
+    uint64_t kernel_tables = _hosted_count_tables((uint64_t)_vmm_PML4_physAddr, 4) - tables_before;
+    if(g_pmm_stats.free_pages + kernel_tables != free_before){
+        hosted_fail("destroying an address space with %d pages left %lu free pages, %lu before (%lu new kernel tables)",
+                    mapped, g_pmm_stats.free_pages, free_before, kernel_tables);
+    }
+}
+
+
+static void _hosted_report_fragmentation(){
+    struct pmm_fragmentation frag;
+    pmm_fragmentation(&frag);
+    printf("  free: %lu pages in %lu runs, largest run %lu pages, fragmentation index %u.%03u\n",
+           frag.free_pages, frag.free_runs, frag.largest_run, frag.fragmentation_permille / 1000, frag.fragmentation_permille % 1000);
+}
+
+
+static void _usage(){
+    fprintf(stderr,
+        "usage: mm_hosted bench [--mem MB] [--ops N] [--seed S] [--layout pc|random] [--verbose]\n"
+        "       mm_hosted fuzz [--mem MB] [--ops N] [--iterations N] [--check-every N] [--seed S]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2 || (strcmp(argv[1], "bench") && strcmp(argv[1], "fuzz"))){
+        _usage();
+    }
+    bool fuzz = strcmp(argv[1], "fuzz") == 0;
+    uint64_t mem_mb = 256;
+    uint64_t ops = fuzz? 20000 : 2000000;
+    uint64_t iterations = 100;
+    uint64_t check_every = 2000;
+    bool random_layout = fuzz;
+    _seed = (uint64_t)time(NULL);
+    for(int i=2; i<argc; i++){
+        if(!strcmp(argv[i], "--verbose")){
+            g_hosted_verbose = true;
+            continue;
+        }
+        if(i+1 >= argc){
+            _usage();
+        }
+        const char* value = argv[++i];
+        if(!strcmp(argv[i-1], "--mem")){
+            mem_mb = strtoull(value, NULL, 0);
+        }else if(!strcmp(argv[i-1], "--ops")){
+            ops = strtoull(value, NULL, 0);
+        }else if(!strcmp(argv[i-1], "--seed")){
+            _seed = strtoull(value, NULL, 0);
+        }else if(!strcmp(argv[i-1], "--iterations")){
+            iterations = strtoull(value, NULL, 0);
+        }else if(!strcmp(argv[i-1], "--check-every")){
+            check_every = strtoull(value, NULL, 0);
+        }else if(!strcmp(argv[i-1], "--layout")){
+            random_layout = !strcmp(value, "random");
+        }else{
+            _usage();
+        }
+    }
+    if(mem_mb < 16){
+        mem_mb = 16;
+    }
+
+    g_hosted_arena_size = mem_mb << 20;
+    g_hosted_arena = aligned_alloc(PAGE_SIZE, g_hosted_arena_size);
+    _owner = malloc(g_hosted_arena_size / PAGE_SIZE);
+    if(g_hosted_arena == NULL || _owner == NULL){
+        fprintf(stderr, "out of host memory\n");
+        return 1;
+    }
+    _rng_state = _seed? _seed : 1;
+    printf("seed %lu, %lu MiB\n", _seed, mem_mb);
+
+    if(!fuzz){
+        if(random_layout){
+            _layout_random(g_hosted_arena_size);
+        }else{
+            _layout_pc(g_hosted_arena_size);
+        }
+        _hosted_boot();
+
+        double start = _now();
+        for(_op=0; _op<ops; _op++){
+            _hosted_pmm_op();
+        }
+        double pmm_s = _now() - start;
+        printf("pmm alloc/free: %lu ops in %.3f s, %.2f Mops/s (%lu pages held at the end, %lu allocations out of memory)\n",
+               ops, pmm_s, ops / pmm_s / 1e6, _held_pages, _oom_count);
+        _hosted_report_fragmentation();
+
+        start = _now();
+        for(_op=0; _op<ops; _op++){
+            _hosted_vmm_op();
+        }
+        double vmm_s = _now() - start;
+        printf("vmm map/unmap: %lu ops in %.3f s, %.2f Mops/s\n", ops, vmm_s, ops / vmm_s / 1e6);
+        _hosted_report_fragmentation();
+
+        _hosted_check();
+        printf("invariants OK\n\n");
+        pmm_stats_dump();
+        return 0;
+    }
+
+    for(_iteration=0; _iteration<iterations; _iteration++){
+        _layout_random(g_hosted_arena_size);
+        _hosted_boot();
+        _hosted_check();
+        for(_op=0; _op<ops; _op++){
+            uint64_t r = _rand_below(64);
+            if(r < 32){
+                _hosted_pmm_op();
+            }else if(r < 63){
+                _hosted_vmm_op();
+            }else{
+                _hosted_space_op();
+            }
+            if((_op + 1) % check_every == 0){
+                _hosted_check();
+            }
+        }
+        _hosted_check();
+    }
+    printf("%lu iterations of %lu ops, invariants OK\n", iterations, ops);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""
+Extract kbench results (kernel/src/debugging/kbench.h) from a serial capture, and check them against
+a baseline.
+
+Usage: tools/kbench_parse.py [serial.log] [--output kbench.json] [--baseline tools/kbench_baseline.json]
+                             [--threshold 0.25] [--slack-cycles 50] [--update]
+
+The results of the last complete run (ended by "KBENCH done") are written to --output as JSON.
+A benchmark regresses when its median takes more than baseline * (1 + threshold) + slack cycles.
+With --update the measured results become the new baseline. When no baseline exists yet the
+results are recorded as one, but nothing was checked, so that is not a pass.
+
+Exit status: 0 checked and no regression (or --update), 1 a benchmark regressed or the capture has
+no complete run, 2 no baseline, the results were recorded as the baseline.
+
+The KBENCH lines are plain text, so run with serial compression off (the default).
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+EXIT_NO_BASELINE = 2
+
+RESULT_RE = re.compile(rb"^KBENCH name=(\S+) ((?:\w+=\d+ ?)+)\r?$")
+DONE_RE = re.compile(rb"^KBENCH done count=(\d+)\r?$")
+
+
+def parse_run(data):
+    """Return {name: {field: value}} for the last complete run in the capture."""
+    run = {}
+    result = None
+    for line in data.split(b"\n"):
+        m = RESULT_RE.match(line)
+        if m:
+            fields = dict(kv.split(b"=") for kv in m.group(2).split())
+            run[m.group(1).decode(errors="replace")] = {k.decode(): int(v) for k, v in fields.items()}
+            continue
+        m = DONE_RE.match(line)
+        if m:
+            if int(m.group(1)) == len(run):
+                result = run
+            run = {}
+    return result
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", default="serial.log")
+    parser.add_argument("--output", default="kbench.json", help="where to write the parsed results")
+    parser.add_argument("--baseline", default=os.path.join(here, "kbench_baseline.json"))
+    parser.add_argument("--threshold", type=float, default=0.25, help="allowed relative slowdown of the median")
+    parser.add_argument("--slack-cycles", type=int, default=50, help="allowed absolute slowdown of the median")
+    parser.add_argument("--update", action="store_true", help="write the measured results as the new baseline")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        run = parse_run(f.read())
+    if run is None:
+        print(f"{args.capture}: no complete KBENCH run found", file=sys.stderr)
+        return 1
+
+    with open(args.output, "w") as f:
+        json.dump({"benchmarks": run}, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    baseline = None
+    if not args.update and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    print(f"{'benchmark':24} {'min':>10} {'median':>10} {'p99':>10} {'baseline':>10} {'limit':>10}")
+    regressions = []
+    unchecked = []
+    for name, res in sorted(run.items()):
+        line = f"{name:24} {res['min_cyc']:10d} {res['median_cyc']:10d} {res['p99_cyc']:10d}"
+        if baseline is None or name not in baseline["benchmarks"]:
+            unchecked.append(name)
+            print(f"{line} {'-':>10} {'-':>10}")
+            continue
+        base = baseline["benchmarks"][name]["median_cyc"]
+        limit = int(base * (1 + args.threshold)) + args.slack_cycles
+        flag = ""
+        if res["median_cyc"] > limit:
+            regressions.append(name)
+            flag = "  REGRESSED"
+        print(f"{line} {base:10d} {limit:10d}{flag}")
+    print(f"results written to {args.output}")
+
+    if baseline is None:
+        with open(args.baseline, "w") as f:
+            json.dump({"benchmarks": run}, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"baseline written to {args.baseline}")
+        if args.update:
+            return 0
+        print(f"no baseline at {args.baseline}, results recorded but not checked", file=sys.stderr)
+        return EXIT_NO_BASELINE
+
+    if unchecked:
+        print(f"{len(unchecked)} benchmark(s) not in the baseline, not checked: {', '.join(unchecked)}")
+    if regressions:
+        print(f"{len(regressions)} benchmark(s) regressed: {', '.join(regressions)}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""
+Build the initramfs (kernel/src/fs/initramfs.h): a USTAR archive Limine loads as a boot module.
+
+Usage: tools/mkinitramfs.py -o initramfs.tar [DIR ...] [--file SRC=/DEST ...]
+
+Every file under each DIR goes in at the same path relative to DIR, --file adds single files
+(user programs) at DEST. Later entries for the same path win, like they do in the kernel's index.
+
+File contents start on a page boundary, so the kernel can map them into address spaces without
+copying (an ELF's read-only segments, for example). Padding entries under /.pad/ fill the gaps;
+the kernel doesn't index them, and the archive stays a plain tar that any tar tool can list.
+"""
+
+import argparse
+import io
+import os
+import sys
+import tarfile
+
+PAGE_SIZE = 4096
+BLOCK_SIZE = tarfile.BLOCKSIZE
+PAD_DIR = ".pad"
+
+
+def collect(dirs, files):
+    """Return [(archive path, source path)] in archive order."""
+    entries = []
+    for root in dirs:
+        for dirpath, dirnames, filenames in os.walk(root):
+            dirnames.sort()
+            for name in sorted(filenames):
+                src = os.path.join(dirpath, name)
+                entries.append((os.path.relpath(src, root).replace(os.sep, "/"), src))
+    for spec in files:
+        src, sep, dest = spec.partition("=")
+        if not sep:
+            sys.exit(f"--file wants SRC=/DEST, got {spec}")
+        entries.append((dest.lstrip("/"), src))
+    return entries
+
+
+def add_padding(tar, n_pad):
+    """Pad so the next header ends, and the next file's data starts, on a page boundary."""
+    gap = (PAGE_SIZE - BLOCK_SIZE - tar.offset) % PAGE_SIZE
+    if gap == 0:
+        return n_pad
+    info = tarfile.TarInfo(f"{PAD_DIR}/{n_pad}")
+    info.size = gap - BLOCK_SIZE    # The padding entry's own header is one block
+    tar.addfile(info, io.BytesIO(bytes(info.size)))
+    return n_pad + 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("dirs", nargs="*")
+    parser.add_argument("--file", action="append", default=[])
+    args = parser.parse_args()
+
+    n_pad = 0
+    with tarfile.open(args.output, "w", format=tarfile.USTAR_FORMAT) as tar:
+        for path, src in collect(args.dirs, args.file):
+            n_pad = add_padding(tar, n_pad)
+            info = tar.gettarinfo(src, arcname=path)
+            info.uid = info.gid = 0
+            info.uname = info.gname = ""
+            info.mtime = 0      # Reproducible archives
+            with open(src, "rb") as f:
+                tar.addfile(info, f)
+            print(f"  /{path}: {info.size} bytes")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+Symbolize sampling profiler dumps (kernel/src/debugging/profile.h) out of a serial capture.
+
+Usage: tools/profile_symbolize.py [serial.log] [--kernel kernel/bin/kernel] [--folded] [--top N]
+
+Prints a flat profile: per function, the share of samples it was executing in (self) and the
+share it was anywhere on the sampled backtrace (total). --folded prints one "a;b;c count" line
+per distinct stack instead, the input format of flamegraph.pl.
+Symbols come from `nm` on the kernel ELF, which must be the exact binary that was booted.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import struct
+import subprocess
+import sys
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_KERNEL = os.path.join(REPO_ROOT, "kernel", "bin", "kernel")
+
+HEADER_FMT = "<4sHHIIIHH"
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+SAMPLE_HEAD_FMT = "<HHIQ"
+SAMPLE_HEAD_SIZE = struct.calcsize(SAMPLE_HEAD_FMT)
+MAGIC = b"MPRF"
+END_MAGIC = b"FRPM"
+
+
+class Symbols:
+    def __init__(self, kernel, nm):
+        out = subprocess.run([nm, "-n", "-S", "--defined-only", kernel],
+                             check=True, capture_output=True, text=True).stdout
+        self.starts = []
+        self.entries = []
+        for line in out.splitlines():
+            parts = line.split()
+            if len(parts) == 4 and parts[2] in "tTwW":
+                start, size = int(parts[0], 16), int(parts[1], 16)
+                self.starts.append(start)
+                self.entries.append((start, size, parts[3]))
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.starts, addr) - 1
+        if i >= 0:
+            start, size, name = self.entries[i]
+            if addr < start + max(size, 1):
+                return name
+        return f"0x{addr:x}"
+
+
+def read_frames(data):
+    """Yield (header fields, samples) for every complete MPRF frame. A sample is (cpu, pcs)."""
+    pos = 0
+    while True:
+        start = data.find(MAGIC, pos)
+        if start < 0 or start + HEADER_SIZE > len(data):
+            return
+        _, version, sample_size, count, lost, hz, max_frames, _ = struct.unpack_from(HEADER_FMT, data, start)
+        body = start + HEADER_SIZE
+        end = body + count * sample_size
+        if version != 1 or sample_size != SAMPLE_HEAD_SIZE + 8 * max_frames or data[end:end + 4] != END_MAGIC:
+            # Not a real frame (or a truncated one), keep scanning after the magic
+            pos = start + len(MAGIC)
+            continue
+        samples = []
+        for i in range(count):
+            offset = body + i * sample_size
+            cpu, depth, _, _ = struct.unpack_from(SAMPLE_HEAD_FMT, data, offset)
+            pcs = struct.unpack_from(f"<{max_frames}Q", data, offset + SAMPLE_HEAD_SIZE)
+            samples.append((cpu, pcs[:min(depth, max_frames)]))
+        yield {"count": count, "lost": lost, "hz": hz}, samples
+        pos = end + len(END_MAGIC)
+
+
+def symbolize(symbols, pcs):
+    """Leaf first. Return addresses point after the call, so look up the byte before them."""
+    return [symbols.lookup(pc if i == 0 else pc - 1) for i, pc in enumerate(pcs)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", default="serial.log")
+    parser.add_argument("--kernel", default=DEFAULT_KERNEL)
+    parser.add_argument("--nm", default="nm", help="nm binary to read the kernel symbols with")
+    parser.add_argument("--folded", action="store_true", help="print folded stacks for flamegraph.pl")
+    parser.add_argument("--top", type=int, default=30, help="functions to list in the flat profile")
+    parser.add_argument("--cpu", type=int, help="only use samples from this CPU")
+    opts = parser.parse_args()
+
+    symbols = Symbols(opts.kernel, opts.nm)
+    with open(opts.log, "rb") as f:
+        data = f.read()
+
+    stacks = []
+    lost = 0
+    hz = 0
+    for header, samples in read_frames(data):
+        lost += header["lost"]
+        hz = header["hz"]
+        stacks += [symbolize(symbols, pcs) for cpu, pcs in samples if opts.cpu is None or cpu == opts.cpu]
+    if not stacks:
+        print("no profile samples found", file=sys.stderr)
+        return 1
+
+    if opts.folded:
+        folded = collections.Counter(";".join(reversed(stack)) for stack in stacks)
+        for line, count in sorted(folded.items()):
+            print(f"{line} {count}")
+        return 0
+
+    self_counts = collections.Counter(stack[0] for stack in stacks)
+    total_counts = collections.Counter(name for stack in stacks for name in set(stack))
+    n = len(stacks)
+    print(f"{n} samples at {hz} Hz ({n / hz if hz else 0:.2f} CPU-seconds), {lost} lost")
+    if opts.cpu is None or opts.cpu == 0:
+        # The other CPUs are sampled by NMI, CPU 0 by the PIT IRQ itself
+        print("note: CPU 0 samples come from the PIT IRQ, its interrupts-off sections are not seen")
+    print(f"{'self%':>7} {'total%':>7} {'self':>7}  function")
+    for name, count in self_counts.most_common(opts.top):
+        print(f"{100 * count / n:7.2f} {100 * total_counts[name] / n:7.2f} {count:7d}  {name}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
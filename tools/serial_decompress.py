@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""
+Expand LZ4 framed serial output (kernel/src/debugging/serialcompress.h) back into plain bytes.
+
+Usage: tools/serial_decompress.py [serial.log] [-o serial.txt]
+
+Bytes outside of frames are copied through unchanged, so a capture that mixes early
+uncompressed boot output with compressed frames decodes cleanly. Frames with a bad
+checksum are reported on stderr and skipped.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b"MLZ4"
+HEADER_FMT = "<4sBBHHHI"
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+FLAG_STORED = 0x01
+
+
+def lz4_block_decompress(src, raw_len):
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+
+        n_literals = token >> 4
+        if n_literals == 15:
+            while True:
+                b = src[i]
+                i += 1
+                n_literals += b
+                if b != 255:
+                    break
+        out += src[i:i + n_literals]
+        i += n_literals
+        if i >= len(src):
+            break  # Last sequence has no match
+
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        match_len = token & 0x0F
+        if match_len == 15:
+            while True:
+                b = src[i]
+                i += 1
+                match_len += b
+                if b != 255:
+                    break
+        match_len += 4
+        if offset == 0 or offset > len(out):
+            raise ValueError("bad match offset")
+        start = len(out) - offset
+        for k in range(match_len):  # Byte at a time, matches may overlap their own output
+            out.append(out[start + k])
+    if len(out) != raw_len:
+        raise ValueError(f"decoded {len(out)} bytes, expected {raw_len}")
+    return bytes(out)
+
+
+def decompress_stream(data, stats):
+    out = bytearray()
+    pos = 0
+    while True:
+        start = data.find(MAGIC, pos)
+        if start < 0 or start + HEADER_SIZE > len(data):
+            out += data[pos:]
+            return bytes(out)
+        out += data[pos:start]
+
+        _, flags, _, raw_len, payload_len, _, checksum = struct.unpack_from(HEADER_FMT, data, start)
+        payload = data[start + HEADER_SIZE:start + HEADER_SIZE + payload_len]
+        try:
+            if len(payload) != payload_len:
+                raise ValueError("truncated frame")
+            block = payload if flags & FLAG_STORED else lz4_block_decompress(payload, raw_len)
+            if len(block) != raw_len or zlib.adler32(block) != checksum:
+                raise ValueError("checksum mismatch")
+        except (ValueError, IndexError) as e:
+            print(f"skipping bad frame at offset {start}: {e}", file=sys.stderr)
+            stats["bad"] += 1
+            out += MAGIC
+            pos = start + len(MAGIC)
+            continue
+
+        stats["frames"] += 1
+        stats["raw"] += raw_len
+        stats["wire"] += HEADER_SIZE + payload_len
+        out += block
+        pos = start + HEADER_SIZE + payload_len
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", default="serial.log")
+    parser.add_argument("-o", "--output", help="write here instead of stdout")
+    opts = parser.parse_args()
+
+    with open(opts.log, "rb") as f:
+        data = f.read()
+    stats = {"frames": 0, "bad": 0, "raw": 0, "wire": 0}
+    text = decompress_stream(data, stats)
+
+    if opts.output:
+        with open(opts.output, "wb") as f:
+            f.write(text)
+    else:
+        sys.stdout.buffer.write(text)
+
+    ratio = stats["raw"] / stats["wire"] if stats["wire"] else 0
+    print(f"{stats['frames']} frames ({stats['bad']} bad), {stats['raw']} bytes from {stats['wire']} on the wire, "
+          f"ratio {ratio:.2f}x", file=sys.stderr)
+    return 1 if stats["bad"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
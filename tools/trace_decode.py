@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""
+Decode binary trace dumps (kernel/src/debugging/trace.h) out of a serial capture.
+
+Usage: tools/trace_decode.py [serial.log] [--header kernel/src/debugging/trace.h] [--text]
+
+The serial log is a mix of plain text and binary "MTRC" frames. Every frame found is decoded
+using the event table parsed from trace.h, so new events need no changes here.
+--text also echoes the plain text between frames.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_HEADER = os.path.join(REPO_ROOT, "kernel", "src", "debugging", "trace.h")
+
+HEADER_FMT = "<4sHHIIQ"
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+RECORD_FMT = "<HHIQ4Q"
+RECORD_SIZE = struct.calcsize(RECORD_FMT)
+MAGIC = b"MTRC"
+END_MAGIC = b"CRTM"
+
+
+def load_events(header_path):
+    """Parse the X(ID, "fmt") entries of TRACE_EVENTS in order, ids are their position."""
+    events = []
+    with open(header_path) as f:
+        for line in f:
+            m = re.match(r'\s*X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', line)
+            if m:
+                events.append((m.group(1), m.group(2)))
+    return events
+
+
+def c_format(fmt, args):
+    """Apply a kvsnprintf style format string to a list of integer arguments."""
+    out = []
+    arg_iter = iter(args)
+    pos = 0
+    for m in re.finditer(r"%([-0+ ]*)(\d*)(?:hh|h|ll|l|z)?([diuxXop%])", fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        value = next(arg_iter, 0)
+        if conv in "di" and value >= 1 << 63:
+            value -= 1 << 64
+        spec = {"d": "d", "i": "d", "u": "d", "x": "x", "X": "X", "o": "o", "p": "x"}[conv]
+        text = format(value, (flags.replace(" ", "") or "") + width + spec)
+        out.append("0x" + text if conv == "p" else text)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def decode_frames(data, events, echo_text):
+    pos = 0
+    frames = 0
+    while True:
+        start = data.find(MAGIC, pos)
+        if start < 0 or start + HEADER_SIZE > len(data):
+            if echo_text:
+                sys.stdout.write(data[pos:].decode("utf-8", "replace"))
+            break
+        if echo_text:
+            sys.stdout.write(data[pos:start].decode("utf-8", "replace"))
+
+        magic, version, record_size, count, lost, tsc_hz = struct.unpack_from(HEADER_FMT, data, start)
+        body = start + HEADER_SIZE
+        end = body + count * record_size
+        if version != 1 or record_size != RECORD_SIZE or data[end:end + 4] != END_MAGIC:
+            # Not a real frame (or a truncated one), keep scanning after the magic
+            pos = start + len(MAGIC)
+            continue
+
+        frames += 1
+        print(f"=== trace frame {frames}: {count} records, {lost} lost, tsc_hz={tsc_hz or 'unknown'} ===")
+        first_tsc = None
+        for i in range(count):
+            event, cpu, _, tsc, *args = struct.unpack_from(RECORD_FMT, data, body + i * record_size)
+            if first_tsc is None:
+                first_tsc = tsc
+            delta = tsc - first_tsc
+            stamp = f"+{delta * 1e6 / tsc_hz:14.3f}us" if tsc_hz else f"+{delta:16d}cyc"
+            if event < len(events):
+                name, fmt = events[event]
+                text = f"{name}: {c_format(fmt, args)}"
+            else:
+                text = f"UNKNOWN_EVENT_{event}: " + " ".join(hex(a) for a in args)
+            print(f"[cpu{cpu:<2d} {stamp}] {text}")
+        pos = end + len(END_MAGIC)
+    return frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", default="serial.log")
+    parser.add_argument("--header", default=DEFAULT_HEADER)
+    parser.add_argument("--text", action="store_true", help="also print the plain text around frames")
+    opts = parser.parse_args()
+
+    events = load_events(opts.header)
+    with open(opts.log, "rb") as f:
+        data = f.read()
+    if decode_frames(data, events, opts.text) == 0:
+        print("no trace frames found", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,43 @@
+#include "syscall.h"
+
+/*
+    write() with buffers the kernel must not read: each has to come back -EFAULT, without the
+    kernel faulting on them. Exits with the number of cases that did not.
+*/
+#define UNMAPPED_ADDR       0x0000000010000000UL    // Nothing is loaded or mapped here
+#define STACK_TOP           0x0000600000000000UL    // ELF_USER_STACK_TOP, the page above is unmapped
+#define KERNEL_ADDR         0xffffffff80000000UL
+
+struct efault_case{
+    const char* name;
+    uint64_t addr;
+    size_t len;
+};
+
+static const struct efault_case _cases[] = {
+    {"unmapped page\n", UNMAPPED_ADDR, 16},
+    {"past the top of the stack\n", STACK_TOP - 16, 64},
+    {"kernel address\n", KERNEL_ADDR, 16},
+};
+
+static size_t _strlen(const char* s){
+    size_t len = 0;
+    while(s[len] != '\0'){
+        len++;
+    }
+    return len;
+}
+
+void _start(){
+    int failed = 0;
+    for(size_t i=0; i<sizeof(_cases)/sizeof(_cases[0]); i++){
+        int64_t ret = sys_write((const char*)_cases[i].addr, _cases[i].len);
+        const char* verdict = (ret == -SYSCALL_EFAULT)? "efault: ok, " : "efault: FAILED, ";
+        if(ret != -SYSCALL_EFAULT){
+            failed++;
+        }
+        sys_write(verdict, _strlen(verdict));
+        sys_write(_cases[i].name, _strlen(_cases[i].name));
+    }
+    sys_exit(failed);
+}
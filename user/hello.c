@@ -0,0 +1,27 @@
+#include "syscall.h"
+
+/*
+    First user program. Touches each kind of segment the loader handles: text and rodata are
+    mapped straight from the boot module, data and bss get private pages.
+*/
+static const char _greeting[] = "Hello from ring 3\n";
+static int _runs = 1;
+static char _buffer[64];
+
+void _start(){
+    sys_write(_greeting, sizeof(_greeting) - 1);
+
+    // Build a second line in .bss, from .data
+    const char* msg = "bss and data are writable, run ";
+    size_t len = 0;
+    while(msg[len] != '\0'){
+        _buffer[len] = msg[len];
+        len++;
+    }
+    _buffer[len++] = '0' + _runs;
+    _buffer[len++] = '\n';
+    _runs++;
+    sys_write(_buffer, len);
+
+    sys_exit(_runs - 2);
+}
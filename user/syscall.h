@@ -0,0 +1,50 @@
+#ifndef USER_SYSCALL_H
+#define USER_SYSCALL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Syscall stubs for user programs. Numbers and ABI as in kernel/src/syscall/syscall.h:
+    number in rax, arguments in rdi, rsi, rdx, r10, r8, r9, result in rax, rcx and r11 clobbered.
+*/
+#define SYSCALL_NULL        0
+#define SYSCALL_EXIT        1
+#define SYSCALL_WRITE       2
+#define SYSCALL_YIELD       3
+#define SYSCALL_FUTEX_WAIT  4
+#define SYSCALL_FUTEX_WAKE  5
+
+// Errors come back negated
+#define SYSCALL_EAGAIN      11
+#define SYSCALL_EFAULT      14
+#define SYSCALL_EINVAL      22
+
+static inline int64_t syscall2(uint64_t number, uint64_t a0, uint64_t a1){
+    int64_t ret;
+    __asm__ volatile("syscall" : "=a"(ret) : "a"(number), "D"(a0), "S"(a1) : "rcx", "r11", "rdx", "r8", "r9", "r10", "memory");
+    return ret;
+}
+
+static inline int64_t sys_write(const char* buf, size_t len){
+    return syscall2(SYSCALL_WRITE, (uint64_t)buf, len);
+}
+
+static inline int64_t sys_yield(){
+    return syscall2(SYSCALL_YIELD, 0, 0);
+}
+
+static inline int64_t sys_futex_wait(const volatile uint32_t* addr, uint32_t expected){
+    return syscall2(SYSCALL_FUTEX_WAIT, (uint64_t)addr, expected);
+}
+
+static inline int64_t sys_futex_wake(const volatile uint32_t* addr, uint32_t count){
+    return syscall2(SYSCALL_FUTEX_WAKE, (uint64_t)addr, count);
+}
+
+static inline __attribute__((noreturn)) void sys_exit(int64_t code){
+    syscall2(SYSCALL_EXIT, (uint64_t)code, 0);
+    __builtin_unreachable();
+}
+
+#endif